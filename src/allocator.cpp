@@ -0,0 +1,319 @@
+#include "allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "thread_pool.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+
+// class DefaultAllocator
+DefaultAllocator::DefaultAllocator() : DefaultAllocator(Options()) {
+}
+
+DefaultAllocator::DefaultAllocator(const Options& options)
+    : options(options) {
+}
+
+/// The size of the pages of the huge page pool, from /proc/meminfo, or 2MB if
+/// it is not reported.
+static size_t getHugePageSize() {
+  static const size_t hugePageSize = []() {
+    ifstream meminfo("/proc/meminfo");
+    string line;
+    while (getline(meminfo, line)) {
+      size_t kilobytes;
+      if (sscanf(line.c_str(), "Hugepagesize: %zu kB", &kilobytes) == 1) {
+        return kilobytes << 10;
+      }
+    }
+    return (size_t)2 << 20;
+  }();
+  return hugePageSize;
+}
+
+/// Map size bytes of anonymous memory, from the huge page pool if requested
+/// and available, or return nullptr. Huge page mappings must be unmapped with
+/// their length rounded to the huge page size, which is stored in hugeLength,
+/// or zero if the memory was mapped from regular pages.
+static void* mapPages(size_t size, bool hugeTLB, size_t* hugeLength) {
+  void* ptr = MAP_FAILED;
+  *hugeLength = 0;
+#ifdef MAP_HUGETLB
+  if (hugeTLB) {
+    size_t pageSize = getHugePageSize();
+    size_t length = (size + pageSize - 1) / pageSize * pageSize;
+    ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      *hugeLength = length;
+    }
+  }
+#endif
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  return (ptr != MAP_FAILED) ? ptr : nullptr;
+}
+
+void* DefaultAllocator::allocate(size_t size) {
+  if (size < options.hugePageThreshold) {
+    void* ptr = nullptr;
+    return (posix_memalign(&ptr, BUFFER_ALIGNMENT, size) == 0) ? ptr : nullptr;
+  }
+
+  size_t hugeLength;
+  void* ptr = mapPages(size, options.hugeTLB, &hugeLength);
+  if (ptr == nullptr) {
+    return nullptr;
+  }
+  if (hugeLength > 0) {
+    lock_guard<mutex> lock(hugeMappingsMutex);
+    hugeMappings[ptr] = hugeLength;
+  }
+#ifdef MADV_HUGEPAGE
+  if (options.transparentHugePages && hugeLength == 0) {
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+#if defined(__linux__) && defined(SYS_mbind)
+  if (options.numaNode >= 0) {
+    // Bind the pages to the node (MPOL_BIND), without depending on libnuma.
+    // Nodes beyond the mask, or missing from the machine, are ignored.
+    const int MPOL_BIND_MODE = 2;
+    const int maskBits = 8 * sizeof(unsigned long);
+    if (options.numaNode < maskBits) {
+      unsigned long nodeMask = 1ul << options.numaNode;
+      size_t length = (hugeLength > 0) ? hugeLength : size;
+      syscall(SYS_mbind, ptr, length, MPOL_BIND_MODE, &nodeMask, maskBits+1,0);
+    }
+  }
+#endif
+  return ptr;
+}
+
+void DefaultAllocator::deallocate(void* ptr, size_t size) {
+  if (size < options.hugePageThreshold) {
+    free(ptr);
+    return;
+  }
+
+  size_t length = size;
+  {
+    lock_guard<mutex> lock(hugeMappingsMutex);
+    auto hugeMapping = hugeMappings.find(ptr);
+    if (hugeMapping != hugeMappings.end()) {
+      length = hugeMapping->second;
+      hugeMappings.erase(hugeMapping);
+    }
+  }
+  int result = munmap(ptr, length);
+  iassert(result == 0) << "Could not unmap " << length << " bytes at " << ptr;
+  (void)result;
+}
+
+// Allocator registry and statistics
+static mutex allocatorsMutex;
+static vector<shared_ptr<Allocator>> allocators;
+static atomic<Allocator*> currentAllocator(nullptr);
+
+static atomic<size_t> numAllocations(0);
+static atomic<size_t> numDeallocations(0);
+static atomic<size_t> bytesAllocated(0);
+static atomic<size_t> peakBytesAllocated(0);
+
+static Allocator* getAllocator() {
+  Allocator* allocator = currentAllocator.load(memory_order_acquire);
+  if (allocator == nullptr) {
+    setAllocator(nullptr);
+    allocator = currentAllocator.load(memory_order_acquire);
+  }
+  return allocator;
+}
+
+void setAllocator(shared_ptr<Allocator> allocator) {
+  if (allocator == nullptr) {
+    allocator = make_shared<DefaultAllocator>();
+  }
+  lock_guard<mutex> lock(allocatorsMutex);
+  allocators.push_back(allocator);
+  currentAllocator.store(allocator.get(), memory_order_release);
+}
+
+AllocationStats getAllocationStats() {
+  AllocationStats stats;
+  stats.numAllocations = numAllocations.load();
+  stats.numDeallocations = numDeallocations.load();
+  stats.bytesAllocated = bytesAllocated.load();
+  stats.peakBytesAllocated = peakBytesAllocated.load();
+  return stats;
+}
+
+namespace internal {
+
+/// Each allocation is preceded by a header that records its allocator and
+/// size, padded to keep the allocation aligned, so that buffers are released
+/// by the allocator that allocated them.
+struct AllocationHeader {
+  Allocator* allocator;
+  size_t size;
+};
+static_assert(sizeof(AllocationHeader) <= BUFFER_ALIGNMENT,
+              "allocation headers must fit in the alignment padding");
+
+static AllocationHeader* getHeader(void* ptr) {
+  return reinterpret_cast<AllocationHeader*>((char*)ptr - BUFFER_ALIGNMENT);
+}
+
+void* alignedMalloc(size_t size) {
+  if (size == 0) {
+    return nullptr;
+  }
+  Allocator* allocator = getAllocator();
+  char* base = (char*)allocator->allocate(size + BUFFER_ALIGNMENT);
+  if (base == nullptr) {
+    throw bad_alloc();
+  }
+  AllocationHeader* header = reinterpret_cast<AllocationHeader*>(base);
+  header->allocator = allocator;
+  header->size = size;
+
+  ++numAllocations;
+  size_t bytes = (bytesAllocated += size);
+  size_t peak = peakBytesAllocated.load();
+  while (bytes > peak && !peakBytesAllocated.compare_exchange_weak(peak,bytes)){
+  }
+  return base + BUFFER_ALIGNMENT;
+}
+
+void* alignedCalloc(size_t num, size_t size) {
+  void* ptr = alignedMalloc(num * size);
+  if (ptr != nullptr) {
+    memset(ptr, 0, num * size);
+  }
+  return ptr;
+}
+
+void* alignedRealloc(void* ptr, size_t size) {
+  size_t oldSize = (ptr != nullptr) ? getHeader(ptr)->size : 0;
+  if (ptr != nullptr && size <= oldSize) {
+    return ptr;
+  }
+  void* newPtr = alignedMalloc(size);
+  if (ptr != nullptr) {
+    memcpy(newPtr, ptr, oldSize);
+    alignedFree(ptr);
+  }
+  return newPtr;
+}
+
+void* alignedResize(void* ptr, size_t size) {
+  if (ptr != nullptr && size <= getHeader(ptr)->size) {
+    return ptr;
+  }
+  alignedFree(ptr);
+  return alignedMalloc(size);
+}
+
+void alignedFree(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  AllocationHeader* header = getHeader(ptr);
+  size_t size = header->size;
+  ++numDeallocations;
+  bytesAllocated -= size;
+  header->allocator->deallocate(header, size + BUFFER_ALIGNMENT);
+}
+
+/// Buffers smaller than this are first touched by the calling thread, as they
+/// span few pages and may come from memory the heap has already touched.
+static const size_t minParallelTouchBytes = 1 << 20;
+
+/// Run body over the partition of [0,num) on the thread pool, or on the
+/// calling thread if the buffer of the given size is small.
+static void forEachChunk(size_t num, size_t bytes,
+                         const function<void(int,int)>& body) {
+  if (bytes < minParallelTouchBytes) {
+    body(0, (int)num);
+  }
+  else {
+    getThreadPool().parallelFor(0, (int)num, body);
+  }
+}
+
+/// Initialize objects [first,num) of data in the partition of a parallel loop
+/// over [0,num), copying the objects below numSrc from src and zeroing the
+/// rest.
+static void initialize(char* data, const char* src, size_t numSrc,
+                       size_t first, size_t num, size_t size) {
+  if (data == nullptr || first >= num) {
+    return;
+  }
+  forEachChunk(num, (num-first)*size, [=](int begin, int end) {
+    size_t copyBegin = max((size_t)begin, first);
+    size_t copyEnd = min((size_t)end, max(numSrc, copyBegin));
+    size_t zeroBegin = max((size_t)begin, max(first, copyEnd));
+    if (copyBegin < copyEnd) {
+      memcpy(data + copyBegin*size, src + copyBegin*size,
+             (copyEnd-copyBegin)*size);
+    }
+    if (zeroBegin < (size_t)end) {
+      memset(data + zeroBegin*size, 0, (end-zeroBegin)*size);
+    }
+  });
+}
+
+void* parallelCalloc(size_t num, size_t size) {
+  char* data = (char*)alignedMalloc(num * size);
+  initialize(data, nullptr, 0, 0, num, size);
+  return data;
+}
+
+void* parallelRealloc(void* ptr, size_t num, size_t newNum, size_t size) {
+  if (ptr != nullptr && newNum*size <= getHeader(ptr)->size) {
+    initialize((char*)ptr, nullptr, 0, num, newNum, size);
+    return ptr;
+  }
+  char* data = (char*)alignedMalloc(newNum * size);
+  initialize(data, (const char*)ptr, min(num, newNum), 0, newNum, size);
+  alignedFree(ptr);
+  return data;
+}
+
+void parallelZero(void* ptr, size_t num, size_t size) {
+  initialize((char*)ptr, nullptr, 0, 0, num, size);
+}
+
+void parallelZeroRows(void* ptr, const unsigned* rowOffsets, int numRows,
+                      size_t size) {
+  if (ptr == nullptr || numRows <= 0) {
+    return;
+  }
+  char* data = (char*)ptr;
+  forEachChunk(numRows, rowOffsets[numRows]*size, [=](int begin, int end) {
+    memset(data + rowOffsets[begin]*size, 0,
+           (rowOffsets[end]-rowOffsets[begin])*size);
+  });
+}
+
+}}
@@ -0,0 +1,140 @@
+#ifndef SIMIT_ALLOCATOR_H
+#define SIMIT_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <map>
+
+namespace simit {
+
+/// The alignment of the memory Simit allocates for set fields and endpoints,
+/// for the temporaries and buffers of compiled functions, and for path
+/// indices. Buffers start on cache lines, so vector loads of their first
+/// elements do not straddle lines, and compiled code may assume that buffers do
+/// not share lines.
+const size_t BUFFER_ALIGNMENT = 64;
+
+/// Statistics of the memory Simit has allocated (see getAllocationStats).
+struct AllocationStats {
+  size_t numAllocations = 0;
+  size_t numDeallocations = 0;
+
+  /// The bytes that are currently allocated, and the most that have been
+  /// allocated at once.
+  size_t bytesAllocated = 0;
+  size_t peakBytesAllocated = 0;
+};
+
+/// Allocates the memory of set fields and endpoints, of the temporaries and
+/// buffers of compiled functions, and of path indices. Implement it to control
+/// where Simit's large buffers are placed, and install it with setAllocator.
+class Allocator {
+public:
+  virtual ~Allocator() {}
+
+  /// Allocate size bytes aligned to BUFFER_ALIGNMENT. Returns nullptr if the
+  /// memory cannot be allocated.
+  virtual void* allocate(size_t size) = 0;
+
+  /// Release memory returned by allocate, given the size it was allocated with.
+  virtual void deallocate(void* ptr, size_t size) = 0;
+};
+
+/// The allocator Simit uses unless another one is installed. Small buffers are
+/// allocated from the heap, while buffers of at least hugePageThreshold bytes
+/// are mapped directly, which the page options apply to.
+class DefaultAllocator : public Allocator {
+public:
+  struct Options {
+    /// Advise the kernel to back large buffers with transparent huge pages
+    /// (madvise with MADV_HUGEPAGE).
+    bool transparentHugePages = false;
+
+    /// Map large buffers from the reserved huge page pool (mmap with
+    /// MAP_HUGETLB), rounded up to whole huge pages. Buffers are mapped from
+    /// regular pages when the pool is exhausted.
+    bool hugeTLB = false;
+
+    /// The size in bytes from which buffers are mapped directly.
+    size_t hugePageThreshold = 2 << 20;
+
+    /// The NUMA node to bind the pages of large buffers to (mbind), or -1 to
+    /// place each page on the node of the thread that first touches it.
+    int numaNode = -1;
+  };
+
+  DefaultAllocator();
+  explicit DefaultAllocator(const Options& options);
+
+  virtual void* allocate(size_t size);
+  virtual void deallocate(void* ptr, size_t size);
+
+  const Options& getOptions() const {return options;}
+
+private:
+  Options options;
+
+  /// The lengths of the mappings from the huge page pool, which are rounded to
+  /// the huge page size
+  std::mutex hugeMappingsMutex;
+  std::map<void*,size_t> hugeMappings;
+};
+
+/// Allocate Simit's memory with the given allocator from now on, or with a
+/// DefaultAllocator if it is null. Memory is released by the allocator that
+/// allocated it, so installed allocators are kept alive until the process
+/// exits.
+void setAllocator(std::shared_ptr<Allocator> allocator);
+
+/// Returns statistics of the memory allocated by all of Simit's allocators.
+AllocationStats getAllocationStats();
+
+namespace internal {
+
+/// Allocate size bytes with the installed allocator, aligned to
+/// BUFFER_ALIGNMENT. The memory is released with alignedFree. Returns nullptr
+/// if size is zero, and throws std::bad_alloc if the allocator fails.
+void* alignedMalloc(size_t size);
+
+/// Allocate zeroed memory for num objects of size bytes.
+void* alignedCalloc(size_t num, size_t size);
+
+/// Resize a buffer from alignedMalloc to hold at least size bytes, preserving
+/// its contents. Buffers that are large enough are returned as they are.
+void* alignedRealloc(void* ptr, size_t size);
+
+/// Resize a buffer from alignedMalloc to hold at least size bytes, without
+/// preserving its contents, so that new memory is left for the caller to
+/// first touch.
+void* alignedResize(void* ptr, size_t size);
+
+/// Release memory from alignedMalloc. Null pointers are ignored.
+void alignedFree(void* ptr);
+
+/// Allocate zeroed memory for num objects of size bytes, which are zeroed in
+/// the partition of a parallel loop over [0,num) (see ThreadPool). The pages
+/// of each chunk are then placed on the NUMA node of the thread that processes
+/// it in parallel loops, rather than all on the node of the calling thread.
+/// Small buffers are zeroed by the calling thread.
+void* parallelCalloc(size_t num, size_t size);
+
+/// Resize a buffer of num objects from parallelCalloc to newNum objects. The
+/// objects are copied, and new objects zeroed, in the partition of a parallel
+/// loop over [0,newNum).
+void* parallelRealloc(void* ptr, size_t num, size_t newNum, size_t size);
+
+/// Zero num objects of size bytes in the partition of a parallel loop over
+/// [0,num).
+void parallelZero(void* ptr, size_t num, size_t size);
+
+/// Zero the rows of a segmented buffer in the partition of a parallel loop
+/// over its rows, where row i holds the objects [rowOffsets[i],
+/// rowOffsets[i+1]).
+void parallelZeroRows(void* ptr, const unsigned* rowOffsets, int numRows,
+                      size_t size);
+
+}
+
+}
+#endif
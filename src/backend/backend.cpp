@@ -10,6 +10,7 @@
 #include "ir_visitor.h"
 #include "util/scopedmap.h"
 #include "util/collections.h"
+#include "error.h"
 
 using namespace std;
 using namespace simit::ir;
@@ -17,27 +18,32 @@ using namespace simit::ir;
 namespace simit {
 namespace backend {
 
-BackendImpl* getBackendImpl(const std::string &type) {
-  if (type == "cpu") {
-    return new backend::LLVMBackend();
+static bool isBackendType(const std::string &type) {
+#ifdef GPU
+  if (type == "gpu") {
+    return true;
   }
+#endif
+  return type == "cpu" || type == "cpu-parallel";
+}
+
+BackendImpl* getBackendImpl(const std::string &type) {
 #ifdef GPU
   if (type == "gpu") {
     return new backend::GPUBackend();
   }
 #endif
-
-  ierror << "Invalid backend choice: " << type << ". "
-         << "Did you forget to call simit::init()?";
-  return nullptr;
+  return new backend::LLVMBackend();
 }
 
 // class Backend
-Backend::Backend(const std::string &type) : pimpl(getBackendImpl(type)) {
+Backend::Backend(const std::string &type) : type(type) {
+  iassert(isBackendType(type))
+      << "Invalid backend choice: " << type << ". "
+      << "Did you forget to call simit::init()?";
 }
 
 Backend::~Backend() {
-  delete pimpl;
 }
 
 backend::Function* Backend::compile(const ir::Func& func) {
@@ -45,7 +51,8 @@ backend::Function* Backend::compile(const ir::Func& func) {
 }
 
 Function* Backend::compile(const Func& func, const Storage& storage) {
-  return pimpl->compile(func, storage);
+  unique_ptr<BackendImpl> impl(getBackendImpl(type));
+  return impl->compile(func, storage);
 }
 
 backend::Function* Backend::compile(const Stmt& stmt, const Environment& env) {
@@ -117,7 +124,7 @@ backend::Function* Backend::compile(const Stmt& stmt, const Environment& env,
   );
 
   Func func("main", {}, {}, stmt, environment);
-  return pimpl->compile(func, storage);
+  return compile(func, storage);
 }
 
 Function* Backend::compile(const Stmt& stmt, vector<ir::Var> output){
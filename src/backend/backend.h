@@ -15,10 +15,11 @@ class Storage;
 }
 namespace backend {
 class Function;
-class BackendImpl;
 
 /// Code generators are used to turn Simit IR into some other representation.
 /// Examples include LLVM IR, compiled machine code and Graphviz .dot files.
+/// Each compilation uses code generator state of its own, so a backend can
+/// compile functions on several threads concurrently.
 class Backend : simit::interfaces::Uncopyable {
 public:
   Backend(const std::string &type);
@@ -51,7 +52,7 @@ public:
   backend::Function* compile(const ir::Stmt& stmt, std::vector<ir::Var> output);
 
 protected:
-  BackendImpl* pimpl;
+  std::string type;
 };
 
 }}
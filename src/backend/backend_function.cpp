@@ -8,6 +8,8 @@ using namespace std;
 #include "ir.h"
 #include "ir_visitor.h"
 #include "graph_indices.h"
+#include "solver.h"
+#include "tensor_data.h"
 #include "util/collections.h"
 #include "error.h"
 
@@ -16,7 +18,8 @@ namespace backend {
 
 // class Function
 Function::Function(const ir::Func& func)
-    : environment(new ir::Environment(func.getEnvironment())) {
+    : environment(new ir::Environment(func.getEnvironment())),
+      solverContext(new internal::SolverContext) {
   for (const ir::Var& arg : func.getArguments()) {
     string argName = arg.getName();
     arguments.push_back(argName);
@@ -68,6 +71,15 @@ Function::~Function() {
   delete environment;
 }
 
+void Function::setSolverParams(const SolverParams& params) {
+  solverContext->setParams(params);
+}
+
+SparseMatrixView Function::getMatrix(const std::string& name) {
+  terror << "this backend does not support reading function matrices";
+  return SparseMatrixView();
+}
+
 bool Function::hasArg(std::string arg) const {
   return util::contains(argumentTypes, arg);
 }
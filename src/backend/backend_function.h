@@ -6,6 +6,7 @@
 #include <map>
 #include <functional>
 #include <set>
+#include <memory>
 
 #include "interfaces/printable.h"
 #include "interfaces/uncopyable.h"
@@ -13,6 +14,12 @@
 namespace simit {
 class Set;
 class TensorData;
+struct SolverParams;
+struct SparseMatrixView;
+
+namespace internal {
+class SolverContext;
+}
 
 namespace ir {
 class Func;
@@ -47,6 +54,10 @@ public:
   /// Query whether the function requires intialization.
   virtual bool isInitialized() = 0;
 
+  /// Block until optimized code that the function compiles in the background
+  /// is ready. The functions returned by init switch to it on their own.
+  virtual void waitForOptimization() {}
+
   // TODO Should these really be an extension to the bind interface?
   //      Per-argument updates/copies.
   //      Don't always write in a new pointer (requires re-JIT), just alert to
@@ -54,6 +65,10 @@ public:
   virtual void mapArgs() {}
   virtual void unmapArgs(bool updated=true) {}
 
+  /// Returns a view of the memory of the matrix with the given name, which is
+  /// a matrix the function assembles or a sparse global.
+  virtual SparseMatrixView getMatrix(const std::string& name);
+
   /// Write the function to the stream. The output depends on the backend,
   /// for example the LLVM backend will write LLVM IR.
   virtual void print(std::ostream &os) const = 0;
@@ -74,6 +89,14 @@ public:
 
   const ir::Environment& getEnvironment() const;
 
+  /// Set the parameters of the function's solves.
+  void setSolverParams(const SolverParams& params);
+
+  /// Returns the context that holds the state of the function's solves.
+  internal::SolverContext* getSolverContext() const {
+    return solverContext.get();
+  }
+
 private:
   ir::Environment* environment;
 
@@ -85,6 +108,8 @@ private:
   /// reclaimed if the IR is deleted, as compiled functions are allowed to
   /// access them at runtime.
   std::vector<simit::ir::Expr> literals;
+
+  std::unique_ptr<internal::SolverContext> solverContext;
 };
 
 }}
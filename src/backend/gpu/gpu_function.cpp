@@ -184,6 +184,7 @@ GPUFunction::SetData GPUFunction::pushSetData(Set* set, const ir::SetType* setTy
     data.endpoints = nullHandle;
     data.startIndex = nullHandle;
     data.nbrIndex = nullHandle;
+    data.locations = nullHandle;
     return data;
   }
 
@@ -243,6 +244,19 @@ GPUFunction::SetData GPUFunction::pushSetData(Set* set, const ir::SetType* setTy
     data.nbrIndex = nbrIndexHandle;
     // setData.push_back(llvmPtr(LLVM_INT_PTR,
     //                           reinterpret_cast<void*>(*nbrBuffer)));
+
+    // Edge locations
+    const int *locations = set->getEdgeLocationIndex()->getLocations();
+    size_t locSize = set->getSize() * set->getCardinality() *
+                     set->getCardinality() * sizeof(int);
+    CUdeviceptr *locBuffer = new CUdeviceptr();
+    checkCudaErrors(cuMemAlloc(locBuffer, locSize));
+    checkCudaErrors(cuMemcpyHtoD(*locBuffer, locations, locSize));
+    // Pushed bufs expects non-const pointers, because some are written to.
+    DeviceDataHandle *locationsHandle = new DeviceDataHandle(
+        const_cast<int*>(locations), locBuffer, locSize);
+    pushedBufs.push_back(locationsHandle);
+    data.locations = locationsHandle;
   }
 
   // Fields
@@ -441,6 +455,11 @@ llvm::Value *GPUFunction::pushArg(std::string name, ir::Type& argType, Actual* a
           *(pushedData.startIndex->devBuffer))));
       setData.push_back(llvmPtr(LLVM_INT_PTR, reinterpret_cast<void*>(
           *(pushedData.nbrIndex->devBuffer))));
+      // Edge coloring (unused on the GPU)
+      setData.push_back(llvm::ConstantPointerNull::get(LLVM_INT_PTR));
+      setData.push_back(llvm::ConstantPointerNull::get(LLVM_INT_PTR));
+      setData.push_back(llvmPtr(LLVM_INT_PTR, reinterpret_cast<void*>(
+          *(pushedData.locations->devBuffer))));
     }
     // Fields
     ir::Type ety = setType->elementType;
@@ -702,7 +721,7 @@ GPUFunction::init() {
       size_t expectedSize = sizeof(int) // setSize
           + pushedData.fields.size() * sizeof(void*); // fields
       if (setType->getCardinality() > 0) {
-        expectedSize += 3*sizeof(void*); // endpoints and indices arrays
+        expectedSize += 6*sizeof(void*); // endpoints and indices arrays
       }
       void *globalPtrHost = getGlobalHostPtr(
           *cudaModule, bufVar.getName(), expectedSize);
@@ -719,9 +738,18 @@ GPUFunction::init() {
         *(void**)globalPtrHost  = reinterpret_cast<void*>(
             *(pushedData.nbrIndex->devBuffer));
         globalPtrHost = ((void**)globalPtrHost)+1;
+        // Edge coloring (unused on the GPU)
+        *(void**)globalPtrHost = nullptr;
+        globalPtrHost = ((void**)globalPtrHost)+1;
+        *(void**)globalPtrHost = nullptr;
+        globalPtrHost = ((void**)globalPtrHost)+1;
+        *(void**)globalPtrHost = reinterpret_cast<void*>(
+            *(pushedData.locations->devBuffer));
+        globalPtrHost = ((void**)globalPtrHost)+1;
         handleVec.push_back(pushedData.endpoints);
         handleVec.push_back(pushedData.startIndex);
         handleVec.push_back(pushedData.nbrIndex);
+        handleVec.push_back(pushedData.locations);
       }
       // NOTE: This code assumes the width of void* is the same as
       // and float*/int* on the GPU.
@@ -753,8 +781,9 @@ GPUFunction::init() {
   // Initialize tensor index data
   for (const ir::TensorIndex& tensorIndex : env.getTensorIndices()) {
     const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
-    const uint32_t** coordDataPtr = tensorIndexPtrs[pexpr].first;
-    const uint32_t** sinkDataPtr = tensorIndexPtrs[pexpr].second;
+    auto ptrPair = tensorIndexPtrs[{pexpr, tensorIndex.isUpperTriangular()}];
+    const uint32_t** coordDataPtr = ptrPair.first;
+    const uint32_t** sinkDataPtr = ptrPair.second;
     CUdeviceptr *devCoordBuffer = new CUdeviceptr();
     CUdeviceptr *devSinkBuffer = new CUdeviceptr();
 
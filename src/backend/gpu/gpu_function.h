@@ -78,6 +78,7 @@ class GPUFunction : public LLVMFunction {
     DeviceDataHandle *endpoints;
     DeviceDataHandle *startIndex; // row starts
     DeviceDataHandle *nbrIndex; // col indexes
+    DeviceDataHandle *locations; // edge locations in the neighbor index
 
     // Fields
     std::vector<DeviceDataHandle*> fields;
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <stack>
 #include <algorithm>
+#include <mutex>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
@@ -13,6 +14,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
@@ -23,6 +25,7 @@
 
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 
 #include "llvm/PassManager.h"
@@ -33,6 +36,7 @@
 #include "llvm_types.h"
 #include "llvm_codegen.h"
 #include "llvm_util.h"
+#include "llvm_object_cache.h"
 
 #include "macros.h"
 #include "types.h"
@@ -42,12 +46,14 @@
 #include "ir_printer.h"
 #include "ir_queries.h"
 #include "ir_transforms.h"
+#include "ir_visitor.h"
 #include "ir_rewriter.h" // TODO: Remove this header
 #include "environment.h"
 #include "tensor_index.h"
 #include "llvm_function.h"
 #include "macros.h"
 #include "runtime.h"
+#include "allocator.h"
 #include "path_expressions.h"
 #include "util/collections.h"
 
@@ -55,6 +61,13 @@ using namespace std;
 using namespace simit::ir;
 
 namespace simit {
+
+static bool tieredCompilation = false;
+
+void setTieredCompilation(bool enabled) {
+  tieredCompilation = enabled;
+}
+
 namespace backend {
 
 const std::string VAL_SUFFIX(".val");
@@ -62,19 +75,23 @@ const std::string PTR_SUFFIX(".ptr");
 const std::string LEN_SUFFIX(".len");
 
 // class LLVMBackend
-bool LLVMBackend::llvmInitialized = false;
-
 shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module) {
   shared_ptr<llvm::EngineBuilder> engineBuilder(new llvm::EngineBuilder(module));
   return engineBuilder;
 }
 
-LLVMBackend::LLVMBackend() : builder(new SimitIRBuilder(LLVM_CTX)) {
-  if (!llvmInitialized) {
+LLVMBackend::LLVMBackend() : environment(nullptr),
+                             builder(new SimitIRBuilder(LLVM_CTX)),
+                             parallelLoopKind(ir::For::Serial),
+                             aliasRoot(nullptr) {
+  static std::once_flag llvmInitialized;
+  std::call_once(llvmInitialized, []() {
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
+    llvm::llvm_start_multithreaded();
+#endif
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
-    llvmInitialized = true;
-  }
+  });
 }
 
 LLVMBackend::~LLVMBackend() {}
@@ -116,7 +133,12 @@ Func LLVMBackend::makeSystemTensorsGlobal(Func func) {
 }
 
 Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
-  this->module = new llvm::Module("simit", LLVM_CTX);
+  // The function is generated in a context of its own, which it takes
+  // ownership of, so that other functions can be compiled concurrently
+  shared_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+  LLVMContextScope contextScope(*context);
+  this->builder.reset(new SimitIRBuilder(*context));
+  this->module = new llvm::Module("simit", *context);
 
   iassert(func.getBody().defined()) << "cannot compile an undefined function";
 
@@ -126,6 +148,8 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   this->buffers.clear();
   this->globals.clear();
   this->storage = storage;
+  this->aliasRoot = nullptr;
+  this->aliasTags.clear();
 
   // This backend stores dense tensors and sparse tensors with path expressions
   // as globals.
@@ -171,15 +195,16 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   }
   iassert(llvmFunc);
 
-  // Declare malloc and free if necessary
+  // Declare malloc and free if necessary. Buffers are allocated by the
+  // installed allocator, like set fields (see simit::setAllocator).
   llvm::FunctionType *m =
-      llvm::FunctionType::get(LLVM_INT8_PTR, {LLVM_INT}, false);
+      llvm::FunctionType::get(LLVM_INT8_PTR, {LLVM_INT64}, false);
   llvm::Function *malloc =
-      llvm::cast<llvm::Function>(module->getOrInsertFunction("malloc", m));
+      llvm::cast<llvm::Function>(module->getOrInsertFunction("simitMalloc",m));
   llvm::FunctionType *f =
       llvm::FunctionType::get(LLVM_VOID, {LLVM_INT8_PTR}, false);
   llvm::Function *free =
-      llvm::cast<llvm::Function>(module->getOrInsertFunction("free", f));
+      llvm::cast<llvm::Function>(module->getOrInsertFunction("simitFree", f));
 
   // Create initialization function
   emitEmptyFunction(func.getName()+"_init", func.getArguments(),
@@ -195,7 +220,10 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
     const TensorType *ttype = type.toTensor();
     llvm::Value *len= emitComputeLen(ttype,this->storage.getStorage(bufferVar));
     unsigned compSize = ttype->getComponentType().bytes();
-    llvm::Value *size = builder->CreateMul(len, llvmInt(compSize));
+
+    // Compute the size in 64 bits, so that buffers may exceed 2GB
+    llvm::Value *len64 = builder->CreateZExt(len, LLVM_INT64);
+    llvm::Value *size = builder->CreateMul(len64, llvmInt(compSize, 64));
     llvm::Value *mem = builder->CreateCall(malloc, size);
 
     mem = builder->CreateCast(llvm::Instruction::CastOps::BitCast, mem, ltype);
@@ -225,39 +253,49 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
 
   auto engineBuilder = createEngineBuilder(module);
 
-#ifndef SIMIT_DEBUG
-  // Run LLVM optimization passes on the function
-  // We use the built-in PassManagerBuilder to build
-  // the set of passes that are similar to clang's -O3
-  llvm::FunctionPassManager fpm(module);
-  llvm::PassManager mpm;
-  llvm::PassManagerBuilder pmBuilder;
-  
-  pmBuilder.OptLevel = 3;
+  std::shared_ptr<LLVMObjectCache> objectCache = getObjectCache();
 
-  pmBuilder.BBVectorize = 1;
-  pmBuilder.LoopVectorize = 1;
-//  pmBuilder.LoadCombine = 1;
-  pmBuilder.SLPVectorize = 1;
-
-  llvm::DataLayout dataLayout(module);
-#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 5
-  fpm.add(new llvm::DataLayoutPass(dataLayout));
+  // With tiered compilation the function is first optimized lightly, so that
+  // it can run sooner, and its unoptimized IR is kept for the function to
+  // recompile with full optimization in the background. Functions compiled
+  // with the compile cache are not tiered, since the cache stores fully
+  // optimized code.
+  std::string tieredIR;
+  llvm::CodeGenOpt::Level codeGenOptLevel = llvm::CodeGenOpt::Default;
+#ifndef SIMIT_DEBUG
+  if (tieredCompilation && objectCache == nullptr) {
+    llvm::raw_string_ostream irStream(tieredIR);
+    module->print(irStream, nullptr);
+    irStream.flush();
+    codeGenOptLevel = llvm::CodeGenOpt::Less;
+  }
+  unsigned optLevel = tieredIR.empty() ? 3 : 1;
 #else
-  fpm.add(new llvm::DataLayout(dataLayout));
+  unsigned optLevel = 0;
 #endif
+  engineBuilder->setOptLevel(codeGenOptLevel);
 
-  pmBuilder.populateFunctionPassManager(fpm);
-  pmBuilder.populateModulePassManager(mpm);
+  // Modules whose object code is in the compile cache are loaded by MCJIT
+  // instead of compiled, so they are not optimized. The module is looked up
+  // once, and the object found is held until MCJIT loads it, so a hit cannot
+  // turn into a miss that compiles the unoptimized module. The function is
+  // still lowered on a hit, since its storage and environment describe how to
+  // bind arguments and build indices.
+  bool cached = false;
+  if (objectCache != nullptr) {
+    std::string key = LLVMObjectCache::getModuleKey(module, optLevel,
+                                                    codeGenOptLevel);
+    module->setModuleIdentifier(key);
+    cached = objectCache->lookup(key);
+  }
 
-  fpm.doInitialization();
-  fpm.run(*llvmFunc);
-  fpm.doFinalization();
-  
-  mpm.run(*module);
-#endif
+  if (!cached && optLevel > 0) {
+    // Run LLVM optimization passes on the function
+    optimizeModule(module, llvmFunc, optLevel);
+  }
 
-  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder);
+  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder,
+                          context, tieredIR, objectCache);
 }
 
 void LLVMBackend::compile(const ir::Literal& literal) {
@@ -302,9 +340,18 @@ void LLVMBackend::compile(const ir::Literal& literal) {
     }
   }
   else {
-    // TODO: This should become a reference to a global literal
-    // (unify with GPUBackend).
-    val = llvmPtr(literal);
+    // Put the data in a constant global rather than pointing to the literal's
+    // memory, so that the module does not depend on where the literal happens
+    // to be allocated, which lets the compile cache find it in other processes
+    llvm::Constant* data = llvm::ConstantDataArray::get(LLVM_CTX,
+        llvm::ArrayRef<uint8_t>(static_cast<const uint8_t*>(literal.data),
+                                literal.size));
+    llvm::GlobalVariable* global =
+        new llvm::GlobalVariable(*module, data->getType(), true,
+                                 llvm::GlobalValue::InternalLinkage, data,
+                                 "literal");
+    global->setAlignment(16);
+    val = llvm::ConstantExpr::getBitCast(global, llvmType(*type));
   }
   iassert(val);
 }
@@ -351,7 +398,9 @@ void LLVMBackend::compile(const ir::Load& load) {
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
 
   string valName = string(buffer->getName()) + VAL_SUFFIX;
-  val = builder->CreateLoad(bufferLoc, valName);
+  llvm::LoadInst *llvmLoad = builder->CreateLoad(bufferLoc, valName);
+  tagAliasing(llvmLoad, load.buffer);
+  val = llvmLoad;
 }
 
 void LLVMBackend::compile(const ir::FieldRead& fieldRead) {
@@ -499,9 +548,8 @@ void LLVMBackend::compile(const ir::Div& divExpr) {
 
   switch (divExpr.type.toTensor()->getComponentType().kind) {
     case ScalarType::Int:
-      // TODO: Figure out what's the deal with integer div. Cast to fp, div and
-      // truncate?
-      not_supported_yet;
+      // Truncates, like the integer divisions of batched loop bounds expect
+      val = builder->CreateSDiv(a, b);
       break;
     case ScalarType::Float:
       val = builder->CreateFDiv(a, b);
@@ -988,8 +1036,33 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
     std::string fname = callStmt.callee.getName() + "3" + floatTypeName;
     call = emitCall(fname, args);
   }
+  else if (callee == ir::intrinsics::gemm()) {
+    iassert(args.size() == 7);
+
+    Var result = callStmt.results[0];
+    llvm::Value *llvmResult = symtable.get(result);
+    args.push_back(llvmResult);
+
+    std::string fname = "simitBlockGemm" + floatTypeName;
+    call = emitCall(fname, args);
+  }
   else if (callStmt.callee == ir::intrinsics::solve()) {
-    std::string fname = "cMatSolve" + floatTypeName;
+    args.insert(args.begin(), emitSolverContext());
+
+    // Symmetric matrices only store their upper triangles
+    iassert(isa<VarExpr>(callStmt.actuals[0]));
+    const Var& matrix = to<VarExpr>(callStmt.actuals[0])->var;
+    std::string fname = storage.getStorage(matrix).isSymmetric()
+                        ? "cMatSolveSymmetric" + floatTypeName
+                        : "cMatSolve" + floatTypeName;
+    call = emitCall(fname, args);
+  }
+  else if (callStmt.callee == ir::intrinsics::symmetricMatVec()) {
+    iassert(callStmt.results.size() == 1);
+    args.insert(args.begin(), emitSolverContext());
+    args.push_back(compile(VarExpr::make(callStmt.results[0])));
+
+    std::string fname = "cMatVecSymmetric" + floatTypeName;
     call = emitCall(fname, args);
   }
   else if (callStmt.callee == ir::intrinsics::complexNorm()) {
@@ -1041,6 +1114,19 @@ void LLVMBackend::compile(const ir::CallStmt& callStmt) {
 void LLVMBackend::compile(const ir::Store& store) {
   llvm::Value *buffer = compile(store.buffer);
   llvm::Value *index = compile(store.index);
+
+  // Concurrent iterations of a parallel loop may add to the same location,
+  // unlike iterations of a colored loop that run concurrently
+  if (parallelLoopKind == ir::For::Parallel &&
+      store.cop == CompoundOperator::Add &&
+      !(isa<VarExpr>(store.buffer) &&
+        util::contains(parallelPrivates, to<VarExpr>(store.buffer)->var))) {
+    string locName = string(buffer->getName()) + PTR_SUFFIX;
+    llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
+    emitAtomicLoadAdd(bufferLoc, compile(store.value));
+    return;
+  }
+
   llvm::Value *value;
   switch (store.cop) {
     case CompoundOperator::None: {
@@ -1057,7 +1143,8 @@ void LLVMBackend::compile(const ir::Store& store) {
 
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
-  builder->CreateStore(value, bufferLoc);
+  llvm::StoreInst *llvmStore = builder->CreateStore(value, bufferLoc);
+  tagAliasing(llvmStore, store.buffer);
 }
 
 void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
@@ -1088,7 +1175,10 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
       unsigned compSize = tensorFieldType->getComponentType().bytes();
       llvm::Value *fieldSize = builder->CreateMul(fieldLen,llvmInt(compSize));
 
-      emitMemSet(fieldPtr, llvmInt(0,8), fieldSize, compSize);
+      // Whole fields start at aligned addresses
+      unsigned align = fieldWrite.elementOrSet.type().isSet()
+                       ? BUFFER_ALIGNMENT : compSize;
+      emitMemSet(fieldPtr, llvmInt(0,8), fieldSize, align);
     }
     else {
       not_supported_yet;
@@ -1203,6 +1293,11 @@ void LLVMBackend::compile(const ir::ForRange& forLoop) {
 }
 
 void LLVMBackend::compile(const ir::For& forLoop) {
+  if (forLoop.kind != ir::For::Serial && parallelLoopKind == ir::For::Serial) {
+    emitParallelFor(forLoop);
+    return;
+  }
+
   std::string iName = forLoop.var.getName();
   ForDomain domain = forLoop.domain;
 
@@ -1259,6 +1354,384 @@ void LLVMBackend::compile(const ir::For& forLoop) {
   builder->SetInsertPoint(loopEnd);
 }
 
+/// Collects the variables that compiling a statement looks up in the symbol
+/// table, including the sets that determine the sizes of tensor variables and
+/// the index arrays of sparse tensor variables.
+class ReferencedVars : public IRVisitor {
+public:
+  ReferencedVars(const Storage& storage) : storage(storage) {}
+
+  set<Var> get(const Stmt& stmt) {
+    vars.clear();
+    stmt.accept(this);
+    return vars;
+  }
+
+private:
+  const Storage& storage;
+  set<Var> vars;
+
+  using IRVisitor::visit;
+
+  void addVar(const Var& var) {
+    if (util::contains(vars, var)) {
+      return;
+    }
+    vars.insert(var);
+    if (var.getType().isTensor()) {
+      for (const IndexDomain& dim : var.getType().toTensor()->getDimensions()) {
+        addIndexSets(dim);
+      }
+    }
+    if (storage.hasStorage(var)) {
+      const TensorStorage& tensorStorage = storage.getStorage(var);
+      if (tensorStorage.getKind() == TensorStorage::Indexed) {
+        vars.insert(tensorStorage.getTensorIndex().getRowptrArray());
+        vars.insert(tensorStorage.getTensorIndex().getColidxArray());
+      }
+    }
+  }
+
+  void addIndexSets(const IndexDomain& dom) {
+    for (const IndexSet& is : dom.getIndexSets()) {
+      if (is.getKind() == IndexSet::Set) {
+        is.getSet().accept(this);
+      }
+    }
+  }
+
+  void visit(const VarExpr *op) {
+    addVar(op->var);
+  }
+
+  void visit(const VarDecl *op) {
+    addVar(op->var);
+  }
+
+  void visit(const AssignStmt *op) {
+    addVar(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    for (const Var& result : op->results) {
+      addVar(result);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const ForRange *op) {
+    addVar(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For *op) {
+    addVar(op->var);
+    if (op->domain.kind == ForDomain::IndexSet &&
+        op->domain.indexSet.getKind() == IndexSet::Set) {
+      op->domain.indexSet.getSet().accept(this);
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+void LLVMBackend::emitParallelFor(const ir::For& forLoop) {
+  iassert(forLoop.domain.kind == ForDomain::IndexSet);
+  std::string iName = forLoop.var.getName();
+  llvm::Value *iNum = emitComputeLen(forLoop.domain.indexSet);
+
+  bool colored = (forLoop.kind == ir::For::Colored);
+  llvm::Value *colorsStart = nullptr;
+  llvm::Value *colorEdges = nullptr;
+  if (colored) {
+    iassert(forLoop.domain.indexSet.getKind() == IndexSet::Set);
+    Expr edgeSet = forLoop.domain.indexSet.getSet();
+    colorsStart = compile(IndexRead::make(edgeSet, IndexRead::ColorsStart));
+    colorEdges = compile(IndexRead::make(edgeSet, IndexRead::ColorEdges));
+  }
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *callerBlock = builder->GetInsertBlock();
+
+  // Variables declared in the loop body are private to each chunk
+  std::pair<Stmt,std::vector<Stmt>> body = removeVarDecls(forLoop.body);
+  set<Var> privates;
+  for (const Stmt& decl : body.second) {
+    privates.insert(to<VarDecl>(decl)->var);
+  }
+
+  // Scalar reductions into enclosing variables accumulate into a private
+  // partial result per chunk
+  class ReductionVars : public IRVisitor {
+  public:
+    set<Var> vars;
+    using IRVisitor::visit;
+    void visit(const AssignStmt *op) {
+      if (op->cop == CompoundOperator::Add) {
+        vars.insert(op->var);
+      }
+    }
+  } reductionVars;
+  body.first.accept(&reductionVars);
+  vector<Var> reduced;
+  for (const Var& var : reductionVars.vars) {
+    if (!util::contains(privates, var)) {
+      iassert(isScalar(var.getType()));
+      reduced.push_back(var);
+    }
+  }
+
+  // Colored loops write the partial results of each chunk into an array, that
+  // is added to the shared variables in chunk order after the loop, so that
+  // the result does not depend on the order the chunks run in. Other parallel
+  // loops add their partial results atomically.
+  llvm::BasicBlock &entryBlock = llvmFunc->getEntryBlock();
+  llvm::IRBuilder<> entryBuilder(&entryBlock, entryBlock.begin());
+  vector<llvm::Value*> chunkPartials;
+  if (colored) {
+    for (const Var& var : reduced) {
+      llvm::Type *type = llvmType(var.getType().toTensor()->getComponentType());
+      llvm::Value *partials =
+          entryBuilder.CreateAlloca(type, llvmInt(internal::kColoredLoopChunks),
+                                    var.getName()+"_partials");
+      emitMemSet(partials, builder->getInt8(0),
+                 llvmInt(internal::kColoredLoopChunks *
+                         type->getPrimitiveSizeInBits() / 8),
+                 type->getPrimitiveSizeInBits() / 8);
+      chunkPartials.push_back(partials);
+    }
+  }
+
+  // Pack the values of the variables referenced by the body into a closure,
+  // followed by the edges sorted by color and the partial result arrays if the
+  // loop is colored
+  vector<Var> captured;
+  vector<llvm::Value*> closureValues;
+  vector<llvm::Type*> closureTypes;
+  for (const Var& var : ReferencedVars(storage).get(body.first)) {
+    if (var == forLoop.var || util::contains(privates, var) ||
+        !symtable.contains(var) || isa<llvm::Constant>(symtable.get(var))) {
+      continue;
+    }
+    captured.push_back(var);
+    closureValues.push_back(symtable.get(var));
+  }
+  if (colored) {
+    closureValues.push_back(colorEdges);
+    closureValues.insert(closureValues.end(),
+                         chunkPartials.begin(), chunkPartials.end());
+  }
+  for (llvm::Value *closureValue : closureValues) {
+    closureTypes.push_back(closureValue->getType());
+  }
+  llvm::StructType *closureType =
+      llvm::StructType::get(LLVM_CTX, closureTypes);
+
+  llvm::Value *closure = entryBuilder.CreateAlloca(closureType, nullptr,
+                                                   iName+"_closure");
+  for (size_t k=0; k < closureValues.size(); ++k) {
+    builder->CreateStore(closureValues[k],
+                         builder->CreateStructGEP(closure, k));
+  }
+
+  // Outline the loop body into a function that executes one chunk. The chunks
+  // of colored loops also get their chunk number.
+  vector<llvm::Type*> bodyArgTypes = {LLVM_INT, LLVM_INT};
+  if (colored) {
+    bodyArgTypes.push_back(LLVM_INT);
+  }
+  bodyArgTypes.push_back(LLVM_INT8_PTR);
+  llvm::FunctionType *bodyFuncType =
+      llvm::FunctionType::get(LLVM_VOID, bodyArgTypes, false);
+  llvm::Function *bodyFunc =
+      llvm::Function::Create(bodyFuncType, llvm::Function::InternalLinkage,
+                             string(llvmFunc->getName())+"_"+iName+"_chunk",
+                             module);
+  bodyFunc->setDoesNotThrow();
+  auto bodyArgs = bodyFunc->arg_begin();
+  llvm::Value *chunkBegin = &*bodyArgs++;
+  llvm::Value *chunkEnd = &*bodyArgs++;
+  llvm::Value *chunk = colored ? &*bodyArgs++ : nullptr;
+  llvm::Value *closureArg = &*bodyArgs++;
+  chunkBegin->setName(iName+"_begin");
+  chunkEnd->setName(iName+"_end");
+  closureArg->setName(iName+"_closure");
+
+  builder->SetInsertPoint(llvm::BasicBlock::Create(LLVM_CTX, "entry",
+                                                   bodyFunc));
+  symtable.scope();
+  std::set<ir::Var> enclosingGlobals = globals;
+
+  llvm::Value *bodyClosure =
+      builder->CreateBitCast(closureArg, closureType->getPointerTo());
+  for (size_t k=0; k < captured.size(); ++k) {
+    llvm::Value *val =
+        builder->CreateLoad(builder->CreateStructGEP(bodyClosure, k),
+                            captured[k].getName());
+    symtable.insert(captured[k], val);
+  }
+  llvm::Value *chunkColorEdges = nullptr;
+  if (colored) {
+    chunk->setName(iName+"_chunk");
+    chunkColorEdges =
+        builder->CreateLoad(builder->CreateStructGEP(bodyClosure,
+                                                     captured.size()),
+                            colorEdges->getName());
+  }
+
+  // Allocate the private variables on the chunk's stack
+  for (const Stmt& decl : body.second) {
+    const VarDecl *varDecl = to<VarDecl>(decl);
+    const Var& var = varDecl->var;
+    globals.erase(var);
+    if (isScalar(var.getType())) {
+      compile(*varDecl);
+    }
+    else {
+      const TensorType *ttype = var.getType().toTensor();
+      iassert(!ttype->hasSystemDimensions());
+      llvm::Type *ctype = llvmType(ttype->getComponentType());
+      symtable.insert(var, builder->CreateAlloca(ctype, llvmInt(ttype->size()),
+                                                 var.getName()));
+    }
+  }
+  parallelPrivates = privates;
+
+  // The partial results of reductions start at zero in each chunk
+  vector<pair<llvm::Value*,llvm::Value*>> reductions;
+  for (size_t k=0; k < reduced.size(); ++k) {
+    const Var& var = reduced[k];
+    llvm::Value *shared;
+    if (colored) {
+      llvm::Value *partials =
+          builder->CreateLoad(builder->CreateStructGEP(
+                                  bodyClosure, captured.size()+1+k),
+                              var.getName()+"_partials");
+      shared = builder->CreateInBoundsGEP(partials, chunk);
+    }
+    else {
+      shared = symtable.get(var);
+      if (util::contains(globals, var)) {
+        shared = builder->CreateLoad(shared, var.getName()+PTR_SUFFIX);
+      }
+    }
+    globals.erase(var);
+    llvm::Type *type = llvmType(var.getType().toTensor()->getComponentType());
+    llvm::Value *partial = builder->CreateAlloca(type, nullptr,
+                                                 var.getName()+"_partial");
+    builder->CreateStore(llvm::Constant::getNullValue(type), partial);
+    symtable.insert(var, partial);
+    reductions.push_back(pair<llvm::Value*,llvm::Value*>(partial, shared));
+  }
+
+  // Loop Header
+  llvm::BasicBlock *chunkEntryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *loopBodyStart =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", bodyFunc);
+  llvm::BasicBlock *loopEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_end", bodyFunc);
+  llvm::Value *firstCmp = builder->CreateICmpSLT(chunkBegin, chunkEnd);
+  builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopBodyStart);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, iName);
+  i->addIncoming(chunkBegin, chunkEntryBlock);
+
+  // Loop Body
+  if (colored) {
+    // Colored loops iterate over positions in the edges sorted by color
+    llvm::Value *edgeLoc = builder->CreateInBoundsGEP(chunkColorEdges, i);
+    symtable.insert(forLoop.var, builder->CreateLoad(edgeLoc, iName+"_edge"));
+  }
+  else {
+    symtable.insert(forLoop.var, i);
+  }
+  parallelLoopKind = forLoop.kind;
+  compile(body.first);
+  parallelLoopKind = ir::For::Serial;
+
+  // Loop Footer
+  llvm::BasicBlock *loopBodyEnd = builder->GetInsertBlock();
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1),
+                                          iName+"_nxt", false, true);
+  i->addIncoming(i_nxt, loopBodyEnd);
+
+  llvm::Value *exitCond = builder->CreateICmpSLT(i_nxt, chunkEnd,
+                                                 iName+"_cmp");
+  builder->CreateCondBr(exitCond, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopEnd);
+
+  for (auto& reduction : reductions) {
+    if (colored) {
+      // A chunk's result accumulates across the colors
+      llvm::Value *partial = builder->CreateLoad(reduction.first);
+      llvm::Value *chunkSum = builder->CreateLoad(reduction.second);
+      chunkSum = partial->getType()->isIntegerTy()
+                     ? builder->CreateAdd(chunkSum, partial)
+                     : builder->CreateFAdd(chunkSum, partial);
+      builder->CreateStore(chunkSum, reduction.second);
+    }
+    else {
+      emitAtomicLoadAdd(reduction.second, builder->CreateLoad(reduction.first));
+    }
+  }
+  builder->CreateRetVoid();
+
+  parallelPrivates.clear();
+  globals = enclosingGlobals;
+  symtable.unscope();
+
+  // Hand the chunk function to the runtime thread pool
+  builder->SetInsertPoint(callerBlock);
+  llvm::Value *closurePtr = builder->CreateBitCast(closure, LLVM_INT8_PTR);
+  if (colored) {
+    emitCall("simitParallelForColored",
+             {colorsStart, iNum, bodyFunc, closurePtr});
+  }
+  else {
+    emitCall("simitParallelFor", {llvmInt(0), iNum, bodyFunc, closurePtr});
+  }
+
+  // Add the partial results of colored loops to the shared variables, one
+  // chunk at a time
+  for (size_t k=0; k < chunkPartials.size(); ++k) {
+    const Var& var = reduced[k];
+    llvm::Value *shared = symtable.get(var);
+    if (util::contains(globals, var)) {
+      shared = builder->CreateLoad(shared, var.getName()+PTR_SUFFIX);
+    }
+    llvm::Value *initial = builder->CreateLoad(shared);
+    llvm::BasicBlock *reduceEntryBlock = builder->GetInsertBlock();
+    llvm::BasicBlock *reduceBody =
+        llvm::BasicBlock::Create(LLVM_CTX, var.getName()+"_reduce", llvmFunc);
+    llvm::BasicBlock *reduceEnd =
+        llvm::BasicBlock::Create(LLVM_CTX, var.getName()+"_reduce_end",
+                                 llvmFunc);
+    builder->CreateBr(reduceBody);
+    builder->SetInsertPoint(reduceBody);
+
+    llvm::PHINode *c = builder->CreatePHI(LLVM_INT32, 2);
+    c->addIncoming(builder->getInt32(0), reduceEntryBlock);
+    llvm::PHINode *sum = builder->CreatePHI(initial->getType(), 2);
+    sum->addIncoming(initial, reduceEntryBlock);
+    llvm::Value *partial =
+        builder->CreateLoad(builder->CreateInBoundsGEP(chunkPartials[k], c));
+    llvm::Value *nextSum = initial->getType()->isIntegerTy()
+                               ? builder->CreateAdd(sum, partial)
+                               : builder->CreateFAdd(sum, partial);
+    llvm::Value *c_nxt = builder->CreateAdd(c, builder->getInt32(1));
+    c->addIncoming(c_nxt, reduceBody);
+    sum->addIncoming(nextSum, reduceBody);
+    builder->CreateCondBr(
+        builder->CreateICmpSLT(c_nxt,
+                               builder->getInt32(internal::kColoredLoopChunks)),
+        reduceBody, reduceEnd);
+
+    builder->SetInsertPoint(reduceEnd);
+    builder->CreateStore(nextSum, shared);
+  }
+}
+
 void LLVMBackend::compile(const ir::While& whileLoop) {
   llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
 
@@ -1515,6 +1988,18 @@ llvm::Constant *LLVMBackend::emitGlobalString(const std::string& str) {
   return llvm::ConstantExpr::getGetElementPtr(strGlobal, idx);
 }
 
+llvm::Value *LLVMBackend::emitSolverContext() {
+  llvm::GlobalVariable* solver = module->getNamedGlobal(SOLVER_CONTEXT_GLOBAL);
+  if (solver == nullptr) {
+    solver = new llvm::GlobalVariable(*module, LLVM_INT8_PTR, false,
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      llvm::ConstantPointerNull::get(
+                                          LLVM_INT8_PTR),
+                                      SOLVER_CONTEXT_GLOBAL);
+  }
+  return builder->CreateLoad(solver);
+}
+
 llvm::Function *LLVMBackend::emitEmptyFunction(const string &name,
                                                const vector<ir::Var> &arguments,
                                                const vector<ir::Var> &results,
@@ -1674,7 +2159,9 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
              to<Literal>(value)->getComplexVal(0) == double_complex(0,0)) ||
             (sType.kind == ScalarType::Int &&
              ((int*)to<Literal>(value)->data)[0] == 0)) {
-          emitMemSet(varPtr, llvmInt(0,8), size, componentSize);
+          unsigned align = isAllocatedBuffer(var) ? BUFFER_ALIGNMENT
+                                                  : componentSize;
+          emitMemSet(varPtr, llvmInt(0,8), size, align);
         }
         else {
           not_supported_yet << "Cannot assign non-zero value to tensor:"
@@ -1698,6 +2185,39 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
   }
 }
 
+bool LLVMBackend::isAllocatedBuffer(const ir::Var& var) const {
+  return util::contains(buffers, var) ||
+         (environment != nullptr && environment->hasTemporary(var));
+}
+
+void LLVMBackend::tagAliasing(llvm::Instruction* access,
+                              const ir::Expr& buffer) {
+  // Each field is allocated separately by its set, and each temporary and
+  // buffer by the function, so they are disjoint. A set may be bound to more
+  // than one argument, so fields are keyed by name only. Tensor arguments and
+  // externs are bound by the user and may alias anything, so they have no tag.
+  string key;
+  if (isa<FieldRead>(buffer)) {
+    key = "." + to<FieldRead>(buffer)->fieldName;
+  }
+  else if (isa<VarExpr>(buffer) && isAllocatedBuffer(to<VarExpr>(buffer)->var)){
+    key = to<VarExpr>(buffer)->var.getName();
+  }
+  else {
+    return;
+  }
+
+  if (!util::contains(aliasTags, key)) {
+    llvm::MDBuilder mdBuilder(LLVM_CTX);
+    if (aliasRoot == nullptr) {
+      aliasRoot = mdBuilder.createTBAARoot("simit buffers");
+    }
+    llvm::MDNode *type = mdBuilder.createTBAAScalarTypeNode(key, aliasRoot);
+    aliasTags[key] = mdBuilder.createTBAAStructTagNode(type, type, 0);
+  }
+  access->setMetadata(llvm::LLVMContext::MD_tbaa, aliasTags.at(key));
+}
+
 void LLVMBackend::emitMemCpy(llvm::Value *dst, llvm::Value *src,
                              llvm::Value *size, unsigned align) {
   builder->CreateMemCpy(dst, src, size, align);
@@ -1708,6 +2228,55 @@ void LLVMBackend::emitMemSet(llvm::Value *dst, llvm::Value *val,
   builder->CreateMemSet(dst, val, size, align);
 }
 
+void LLVMBackend::emitAtomicLoadAdd(llvm::Value *ptr, llvm::Value *value) {
+  if (value->getType()->isIntegerTy()) {
+    builder->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, value,
+                             llvm::AtomicOrdering::Monotonic);
+    return;
+  }
+
+  // There is no atomic floating point add, so we add the value to the last
+  // seen contents and swap the result in until no other thread interferes.
+  iassert(value->getType()->isFloatingPointTy());
+  llvm::Type *intType = builder->getIntNTy(
+      value->getType()->getPrimitiveSizeInBits());
+  llvm::Value *intPtr = builder->CreateBitCast(
+      ptr, intType->getPointerTo(ptr->getType()->getPointerAddressSpace()));
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *casBlock =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add", llvmFunc);
+  llvm::BasicBlock *doneBlock =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add_done", llvmFunc);
+  llvm::Value *initial = builder->CreateLoad(intPtr);
+  builder->CreateBr(casBlock);
+
+  builder->SetInsertPoint(casBlock);
+  llvm::PHINode *expected = builder->CreatePHI(intType, 2);
+  expected->addIncoming(initial, entryBlock);
+  llvm::Value *sum =
+      builder->CreateFAdd(builder->CreateBitCast(expected, value->getType()),
+                          value);
+  llvm::Value *desired = builder->CreateBitCast(sum, intType);
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
+  llvm::Value *seen =
+      builder->CreateAtomicCmpXchg(intPtr, expected, desired,
+                                   llvm::AtomicOrdering::Monotonic);
+  llvm::Value *success = builder->CreateICmpEQ(seen, expected);
+#else
+  llvm::Value *cmpxchg =
+      builder->CreateAtomicCmpXchg(intPtr, expected, desired,
+                                   llvm::AtomicOrdering::Monotonic,
+                                   llvm::AtomicOrdering::Monotonic);
+  llvm::Value *seen = builder->CreateExtractValue(cmpxchg, {0});
+  llvm::Value *success = builder->CreateExtractValue(cmpxchg, {1});
+#endif
+  expected->addIncoming(seen, builder->GetInsertBlock());
+  builder->CreateCondBr(success, doneBlock, casBlock);
+  builder->SetInsertPoint(doneBlock);
+}
+
 llvm::Value *LLVMBackend::makeGlobalTensor(ir::Var var) {
   // Allocate buffer for local variable in global storage.
   // TODO: We should allocate small local dense tensors on the stack
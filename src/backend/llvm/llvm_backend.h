@@ -9,6 +9,7 @@
 
 #include "backend/backend_impl.h"
 
+#include "ir.h"
 #include "storage.h"
 #include "var.h"
 #include "backend/backend_visitor.h"
@@ -28,6 +29,7 @@ class Value;
 class Instruction;
 class Function;
 class DataLayout;
+class MDNode;
 }
 
 
@@ -69,6 +71,19 @@ protected:
   std::unique_ptr<llvm::DataLayout> dataLayout;
   std::unique_ptr<SimitIRBuilder> builder;
 
+  /// The kind of the parallel loop whose body is being compiled, or Serial
+  ir::For::Kind parallelLoopKind;
+
+  /// Variables declared in the parallel loop being compiled, that are private
+  /// to each thread
+  std::set<ir::Var> parallelPrivates;
+
+  /// Type-based alias analysis tags of the buffers that are known to be
+  /// disjoint: set fields, keyed by field name, and the temporaries and
+  /// buffers the function allocates, keyed by variable name.
+  llvm::MDNode* aliasRoot;
+  std::map<std::string, llvm::MDNode*> aliasTags;
+
   using BackendImpl::compile;
   virtual Function* compile(ir::Func func, const ir::Storage& storage);
 
@@ -131,6 +146,11 @@ protected:
   /// Build a global string and return a constant pointer to it
   llvm::Constant *emitGlobalString(const std::string& str);
 
+  /// Load the address of the function's solver context, which keeps the state
+  /// of solves and symmetric matrix products. The function stores the address
+  /// in a global when it is created.
+  llvm::Value *emitSolverContext();
+
   /// Gets a reference to a named built-in
   llvm::Function* getBuiltIn(std::string name,
                              llvm::Type *retTy,
@@ -147,6 +167,16 @@ protected:
 
   void emitAssign(ir::Var var, const ir::Expr& value);
 
+  /// True iff the variable's buffer is allocated by the function, as a
+  /// temporary or a buffer. Such buffers are aligned to BUFFER_ALIGNMENT
+  /// and do not alias each other or set fields.
+  bool isAllocatedBuffer(const ir::Var& var) const;
+
+  /// Tag a load or store of an element of the buffer with the buffer's alias
+  /// tag, if it has one, so that LLVM can tell accesses of disjoint buffers
+  /// apart without runtime alias checks.
+  void tagAliasing(llvm::Instruction* access, const ir::Expr& buffer);
+
   /// Produce LLVM globals for everything in `env` and store in `globals`
   /// and in `symtable` appropriately.
   virtual void emitGlobals(const ir::Environment& env);
@@ -164,6 +194,18 @@ protected:
   virtual void emitMemSet(llvm::Value *dst, llvm::Value *val,
                           llvm::Value *size, unsigned align);
 
+  /// Emit an atomic `*ptr += value`. Floating point adds are emitted as a
+  /// compare-and-swap loop.
+  virtual void emitAtomicLoadAdd(llvm::Value *ptr, llvm::Value *value);
+
+  /// Emit a parallel loop. The loop body is outlined into a function that
+  /// executes a chunk of the iterations, and that is called by the runtime
+  /// thread pool. Variables referenced by the body are passed in a closure,
+  /// variables declared in the body are allocated per chunk, and scalar
+  /// reductions are accumulated per chunk and added atomically at its end.
+  /// Colored loops iterate over the set's edge coloring, one color at a time.
+  void emitParallelFor(const ir::For& forLoop);
+
   /// Allocate a global pointer for a tensor, and add to the symtable
   /// and list of global buffers
   virtual llvm::Value *makeGlobalTensor(ir::Var var);
@@ -197,9 +239,6 @@ protected:
 
   // TODO: Remove this function, once the old init system has been removed
   ir::Func makeSystemTensorsGlobal(ir::Func func);
-
-private:
-  static bool llvmInitialized;
 };
 
 }}
@@ -3,10 +3,33 @@
 
 #include "llvm/IR/LLVMContext.h"
 
-#define LLVM_CTX llvm::getGlobalContext()
+#include "interfaces/uncopyable.h"
+
+/// The LLVM context of the compilation running on the calling thread, or the
+/// global context outside of compilations (see LLVMContextScope).
+#define LLVM_CTX simit::backend::getLLVMContext()
 
 namespace simit {
 namespace backend {
 
+/// The global that solves load the address of their function's solver context
+/// from.
+const char* const SOLVER_CONTEXT_GLOBAL = "simit_solver_context";
+
+llvm::LLVMContext& getLLVMContext();
+
+/// Makes LLVM_CTX refer to the given context on the calling thread for the
+/// lifetime of the scope. Each compilation generates code in a context of its
+/// own, which is owned by the compiled function, so that functions can be
+/// compiled concurrently on different threads.
+class LLVMContextScope : private interfaces::Uncopyable {
+public:
+  explicit LLVMContextScope(llvm::LLVMContext& context);
+  ~LLVMContextScope();
+
+private:
+  llvm::LLVMContext* previous;
+};
+
 }}
 #endif
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <set>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Instructions.h"
@@ -9,11 +10,14 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/SourceMgr.h"
 
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
 #include "llvm/Analysis/Verifier.h"
+#include "llvm/Assembly/Parser.h"
 #else
 #include "llvm/IR/Verifier.h"
+#include "llvm/AsmParser/Parser.h"
 #endif
 
 #include "llvm_types.h"
@@ -21,12 +25,17 @@
 
 #include "backend/actual.h"
 #include "graph.h"
+#include "allocator.h"
 #include "graph_indices.h"
 #include "tensor_index.h"
+#include "ir_queries.h"
 #include "path_indices.h"
+#include "solver.h"
 #include "util/collections.h"
 #include "util/util.h"
+#include "types_convert.h"
 #include "llvm_util.h"
+#include "llvm_object_cache.h"
 
 using namespace std;
 using namespace simit::ir;
@@ -36,17 +45,68 @@ namespace backend {
 
 typedef void (*FuncPtrType)();
 
+/// Emit a void function without arguments named `<func>_harness` into the
+/// harness module, which calls func with the arguments in argumentData. A
+/// prototype is declared if func is defined in another module.
+static void emitHarness(llvm::Function* func, llvm::Module* harnessModule,
+                        const vector<void*>& argumentData) {
+  const std::string name = func->getName();
+  std::vector<string> argNames;
+  std::vector<llvm::Type*> argTypes;
+  for (llvm::Argument &arg : func->getArgumentList()) {
+    argNames.push_back(arg.getName());
+    argTypes.push_back(arg.getType());
+  }
+  llvm::Function *callee = func;
+  if (func->getParent() != harnessModule) {
+    // Build prototype in harness module as an external linkage to the
+    // function in the main module
+    callee = createPrototypeLLVM(name, argNames, argTypes, harnessModule, true);
+  }
+
+  std::string harnessName = name + "_harness";
+  llvm::Function *harness = createPrototype(
+      harnessName, {}, {}, harnessModule, true);
+  auto entry = llvm::BasicBlock::Create(LLVM_CTX, "entry", harness);
+
+  // Load the arguments from the memory that init writes them to
+  iassert(argumentData.size() == argTypes.size());
+  llvm::SmallVector<llvm::Value*, 8> args;
+  for (size_t i=0; i < argTypes.size(); ++i) {
+    llvm::PointerType *argPtrType = llvm::PointerType::getUnqual(argTypes[i]);
+    llvm::Constant *argPtr = llvmPtr(argPtrType, argumentData[i]);
+    args.push_back(new llvm::LoadInst(argPtr, argNames[i], entry));
+  }
+  llvm::CallInst *call = llvm::CallInst::Create(callee, args, "", entry);
+  call->setCallingConv(func->getCallingConv());
+  llvm::ReturnInst::Create(harnessModule->getContext(), entry);
+}
+
 LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
                            llvm::Function* llvmFunc, llvm::Module* module,
-                           std::shared_ptr<llvm::EngineBuilder> engineBuilder)
+                           std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+                           std::shared_ptr<llvm::LLVMContext> context,
+                           const std::string& tieredIR,
+                           std::shared_ptr<LLVMObjectCache> objectCache)
     : Function(func), initialized(false), llvmFunc(llvmFunc), module(module),
-      harnessModule(new llvm::Module("simit_harness", LLVM_CTX)),
-      storage(storage),
-      engineBuilder(engineBuilder),
+      harnessModule(new llvm::Module("simit_harness", module->getContext())),
+      storage(storage), hasColoredLoops(false), context(context),
+      engineBuilder(engineBuilder), objectCache(objectCache),
       executionEngine(engineBuilder->setUseMCJIT(true).create()), // MCJIT EE
       harnessEngineBuilder(new llvm::EngineBuilder(harnessModule)),
       harnessExecEngine(harnessEngineBuilder->setUseMCJIT(true).create()),
-      deinit(nullptr) {
+      deinit(nullptr), tiered(!tieredIR.empty()), optimizedFunc(nullptr) {
+  for (const Func& f : getCallTree(func)) {
+    if (f.getKind() != Func::Internal) continue;
+    match(f.getBody(), std::function<void(const For*)>([&](const For* op) {
+      hasColoredLoops = hasColoredLoops || op->kind == For::Colored;
+    }));
+  }
+
+  // Load the module's object code from the compile cache, or store it there
+  if (objectCache != nullptr) {
+    executionEngine->setObjectCache(objectCache.get());
+  }
 
   // Finalize existing module so we can get global pointer hooks
   // from the LLVM memory manager.
@@ -54,6 +114,13 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
 
   const Environment& env = getEnvironment();
 
+  // Point the function's solves to its solver context
+  uint64_t solverAddr =
+      executionEngine->getGlobalValueAddress(SOLVER_CONTEXT_GLOBAL);
+  if (solverAddr != 0) {
+    *(void**)solverAddr = getSolverContext();
+  }
+
   // Initialize extern pointers
   for (const VarMapping& externMapping : env.getExterns()) {
     Var bindable = externMapping.getVar();
@@ -96,19 +163,48 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
     *colidxPtr = nullptr;
 
     const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
-    tensorIndexPtrs.insert({pexpr, {rowptrPtr, colidxPtr}});
+    tensorIndexPtrs.insert({{pexpr, tensorIndex.isUpperTriangular()},
+                            {rowptrPtr, colidxPtr}});
+  }
+
+  // Allocate the memory the harness functions load the arguments from
+  llvm::DataLayout dataLayout(module);
+  for (llvm::Argument& arg : llvmFunc->getArgumentList()) {
+    argumentData.push_back(
+        calloc(1, dataLayout.getTypeAllocSize(arg.getType())));
   }
 
+  // Recompile the function with full optimization in the background. The
+  // optimized code refers to the globals of this module by address.
+  if (tiered) {
+    map<string, uint64_t> globalAddresses;
+    for (llvm::GlobalVariable& global : module->getGlobalList()) {
+      if (global.isConstant() || !global.hasExternalLinkage()) {
+        continue;
+      }
+      string name = global.getName();
+      uint64_t addr = executionEngine->getGlobalValueAddress(name);
+      if (addr != 0) {
+        globalAddresses[name] = addr;
+      }
+    }
+    optimizer = std::thread(&LLVMFunction::optimize, this, tieredIR,
+                            string(llvmFunc->getName()), globalAddresses);
+  }
 }
 
 LLVMFunction::~LLVMFunction() {
+  waitForOptimization();
   if (deinit) {
     deinit();
   }
   for (auto& tmpPtr : temporaryPtrs) {
-    free(*tmpPtr.second);
+    internal::alignedFree(*tmpPtr.second);
     *tmpPtr.second = nullptr;
   }
+  for (void* data : argumentData) {
+    free(data);
+  }
 
 }
 
@@ -205,12 +301,14 @@ size_t LLVMFunction::size(const ir::IndexDomain& dimension) {
 Function::FuncType LLVMFunction::init() {
   pe::PathIndexBuilder piBuilder;
 
+  setVersions.clear();
   for (auto& pair : arguments) {
     string name = pair.first;
     Actual* actual = pair.second.get();
     if (isa<SetActual>(actual)) {
       Set* set = to<SetActual>(actual)->getSet();
       piBuilder.bind(name,set);
+      setVersions[name] = set->getTopologyVersion();
     }
   }
 
@@ -219,7 +317,8 @@ Function::FuncType LLVMFunction::init() {
   // Initialize indices
   initIndices(piBuilder, environment);
 
-  // Initialize temporaries
+  // Initialize temporaries. Temporaries from a previous initialization are
+  // resized, which reuses their memory when the sets have not grown.
   for (const Var& tmp : environment.getTemporaries()) {
     iassert(util::contains(temporaryPtrs, tmp.getName()));
     const Type& type = tmp.getType();
@@ -235,21 +334,35 @@ Function::FuncType LLVMFunction::init() {
         Type blockType = tensorType->getBlockType();
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
-        *temporaryPtrs.at(tmp.getName()) =
-            calloc(size(vecDimension) *blockSize, componentSize);
+        size_t vecSize = size(vecDimension) * blockSize * componentSize;
+        void* vec = resizeTemporary(tmp.getName(), vecSize);
+        internal::parallelZero(vec, size(vecDimension),
+                               blockSize * componentSize);
       }
       else if (order == 2) {
         iassert(environment.hasTensorIndex(tmp))
           << "No tensor index for: " << tmp;
-        const pe::PathExpression& pexpr =
-            environment.getTensorIndex(tmp).getPathExpression();
-        iassert(util::contains(pathIndices, pexpr));
+        const TensorIndex& tensorIndex = environment.getTensorIndex(tmp);
+        const pe::PathExpression& pexpr = tensorIndex.getPathExpression();
+        const map<pe::PathExpression,pe::PathIndex>& indices =
+            tensorIndex.isUpperTriangular() ? upperPathIndices : pathIndices;
+        iassert(util::contains(indices, pexpr));
         Type blockType = tensorType->getBlockType();
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
-        size_t matSize = pathIndices.at(pexpr).numNeighbors() *
-                         blockSize * componentSize;
-        *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+        const pe::PathIndex& index = indices.at(pexpr);
+        size_t matSize = index.numNeighbors() * blockSize * componentSize;
+        void* mat = resizeTemporary(tmp.getName(), matSize);
+
+        // Zero the block rows of each element in the partition of parallel
+        // loops over the elements, which places them on the NUMA node of the
+        // thread that assembles them
+        vector<unsigned> rowOffsets(index.numElements()+1, 0);
+        for (unsigned i=0; i < index.numElements(); ++i) {
+          rowOffsets[i+1] = rowOffsets[i] + index.numNeighbors(i);
+        }
+        internal::parallelZeroRows(mat, rowOffsets.data(), index.numElements(),
+                                   blockSize * componentSize);
       }
     }
     else {
@@ -258,6 +371,13 @@ Function::FuncType LLVMFunction::init() {
     }
   }
 
+  // Free the buffers a previous initialization allocated, before the init
+  // function allocates them for the new arguments
+  if (deinit) {
+    deinit();
+    deinit = nullptr;
+  }
+
   // Compile a harness void function without arguments that calls the simit
   // llvm function with pointers to the arguments.
   Function::FuncType func;
@@ -278,9 +398,14 @@ Function::FuncType LLVMFunction::init() {
     func = funcPtr;
   }
   else {
-    llvm::SmallVector<llvm::Value*, 8> args;
+    // The harness functions load the arguments from memory, so binding new
+    // arguments only rewrites that memory and the harness module is only
+    // compiled the first time the function is initialized.
+    llvm::DataLayout dataLayout(module);
+    bool createHarnesses = harnessModule->empty();
     auto llvmArgIt = llvmFunc->getArgumentList().begin();
-    for (const std::string& formal : formals) {
+    for (size_t i=0; i < formals.size(); ++i) {
+      const std::string& formal = formals[i];
       iassert(util::contains(arguments, formal));
 
       llvm::Argument* llvmFormal = llvmArgIt++;
@@ -288,88 +413,120 @@ Function::FuncType LLVMFunction::init() {
       ir::Type type = getArgType(formal);
       iassert(type.kind() == ir::Type::Set || type.kind() == ir::Type::Tensor);
 
-      class InitActual : public ActualVisitor {
+      class WriteActual : public ActualVisitor {
       public:
-        llvm::Value* result;
-        Type type;
-        llvm::Argument* llvmFormal;
-        llvm::Value* init(Actual* a, const Type& t, llvm::Argument* f) {
+        void write(Actual* a, const Type& t, llvm::Argument* f,
+                   const llvm::DataLayout* dl, void* d) {
           this->type = t;
           this->llvmFormal = f;
+          this->dataLayout = dl;
+          this->data = (char*)d;
           a->accept(this);
-          return result;
         }
 
+      private:
+        Type type;
+        llvm::Argument* llvmFormal;
+        const llvm::DataLayout* dataLayout;
+        char* data;
+
         void visit(SetActual* actual) {
           const ir::SetType *setType = type.toSet();
           Set *set = actual->getSet();
 
           llvm::StructType *llvmSetType = llvmType(*setType);
-
-          vector<llvm::Constant*> setData;
+          const llvm::StructLayout *layout =
+              dataLayout->getStructLayout(llvmSetType);
+          unsigned element = 0;
+          auto writePtr = [&](const void* ptr) {
+            *(const void**)(data + layout->getElementOffset(element++)) = ptr;
+          };
 
           // Set size
-          setData.push_back(llvmInt(set->getSize()));
+          *(int*)(data + layout->getElementOffset(element++)) = set->getSize();
 
           // Edge indices (if the set is an edge set)
           if (setType->endpointSets.size() > 0) {
             // Endpoints index
-            setData.push_back(llvmPtr(LLVM_INT_PTR, set->getEndpointsData()));
+            writePtr(set->getEndpointsData());
 
             // Edges index
             // TODO
 
-            // Neighbor index
+            // Neighbor index (only built for edge sets of cardinality >= 2)
             const internal::NeighborIndex *nbrs = set->getNeighborIndex();
-            setData.push_back(llvmPtr(LLVM_INT_PTR, nbrs->getStartIndex()));
-            setData.push_back(llvmPtr(LLVM_INT_PTR, nbrs->getNeighborIndex()));
+            writePtr(nbrs ? nbrs->getStartIndex() : nullptr);
+            writePtr(nbrs ? nbrs->getNeighborIndex() : nullptr);
+
+            // Edge coloring (only read by colored parallel loops)
+            if (hasColoredLoops) {
+              const internal::EdgeColoring *coloring = set->getEdgeColoring();
+              writePtr(coloring->getColorStart());
+              writePtr(coloring->getColorEdges());
+            }
+            else {
+              writePtr(nullptr);
+              writePtr(nullptr);
+            }
+
+            // Edge locations (only built for edge sets of cardinality >= 2)
+            const internal::EdgeLocationIndex *locations =
+                set->getEdgeLocationIndex();
+            writePtr(locations ? locations->getLocations() : nullptr);
           }
 
           // Fields
           for (auto &field : setType->elementType.toElement()->fields) {
             assert(field.type.isTensor());
-            setData.push_back(llvmPtr(*field.type.toTensor(),
-                                      set->getFieldData(field.name)));
+            writePtr(set->getFieldData(field.name));
           }
-
-          result = llvm::ConstantStruct::get(llvmSetType, setData);
+          iassert(element == llvmSetType->getNumElements());
         }
 
         void visit(TensorActual* actual) {
-          const ir::TensorType* tensorType = type.toTensor();
           void* tensorData = actual->getData();
-          result = (llvmFormal->getType()->isPointerTy())
-                   ? llvmPtr(*tensorType, tensorData)
-                   : llvmVal(*tensorType, tensorData);
+          if (llvmFormal->getType()->isPointerTy()) {
+            *(void**)data = tensorData;
+          }
+          else {
+            memcpy(data, tensorData,
+                   dataLayout->getTypeStoreSize(llvmFormal->getType()));
+          }
         }
       };
-      llvm::Value* llvmActual = InitActual().init(actual, type, llvmFormal);
-      args.push_back(llvmActual);
+      WriteActual().write(actual, type, llvmFormal, &dataLayout,
+                          argumentData[i]);
     }
 
     const std::string initFuncName = string(llvmFunc->getName())+"_init";
     const std::string deinitFuncName = string(llvmFunc->getName())+"_deinit";
     const std::string funcName = llvmFunc->getName();
 
-    // Calling main module functions from the harness requires the
-    // symbols to be loaded into the memory manager ahead of finalization
-    llvm::sys::DynamicLibrary::AddSymbol(
-        initFuncName,
-        (void*) executionEngine->getFunctionAddress(initFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        deinitFuncName,
-        (void*) executionEngine->getFunctionAddress(deinitFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        funcName,
-        (void*) executionEngine->getFunctionAddress(funcName));
-
-    // Create Init/deinit function harnesses
-    createHarness(initFuncName, args);
-    createHarness(deinitFuncName, args);
-    createHarness(funcName, args);
-
-    // Finalize harness module
-    harnessExecEngine->finalizeObject();
+    if (createHarnesses) {
+      // Calling main module functions from the harness requires the
+      // symbols to be loaded into the memory manager ahead of finalization
+      llvm::sys::DynamicLibrary::AddSymbol(
+          initFuncName,
+          (void*) executionEngine->getFunctionAddress(initFuncName));
+      llvm::sys::DynamicLibrary::AddSymbol(
+          deinitFuncName,
+          (void*) executionEngine->getFunctionAddress(deinitFuncName));
+      llvm::sys::DynamicLibrary::AddSymbol(
+          funcName,
+          (void*) executionEngine->getFunctionAddress(funcName));
+
+      // Create Init/deinit function harnesses
+      createHarness(initFuncName);
+      createHarness(deinitFuncName);
+      createHarness(funcName);
+
+      // Finalize harness module
+      harnessExecEngine->finalizeObject();
+      iassert(!llvm::verifyModule(*module))
+          << "LLVM module does not pass verification";
+      iassert(!llvm::verifyModule(*harnessModule))
+          << "LLVM harness module does not pass verification";
+    }
 
     // Fetch hard addresses from ExecutionEngine
     auto init = getHarnessFunctionAddress(initFuncName);
@@ -378,14 +535,132 @@ Function::FuncType LLVMFunction::init() {
 
     // Compute function
     func = getHarnessFunctionAddress(funcName);
-    iassert(!llvm::verifyModule(*module))
-        << "LLVM module does not pass verification";
-    iassert(!llvm::verifyModule(*harnessModule))
-        << "LLVM harness module does not pass verification";
+  }
+
+  // Switch to the optimized code between calls, once it is ready. It shares
+  // the temporaries init allocated and deinit frees with the first code.
+  if (tiered) {
+    std::atomic<FuncPtrType>* optimized = &optimizedFunc;
+    FuncType first = func;
+    func = [optimized, first]() {
+      FuncPtrType optimizedPtr = optimized->load(std::memory_order_acquire);
+      if (optimizedPtr != nullptr) {
+        optimizedPtr();
+      }
+      else {
+        first();
+      }
+    };
   }
   return func;
 }
 
+void LLVMFunction::waitForOptimization() {
+  if (optimizer.joinable()) {
+    optimizer.join();
+  }
+}
+
+void LLVMFunction::optimize(std::string ir, std::string funcName,
+                            std::map<std::string, uint64_t> globalAddresses) {
+  // The optimized module is parsed into a context of its own, since contexts
+  // may not be used by more than one thread at a time
+  try {
+    optimizedContext.reset(new llvm::LLVMContext());
+    LLVMContextScope contextScope(*optimizedContext);
+    llvm::SMDiagnostic error;
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+    llvm::Module* optimized =
+        llvm::ParseAssemblyString(ir.c_str(), nullptr, error,
+                                  *optimizedContext);
+#else
+    llvm::Module* optimized =
+        llvm::parseAssemblyString(ir, error, *optimizedContext).release();
+#endif
+    if (optimized == nullptr) {
+      return;
+    }
+
+    for (auto it = optimized->global_begin(); it != optimized->global_end();) {
+      llvm::GlobalVariable* global = &*it++;
+      auto addr = globalAddresses.find(global->getName().str());
+      if (addr != globalAddresses.end()) {
+        global->replaceAllUsesWith(
+            llvmPtr(global->getType(), (const void*)addr->second));
+        global->eraseFromParent();
+      }
+    }
+
+    llvm::Function* optimizedLLVMFunc = optimized->getFunction(funcName);
+    if (!argumentData.empty()) {
+      emitHarness(optimizedLLVMFunc, optimized, argumentData);
+    }
+    optimizeModule(optimized, optimizedLLVMFunc, 3);
+
+    llvm::EngineBuilder optimizedEngineBuilder(optimized);
+    optimizedEngine.reset(optimizedEngineBuilder.setUseMCJIT(true).create());
+    optimizedEngine->finalizeObject();
+    string entry = argumentData.empty() ? funcName : funcName + "_harness";
+    uint64_t addr = optimizedEngine->getFunctionAddress(entry);
+    if (addr != 0) {
+      optimizedFunc.store(reinterpret_cast<FuncPtrType>(addr),
+                          std::memory_order_release);
+    }
+  }
+  catch (...) {
+    // The function keeps running the code it was first compiled to
+  }
+}
+
+SparseMatrixView LLVMFunction::getMatrix(const std::string& name) {
+  uassert(initialized)
+      << "the function must be initialized before its matrices are read";
+  const Environment& env = getEnvironment();
+
+  // Assembled matrices are stored in temporaries indexed by tensor indices,
+  // while sparse globals are stored in the arrays they were bound with
+  SparseMatrixView view;
+  const ir::TensorType* type = nullptr;
+  for (const Var& tmp : env.getTemporaries()) {
+    if (tmp.getName() == name && env.hasTensorIndex(tmp)) {
+      const TensorIndex& tensorIndex = env.getTensorIndex(tmp);
+      pair<const uint32_t**,const uint32_t**> ptrPair =
+          tensorIndexPtrs.at({tensorIndex.getPathExpression(),
+                              tensorIndex.isUpperTriangular()});
+      view.rowPtr = (const int*)*ptrPair.first;
+      view.colIdx = (const int*)*ptrPair.second;
+      view.vals = *temporaryPtrs.at(name);
+      view.upperTriangular = tensorIndex.isUpperTriangular();
+      type = tmp.getType().toTensor();
+      break;
+    }
+  }
+  if (type == nullptr && hasGlobal(name) && util::contains(externPtrs, name) &&
+      externPtrs.at(name).size() == 3) {
+    // Sparse matrix externs are ordered: data, rowPtr, colInd
+    view.vals = *externPtrs.at(name)[0];
+    view.rowPtr = (const int*)*externPtrs.at(name)[1];
+    view.colIdx = (const int*)*externPtrs.at(name)[2];
+    type = getGlobalType(name).toTensor();
+  }
+  uassert(type != nullptr)
+      << "no assembled matrix or sparse global " << util::quote(name)
+      << " in function";
+  iassert(type->order() == 2);
+
+  vector<IndexSet> outerDimensions = type->getOuterDimensions();
+  view.numBlockRows = size(outerDimensions[0]);
+  view.numBlockCols = size(outerDimensions[1]);
+  Type blockType = type->getBlockType();
+  if (blockType.toTensor()->order() == 2) {
+    vector<IndexDomain> blockDimensions = blockType.toTensor()->getDimensions();
+    view.rowBlockSize = blockDimensions[0].getSize();
+    view.colBlockSize = blockDimensions[1].getSize();
+  }
+  view.componentType = ir::convert(type->getComponentType());
+  return view;
+}
+
 void LLVMFunction::print(std::ostream &os) const {
   std::string fstr;
   llvm::raw_string_ostream rsos(fstr);
@@ -404,13 +679,65 @@ void LLVMFunction::printMachine(std::ostream &os) const {
 
 void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
                                const Environment& environment) {
+  // The path indices that were updated in place by this initialization
+  std::set<pe::PathExpression> updated;
+
   // Initialize indices
   for (const TensorIndex& tensorIndex : environment.getTensorIndices()) {
     pe::PathExpression pexpr = tensorIndex.getPathExpression();
-    pe::PathIndex pidx = piBuilder.buildSegmented(pexpr, 0);
-    pathIndices.insert({pexpr, pidx});
 
-    pair<const uint32_t**,const uint32_t**> ptrPair = tensorIndexPtrs.at(pexpr);
+    // Path indices only change when elements are added to or removed from
+    // their sets, so reuse the index from the last initialization otherwise.
+    // Indices of neighbor path expressions are then patched in place, and
+    // others are built again.
+    vector<pair<const Set*,unsigned long>> sets;
+    for (auto& varSet : pexpr.getSets()) {
+      const Set* set = piBuilder.getBinding(varSet.second);
+      sets.push_back({set, set->getTopologyVersion()});
+    }
+    if (!util::contains(pathIndices, pexpr)) {
+      pathIndices[pexpr] = piBuilder.buildSegmented(pexpr, 0);
+      pathIndexSets[pexpr] = sets;
+    }
+    else if (pathIndexSets.at(pexpr) != sets) {
+      if (piBuilder.updateSegmented(pexpr, pathIndices.at(pexpr))) {
+        updated.insert(pexpr);
+      }
+      else {
+        pathIndices[pexpr] = piBuilder.buildSegmented(pexpr, 0);
+        upperPathIndices.erase(pexpr);
+      }
+      pathIndexSets[pexpr] = sets;
+    }
+    pe::PathIndex pidx = pathIndices.at(pexpr);
+
+    // Symmetric matrices are indexed by the upper triangle of the path index,
+    // and their products by the blocks below the diagonal, which are indexed
+    // again whenever the upper triangle changes
+    if (tensorIndex.isUpperTriangular()) {
+      bool indexLower = false;
+      if (!util::contains(upperPathIndices, pexpr)) {
+        upperPathIndices[pexpr] = piBuilder.buildUpperTriangular(pidx);
+        indexLower = true;
+      }
+      else if (util::contains(updated, pexpr)) {
+        piBuilder.updateUpperTriangular(pidx, upperPathIndices.at(pexpr));
+        indexLower = true;
+      }
+      pe::PathIndex upper = upperPathIndices.at(pexpr);
+      iassert(isa<pe::SegmentedPathIndex>(upper));
+      if (indexLower) {
+        const pe::SegmentedPathIndex* upperIndex =
+            to<pe::SegmentedPathIndex>(upper);
+        getSolverContext()->indexLowerTriangle(
+            upperIndex->numElements(), (const int*)upperIndex->getCoordData(),
+            (const int*)upperIndex->getSinkData());
+      }
+      pidx = upper;
+    }
+
+    pair<const uint32_t**,const uint32_t**> ptrPair =
+        tensorIndexPtrs.at({pexpr, tensorIndex.isUpperTriangular()});
 
     if (isa<pe::SegmentedPathIndex>(pidx)) {
       const pe::SegmentedPathIndex* spidx = to<pe::SegmentedPathIndex>(pidx);
@@ -423,28 +750,27 @@ void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
   }
 }
 
-void LLVMFunction::createHarness(
-    const std::string &name,
-    const llvm::SmallVector<llvm::Value*,8> &args) {
-  // Build prototype in harnass module as an extrnal linkage to the
-  // function in the main module
-  llvm::Function *llvmFunc = module->getFunction(name);
-  std::vector<string> argNames;
-  std::vector<llvm::Type*> argTypes;
-  for (llvm::Argument &arg : llvmFunc->getArgumentList()) {
-    argNames.push_back(arg.getName());
-    argTypes.push_back(arg.getType());
+void* LLVMFunction::resizeTemporary(const std::string& name, size_t size) {
+  void** tmpPtr = temporaryPtrs.at(name);
+  *tmpPtr = internal::alignedResize(*tmpPtr, size);
+  return *tmpPtr;
+}
+
+bool LLVMFunction::hasTopologyChanged() const {
+  for (auto& setVersion : setVersions) {
+    Actual* actual = arguments.at(setVersion.first).get();
+    iassert(isa<SetActual>(actual));
+    const Set* set = to<SetActual>(actual)->getSet();
+    if (set->getTopologyVersion() != setVersion.second) {
+      return true;
+    }
   }
-  llvm::Function *llvmFuncProto = createPrototypeLLVM(
-      name, argNames, argTypes, harnessModule, true);
-      
-  std::string harnessName = name + "_harness";
-  llvm::Function *harness = createPrototype(
-      harnessName, {}, {}, harnessModule, true);
-  auto entry = llvm::BasicBlock::Create(LLVM_CTX, "entry", harness);
-  llvm::CallInst *call = llvm::CallInst::Create(llvmFuncProto, args, "", entry);
-  call->setCallingConv(llvmFunc->getCallingConv());
-  llvm::ReturnInst::Create(harnessModule->getContext(), entry);
+  return false;
+}
+
+void LLVMFunction::createHarness(const std::string &name) {
+  LLVMContextScope contextScope(module->getContext());
+  emitHarness(module->getFunction(name), harnessModule, argumentData);
 }
 
 LLVMFunction::FuncType
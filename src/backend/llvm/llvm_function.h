@@ -5,6 +5,8 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <thread>
 
 #include "llvm/IR/Module.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
@@ -27,13 +29,22 @@ class PathIndexBuilder;
 }
 namespace backend {
 class Actual;
+class LLVMObjectCache;
 
 /// A Simit function that has been compiled with LLVM.
 class LLVMFunction : public backend::Function {
  public:
+  /// The function takes shared ownership of the LLVM context its module was
+  /// generated in, if given, which outlives its execution engines. If given
+  /// the unoptimized IR of the module (tiered compilation), the function
+  /// recompiles it with full optimization on a background thread. If given an
+  /// object cache, the module's object code is loaded from or stored to it.
   LLVMFunction(ir::Func func, const ir::Storage &storage,
                llvm::Function* llvmFunc, llvm::Module* module,
-               std::shared_ptr<llvm::EngineBuilder> engineBuilder);
+               std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+               std::shared_ptr<llvm::LLVMContext> context=nullptr,
+               const std::string& tieredIR="",
+               std::shared_ptr<LLVMObjectCache> objectCache=nullptr);
   virtual ~LLVMFunction();
 
   virtual void bind(const std::string& name, simit::Set* set);
@@ -43,9 +54,13 @@ class LLVMFunction : public backend::Function {
   virtual FuncType init();
 
   virtual bool isInitialized() {
-    return initialized;
+    return initialized && !hasTopologyChanged();
   }
 
+  virtual void waitForOptimization();
+
+  virtual SparseMatrixView getMatrix(const std::string& name);
+
   virtual void print(std::ostream &os) const;
   virtual void printMachine(std::ostream &os) const;
 
@@ -56,6 +71,10 @@ class LLVMFunction : public backend::Function {
   void initIndices(pe::PathIndexBuilder& piBuilder,
                    const ir::Environment& environment);
 
+  /// True iff elements have been added to or removed from a set argument since
+  /// the function was initialized.
+  bool hasTopologyChanged() const;
+
   bool initialized;
 
   llvm::Function*                        llvmFunc;
@@ -70,13 +89,33 @@ class LLVMFunction : public backend::Function {
   /// Externs
   std::map<std::string, std::vector<void**>> externPtrs;
 
-  /// TensorIndices
-  std::map<pe::PathExpression,
+  /// TensorIndices, keyed by their path expressions and whether they are upper
+  /// triangular
+  std::map<std::pair<pe::PathExpression,bool>,
            std::pair<const uint32_t**,const uint32_t**>> tensorIndexPtrs;
   std::map<pe::PathExpression, pe::PathIndex>            pathIndices;
 
+  /// The upper triangles of path indices, which index symmetric matrices. They
+  /// are patched with their path index, and discarded when it is rebuilt.
+  std::map<pe::PathExpression, pe::PathIndex>            upperPathIndices;
+
+  /// The sets each path index was built from, and their topology versions, so
+  /// path indices are only patched or rebuilt when their sets change.
+  std::map<pe::PathExpression,
+           std::vector<std::pair<const Set*,unsigned long>>> pathIndexSets;
+
+  /// The topology versions of the set arguments at initialization
+  std::map<std::string, unsigned long> setVersions;
+
+  /// True iff the function or a function it calls has colored loops, which
+  /// read the edge colorings of their edge set arguments. Other functions get
+  /// null colorings, so their sets are not colored.
+  bool hasColoredLoops;
+
  private:
+  std::shared_ptr<llvm::LLVMContext>     context;
   std::shared_ptr<llvm::EngineBuilder>   engineBuilder;
+  std::shared_ptr<LLVMObjectCache>       objectCache;
   std::shared_ptr<llvm::ExecutionEngine> executionEngine;
   std::unique_ptr<llvm::EngineBuilder>    harnessEngineBuilder;
   std::unique_ptr<llvm::ExecutionEngine> harnessExecEngine;
@@ -84,15 +123,40 @@ class LLVMFunction : public backend::Function {
   /// Temporaries
   std::map<std::string, void**> temporaryPtrs;
 
+  /// Memory the harness functions load the arguments from, one buffer per
+  /// formal laid out as its llvm type. Empty until the harness is created.
+  std::vector<void*> argumentData;
+
   FuncType deinit;
 
+  /// Tiered compilation: the functions init returns call the fully optimized
+  /// code once the optimizer thread has compiled it into an engine and context
+  /// of its own. The optimized module shares the globals of the first module,
+  /// so it runs on the arguments, temporaries and indices init sets up.
+  bool tiered;
+  std::thread optimizer;
+  std::unique_ptr<llvm::LLVMContext> optimizedContext;
+  std::unique_ptr<llvm::ExecutionEngine> optimizedEngine;
+  std::atomic<void (*)()> optimizedFunc;
+
+  /// Compile the IR with full optimization, with its globals replaced by the
+  /// given addresses, and publish the result in optimizedFunc.
+  void optimize(std::string ir, std::string funcName,
+                std::map<std::string, uint64_t> globalAddresses);
+
   // MCJIT does not allow module modification after code generation. Instead,
   // create all harness functions in the harness module first, then fetch
-  // generated addresses using getHarnessFunctionAddress.
-  void createHarness(const std::string& name,
-                     const llvm::SmallVector<llvm::Value*,8>& args);
+  // generated addresses using getHarnessFunctionAddress. The harness functions
+  // call `name` with the arguments in argumentData.
+  void createHarness(const std::string& name);
   FuncType getHarnessFunctionAddress(const std::string& name);
 
+  /// Resize the buffer of the temporary to hold at least size bytes, with the
+  /// installed allocator, and return it. Buffers that are large enough are
+  /// reused. The contents are not preserved, so the caller first touches new
+  /// buffers.
+  void* resizeTemporary(const std::string& name, size_t size);
+
   llvm::Function* getInitFunc() const;
   llvm::Function* getDeinitFunc() const;
 };
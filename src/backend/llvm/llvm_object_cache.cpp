@@ -0,0 +1,100 @@
+#include "llvm_object_cache.h"
+
+#include <mutex>
+
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace backend {
+
+// class LLVMObjectCache
+LLVMObjectCache::LLVMObjectCache(const std::string& directory)
+    : files(directory) {
+}
+
+std::string LLVMObjectCache::getModuleKey(const llvm::Module* module,
+                                          unsigned optLevel,
+                                          unsigned codeGenOptLevel) {
+  std::string ir;
+  llvm::raw_string_ostream irStream(ir);
+  module->print(irStream, nullptr);
+  irStream.flush();
+
+  // The IR determines the generated code only together with the optimizations
+  // and the target
+  llvm::MD5 hash;
+  hash.update(ir);
+  hash.update("O" + to_string(optLevel) + " CG" + to_string(codeGenOptLevel));
+  hash.update(llvm::sys::getProcessTriple());
+  hash.update(llvm::sys::getHostCPUName());
+  hash.update(to_string(LLVM_MAJOR_VERSION) + "." +
+              to_string(LLVM_MINOR_VERSION));
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> hex;
+  llvm::MD5::stringifyResult(result, hex);
+  return "simit-" + hex.str().str();
+}
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           const llvm::MemoryBuffer* object) {
+  files.storeObject(module->getModuleIdentifier(), object->getBufferStart(),
+                    object->getBufferSize());
+}
+
+llvm::MemoryBuffer* LLVMObjectCache::getObject(const llvm::Module* module) {
+#else
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           llvm::MemoryBufferRef object) {
+  files.storeObject(module->getModuleIdentifier(), object.getBufferStart(),
+                    object.getBufferSize());
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+LLVMObjectCache::getObject(const llvm::Module* module) {
+#endif
+  // Only load objects the backend found when it looked up the module, since
+  // it did not optimize the module for those alone
+  const std::string& key = module->getModuleIdentifier();
+  std::string object;
+  if (!files.takeObject(key, &object)) {
+    return nullptr;
+  }
+  return llvm::MemoryBuffer::getMemBufferCopy(object, key);
+}
+
+static mutex objectCacheMutex;
+static shared_ptr<LLVMObjectCache> objectCache;
+
+shared_ptr<LLVMObjectCache> getObjectCache() {
+  lock_guard<mutex> lock(objectCacheMutex);
+  return objectCache;
+}
+
+shared_ptr<ObjectFileCache> getObjectFileCache() {
+  shared_ptr<LLVMObjectCache> cache = getObjectCache();
+  return cache ? shared_ptr<ObjectFileCache>(cache, &cache->getFiles())
+               : nullptr;
+}
+
+}  // namespace simit::backend
+
+void setCompileCacheDirectory(const std::string& directory) {
+  shared_ptr<backend::LLVMObjectCache> cache(
+      directory.empty() ? nullptr : new backend::LLVMObjectCache(directory));
+  lock_guard<mutex> lock(backend::objectCacheMutex);
+  backend::objectCache.swap(cache);
+}
+
+}
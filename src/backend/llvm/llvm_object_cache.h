@@ -0,0 +1,74 @@
+#ifndef SIMIT_LLVM_OBJECT_CACHE_H
+#define SIMIT_LLVM_OBJECT_CACHE_H
+
+#include <string>
+#include <memory>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+
+#include "backend/object_file_cache.h"
+
+namespace llvm {
+class Module;
+class MemoryBuffer;
+}
+
+namespace simit {
+namespace backend {
+
+/// A persistent cache of the object code MCJIT generates for Simit modules,
+/// stored as one object file per module in a directory. Modules are named by
+/// a key computed from their unoptimized IR, the optimizations that compile it
+/// and the host target, which LLVMBackend stores as the module identifier. The
+/// backend looks up each module once: on a hit it skips the optimization
+/// passes and MCJIT loads the object that was found instead of generating
+/// code, and on a miss it optimizes the module and MCJIT stores its object.
+class LLVMObjectCache : public llvm::ObjectCache {
+public:
+  /// Create a cache in the given directory, which is created if it is missing.
+  explicit LLVMObjectCache(const std::string& directory);
+
+  /// Compute the cache key of a module: a hash of its IR, the level of the
+  /// optimization passes that run on it (0 if none run), the code generator
+  /// optimization level, the target triple, the host CPU and the LLVM version.
+  /// The IR must not contain addresses of the compiling process, so tensor
+  /// literals are compiled to module globals.
+  static std::string getModuleKey(const llvm::Module* module,
+                                  unsigned optLevel, unsigned codeGenOptLevel);
+
+  /// Look up the object code of the module with the given key. Returns true
+  /// on a hit, in which case getObject returns the object that was found.
+  bool lookup(const std::string& key) {return files.lookup(key);}
+
+  ObjectFileCache& getFiles() {return files;}
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  void notifyObjectCompiled(const llvm::Module* module,
+                            const llvm::MemoryBuffer* object);
+  llvm::MemoryBuffer* getObject(const llvm::Module* module);
+#else
+  void notifyObjectCompiled(const llvm::Module* module,
+                            llvm::MemoryBufferRef object);
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module);
+#endif
+
+private:
+  ObjectFileCache files;
+};
+
+/// Returns the process-wide object cache, or nullptr if object caching is
+/// disabled (see simit::setCompileCacheDirectory). Functions compiled with the
+/// cache share its ownership, so it outlives their execution engines if the
+/// cache is replaced.
+std::shared_ptr<LLVMObjectCache> getObjectCache();
+
+}
+
+/// Cache compiled object code in the given directory, so that functions that
+/// were compiled by an earlier process are loaded instead of recompiled. An
+/// empty directory (the default) disables the cache. Functions compiled with
+/// the previous cache keep using it.
+void setCompileCacheDirectory(const std::string& directory);
+
+}
+#endif
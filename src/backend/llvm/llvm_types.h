@@ -4,6 +4,8 @@
 #include "llvm/IR/Type.h"
 #include "llvm/IR/DerivedTypes.h"
 
+#include "llvm_defines.h"
+
 namespace simit {
 namespace ir {
 class Type;
@@ -15,26 +17,27 @@ struct ScalarType;
 
 namespace backend {
 
-extern llvm::Type* const LLVM_VOID;
-
-extern llvm::Type* const LLVM_FLOAT;
-extern llvm::Type* const LLVM_DOUBLE;
+// The basic types of the LLVM context of the current compilation (see
+// LLVM_CTX)
+#define LLVM_VOID       llvm::Type::getVoidTy(LLVM_CTX)
 
-extern llvm::IntegerType* const LLVM_BOOL;
-extern llvm::IntegerType* const LLVM_INT;
-extern llvm::IntegerType* const LLVM_INT8;
-extern llvm::IntegerType* const LLVM_INT32;
-extern llvm::IntegerType* const LLVM_INT64;
+#define LLVM_FLOAT      llvm::Type::getFloatTy(LLVM_CTX)
+#define LLVM_DOUBLE     llvm::Type::getDoubleTy(LLVM_CTX)
 
-extern llvm::PointerType* const LLVM_FLOAT_PTR;
-extern llvm::PointerType* const LLVM_DOUBLE_PTR;
+#define LLVM_BOOL       llvm::Type::getInt1Ty(LLVM_CTX)
+#define LLVM_INT        llvm::Type::getInt32Ty(LLVM_CTX)
+#define LLVM_INT8       llvm::Type::getInt8Ty(LLVM_CTX)
+#define LLVM_INT32      llvm::Type::getInt32Ty(LLVM_CTX)
+#define LLVM_INT64      llvm::Type::getInt64Ty(LLVM_CTX)
 
-extern llvm::PointerType* const LLVM_BOOL_PTR;
-extern llvm::PointerType* const LLVM_INT_PTR;
-extern llvm::PointerType* const LLVM_INT8_PTR;
-extern llvm::PointerType* const LLVM_INT32_PTR;
-extern llvm::PointerType* const LLVM_INT64_PTR;
+#define LLVM_FLOAT_PTR  llvm::Type::getFloatPtrTy(LLVM_CTX)
+#define LLVM_DOUBLE_PTR llvm::Type::getDoublePtrTy(LLVM_CTX)
 
+#define LLVM_BOOL_PTR   llvm::Type::getInt1PtrTy(LLVM_CTX)
+#define LLVM_INT_PTR    llvm::Type::getInt32PtrTy(LLVM_CTX)
+#define LLVM_INT8_PTR   llvm::Type::getInt8PtrTy(LLVM_CTX)
+#define LLVM_INT32_PTR  llvm::Type::getInt32PtrTy(LLVM_CTX)
+#define LLVM_INT64_PTR  llvm::Type::getInt64PtrTy(LLVM_CTX)
 
 llvm::Type*        llvmType(const ir::Type&,       unsigned addrspace=0);
 llvm::StructType*  llvmType(const ir::SetType&,    unsigned addrspace=0,
@@ -2,10 +2,32 @@
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/PassManager.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+#include "llvm_defines.h"
 
 namespace simit {
 namespace backend {
 
+static thread_local llvm::LLVMContext* currentContext = nullptr;
+
+llvm::LLVMContext& getLLVMContext() {
+  return (currentContext != nullptr) ? *currentContext
+                                     : llvm::getGlobalContext();
+}
+
+// class LLVMContextScope
+LLVMContextScope::LLVMContextScope(llvm::LLVMContext& context)
+    : previous(currentContext) {
+  currentContext = &context;
+}
+
+LLVMContextScope::~LLVMContextScope() {
+  currentContext = previous;
+}
+
 std::ostream &operator<<(std::ostream &os, const llvm::Type &type) {
   std::string str;
   llvm::raw_string_ostream ss(str);
@@ -28,4 +50,38 @@ std::ostream &operator<<(std::ostream &os, const llvm::Module &module) {
   return os;
 }
 
+void optimizeModule(llvm::Module* module, llvm::Function* func,
+                    unsigned optLevel) {
+  // We use the built-in PassManagerBuilder to build the set of passes that
+  // are similar to clang's -O<optLevel>
+  llvm::FunctionPassManager fpm(module);
+  llvm::PassManager mpm;
+  llvm::PassManagerBuilder pmBuilder;
+
+  pmBuilder.OptLevel = optLevel;
+
+  if (optLevel >= 3) {
+    pmBuilder.BBVectorize = 1;
+    pmBuilder.LoopVectorize = 1;
+//  pmBuilder.LoadCombine = 1;
+    pmBuilder.SLPVectorize = 1;
+  }
+
+  llvm::DataLayout dataLayout(module);
+#if LLVM_MAJOR_VERSION >= 3 && LLVM_MINOR_VERSION >= 5
+  fpm.add(new llvm::DataLayoutPass(dataLayout));
+#else
+  fpm.add(new llvm::DataLayout(dataLayout));
+#endif
+
+  pmBuilder.populateFunctionPassManager(fpm);
+  pmBuilder.populateModulePassManager(mpm);
+
+  fpm.doInitialization();
+  fpm.run(*func);
+  fpm.doFinalization();
+
+  mpm.run(*module);
+}
+
 }}
@@ -7,6 +7,7 @@ namespace llvm {
 class Type;
 class Value;
 class Module;
+class Function;
 }
 
 namespace simit {
@@ -16,5 +17,10 @@ std::ostream &operator<<(std::ostream &os, const llvm::Type &);
 std::ostream &operator<<(std::ostream &os, const llvm::Value &);
 std::ostream &operator<<(std::ostream &os, const llvm::Module &);
 
+/// Run the LLVM optimization passes of the given level (0-3) on the module,
+/// with the function passes run on func. Levels of 3 also vectorize.
+void optimizeModule(llvm::Module* module, llvm::Function* func,
+                    unsigned optLevel);
+
 }}
 #endif
@@ -0,0 +1,103 @@
+#include "object_file_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace backend {
+
+/// Create the directory and its missing parents. Returns false on failure.
+static bool createDirectories(const std::string& directory) {
+  for (size_t end = directory.find('/', 1); ; end = directory.find('/', end+1)) {
+    std::string prefix = directory.substr(0, end);
+    if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (end == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+// class ObjectFileCache
+ObjectFileCache::ObjectFileCache(const std::string& directory)
+    : directory(directory), numHits(0), numMisses(0), numWrites(0) {
+  if (!createDirectories(directory)) {
+    uwarning << "Could not create the compile cache directory " << directory;
+  }
+}
+
+bool ObjectFileCache::lookup(const std::string& key) {
+  ifstream file(getPath(key), ios::binary);
+  if (!file.is_open()) {
+    ++numMisses;
+    return false;
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  if (file.bad()) {
+    ++numMisses;
+    return false;
+  }
+
+  lock_guard<mutex> lock(heldMutex);
+  pair<std::string,unsigned>& object = held[key];
+  object.first = contents.str();
+  ++object.second;
+  ++numHits;
+  return true;
+}
+
+bool ObjectFileCache::takeObject(const std::string& key, std::string* object) {
+  lock_guard<mutex> lock(heldMutex);
+  auto it = held.find(key);
+  if (it == held.end()) {
+    return false;
+  }
+  if (--it->second.second == 0) {
+    object->swap(it->second.first);
+    held.erase(it);
+  }
+  else {
+    *object = it->second.first;
+  }
+  return true;
+}
+
+void ObjectFileCache::storeObject(const std::string& key, const char* data,
+                                  size_t size) {
+  // Write to a temporary file and rename it, so that concurrent processes and
+  // compilations never load a partially written object
+  std::string path = getPath(key);
+  std::string tmpPath = path + ".tmp" + to_string(getpid()) + "." +
+                        to_string(numWrites++);
+  {
+    ofstream file(tmpPath, ios::binary);
+    if (!file.is_open()) {
+      return;
+    }
+    file.write(data, size);
+    if (!file.good()) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+  }
+}
+
+std::string ObjectFileCache::getPath(const std::string& key) const {
+  return directory + "/" + key + ".o";
+}
+
+}}
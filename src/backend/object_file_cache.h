@@ -0,0 +1,61 @@
+#ifndef SIMIT_OBJECT_FILE_CACHE_H
+#define SIMIT_OBJECT_FILE_CACHE_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+
+namespace simit {
+namespace backend {
+
+/// The object files of the compile cache, stored as one file per key in a
+/// directory. A compilation looks up its key once: on a hit the object is read
+/// into memory and held until the code generator takes it, so the compilation
+/// loads the object it found even if the file is removed or replaced
+/// afterwards, and on a miss the compilation generates and stores the object.
+class ObjectFileCache {
+public:
+  /// Create a cache in the given directory, which is created if it is missing.
+  explicit ObjectFileCache(const std::string& directory);
+
+  /// Look up the object with the given key, and hold it for takeObject if it
+  /// is found. Returns true on a hit.
+  bool lookup(const std::string& key);
+
+  /// Take an object that a lookup of the key found. Returns false if no lookup
+  /// holds an object for the key.
+  bool takeObject(const std::string& key, std::string* object);
+
+  /// Store the object with the given key.
+  void storeObject(const std::string& key, const char* data, size_t size);
+
+  /// Get the path of the file that stores the object with the given key.
+  std::string getPath(const std::string& key) const;
+
+  /// Get the number of lookups that found their object, and that did not.
+  unsigned getNumHits() const {return numHits;}
+  unsigned getNumMisses() const {return numMisses;}
+
+private:
+  std::string directory;
+
+  /// The objects that lookups found and have not been taken, and the number
+  /// of lookups that wait to take each
+  std::mutex heldMutex;
+  std::map<std::string, std::pair<std::string,unsigned>> held;
+
+  std::atomic<unsigned> numHits;
+  std::atomic<unsigned> numMisses;
+  std::atomic<unsigned> numWrites;
+};
+
+/// Returns the object files of the process-wide compile cache, or nullptr if
+/// the cache is disabled (see simit::setCompileCacheDirectory). The files stay
+/// valid if the cache is replaced.
+std::shared_ptr<ObjectFileCache> getObjectFileCache();
+
+}}
+#endif
@@ -0,0 +1,218 @@
+#include "block_kernels.h"
+
+#include "error.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMIT_X86_BLOCK_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace simit {
+namespace internal {
+
+enum class ISA {Generic, AVX2, AVX512};
+
+static ISA detectISA() {
+#ifdef SIMIT_X86_BLOCK_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return ISA::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return ISA::AVX2;
+  }
+#endif
+  return ISA::Generic;
+}
+
+static ISA getISA() {
+  static const ISA isa = detectISA();
+  return isa;
+}
+
+const char* getBlockKernelISA() {
+  switch (getISA()) {
+    case ISA::AVX512:
+      return "avx512";
+    case ISA::AVX2:
+      return "avx2";
+    case ISA::Generic:
+      return "generic";
+  }
+  return "generic";
+}
+
+// The kernels compute C = A*B for row-major A (m x k) and B (k x n). K and N
+// are the static inner dimensions, or zero if they are only known at runtime,
+// and each row of C is computed as a sum of the rows of B scaled by A's row.
+
+template <typename T, int K, int N>
+static void gemmGeneric(int m, int k, int n, const T* A, const T* B, T* C) {
+  if (K != 0) k = K;
+  if (N != 0) n = N;
+  for (int i=0; i < m; ++i) {
+    T* c = C + i*n;
+    for (int j=0; j < n; ++j) {
+      c[j] = 0;
+    }
+    for (int l=0; l < k; ++l) {
+      T a = A[i*k + l];
+      const T* b = B + l*n;
+      for (int j=0; j < n; ++j) {
+        c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+#ifdef SIMIT_X86_BLOCK_KERNELS
+template <int K, int N>
+__attribute__((target("avx2,fma")))
+static void gemmAVX2(int m, int k, int n, const double* A, const double* B,
+                     double* C) {
+  if (K != 0) k = K;
+  if (N != 0) n = N;
+  const __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+  for (int i=0; i < m; ++i) {
+    for (int j=0; j < n; j += 4) {
+      __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n-j), lanes);
+      __m256d c = _mm256_setzero_pd();
+      for (int l=0; l < k; ++l) {
+        __m256d b = _mm256_maskload_pd(B + l*n + j, mask);
+        c = _mm256_fmadd_pd(_mm256_set1_pd(A[i*k + l]), b, c);
+      }
+      _mm256_maskstore_pd(C + i*n + j, mask, c);
+    }
+  }
+}
+
+template <int K, int N>
+__attribute__((target("avx2,fma")))
+static void gemmAVX2(int m, int k, int n, const float* A, const float* B,
+                     float* C) {
+  if (K != 0) k = K;
+  if (N != 0) n = N;
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  for (int i=0; i < m; ++i) {
+    for (int j=0; j < n; j += 8) {
+      __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n-j), lanes);
+      __m256 c = _mm256_setzero_ps();
+      for (int l=0; l < k; ++l) {
+        __m256 b = _mm256_maskload_ps(B + l*n + j, mask);
+        c = _mm256_fmadd_ps(_mm256_set1_ps(A[i*k + l]), b, c);
+      }
+      _mm256_maskstore_ps(C + i*n + j, mask, c);
+    }
+  }
+}
+
+template <int K, int N>
+__attribute__((target("avx512f")))
+static void gemmAVX512(int m, int k, int n, const double* A, const double* B,
+                       double* C) {
+  if (K != 0) k = K;
+  if (N != 0) n = N;
+  for (int i=0; i < m; ++i) {
+    for (int j=0; j < n; j += 8) {
+      __mmask8 mask = (n-j >= 8) ? 0xFF : (__mmask8)((1u << (n-j)) - 1);
+      __m512d c = _mm512_setzero_pd();
+      for (int l=0; l < k; ++l) {
+        __m512d b = _mm512_maskz_loadu_pd(mask, B + l*n + j);
+        c = _mm512_fmadd_pd(_mm512_set1_pd(A[i*k + l]), b, c);
+      }
+      _mm512_mask_storeu_pd(C + i*n + j, mask, c);
+    }
+  }
+}
+
+template <int K, int N>
+__attribute__((target("avx512f")))
+static void gemmAVX512(int m, int k, int n, const float* A, const float* B,
+                       float* C) {
+  if (K != 0) k = K;
+  if (N != 0) n = N;
+  for (int i=0; i < m; ++i) {
+    for (int j=0; j < n; j += 16) {
+      __mmask16 mask = (n-j >= 16) ? 0xFFFF
+                                   : (__mmask16)((1u << (n-j)) - 1);
+      __m512 c = _mm512_setzero_ps();
+      for (int l=0; l < k; ++l) {
+        __m512 b = _mm512_maskz_loadu_ps(mask, B + l*n + j);
+        c = _mm512_fmadd_ps(_mm512_set1_ps(A[i*k + l]), b, c);
+      }
+      _mm512_mask_storeu_ps(C + i*n + j, mask, c);
+    }
+  }
+}
+#endif
+
+template <typename T, int K, int N>
+static void gemm(int m, int k, int n, const T* A, const T* B, T* C) {
+  switch (getISA()) {
+#ifdef SIMIT_X86_BLOCK_KERNELS
+    case ISA::AVX512:
+      gemmAVX512<K,N>(m, k, n, A, B, C);
+      break;
+    case ISA::AVX2:
+      gemmAVX2<K,N>(m, k, n, A, B, C);
+      break;
+#endif
+    default:
+      gemmGeneric<T,K,N>(m, k, n, A, B, C);
+      break;
+  }
+}
+
+/// Stores the transpose of the rows x cols matrix A in At.
+template <typename T>
+static void transpose(int rows, int cols, const T* A, T* At) {
+  for (int i=0; i < rows; ++i) {
+    for (int j=0; j < cols; ++j) {
+      At[j*rows + i] = A[i*cols + j];
+    }
+  }
+}
+
+template <typename T>
+static void blockGemmT(int m, int k, int n, const T* A, bool transposeA,
+                       const T* B, bool transposeB, T* C) {
+  iassert(m <= MAX_BLOCK_KERNEL_SIZE && k <= MAX_BLOCK_KERNEL_SIZE &&
+          n <= MAX_BLOCK_KERNEL_SIZE) << "block kernel matrix too large";
+
+  // Transposed operands are copied, which is cheap compared to the product
+  T At[MAX_BLOCK_KERNEL_SIZE*MAX_BLOCK_KERNEL_SIZE];
+  T Bt[MAX_BLOCK_KERNEL_SIZE*MAX_BLOCK_KERNEL_SIZE];
+  if (transposeA) {
+    transpose(k, m, A, At);
+    A = At;
+  }
+  if (transposeB) {
+    transpose(n, k, B, Bt);
+    B = Bt;
+  }
+
+  if (k == 3 && n == 3) {
+    gemm<T,3,3>(m, k, n, A, B, C);
+  }
+  else if (k == 4 && n == 4) {
+    gemm<T,4,4>(m, k, n, A, B, C);
+  }
+  else if (k == 12 && n == 12) {
+    gemm<T,12,12>(m, k, n, A, B, C);
+  }
+  else {
+    gemm<T,0,0>(m, k, n, A, B, C);
+  }
+}
+
+void blockGemm(int m, int k, int n, const double* A, bool transposeA,
+               const double* B, bool transposeB, double* C) {
+  blockGemmT(m, k, n, A, transposeA, B, transposeB, C);
+}
+
+void blockGemm(int m, int k, int n, const float* A, bool transposeA,
+               const float* B, bool transposeB, float* C) {
+  blockGemmT(m, k, n, A, transposeA, B, transposeB, C);
+}
+
+}}
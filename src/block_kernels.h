@@ -0,0 +1,31 @@
+#ifndef SIMIT_BLOCK_KERNELS_H
+#define SIMIT_BLOCK_KERNELS_H
+
+namespace simit {
+namespace internal {
+
+/// The largest dimension of the small dense matrices that index expressions
+/// are lowered to block kernels for.
+const int MAX_BLOCK_KERNEL_SIZE = 16;
+
+/// The fewest multiply-adds (m*k*n) of the products that index expressions are
+/// lowered to block kernels for. Smaller products, such as 3x3 matrix products,
+/// run as fast in the inline loops the backend generates as in a call.
+const int MIN_BLOCK_KERNEL_MULTIPLIES = 64;
+
+/// Compute C = op(A)*op(B), where op(A) is m x k, op(B) is k x n, op transposes
+/// its argument if the corresponding flag is set, and all matrices are dense
+/// and row-major with dimensions of at most MAX_BLOCK_KERNEL_SIZE. Uses AVX-512
+/// or AVX2 kernels if the CPU supports them, with unrolled kernels for 3x3, 4x4
+/// and 12x12 matrices.
+void blockGemm(int m, int k, int n, const double* A, bool transposeA,
+               const double* B, bool transposeB, double* C);
+void blockGemm(int m, int k, int n, const float* A, bool transposeA,
+               const float* B, bool transposeB, float* C);
+
+/// Returns the name of the instruction set block kernels use on this CPU:
+/// "avx512", "avx2" or "generic".
+const char* getBlockKernelISA();
+
+}}
+#endif
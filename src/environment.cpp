@@ -22,18 +22,18 @@ std::ostream& operator<<(std::ostream& os, const VarMapping& vm) {
 
 // class Environment
 struct Environment::Content {
-  vector<pair<Var, Expr>>        constants;
+  vector<pair<Var, Expr>>                   constants;
 
-  vector<VarMapping>             externs;
-  map<string, size_t>            externLocationByName;
+  vector<VarMapping>                        externs;
+  map<string, size_t>                       externLocationByName;
 
-  vector<Var>                    temporaries;
-  set<Var>                       temporarySet;
+  vector<Var>                               temporaries;
+  set<Var>                                  temporarySet;
 
-  vector<TensorIndex>            tensorIndices;
-  map<pe::PathExpression,size_t> locationOfTensorIndex;
+  vector<TensorIndex>                       tensorIndices;
+  map<pair<pe::PathExpression,bool>,size_t> locationOfTensorIndex;
 
-  map<Var,TensorIndex>           tensorIndexOfVar;
+  map<Var,TensorIndex>                      tensorIndexOfVar;
 };
 
 Environment::Environment() : content(new Content) {
@@ -121,20 +121,24 @@ const std::vector<TensorIndex>& Environment::getTensorIndices() const {
   return content->tensorIndices;
 }
 
-bool Environment::hasTensorIndex(const pe::PathExpression& pexpr) const {
+bool Environment::hasTensorIndex(const pe::PathExpression& pexpr,
+                                 bool upperTriangular) const {
   if (!pexpr.defined()) {
     return false;
   }
-  return util::contains(content->locationOfTensorIndex, pexpr);
+  return util::contains(content->locationOfTensorIndex,
+                        make_pair(pexpr, upperTriangular));
 }
 
 const TensorIndex&
-Environment::getTensorIndex(const pe::PathExpression& pexpr) const {
+Environment::getTensorIndex(const pe::PathExpression& pexpr,
+                            bool upperTriangular) const {
   iassert(pexpr.defined())
       << "Tensors in the environment have defined path expressions";
-  iassert(util::contains(content->locationOfTensorIndex, pexpr))
+  auto key = make_pair(pexpr, upperTriangular);
+  iassert(util::contains(content->locationOfTensorIndex, key))
       << "Could not find " << pexpr << " in environment";
-  return content->tensorIndices[content->locationOfTensorIndex.at(pexpr)];
+  return content->tensorIndices[content->locationOfTensorIndex.at(key)];
 }
 
 bool Environment::hasTensorIndex(const Var& var) const {
@@ -179,7 +183,7 @@ Var Environment::createTemporary(const Type &type, const std::string name) {
 }
 
 void Environment::addTensorIndex(const pe::PathExpression& pexpr,
-                                 const Var& var) {
+                                 const Var& var, bool upperTriangular) {
   iassert(pexpr.defined())
       << "Attempting to add tensor " << util::quote(var)
       << " index with an undefined path expression";
@@ -190,13 +194,14 @@ void Environment::addTensorIndex(const pe::PathExpression& pexpr,
 
   // Lazily create a new index if no index with the given pexpr exist.
   // TODO: Maybe rename indices as they get used by multiple tensors
-  if (!hasTensorIndex(pexpr)) {
-    TensorIndex ti(name+"_index", pexpr);
+  if (!hasTensorIndex(pexpr, upperTriangular)) {
+    TensorIndex ti(name+"_index", pexpr, upperTriangular);
     content->tensorIndices.push_back(ti);
     size_t loc = content->tensorIndices.size() - 1;
-    content->locationOfTensorIndex.insert({pexpr, loc});
+    content->locationOfTensorIndex.insert({{pexpr, upperTriangular}, loc});
   }
-  content->tensorIndexOfVar.insert({var, getTensorIndex(pexpr)});
+  content->tensorIndexOfVar.insert({var,
+                                    getTensorIndex(pexpr, upperTriangular)});
 }
 
 std::ostream& operator<<(std::ostream& os, const Environment& env) {
@@ -84,10 +84,14 @@ public:
   const std::vector<TensorIndex>& getTensorIndices() const;
 
   /// True of the environment has a tensor index for the given path expression.
-  bool hasTensorIndex(const pe::PathExpression& pexpr) const;
+  /// Upper triangular indices, which store symmetric matrices, are kept apart
+  /// from the full indices of the same path expression.
+  bool hasTensorIndex(const pe::PathExpression& pexpr,
+                      bool upperTriangular=false) const;
 
   /// Retrieve the tensor index of the given path expression.
-  const TensorIndex& getTensorIndex(const pe::PathExpression& pexpr) const;
+  const TensorIndex& getTensorIndex(const pe::PathExpression& pexpr,
+                                    bool upperTriangular=false) const;
 
   /// True of the environment contains the tensor index of var.
   bool hasTensorIndex(const Var& var) const;
@@ -116,7 +120,8 @@ public:
 
   /// Add a tensor index described by the given path expression to the
   /// environment, and associate it with var.
-  void addTensorIndex(const pe::PathExpression& pexpr, const Var& var);
+  void addTensorIndex(const pe::PathExpression& pexpr, const Var& var,
+                      bool upperTriangular=false);
 
 private:
   struct Content;
@@ -1,9 +1,10 @@
 #ifndef SIMIT_FFI_H
 #define SIMIT_FFI_H
 
-#include <tuple>
 #include <cstdlib>
 
+#include "tensor_data.h"
+
 namespace simit {
 namespace ffi {
 
@@ -17,58 +18,64 @@ void simit_free(void* ptr) {
   return free(ptr);
 }
 
-/// Converts a Simit blocked matrix into a CSR matrix.
+/// Expands a Simit blocked matrix into a CSR matrix in the given arrays, which
+/// must hold rows+1 row starts and one column index and value per stored block
+/// component. Each scalar row takes its components from the blocks of its block
+/// row in order, so the scalar rows are sorted by column like the block rows
+/// and the expansion takes time linear in the number of nonzeros.
 template <typename Float>
-void convertToCSR(Float* bufferA,
-                  int* row_start, int* col_idx,
-                  int rows, int columns, int bs_x, int bs_y,
-                  int** csrRowStart, int** csrColIdx, Float** csrVals) {
-  int nnz = row_start[rows/bs_x];
-
-  // create tuples for each matrix entry
-  std::vector<std::tuple<int,int,Float>> entries;
-  entries.reserve(nnz*bs_x*bs_y);
-  for (int i=0; i<rows/bs_x; i++) {
-    for (int j=row_start[i]; j<row_start[i+1]; j++) {
-      for (int bi=0; bi<bs_x; bi++) {
+void expandToCSR(const Float* bufferA,
+                 const int* row_start, const int* col_idx,
+                 int rows, int columns, int bs_x, int bs_y,
+                 int* csrRowStart, int* csrColIdx, Float* csrVals) {
+  int blockRows = rows/bs_x;
+  int blockSize = bs_x*bs_y;
+  for (int i=0; i<blockRows; i++) {
+    int rowBlocks = row_start[i+1] - row_start[i];
+    for (int bi=0; bi<bs_x; bi++) {
+      // Scalar row i*bs_x+bi starts after the components of the previous block
+      // rows and of the previous scalar rows of this block row
+      int k = row_start[i]*blockSize + bi*rowBlocks*bs_y;
+      csrRowStart[i*bs_x+bi] = k;
+      for (int j=row_start[i]; j<row_start[i+1]; j++) {
+        const Float* blockRow = &bufferA[j*blockSize + bi*bs_y];
         for (int bj=0; bj<bs_y; bj++) {
-          Float val = bufferA[j*bs_x*bs_y+bs_x*bi+bj];
-          entries.push_back(std::tuple<int,int,Float>(i*bs_x+bi,
-                                                            col_idx[j]*bs_y+bj,
-                                                            val));
+          csrColIdx[k] = col_idx[j]*bs_y+bj;
+          csrVals[k] = blockRow[bj];
+          k++;
         }
       }
     }
   }
+  csrRowStart[rows] = row_start[blockRows]*blockSize;
+}
+
+/// Expands the matrix the view refers to into a CSR matrix in the given arrays,
+/// which must hold A.numRows()+1 row starts and A.numValues() column indices
+/// and values. Upper triangular views expand to their stored blocks.
+template <typename Float>
+void expandToCSR(const SparseMatrixView& A,
+                 int* csrRowStart, int* csrColIdx, Float* csrVals) {
+  uassert(A.componentType == typeOf<Float>())
+      << "matrix components are not of the requested type";
+  expandToCSR(static_cast<const Float*>(A.vals), A.rowPtr, A.colIdx,
+              A.numRows(), A.numCols(), A.rowBlockSize, A.colBlockSize,
+              csrRowStart, csrColIdx, csrVals);
+}
 
-  // sort the tuples
-  std::sort(entries.begin(), entries.end());
-  
-  // build the matrix
+/// Converts a Simit blocked matrix into a CSR matrix, whose arrays are
+/// allocated with malloc.
+template <typename Float>
+void convertToCSR(Float* bufferA,
+                  int* row_start, int* col_idx,
+                  int rows, int columns, int bs_x, int bs_y,
+                  int** csrRowStart, int** csrColIdx, Float** csrVals) {
+  int nnz = row_start[rows/bs_x]*bs_x*bs_y;
   *csrRowStart = (int*)malloc((rows+1) * sizeof(int));
-  *csrColIdx = (int*)malloc(nnz*bs_x*bs_y * sizeof(int));
-  *csrVals = (Float*)malloc(nnz*bs_x*bs_y * sizeof(Float));
- 
-  // determine row lengths
-  for (int i=0; i<=rows; i++)
-    (*csrRowStart)[i] = 0;
-  for (int i=0; i<nnz*bs_x*bs_y; i++)
-    (*csrRowStart)[std::get<0>(entries[i])+1]++;
-  for (int i=0; i<rows; i++)
-    (*csrRowStart)[i+1] += (*csrRowStart)[i];
- 
-  // fill in col_idx and vals
-  for (int l=0; l<nnz*bs_x*bs_y; l++) {
-    int i = (*csrRowStart)[std::get<0>(entries[l])];
-    (*csrVals)[i] = std::get<2>(entries[l]);
-    (*csrColIdx)[i] = std::get<1>(entries[l]);
-    (*csrRowStart)[std::get<0>(entries[l])]++;
-  }
-  
-  // shift back row_start
-  for (int i=rows; i>0; i--) (*csrRowStart)[i] = (*csrRowStart)[i-1];
-  
-  (*csrRowStart)[0] = 0;
+  *csrColIdx = (int*)malloc(nnz * sizeof(int));
+  *csrVals = (Float*)malloc(nnz * sizeof(Float));
+  expandToCSR(bufferA, row_start, col_idx, rows, columns, bs_x, bs_y,
+              *csrRowStart, *csrColIdx, *csrVals);
 }
 
 }}
@@ -1,6 +1,7 @@
 #include "function.h"
 
 #include "backend/backend_function.h"
+#include "tensor_data.h"
 #include "types_convert.h"
 #include "graph.h"  // TODO: should not need this include
 
@@ -119,6 +120,16 @@ void Function::init() {
   funcPtr = impl->init();
 }
 
+void Function::setSolverParams(const SolverParams& params) {
+  uassert(defined()) << "undefined function";
+  impl->setSolverParams(params);
+}
+
+void Function::waitForOptimization() {
+  uassert(defined()) << "undefined function";
+  impl->waitForOptimization();
+}
+
 void Function::runSafe() {
   uassert(defined()) << "undefined function";
   if (!impl->isInitialized()) {
@@ -139,6 +150,11 @@ void Function::unmapArgs(bool updated) {
   impl->unmapArgs(updated);
 }
 
+SparseMatrixView Function::getMatrix(const std::string& name) {
+  uassert(defined()) << "undefined function";
+  return impl->getMatrix(name);
+}
+
 void Function::print(std::ostream& os) const {
   if (defined()) {
     os << *impl;
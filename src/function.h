@@ -8,6 +8,8 @@
 namespace simit {
 class Set;
 class TensorData;
+struct SolverParams;
+struct SparseMatrixView;
 
 namespace backend {
 class Function;
@@ -74,9 +76,28 @@ public:
   /// overhead over manually initializing and mapping arguments.
   void runSafe();
 
+  /// Set the method and parameters the function's solves use, overriding those
+  /// set with simit::setSolverParams. Solves reuse state across calls, such as
+  /// the symbolic analysis of factorizations and, with SolverParams::warmStart,
+  /// previous solutions.
+  void setSolverParams(const SolverParams& params);
+
+  /// Wait until the fully optimized code of a function compiled with tiered
+  /// compilation (see simit::setTieredCompilation) is ready, after which calls
+  /// to run use it. Returns immediately for other functions.
+  void waitForOptimization();
+
   void mapArgs();
   void unmapArgs(bool updated=true);
 
+  /// Returns a view of the sparse matrix with the given name, which is either a
+  /// matrix the function assembles or a sparse global. The view refers to the
+  /// function's memory without copying it, holds the values of the last run,
+  /// and is invalidated when the function is re-initialized or destroyed. Use
+  /// ffi::expandToCSR to expand it into a scalar CSR matrix, or TensorData to
+  /// bind it to another function.
+  SparseMatrixView getMatrix(const std::string& name);
+
   /// True if the function has been defined, false otherwise.
   bool defined() const {return impl != nullptr;}
 
@@ -11,30 +11,163 @@ Set::~Set() {
   for (auto f: fields) {
     delete f;
   }
-  free(endpoints);
+  internal::alignedFree(endpoints);
 
-  if (this->neighbors != nullptr) {
-    delete this->neighbors;
-  }
+  invalidateIndices();
 }
 
-void Set::increaseCapacity() {
+void Set::setCapacity(int newCapacity) {
+  iassert(newCapacity >= numElements);
   for (auto f : fields) {
     int typeSize = f->sizeOfType;
-    f->data = realloc(f->data, (capacity+capacityIncrement) * typeSize);
-    memset((char*)(f->data)+capacity*typeSize, 0, capacityIncrement*typeSize);
+    f->data = internal::parallelRealloc(f->data, capacity, newCapacity,
+                                        typeSize);
 
     for (FieldRefBase *fieldRef : f->fieldReferences) {
       fieldRef->data = f->data;
     }
   }
-  capacity += capacityIncrement;
+  if (getCardinality() > 0) {
+    endpoints = (int*)internal::parallelRealloc(endpoints, capacity,
+                                                newCapacity,
+                                                getCardinality()*sizeof(int));
+  }
+  capacity = newCapacity;
+}
+
+void Set::reserve(int n) {
+  uassert(n >= 0) << "Cannot reserve a negative number of elements";
+  if (n > capacity) {
+    setCapacity(max(n, 2*capacity));
+  }
+}
+
+ElementRef Set::addN(int count) {
+  uassert(getCardinality() == 0) << "Use addEdges to add elements to edge sets";
+  uassert(count >= 0) << "Cannot add a negative number of elements";
+  reserve(numElements+count);
+  int first = numElements;
+  numElements += count;
+  recordAddedElements(first, count);
+  return ElementRef(first);
+}
+
+ElementRef Set::addEdges(const int *endpoints, int count) {
+  uassert(getCardinality() > 0) << "Use addN to add elements to non-edge sets";
+  uassert(count >= 0) << "Cannot add a negative number of elements";
+  int cardinality = getCardinality();
+  for (int i=0; i < count*cardinality; ++i) {
+    const Set *endpointSet = endpointSets[i % cardinality];
+    uassert(endpoints[i] >= 0 && endpoints[i] < endpointSet->getSize())
+        << "Invalid member of set in addEdges";
+  }
+  reserve(numElements+count);
+  memcpy(this->endpoints + numElements*cardinality, endpoints,
+         count*cardinality*sizeof(int));
+  int first = numElements;
+  numElements += count;
+  recordAddedElements(first, count);
+  return ElementRef(first);
+}
+
+void Set::invalidateIndices() {
+  delete neighbors;
+  neighbors = nullptr;
+  delete coloring;
+  coloring = nullptr;
+  delete locations;
+  locations = nullptr;
+  addedEndpoints.clear();
+  removedEndpoints.clear();
+  changedEdges.clear();
+}
+
+// Patching the neighbor index moves the rows after each changed row, so when
+// many edges change it is cheaper to build a new one
+static bool isSmallChange(size_t numChangedEndpoints, int cardinality,
+                          int numEdges) {
+  return numChangedEndpoints / cardinality <= (size_t)numEdges/4 + 64;
+}
+
+void Set::recordAddedElements(int first, int count) {
+  ++topologyVersion;
+  if (coloring != nullptr) {
+    coloring->addEdges(*this, first, count);
+  }
+
+  if (neighbors != nullptr) {
+    // The index is patched from counts of the edges it was built from
+    if (!neighbors->hasEdgeCounts()) {
+      neighbors->countEdges(*this, first);
+    }
+
+    int cardinality = getCardinality();
+    addedEndpoints.insert(addedEndpoints.end(), endpoints + first*cardinality,
+                          endpoints + (first+count)*cardinality);
+    for (int e=first; e < first+count; ++e) {
+      changedEdges.push_back(e);
+    }
+    if (!isSmallChange(addedEndpoints.size() + removedEndpoints.size(),
+                       cardinality, numElements)) {
+      invalidateIndices();
+    }
+  }
+}
+
+void Set::recordRemovedElement(int ident) {
+  ++topologyVersion;
+  if (coloring != nullptr) {
+    coloring->removeEdge(*this, ident);
+  }
+
+  if (neighbors != nullptr) {
+    if (!neighbors->hasEdgeCounts()) {
+      neighbors->countEdges(*this, numElements);
+    }
+
+    // The last edge takes the removed edge's place
+    int cardinality = getCardinality();
+    removedEndpoints.insert(removedEndpoints.end(),
+                            endpoints + ident*cardinality,
+                            endpoints + (ident+1)*cardinality);
+    changedEdges.push_back(ident);
+    if (!isSmallChange(addedEndpoints.size() + removedEndpoints.size(),
+                       cardinality, numElements)) {
+      invalidateIndices();
+    }
+  }
 }
 
 const internal::NeighborIndex *Set::getNeighborIndex() const {
   tassert(isHomogeneous())
       << "neighbor indices are currently only supported for homogeneous sets";
 
+  if (getCardinality() >= 2 && neighbors != nullptr) {
+    // Bring the index, and the edge locations in it, up to date with the edges
+    // added and removed since it was last patched. Removing elements from the
+    // endpoint set renumbers them, so the index is then built again.
+    int numVertices = getEndpointSet(0)->getSize();
+    bool changed = addedEndpoints.size() > 0 || removedEndpoints.size() > 0 ||
+                   neighbors->getNumVertices() != numVertices;
+    if (changed) {
+      if (neighbors->getNumVertices() <= numVertices) {
+        std::vector<internal::RowResize> resized;
+        neighbors->update(*this, addedEndpoints, removedEndpoints, &resized);
+        if (locations != nullptr) {
+          locations->update(*this, *neighbors, resized, changedEdges);
+        }
+      }
+      else {
+        delete neighbors;
+        this->neighbors = new internal::NeighborIndex(*this);
+        delete locations;
+        this->locations = nullptr;
+      }
+      addedEndpoints.clear();
+      removedEndpoints.clear();
+      changedEdges.clear();
+    }
+  }
   if (getCardinality() >= 2 && neighbors == nullptr) {
     // Cast to non-const since adding a neighbor index does not change the 
     this->neighbors = new internal::NeighborIndex(*this);
@@ -42,12 +175,32 @@ const internal::NeighborIndex *Set::getNeighborIndex() const {
   return this->neighbors;
 }
 
+const internal::EdgeLocationIndex *Set::getEdgeLocationIndex() const {
+  if (getCardinality() >= 2) {
+    // Getting the neighbor index patches the locations
+    const internal::NeighborIndex *nbrs = getNeighborIndex();
+    if (locations == nullptr) {
+      this->locations = new internal::EdgeLocationIndex(*this, *nbrs);
+    }
+  }
+  return this->locations;
+}
+
+const internal::EdgeColoring *Set::getEdgeColoring() const {
+  if (getCardinality() > 0 && coloring == nullptr) {
+    this->coloring = new internal::EdgeColoring(*this);
+  }
+  else if (coloring != nullptr) {
+    // Sort the edges colored as they were added and removed
+    coloring->sortEdges();
+  }
+  return this->coloring;
+}
+
 
 // Graph generators
 void createElements(Set *elements, unsigned num) {
-  for (size_t i=0; i < num; ++i) {
-    elements->add();
-  }
+  elements->addN(num);
 }
 
 #define node0(x,y,z)  x*numY*numZ + y*numZ + z      // node at x,y,z
@@ -81,6 +234,9 @@ Box createBox(Set *vertices, Set *edges,
               unsigned numX, unsigned numY, unsigned numZ) {
   uassert(numX >= 1 && numY >= 1 && numZ >= 1);
   vector<ElementRef> points(numX*numY*numZ);
+  vertices->reserve(vertices->getSize() + numX*numY*numZ);
+  edges->reserve(edges->getSize() + (numX-1)*numY*numZ +
+                 numX*(numY-1)*numZ + numX*numY*(numZ-1));
 
   for(unsigned x = 0; x < numX; ++x) {
     for(unsigned y = 0; y < numY; ++y) {
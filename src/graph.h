@@ -12,6 +12,7 @@
 #include "tensor_type.h"
 #include "error.h"
 #include "types.h"
+#include "allocator.h"
 #include "util/variadic.h"
 #include "interfaces/comparable.h"
 
@@ -28,6 +29,8 @@ namespace internal {
 class VertexToEdgeEndpointIndex;
 class VertexToEdgeIndex;
 class NeighborIndex;
+class EdgeColoring;
+class EdgeLocationIndex;
 }
 
 namespace pe {
@@ -82,6 +85,8 @@ private:
   friend class internal::VertexToEdgeEndpointIndex;
   friend class internal::VertexToEdgeIndex;
   friend class internal::NeighborIndex;
+  friend class internal::EdgeColoring;
+  friend class internal::EdgeLocationIndex;
   friend class pe::SetEndpointPathIndex;
 };
 
@@ -93,14 +98,16 @@ class Set {
 public:
   Set(const std::string &name)
       : name(name), numElements(0), endpoints(nullptr),
-        capacity(capacityIncrement), neighbors(nullptr) {}
+        capacity(initialCapacity), topologyVersion(0), neighbors(nullptr),
+        coloring(nullptr), locations(nullptr) {}
 
   template <typename ...Sets>
   Set(const char *name, const Sets& ...sets) : Set(std::string(name)) {
     static_assert(util::areSame<Set, Sets...>{},
         "Set constructor takes an optional name followed by zero or more Sets");
     this->endpointSets = {&sets...};
-    this->endpoints    = (int*)calloc(sizeof(int), capacity * getCardinality());
+    this->endpoints    = (int*)internal::parallelCalloc(capacity,
+                                          getCardinality()*sizeof(int));
   }
 
   template <typename ...Sets>
@@ -114,6 +121,11 @@ public:
   /// Return the number of elements in the Set
   inline int getSize() const { return numElements; }
 
+  /// Return a counter that changes whenever elements are added to or removed
+  /// from the Set, so that indices built from the Set can tell if they are
+  /// out of date.
+  inline unsigned long getTopologyVersion() const { return topologyVersion; }
+
   /// Return the number of endpoints of the elements in the set.  Non-edge sets
   /// have cardinality 0.
   inline int getCardinality() const { return endpointSets.size(); }
@@ -122,12 +134,14 @@ public:
   /// component type and dimension sizes of the tensors.  For example, define a
   /// field of 2x3 matrices containing doubles as follows:
   /// Field<double,2,3> matrix = addField<double,2,3>("mat");
+  /// Field data is allocated by the installed Allocator (see setAllocator),
+  /// and first touched in the partition of parallel loops over the set.
   template <typename T, int... dimensions>
   FieldRef<T, dimensions...> addField(const std::string &name) {
     FieldData::TensorType *type =
         new FieldData::TensorType(typeOf<T>(), {dimensions...});
     FieldData *fieldData = new FieldData(name, type, this);
-    fieldData->data = calloc(capacity, fieldData->sizeOfType);
+    fieldData->data = internal::parallelCalloc(capacity, fieldData->sizeOfType);
     fields.push_back(fieldData);
     fieldNames[name] = fields.size()-1;
     return FieldRef<T, dimensions...>(fieldData);
@@ -164,19 +178,38 @@ public:
   ElementRef add(Endpoints... endpoints) {
     iassert(sizeof...(endpoints) == getCardinality()) <<"Wrong number of \
       endpoints.";
-    if (numElements > capacity-1) {
-      increaseEdgeCapacity();
+    if (numElements == capacity) {
+      reserve(numElements+1);
     }
     addEndpoints(0, endpoints...);
-
-    if (numElements > capacity-1) {
-      increaseCapacity();
-    }
+    recordAddedElements(numElements, 1);
     return ElementRef(numElements++);
   }
 
-  /// Remove an element from the Set
+  /// Make room for at least n elements, so that adding up to n elements does
+  /// not reallocate the set's fields and endpoints.  The capacity grows
+  /// geometrically, so adding elements one by one takes amortized constant time.
+  void reserve(int n);
+
+  /// Add `count` elements to a set without endpoints, returning the handle of
+  /// the first.  The new elements are numbered consecutively and their fields
+  /// are zero-initialized.
+  ElementRef addN(int count);
+
+  /// Add `count` edges whose endpoints are given by the flat array `endpoints`,
+  /// that holds getCardinality() endpoint indices per edge.  The endpoint
+  /// indices refer to the respective endpoint sets.  Returns the handle of the
+  /// first new edge; the new edges are numbered consecutively.
+  ElementRef addEdges(const int *endpoints, int count);
+
+  /// Remove an element from the Set.  The last element of the set takes the
+  /// removed element's place.
   void remove(ElementRef element) {
+    recordRemovedElement(element.ident);
+    for (int i=0; i < getCardinality(); ++i) {
+      endpoints[element.ident*getCardinality()+i] =
+          endpoints[(numElements-1)*getCardinality()+i];
+    }
     for (auto f : fields){
       switch (f->type->getComponentType()) {
         case ComponentType::Float: {
@@ -394,11 +427,23 @@ public:
   /// Get an array containing, for each edge in a set, the elements it connects.
   int *getEndpointsData() { return endpoints; }
 
-  /// If this set is an edge set with cardinality 2 then return an index that
-  /// for each element in the first connected set contains it's neighbors in the
-  /// second connceted set. Otherwise, return nullptr.
+  /// If this set is an edge set with a cardinality of at least 2 then return an
+  /// index that for each element in the first connected set contains it's
+  /// neighbors in the second connceted set. Otherwise, return nullptr.  When
+  /// edges have been added or removed since the index was built, the index is
+  /// patched with the changed edges instead of rebuilt.
   const internal::NeighborIndex *getNeighborIndex() const;
 
+  /// If this set is an edge set with a cardinality of at least 2 then return an
+  /// index that for each edge contains the locations of its endpoint pairs in
+  /// the neighbor index. Otherwise, return nullptr.
+  const internal::EdgeLocationIndex *getEdgeLocationIndex() const;
+
+  /// If this set is an edge set then return a partition of its edges into
+  /// colors, where no two edges of a color share an endpoint. Otherwise, return
+  /// nullptr.
+  const internal::EdgeColoring *getEdgeColoring() const;
+
   void setName(const std::string &name) { this->name = name; }
   std::string getName() const { return name; }
 
@@ -407,7 +452,7 @@ public:
   }
 
   // A field on the members of the Set.
-  // Invariant: elements < capacity
+  // Invariant: elements <= capacity
   struct FieldData {
     // Replace with simit::TensorType
     class TensorType {
@@ -443,7 +488,7 @@ public:
     }
 
     ~FieldData() {
-      if (data != nullptr) free(data);
+      internal::alignedFree(data);
       delete type;
     }
 
@@ -470,6 +515,7 @@ public:
 
   // Added getters for reordering
   inline int* getEndpointsPtr() { return endpoints; }
+  inline const int* getEndpointsPtr() const { return endpoints; }
   inline int getFieldIndex(std::string name) { return fieldNames[name]; } inline 
     std::vector<FieldData*>& getFields() { return fields; } inline std::string 
     getSpatialFieldName() const { return spatialFieldName; }
@@ -485,9 +531,20 @@ private:
   int* endpoints;                            // the endpoints of edge elements
 
   int capacity;                              // current capacity of the set
-  static const int capacityIncrement = 1024; // increment for capacity increases
+  static const int initialCapacity = 1024;   // capacity of a new set
+
+  unsigned long topologyVersion;             // incremented on add and remove
+  mutable std::vector<int> addedEndpoints;   // endpoints of edges added and
+  mutable std::vector<int> removedEndpoints; // removed since the neighbor
+                                             // index was last brought up to
+                                             // date
+  mutable std::vector<int> changedEdges;     // edges whose endpoints changed
+                                             // since then
 
   mutable internal::NeighborIndex *neighbors;// neighbor index (lazily created)
+  mutable internal::EdgeColoring *coloring;  // edge coloring (lazily created)
+  mutable internal::EdgeLocationIndex *locations; // edge locations (lazily
+                                                  // created)
   std::map<std::string, int> fieldNames;     // name to field lookups
   std::vector<FieldData*> fields;            // fields of elements in the set
 
@@ -495,8 +552,17 @@ private:
   Set(const Set& s);
   Set& operator=(const Set& s);
 
-  /// increase capacity of all fields
-  void increaseCapacity();
+  /// set the capacity of all fields and of the endpoints to newCapacity
+  void setCapacity(int newCapacity);
+
+  /// delete the indices computed from the elements, since they are out of date
+  void invalidateIndices();
+
+  /// record that elements were added to or removed from the set, which colors
+  /// or uncolors the changed edges and logs them so the neighbor and edge
+  /// location indices can be patched
+  void recordAddedElements(int first, int count);
+  void recordRemovedElement(int ident);
 
   /// helpers for constructing endpoint sets
   template <typename F, typename ...T> std::vector<const Set*>
@@ -512,11 +578,6 @@ private:
   std::vector<const Set*>
   epsMaker(std::vector<const Set*> sofar) {return sofar;}
 
-  void increaseEdgeCapacity() {
-    size_t newSize = (capacity+capacityIncrement)*getCardinality()*sizeof(int);
-    endpoints = (int*)realloc(endpoints, newSize);
-  }
-
   // helper for adding edges
   template <typename F, typename ...T>
   void addEndpoints(int which, F f, T ... eps) {
@@ -562,7 +623,8 @@ private:
       FieldData::TensorType *type =
           new FieldData::TensorType(ctype, dims);
       FieldData *fieldData = new FieldData(field.name, type, this);
-      fieldData->data = calloc(capacity, fieldData->sizeOfType);
+      fieldData->data = internal::parallelCalloc(capacity,
+                                                 fieldData->sizeOfType);
       fields.push_back(fieldData);
       fieldNames[field.name] = fields.size()-1;
     }
@@ -1,8 +1,26 @@
 #include "graph_indices.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace simit {
+extern std::string kBackend;
+
 namespace internal {
 
+void parallelForIndex(int begin, int end,
+                      const std::function<void(int,int)>& body) {
+  if (end <= begin) {
+    return;
+  }
+  if (kBackend == "cpu-parallel") {
+    getThreadPool().parallelFor(begin, end, body);
+  }
+  else {
+    body(begin, end);
+  }
+}
+
 // class VertexToEdgeEndpointIndex
 VertexToEdgeEndpointIndex:: VertexToEdgeEndpointIndex(const Set &edgeSet) {
   totalEdges = edgeSet.getSize();
@@ -11,11 +29,11 @@ VertexToEdgeEndpointIndex:: VertexToEdgeEndpointIndex(const Set &edgeSet) {
     endpointSets.push_back(es);
   }
 
-  for (auto e : edgeSet) {
-    for (int epi=0; epi<(int)(endpointSets.size()); epi++) {
-      auto ep = edgeSet.getEndpoint(e, epi);
-      whichEdgesForVertex[std::make_pair(epi, ep.ident)].insert(e.ident);
-    }
+  whichEdgesForVertex.resize(endpointSets.size());
+  for (int epi=0; epi<(int)(endpointSets.size()); epi++) {
+    VertexToEdgeRows &rows = whichEdgesForVertex[epi];
+    buildVertexToEdges(edgeSet, {epi}, endpointSets[epi]->getSize(),
+                       &rows.start, &rows.edges);
   }
 }
 
@@ -32,12 +50,15 @@ VertexToEdgeIndex::VertexToEdgeIndex(const Set &edgeSet) {
     endpointSets.push_back(es);
   }
 
-  for (auto e : edgeSet) {
-    for (int epi=0; epi<(int)(endpointSets.size()); epi++) {
-      auto ep = edgeSet.getEndpoint(e, epi);
-      whichEdgesForVertex[std::make_pair(
-          endpointSets[epi], ep.ident)].insert(e.ident);
-    }
+  // Index each endpoint set through the endpoints that belong to it
+  std::map<const Set*, std::vector<int>> slots;
+  for (int epi=0; epi<(int)(endpointSets.size()); epi++) {
+    slots[endpointSets[epi]].push_back(epi);
+  }
+  for (auto &setSlots : slots) {
+    VertexToEdgeRows &rows = whichEdgesForVertex[setSlots.first];
+    buildVertexToEdges(edgeSet, setSlots.second, setSlots.first->getSize(),
+                       &rows.start, &rows.edges);
   }
 }
 
@@ -47,44 +68,498 @@ VertexToEdgeIndex::~VertexToEdgeIndex() {
 
 // class NeighborIndex
 NeighborIndex::NeighborIndex(const Set &edgeSet) {
-  VertexToEdgeIndex VToE(edgeSet);
-
   //number of vertices per edge
-  unsigned cardinality = edgeSet.getCardinality();
+  int cardinality = edgeSet.getCardinality();
+  const int *endpoints = edgeSet.getEndpointsPtr();
 
+  // The edges of each vertex, through the endpoints in the vertex set
   const Set* vSet = edgeSet.getEndpointSet(0);
-  startIndex = (int*)malloc(sizeof(int) * (vSet->getSize()+1));
-  startIndex[0] = 0;
-  for(auto v : *vSet){
-    std::set<int> edgeNeighbors = VToE.getWhichEdgesForElement(v, *vSet);
-
-    std::vector<int> nbr;
-    for(int eIdx : edgeNeighbors) {
-      for(unsigned jj = 0; jj<cardinality; jj++){
-        int nbrIdx = edgeSet.getEndpoint(ElementRef(eIdx), jj).ident;
-        addNoCollision(nbrIdx, nbr);
+  std::vector<int> slots;
+  for (int i=0; i < cardinality; ++i) {
+    if (edgeSet.getEndpointSet(i) == vSet) {
+      slots.push_back(i);
+    }
+  }
+  std::vector<int> edgeStart;
+  std::vector<int> edges;
+  buildVertexToEdges(edgeSet, slots, vSet->getSize(), &edgeStart, &edges);
+
+  // The neighbors of a vertex are the sorted and unique endpoints of its edges
+  buildRowsInParallel<int>(vSet->getSize(),
+      [&](int v, std::vector<int> *nbrs) {
+        size_t rowBegin = nbrs->size();
+        for (int i=edgeStart[v]; i < edgeStart[v+1]; ++i) {
+          const int *edgeEndpoints = &endpoints[edges[i]*cardinality];
+          nbrs->insert(nbrs->end(), edgeEndpoints, edgeEndpoints+cardinality);
+        }
+        std::sort(nbrs->begin()+rowBegin, nbrs->end());
+        nbrs->erase(std::unique(nbrs->begin()+rowBegin, nbrs->end()),
+                    nbrs->end());
+      },
+      &startIndex, &neighbors);
+}
+
+NeighborIndex::~NeighborIndex() {
+}
+
+void NeighborIndex::countEdges(const Set &edgeSet, int numEdges) {
+  int cardinality = edgeSet.getCardinality();
+  const int *endpoints = edgeSet.getEndpointsPtr();
+  const Set *vSet = edgeSet.getEndpointSet(0);
+  iassert(numEdges <= edgeSet.getSize());
+
+  // Count each edge once in the rows of its distinct endpoints in the vertex
+  // set, for each of its distinct endpoints
+  edgeCounts.assign(neighbors.size(), 0);
+  for (int e=0; e < numEdges; ++e) {
+    const int *edgeEndpoints = &endpoints[e*cardinality];
+    for (int i=0; i < cardinality; ++i) {
+      int v = edgeEndpoints[i];
+      if (edgeSet.getEndpointSet(i) != vSet ||
+          std::find(edgeEndpoints, edgeEndpoints+i, v) != edgeEndpoints+i) {
+        continue;
+      }
+      const int *rowBegin = neighbors.data() + startIndex[v];
+      const int *rowEnd = neighbors.data() + startIndex[v+1];
+      for (int j=0; j < cardinality; ++j) {
+        int w = edgeEndpoints[j];
+        if (std::find(edgeEndpoints, edgeEndpoints+j, w) != edgeEndpoints+j) {
+          continue;
+        }
+        const int *nbr = std::lower_bound(rowBegin, rowEnd, w);
+        iassert(nbr != rowEnd && *nbr == w);
+        ++edgeCounts[nbr - neighbors.data()];
       }
     }
-    neighbors.insert(neighbors.end(), nbr.begin(), nbr.end());
-    startIndex[v.ident+1] = neighbors.size();
   }
+}
 
-  for (int i=0; i < vSet->getSize(); ++i) {
-    std::sort(neighbors.begin()+startIndex[i], neighbors.begin()+startIndex[i+1]);
+/// Resize a buffer whose capacity grows geometrically, so that indices that
+/// grow by a few entries at a time are not reallocated every time.
+template <typename T>
+static void resizeBuffer(std::vector<T> *buffer, size_t size) {
+  if (size > buffer->capacity()) {
+    buffer->reserve(size + size/4);
   }
+  buffer->resize(size);
 }
 
-NeighborIndex::~NeighborIndex() {
-  free(startIndex);
+void NeighborIndex::update(const Set &edgeSet,
+                           const std::vector<int> &addedEndpoints,
+                           const std::vector<int> &removedEndpoints,
+                           std::vector<RowResize> *resized) {
+  iassert(hasEdgeCounts() ||
+          (addedEndpoints.size() == 0 && removedEndpoints.size() == 0))
+      << "Updating a neighbor index requires edge counts";
+  int cardinality = edgeSet.getCardinality();
+  const Set *vSet = edgeSet.getEndpointSet(0);
+  int numVertices = vSet->getSize();
+  int oldNumVertices = getNumVertices();
+  iassert(numVertices >= oldNumVertices);
+
+  // The change to the edge count of each (vertex,neighbor) pair, where the
+  // vertices are the distinct endpoints in the vertex set and the neighbors
+  // the distinct endpoints of each changed edge
+  typedef std::pair<int,int> Pair;
+  std::vector<std::pair<Pair,int>> changes;
+  auto addChanges = [&](const std::vector<int> &changedEndpoints, int change) {
+    for (size_t e=0; e < changedEndpoints.size(); e += cardinality) {
+      const int *edgeEndpoints = &changedEndpoints[e];
+      for (int i=0; i < cardinality; ++i) {
+        int v = edgeEndpoints[i];
+        if (edgeSet.getEndpointSet(i) != vSet ||
+            std::find(edgeEndpoints, edgeEndpoints+i, v) != edgeEndpoints+i) {
+          continue;
+        }
+        iassert(v >= 0 && v < numVertices);
+        for (int j=0; j < cardinality; ++j) {
+          int w = edgeEndpoints[j];
+          if (std::find(edgeEndpoints, edgeEndpoints+j, w) ==
+              edgeEndpoints+j) {
+            changes.push_back({{v,w}, change});
+          }
+        }
+      }
+    }
+  };
+  addChanges(addedEndpoints, 1);
+  addChanges(removedEndpoints, -1);
+  std::sort(changes.begin(), changes.end());
+
+  // New vertices get empty rows
+  resizeBuffer(&startIndex, numVertices+1);
+  std::fill(startIndex.begin()+oldNumVertices+1, startIndex.end(),
+            startIndex[oldNumVertices]);
+
+  // Merge the changes into the rows of their vertices, adding pairs whose count
+  // becomes positive and dropping pairs whose count drops to zero. The merged
+  // rows are set aside until the rows between them have been moved.
+  std::vector<RowResize> rows;
+  std::vector<int> rowNeighbors;
+  std::vector<int> rowEdgeCounts;
+  auto copyNeighbors = [&](int begin, int end) {
+    rowNeighbors.insert(rowNeighbors.end(),
+                        neighbors.begin()+begin, neighbors.begin()+end);
+    rowEdgeCounts.insert(rowEdgeCounts.end(),
+                         edgeCounts.begin()+begin, edgeCounts.begin()+end);
+  };
+  size_t c = 0;
+  while (c < changes.size()) {
+    int v = changes[c].first.first;
+    int i = startIndex[v];
+    int rowEnd = startIndex[v+1];
+    size_t rowBegin = rowNeighbors.size();
+    while (c < changes.size() && changes[c].first.first == v) {
+      int w = changes[c].first.second;
+      int count = 0;
+      for (; c < changes.size() && changes[c].first == Pair(v,w); ++c) {
+        count += changes[c].second;
+      }
+
+      int nbrEnd = std::lower_bound(neighbors.begin()+i,
+                                    neighbors.begin()+rowEnd, w) -
+                   neighbors.begin();
+      copyNeighbors(i, nbrEnd);
+      i = nbrEnd;
+      if (i < rowEnd && neighbors[i] == w) {
+        count += edgeCounts[i];
+        ++i;
+      }
+      iassert(count >= 0) << "Removed an edge that is not in the index";
+      if (count > 0) {
+        rowNeighbors.push_back(w);
+        rowEdgeCounts.push_back(count);
+      }
+    }
+    copyNeighbors(i, rowEnd);
+    rows.push_back({v, rowEnd - startIndex[v],
+                    (int)(rowNeighbors.size() - rowBegin)});
+  }
+
+  // Move the rows between the merged rows in place, and fill in the merged rows
+  size_t oldSize = neighbors.size();
+  size_t newSize = oldSize + rowNeighbors.size();
+  for (const RowResize &row : rows) {
+    newSize -= row.oldSize;
+  }
+  if (newSize > oldSize) {
+    resizeBuffer(&neighbors, newSize);
+    resizeBuffer(&edgeCounts, newSize);
+  }
+  resizeRows(startIndex.data(), numVertices, rows,
+      [&](long long from, long long to, long long count) {
+        std::memmove(&neighbors[to], &neighbors[from], count*sizeof(int));
+        std::memmove(&edgeCounts[to], &edgeCounts[from], count*sizeof(int));
+      });
+  size_t rowOffset = 0;
+  for (const RowResize &row : rows) {
+    std::copy(rowNeighbors.begin()+rowOffset,
+              rowNeighbors.begin()+rowOffset+row.newSize,
+              neighbors.begin()+startIndex[row.row]);
+    std::copy(rowEdgeCounts.begin()+rowOffset,
+              rowEdgeCounts.begin()+rowOffset+row.newSize,
+              edgeCounts.begin()+startIndex[row.row]);
+    rowOffset += row.newSize;
+  }
+  if (newSize < oldSize) {
+    neighbors.resize(newSize);
+    edgeCounts.resize(newSize);
+  }
+  iassert(startIndex[numVertices] == (int)newSize);
+
+  if (resized != nullptr) {
+    resized->swap(rows);
+  }
+}
+
+
+// class EdgeLocationIndex
+EdgeLocationIndex::EdgeLocationIndex(const Set &edgeSet,
+                                     const NeighborIndex &neighbors) {
+  int cardinality = edgeSet.getCardinality();
+  locations.resize(edgeSet.getSize() * cardinality * cardinality);
+  for (int e=0; e < edgeSet.getSize(); ++e) {
+    for (int i=0; i < cardinality; ++i) {
+      locate(edgeSet, neighbors, e, i);
+    }
+  }
 }
 
-void NeighborIndex::addNoCollision(int x, std::vector<int> & a) {
-  for(unsigned int ii=0 ;ii<a.size();ii++){
-    if(a[ii]==x){
-      return;
+void EdgeLocationIndex::update(const Set &edgeSet,
+                               const NeighborIndex &neighbors,
+                               const std::vector<RowResize> &resized,
+                               const std::vector<int> &changedEdges) {
+  int numEdges = edgeSet.getSize();
+  int cardinality = edgeSet.getCardinality();
+  resizeBuffer(&locations, (size_t)numEdges * cardinality * cardinality);
+
+  // The rows after each resized row, up to the next, moved by the size changes
+  // of the resized rows up to it
+  std::vector<int> shifts(resized.size());
+  int shift = 0;
+  for (size_t k=0; k < resized.size(); ++k) {
+    shift += resized[k].newSize - resized[k].oldSize;
+    shifts[k] = shift;
+  }
+
+  std::vector<int> changed(changedEdges);
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+  parallelForIndex(0, numEdges, [&](int edgeBegin, int edgeEnd) {
+    for (int e=edgeBegin; e < edgeEnd; ++e) {
+      if (std::binary_search(changed.begin(), changed.end(), e)) {
+        continue;
+      }
+      for (int i=0; i < cardinality; ++i) {
+        int v = edgeSet.getEndpoint(ElementRef(e), i).ident;
+        auto row = std::lower_bound(resized.begin(), resized.end(), v,
+            [](const RowResize &r, int v) {return r.row < v;});
+        if (row != resized.end() && row->row == v) {
+          locate(edgeSet, neighbors, e, i);
+        }
+        else if (row != resized.begin() && shifts[row-resized.begin()-1] != 0) {
+          int *loc = &locations[(e*cardinality + i)*cardinality];
+          for (int j=0; j < cardinality; ++j) {
+            loc[j] += shifts[row-resized.begin()-1];
+          }
+        }
+      }
+    }
+  });
+  for (int e : changed) {
+    if (e < numEdges) {
+      for (int i=0; i < cardinality; ++i) {
+        locate(edgeSet, neighbors, e, i);
+      }
     }
   }
-  a.push_back(x);
+}
+
+void EdgeLocationIndex::locate(const Set &edgeSet,
+                               const NeighborIndex &neighbors, int e, int i) {
+  int cardinality = edgeSet.getCardinality();
+  const int *startIndex = neighbors.getStartIndex();
+  const int *nbrs = neighbors.getNeighborIndex();
+
+  int v0 = edgeSet.getEndpoint(ElementRef(e), i).ident;
+  const int *rowBegin = nbrs + startIndex[v0];
+  const int *rowEnd = nbrs + startIndex[v0+1];
+  int *loc = &locations[(e*cardinality + i)*cardinality];
+  for (int j=0; j < cardinality; ++j) {
+    // The neighbors of each element are sorted
+    int v1 = edgeSet.getEndpoint(ElementRef(e), j).ident;
+    const int *nbr = std::lower_bound(rowBegin, rowEnd, v1);
+    iassert(nbr != rowEnd && *nbr == v1);
+    loc[j] = nbr - nbrs;
+  }
+}
+
+
+// class EdgeColoring
+EdgeColoring::EdgeColoring(const Set &edgeSet) : stamp(0), sorted(false) {
+  int cardinality = edgeSet.getCardinality();
+
+  // Number the endpoint sets, so that elements of different endpoint sets do
+  // not conflict
+  std::vector<const Set*> sets;
+  for (int i=0; i < cardinality; ++i) {
+    const Set *endpointSet = edgeSet.getEndpointSet(i);
+    auto set = std::find(sets.begin(), sets.end(), endpointSet);
+    endpointSets.push_back(set - sets.begin());
+    if (set == sets.end()) {
+      sets.push_back(endpointSet);
+    }
+  }
+  vertexColors.resize(sets.size());
+  for (size_t k=0; k < sets.size(); ++k) {
+    vertexColors[k].resize(sets[k]->getSize());
+  }
+
+  addEdges(edgeSet, 0, edgeSet.getSize());
+  sortEdges();
+}
+
+void EdgeColoring::addEdges(const Set &edgeSet, int first, int count) {
+  iassert(first == (int)edgeColors.size());
+  edgeColors.resize(first+count);
+  for (int e=first; e < first+count; ++e) {
+    colorEdge(edgeSet, e);
+  }
+  sorted = false;
+}
+
+void EdgeColoring::removeEdge(const Set &edgeSet, int ident) {
+  int last = edgeColors.size()-1;
+  iassert(ident >= 0 && ident <= last);
+  int color = edgeColors[ident];
+  for (int i=0; i < edgeSet.getCardinality(); ++i) {
+    std::vector<int> &colors = getVertexColors(edgeSet, ident, i);
+    auto c = std::find(colors.begin(), colors.end(), color);
+    iassert(c != colors.end());
+    colors.erase(c);
+  }
+  edgeColors[ident] = edgeColors[last];
+  edgeColors.pop_back();
+  sorted = false;
+}
+
+void EdgeColoring::sortEdges() {
+  if (sorted) {
+    return;
+  }
+
+  // Colors that no edge has any more are dropped from the end, but not from
+  // between other colors
+  int numEdges = edgeColors.size();
+  int numColors = 0;
+  for (int e=0; e < numEdges; ++e) {
+    numColors = std::max(numColors, edgeColors[e]+1);
+  }
+  colorStart.assign(numColors+1, 0);
+  for (int e=0; e < numEdges; ++e) {
+    ++colorStart[edgeColors[e]+1];
+  }
+  for (int color=0; color < numColors; ++color) {
+    colorStart[color+1] += colorStart[color];
+  }
+  colorEdges.resize(numEdges);
+  std::vector<int> next(colorStart.begin(), colorStart.end()-1);
+  for (int e=0; e < numEdges; ++e) {
+    colorEdges[next[edgeColors[e]]++] = e;
+  }
+  sorted = true;
+}
+
+std::vector<int>& EdgeColoring::getVertexColors(const Set &edgeSet, int e,
+                                                int i) {
+  std::vector<std::vector<int>> &colors = vertexColors[endpointSets[i]];
+  int v = edgeSet.getEndpoint(ElementRef(e), i).ident;
+  if (v >= (int)colors.size()) {
+    colors.resize(edgeSet.getEndpointSet(i)->getSize());
+  }
+  return colors[v];
+}
+
+void EdgeColoring::colorEdge(const Set &edgeSet, int e) {
+  // Greedily give the edge the first color that is not used by an edge that
+  // shares one of its endpoints
+  int cardinality = edgeSet.getCardinality();
+  ++stamp;
+  for (int i=0; i < cardinality; ++i) {
+    for (int color : getVertexColors(edgeSet, e, i)) {
+      takenBy[color] = stamp;
+    }
+  }
+
+  int color = 0;
+  while (color < (int)takenBy.size() && takenBy[color] == stamp) {
+    ++color;
+  }
+  if (color == (int)takenBy.size()) {
+    takenBy.push_back(0);
+  }
+  edgeColors[e] = color;
+
+  for (int i=0; i < cardinality; ++i) {
+    getVertexColors(edgeSet, e, i).push_back(color);
+  }
+}
+
+
+void buildVertexToEdges(const Set &edgeSet, const std::vector<int> &slots,
+                        int numVertices, std::vector<int> *start,
+                        std::vector<int> *edges) {
+  int numEdges = edgeSet.getSize();
+  int cardinality = edgeSet.getCardinality();
+  int numSlots = slots.size();
+  const int *endpoints = edgeSet.getEndpointsPtr();
+
+  // Returns the vertex at the given slot of edge e, or -1 if an earlier slot of
+  // e contains the same vertex
+  auto getVertex = [&](int e, int slot) {
+    int v = endpoints[e*cardinality + slots[slot]];
+    for (int i=0; i < slot; ++i) {
+      if (endpoints[e*cardinality + slots[i]] == v) {
+        return -1;
+      }
+    }
+    iassert(v >= 0 && v < numVertices) << "Invalid endpoint " << v;
+    return v;
+  };
+
+  // Each chunk of edges gets a histogram over all the vertices, so bound the
+  // chunks to keep the histograms within a few times the size of the result
+  long long numEntries = (long long)numEdges * numSlots + numVertices;
+  long long maxChunks = 4 * numEntries / std::max(numVertices, 1);
+  int numChunks = (int)std::max(1LL, std::min((long long)kMaxIndexChunks,
+                                              std::min(maxChunks,
+                                                       (long long)numEdges)));
+
+  // Count the edges of each vertex, with one histogram per chunk of edges
+  std::vector<std::vector<int>> offsets(numChunks);
+  parallelForIndex(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+    for (int chunk=chunkBegin; chunk < chunkEnd; ++chunk) {
+      std::vector<int> &counts = offsets[chunk];
+      counts.assign(numVertices, 0);
+      int edgeBegin = getIndexChunkBegin(0, numEdges, chunk, numChunks);
+      int edgeEnd = getIndexChunkBegin(0, numEdges, chunk+1, numChunks);
+      for (int e=edgeBegin; e < edgeEnd; ++e) {
+        for (int slot=0; slot < numSlots; ++slot) {
+          int v = getVertex(e, slot);
+          if (v != -1) {
+            ++counts[v];
+          }
+        }
+      }
+    }
+  });
+
+  // Prefix sum the counts into the start of each vertex's edges, and the start
+  // of each chunk's edges within them
+  start->resize(numVertices+1);
+  (*start)[0] = 0;
+  parallelForIndex(0, numVertices, [&](int vBegin, int vEnd) {
+    for (int v=vBegin; v < vEnd; ++v) {
+      int count = 0;
+      for (int chunk=0; chunk < numChunks; ++chunk) {
+        count += offsets[chunk][v];
+      }
+      (*start)[v+1] = count;
+    }
+  });
+  for (int v=0; v < numVertices; ++v) {
+    (*start)[v+1] += (*start)[v];
+  }
+  parallelForIndex(0, numVertices, [&](int vBegin, int vEnd) {
+    for (int v=vBegin; v < vEnd; ++v) {
+      int offset = (*start)[v];
+      for (int chunk=0; chunk < numChunks; ++chunk) {
+        int count = offsets[chunk][v];
+        offsets[chunk][v] = offset;
+        offset += count;
+      }
+    }
+  });
+
+  // Scatter the edges. Each chunk's edges go after the edges of earlier chunks,
+  // so the edges of each vertex come out in increasing order.
+  edges->resize((*start)[numVertices]);
+  parallelForIndex(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+    for (int chunk=chunkBegin; chunk < chunkEnd; ++chunk) {
+      std::vector<int> &next = offsets[chunk];
+      int edgeBegin = getIndexChunkBegin(0, numEdges, chunk, numChunks);
+      int edgeEnd = getIndexChunkBegin(0, numEdges, chunk+1, numChunks);
+      for (int e=edgeBegin; e < edgeEnd; ++e) {
+        for (int slot=0; slot < numSlots; ++slot) {
+          int v = getVertex(e, slot);
+          if (v != -1) {
+            (*edges)[next[v]++] = e;
+          }
+        }
+      }
+    }
+  });
 }
 
 }}
@@ -2,12 +2,45 @@
 #define SIMIT_INDICES_H
 
 #include "graph.h"
+#include <algorithm>
 #include <map>
 #include <vector>
+#include <functional>
+
+#include "thread_pool.h"
 
 namespace simit {
 namespace internal {
 
+/// The indices of the edges that contain a vertex, in increasing order.
+class VertexEdges {
+ public:
+  VertexEdges(const int *first, const int *last) : first(first), last(last) {}
+
+  const int* begin() const { return first; }
+  const int* end() const { return last; }
+  size_t size() const { return last - first; }
+
+ private:
+  const int *first;
+  const int *last;
+};
+
+
+/// The edges that contain each vertex of an endpoint set, stored as compressed
+/// rows: the edges of vertex v are edges[start[v]:start[v+1]].
+struct VertexToEdgeRows {
+  std::vector<int> start;
+  std::vector<int> edges;
+
+  VertexEdges getEdges(int vertex) const {
+    iassert(vertex >= 0 && vertex+1 < (int)start.size());
+    return VertexEdges(edges.data() + start[vertex],
+                       edges.data() + start[vertex+1]);
+  }
+};
+
+
 /// A class for an index that maps from points to edges that contain that point
 /// differentiating between different endpoints
 class VertexToEdgeEndpointIndex {
@@ -15,17 +48,17 @@ class VertexToEdgeEndpointIndex {
   VertexToEdgeEndpointIndex(const Set &edgeSet);
  ~VertexToEdgeEndpointIndex();
   
-  std::set<int> getWhichEdgesForElement(ElementRef vertex, int whichEndpoint) {
-    return whichEdgesForVertex[std::make_pair(whichEndpoint, vertex.ident)];
+  VertexEdges getWhichEdgesForElement(ElementRef vertex,
+                                      int whichEndpoint) const {
+    return whichEdgesForVertex[whichEndpoint].getEdges(vertex.ident);
   }
   
   int getTotalEdges() { return totalEdges; }
 
  private:
   std::vector<const Set*> endpointSets;       // the endpoint sets
-  // which edges v belongs to
-  // Map from (endpointIndex, point) -> set of edge indices
-  std::map< std::pair<int, int>, std::set<int> > whichEdgesForVertex;
+  // which edges v belongs to, for each endpoint index
+  std::vector<VertexToEdgeRows> whichEdgesForVertex;
   int totalEdges;
 };
 
@@ -37,25 +70,61 @@ class VertexToEdgeIndex {
   VertexToEdgeIndex(const Set &edgeSet);
   ~VertexToEdgeIndex();
   
-  std::set<int> getWhichEdgesForElement(ElementRef vertex, const Set& whichSet) {
-    return whichEdgesForVertex[std::make_pair(&whichSet, vertex.ident)];
+  VertexEdges getWhichEdgesForElement(ElementRef vertex,
+                                      const Set& whichSet) const {
+    auto rows = whichEdgesForVertex.find(&whichSet);
+    if (rows == whichEdgesForVertex.end()) {
+      return VertexEdges(nullptr, nullptr);
+    }
+    return rows->second.getEdges(vertex.ident);
   }
   
   int getTotalEdges() { return totalEdges; }
   
  private:
   std::vector<const Set*> endpointSets;           // the endpoint sets
-  std::map< std::pair<const Set*,int>, std::set<int> > whichEdgesForVertex;
+  // which edges v belongs to, for each distinct endpoint set
+  std::map<const Set*, VertexToEdgeRows> whichEdgesForVertex;
   int totalEdges;
 };
 
 
+/// A change to the size of a row of compressed rows (see resizeRows).
+struct RowResize {
+  int row;
+  int oldSize;
+  int newSize;
+};
+
+
 /// Maps elements to their neighbors through an edge set. Note that an element
 /// is its own neighbor. This index does not work for heterogeneous graphs.
 class NeighborIndex {
  public:
+  /// Build the neighbor index of an edge set.
   NeighborIndex(const Set &edgeSet);
   ~NeighborIndex();
+
+  /// Count the edges that make each pair of elements neighbors, among the
+  /// first `numEdges` edges of the edge set, which must be the edges the index
+  /// was built from. The counts let the index be updated as edges are added
+  /// and removed.
+  void countEdges(const Set &edgeSet, int numEdges);
+
+  /// Update the index in place after the edges with the given endpoints (laid
+  /// out as in the edge set) have been added to and removed from the edge set.
+  /// Elements may also have been added to the endpoint set. Only the rows of
+  /// the changed endpoints are rewritten, and the rows after them are moved, so
+  /// the index buffers are only reallocated when they grow past their
+  /// capacity. The rows that were rewritten, sorted, are stored in `resized`
+  /// if it is given. Requires edge counts.
+  void update(const Set &edgeSet, const std::vector<int> &addedEndpoints,
+              const std::vector<int> &removedEndpoints,
+              std::vector<RowResize> *resized=nullptr);
+
+  bool hasEdgeCounts() const { return edgeCounts.size() == neighbors.size(); }
+
+  int getNumVertices() const { return startIndex.size()-1; }
   
   int getNumNeighbors(ElementRef vertex) const {
     return startIndex[vertex.ident+1] - startIndex[vertex.ident];
@@ -70,7 +139,7 @@ class NeighborIndex {
     return &neighbors[startIndex[element.ident]];
   }
 
-  const int* getStartIndex() const { return startIndex; }
+  const int* getStartIndex() const { return startIndex.data(); }
   
   const int* getNeighborIndex() const { return neighbors.data(); }
   
@@ -78,13 +147,245 @@ class NeighborIndex {
   /// start index into neighbors array for vertex.
   /// the last index is total size of neighbors array, which is also the number
   /// of non-zeros in a vertex x vertex matrix.
-  int* startIndex;
+  std::vector<int> startIndex;
 
   /// which edges v belongs to
   std::vector<int> neighbors;
 
-  void addNoCollision(int x, std::vector<int> & a);
+  /// the number of edges that make each pair of elements neighbors, if the
+  /// index counts edges, otherwise empty
+  std::vector<int> edgeCounts;
+};
+
+
+/// For each edge of an edge set, and each pair of its endpoints (i,j), stores
+/// the location of endpoint j among the neighbors of endpoint i in the edge
+/// set's NeighborIndex. These are the locations of the edge's blocks in
+/// matrices indexed by the neighbor index, so precomputing them saves assembly
+/// from searching the neighbor lists for every edge.
+class EdgeLocationIndex {
+ public:
+  EdgeLocationIndex(const Set &edgeSet, const NeighborIndex &neighbors);
+
+  /// Update the locations in place after the neighbor index was updated. The
+  /// locations in the `resized` rows (see NeighborIndex::update) and those of
+  /// the `changedEdges`, which hold other endpoints than before, are looked up
+  /// again, and the others are moved with their rows.
+  void update(const Set &edgeSet, const NeighborIndex &neighbors,
+              const std::vector<RowResize> &resized,
+              const std::vector<int> &changedEdges);
+
+  /// Get the locations, laid out as an edges x cardinality x cardinality array.
+  const int* getLocations() const { return locations.data(); }
+
+ private:
+  std::vector<int> locations;
+
+  /// Look up the locations of the endpoints of edge e in the row of its
+  /// endpoint i.
+  void locate(const Set &edgeSet, const NeighborIndex &neighbors, int e, int i);
+};
+
+
+/// Partitions the edges of an edge set into colors, such that no two edges of
+/// the same color share an endpoint. The edges of a color can therefore be
+/// assembled concurrently without conflicting writes. The edges are stored
+/// sorted by color, and in increasing order within each color, so iterating
+/// over the colors in order visits the edges in a deterministic order.
+class EdgeColoring {
+ public:
+  EdgeColoring(const Set &edgeSet);
+
+  /// Color the edges [first,first+count) that were added to the edge set. They
+  /// get the first color that none of their endpoints' edges has.
+  void addEdges(const Set &edgeSet, int first, int count);
+
+  /// Uncolor an edge that is about to be removed from the edge set, and give
+  /// its slot the color of the last edge, which takes its place.
+  void removeEdge(const Set &edgeSet, int ident);
+
+  /// Sort the edges by color after edges were added or removed. The sorted
+  /// edges are stored in the same buffers.
+  void sortEdges();
+
+  int getNumColors() const { return colorStart.size()-1; }
+
+  /// Get the offset of the first edge of each color in the color edges array.
+  /// The last entry is the number of edges.
+  const int* getColorStart() const { return colorStart.data(); }
+
+  /// Get the edges, sorted by color.
+  const int* getColorEdges() const { return colorEdges.data(); }
+
+ private:
+  std::vector<int> colorStart;
+  std::vector<int> colorEdges;
+
+  /// The color of each edge
+  std::vector<int> edgeColors;
+
+  /// The colors of the edges of each element of each distinct endpoint set,
+  /// and the distinct endpoint set of each endpoint
+  std::vector<std::vector<std::vector<int>>> vertexColors;
+  std::vector<int> endpointSets;
+
+  /// takenBy[c] == stamp iff color c is taken at the endpoints of the edge
+  /// being colored with that stamp
+  std::vector<int> takenBy;
+  int stamp;
+
+  bool sorted;
+
+  std::vector<int>& getVertexColors(const Set &edgeSet, int e, int i);
+  void colorEdge(const Set &edgeSet, int e);
 };
 
+
+/// Resize rows of compressed rows in place. `start` holds the offsets of the
+/// `numRows` rows and the number of entries, and `resized` the rows that change
+/// size, sorted. The rows between them are moved by `move(from,to,count)`,
+/// which must copy `count` entries from offset `from` to offset `to` of the
+/// rows' buffers (as memmove), in an order that never overwrites entries that
+/// are yet to be moved. `start` is then updated to the new offsets, and the
+/// resized rows are left for the caller to fill in. Buffers that grow must be
+/// grown before the call, and buffers that shrink may be shrunk after it.
+template <typename T, typename Move>
+void resizeRows(T *start, int numRows, const std::vector<RowResize> &resized,
+                Move move) {
+  // The rows after each resized row, up to the next, are moved by the size
+  // changes of the resized rows up to it
+  int numResized = resized.size();
+  std::vector<long long> shifts(numResized);
+  long long shift = 0;
+  for (int k=0; k < numResized; ++k) {
+    iassert(k == 0 || resized[k-1].row < resized[k].row);
+    shift += resized[k].newSize - resized[k].oldSize;
+    shifts[k] = shift;
+  }
+  auto moveRows = [&](int k) {
+    int rowBegin = resized[k].row + 1;
+    int rowEnd = (k+1 < numResized) ? resized[k+1].row : numRows;
+    if (rowBegin < rowEnd && shifts[k] != 0) {
+      long long from = start[rowBegin];
+      move(from, from + shifts[k], (long long)start[rowEnd] - from);
+    }
+  };
+
+  // Rows that move towards the front are moved front to back, and rows that
+  // move towards the back are moved back to front
+  for (int k=0; k < numResized; ++k) {
+    if (shifts[k] < 0) {
+      moveRows(k);
+    }
+  }
+  for (int k=numResized-1; k >= 0; --k) {
+    if (shifts[k] > 0) {
+      moveRows(k);
+    }
+  }
+
+  for (int k=0; k < numResized; ++k) {
+    int row = resized[k].row;
+    int rowEnd = (k+1 < numResized) ? resized[k+1].row : numRows;
+    start[row+1] = start[row] + resized[k].newSize;
+    for (int v=row+1; v < rowEnd; ++v) {
+      start[v+1] += shifts[k];
+    }
+  }
+}
+
+
+/// The maximum number of chunks that index construction partitions its rows or
+/// edges into. The chunks are fixed by the input rather than by the number of
+/// threads, so the work of each chunk, and the result, do not depend on the
+/// thread count.
+const int kMaxIndexChunks = 64;
+
+/// Return the first element of chunk `chunk` when [begin,end) is partitioned
+/// into `numChunks` chunks.
+inline int getIndexChunkBegin(int begin, int end, int chunk, int numChunks) {
+  return begin + (int)(((long long)(end-begin) * chunk) / numChunks);
+}
+
+/// Calls body(chunkBegin, chunkEnd) on the chunks of [begin,end) across the
+/// thread pool if the "cpu-parallel" backend is selected, and body(begin, end)
+/// on the calling thread otherwise, so that building indices for the serial
+/// backends does not start the pool.
+void parallelForIndex(int begin, int end,
+                      const std::function<void(int,int)>& body);
+
+/// Computes the edges that contain each vertex of an endpoint set, as
+/// compressed rows: the edges of vertex v are edges[start[v]:start[v+1]], in
+/// increasing order. Only the endpoints at the given `slots` of each edge are
+/// considered, and an edge that contains a vertex several times is listed once.
+/// The edges are counted with one histogram per chunk of edges and scattered in
+/// parallel. The number of chunks is bounded so that the histograms take at
+/// most a few times the memory of the result.
+void buildVertexToEdges(const Set &edgeSet, const std::vector<int> &slots,
+                        int numVertices, std::vector<int> *start,
+                        std::vector<int> *edges);
+
+/// Builds compressed rows in parallel, where `buildRow(row, entries)` appends
+/// the entries of `row` to `entries`, and each thread builds its rows with a
+/// row builder returned by `makeRowBuilder`, which may keep scratch state
+/// across the rows it builds. The rows are split into at most kMaxIndexChunks
+/// contiguous chunks that are built in parallel (see parallelForIndex) and
+/// concatenated in order. `start` gets the offset of each row's entries and
+/// the total number of entries.
+template <typename T>
+void buildRowsInParallelWith(
+    int numRows,
+    const std::function<std::function<void(int,std::vector<T>*)>()>&
+        makeRowBuilder,
+    std::vector<T> *start, std::vector<T> *entries) {
+  int numChunks = std::max(1, std::min(kMaxIndexChunks, numRows));
+  start->resize(numRows+1);
+  (*start)[0] = 0;
+
+  std::vector<std::vector<T>> chunkEntries(numChunks);
+  parallelForIndex(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+    std::function<void(int,std::vector<T>*)> buildRow = makeRowBuilder();
+    for (int chunk=chunkBegin; chunk < chunkEnd; ++chunk) {
+      int rowBegin = getIndexChunkBegin(0, numRows, chunk, numChunks);
+      int rowEnd = getIndexChunkBegin(0, numRows, chunk+1, numChunks);
+      for (int row=rowBegin; row < rowEnd; ++row) {
+        buildRow(row, &chunkEntries[chunk]);
+        (*start)[row+1] = chunkEntries[chunk].size();
+      }
+    }
+  });
+
+  // Offset the rows of each chunk by the entries of the chunks before it
+  std::vector<size_t> chunkOffsets(numChunks+1, 0);
+  for (int chunk=0; chunk < numChunks; ++chunk) {
+    chunkOffsets[chunk+1] = chunkOffsets[chunk] + chunkEntries[chunk].size();
+  }
+  entries->resize(chunkOffsets[numChunks]);
+  parallelForIndex(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+    for (int chunk=chunkBegin; chunk < chunkEnd; ++chunk) {
+      int rowBegin = getIndexChunkBegin(0, numRows, chunk, numChunks);
+      int rowEnd = getIndexChunkBegin(0, numRows, chunk+1, numChunks);
+      for (int row=rowBegin; row < rowEnd; ++row) {
+        (*start)[row+1] += chunkOffsets[chunk];
+      }
+      std::copy(chunkEntries[chunk].begin(), chunkEntries[chunk].end(),
+                entries->begin() + chunkOffsets[chunk]);
+      std::vector<T>().swap(chunkEntries[chunk]);
+    }
+  });
+}
+
+/// Builds compressed rows in parallel with a row builder that all threads share
+/// (see buildRowsInParallelWith).
+template <typename T>
+void buildRowsInParallel(int numRows,
+                         const std::function<void(int,std::vector<T>*)>& buildRow,
+                         std::vector<T> *start, std::vector<T> *entries) {
+  buildRowsInParallelWith<T>(numRows,
+      std::function<std::function<void(int,std::vector<T>*)>()>(
+          [&]() {return buildRow;}),
+      start, entries);
+}
+
 }} // simit::internal
 #endif
@@ -17,7 +17,7 @@ namespace ir {
     int kind;
 
     ~IndexVarContent();
-    mutable long ref = 0;
+    mutable std::atomic<long> ref{0};
     friend inline void aquire(IndexVarContent *c) {++c->ref;}
     friend inline void release(IndexVarContent *c) {if (--c->ref==0) delete c;}
   };
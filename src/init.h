@@ -13,6 +13,46 @@ namespace simit {
 extern const std::vector<std::string> VALID_BACKENDS;
 extern std::string kBackend;
 
+/// Set the number of threads the "cpu-parallel" backend partitions loops
+/// across. Zero (the default) selects the number of hardware threads.
+void setNumThreads(int numThreads);
+
+/// Pin the threads of the "cpu-parallel" backend to CPUs, so that each thread
+/// processes the same elements, and their first-touched memory, on the same
+/// CPU across calls. Processes that share CPUs should leave it disabled, which
+/// is the default.
+void setThreadPinning(bool enabled);
+
+/// Cache compiled object code in the given directory, so that functions that
+/// were compiled by an earlier process are loaded instead of recompiled. An
+/// empty directory (the default) disables the cache.
+void setCompileCacheDirectory(const std::string& directory);
+
+/// Fuse loops over the same set, such as the vector updates and reductions of
+/// an iteration of a solver, so that they traverse memory once. Enabled by
+/// default.
+void setLoopFusion(bool enabled);
+
+/// Replace matrices that are assembled by maps and only multiplied with
+/// vectors by maps that apply each element's blocks to the vector directly, so
+/// the matrices are never stored. Disabled by default.
+void setMatrixFreeOperators(bool enabled);
+
+/// Store matrices that are assembled by maps and provably symmetric, and only
+/// multiplied with vectors or solved, as their upper triangles, which halves
+/// their memory and the memory traffic of their products. Disabled by default.
+void setSymmetricMatrices(bool enabled);
+
+/// Process the elements of serial loops over sets, such as maps, in batches of
+/// the given number of vector lanes, with the variables the loops declare
+/// stored as structures of arrays. One (the default) disables batching.
+void setMapBatchWidth(int width);
+
+/// Compile functions with light optimization, so that they can be run sooner,
+/// and recompile them with full optimization on a background thread. Calls to
+/// run switch to the optimized code once it is ready. Disabled by default.
+void setTieredCompilation(bool enabled);
+
 inline void init(std::string backend="cpu", int floatSize=8) {
   uassert(std::find(VALID_BACKENDS.begin(), VALID_BACKENDS.end(), backend) !=
           VALID_BACKENDS.end()) << "Invalid backend: " << backend;
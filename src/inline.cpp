@@ -15,8 +15,7 @@ namespace ir {
 Stmt inlineMapFunction(const Map *map, Var lv, MapFunctionRewriter &rewriter);
 
 Stmt MapFunctionRewriter::inlineMapFunc(const Map *map, Var targetLoopVar,
-                                        Var endpoints, Var locs) {
-  this->endpoints = endpoints;
+                                        Var locs) {
   this->locs = locs;
   this->reduction = map->reduction;
   this->targetLoopVar = targetLoopVar;
@@ -148,45 +147,29 @@ Stmt inlineMapFunction(const Map *map, Var lv, MapFunctionRewriter &rewriter) {
   const SetType* setType = map->target.type().toSet();
   int cardinality = setType->endpointSets.size();
   if (returnsMatrix && cardinality > 0) {
-    // Computes the return matrix locations of the endpoints of the edge being
-    // assembled.  These are stored in an array and used when storing values to
-    // the return matrix.
+    // Loads the return matrix locations of the endpoints of the edge being
+    // assembled from the target set's edge location index.  These are stored
+    // in an array and used when storing values to the return matrix.
     Var i("i", Int);
     Var j("j", Int);
 
-    Var eps(INTERNAL_PREFIX("eps"), TensorType::make(ScalarType::Int,
-                                                     {IndexDomain(cardinality)}));
-    Expr endpoints = IndexRead::make(target, IndexRead::Endpoints);
-    Expr epLoc = Add::make(Mul::make(lv, cardinality), i);
-    Expr ep = Load::make(endpoints, epLoc);
-    Stmt epsInit = TensorWrite::make(eps, {i}, ep);
-    Stmt epsInitLoop = ForRange::make(i, 0, cardinality, epsInit);
-
     Var locs(INTERNAL_PREFIX("locs"), TensorType::make(ScalarType::Int,
                                                        {IndexDomain(cardinality),
                                                         IndexDomain(cardinality)}));
 
-    Expr nbrs_start = IndexRead::make(target, IndexRead::NeighborsStart);
-    Expr nbrs = IndexRead::make(target, IndexRead::Neighbors);
-
-    Var locVar(INTERNAL_PREFIX("locVar"), Int);
-    Stmt locStmt = CallStmt::make({locVar}, intrinsics::loc(),
-                                  {Load::make(eps,i),
-                                   Load::make(eps,j),
-                                   nbrs_start, nbrs});
-
-    Stmt locsInit = Block::make({locStmt,
-                                TensorWrite::make(locs, {i,j}, locVar)});
+    Expr locations = IndexRead::make(target, IndexRead::Locations);
+    Expr edgeLoc = Add::make(Mul::make(Add::make(Mul::make(lv, cardinality), i),
+                                       cardinality), j);
+    Stmt locsInit = TensorWrite::make(locs, {i,j},
+                                      Load::make(locations, edgeLoc));
 
     Stmt locsInitLoop = ForRange::make(j, 0, cardinality, locsInit);
     locsInitLoop      = ForRange::make(i, 0, cardinality, locsInitLoop);
 
-    Stmt computeLocs = Block::make({VarDecl::make(eps),
-                                    epsInitLoop,
-                                    VarDecl::make(locs),
+    Stmt computeLocs = Block::make({VarDecl::make(locs),
                                     locsInitLoop});
 
-    return Block::make(computeLocs, rewriter.inlineMapFunc(map, lv, eps, locs));
+    return Block::make(computeLocs, rewriter.inlineMapFunc(map, lv, locs));
   }
   else {
     return rewriter.inlineMapFunc(map, lv);
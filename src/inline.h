@@ -14,8 +14,7 @@ class MapFunctionRewriter : protected IRRewriter {
 public:
   virtual ~MapFunctionRewriter() {}
 
-  Stmt inlineMapFunc(const Map *map, Var targetLoopVar,
-                     Var endpoints=Var(), Var locs=Var());
+  Stmt inlineMapFunc(const Map *map, Var targetLoopVar, Var locs=Var());
 
 protected:
   std::map<Var,Var> resultToMapVar;
@@ -30,7 +29,6 @@ protected:
 
   ReductionOperator reduction;
 
-  Var endpoints;
   Var locs;
 
   /// Check if the given variable is a result variable
@@ -1,6 +1,7 @@
 #include "intrinsics.h"
 
 #include <cassert>
+#include <mutex>
 #include "var.h"
 #include "func.h"
 
@@ -252,283 +253,267 @@ void solveInit() {
                   Func::Intrinsic);
 }
 
-// We lazily initialize all the intrinsics. No need to call all the constructors
-// unless we will use them.
+/// Multiplies small dense matrices with statically known dimensions, with the
+/// arguments (A, B, m, k, n, transposeA, transposeB).
+static Func gemmVar;
+void gemmInit() {
+  gemmVar = Func("__gemm",
+                 {Var("A", Type()), Var("B", Type()), Var("m", Int),
+                  Var("k", Int), Var("n", Int), Var("transposeA", Int),
+                  Var("transposeB", Int)},
+                 {Var("C", Type())},
+                 Func::Intrinsic);
+}
+
+/// Multiplies a symmetric matrix that stores its upper triangle with a vector,
+/// with the arguments (A, x) and the result y = A*x.
+static Func symmetricMatVecVar;
+void symmetricMatVecInit() {
+  symmetricMatVecVar = Func("__symmetricMatVec",
+                            {Var("A", Type()), Var("x", Type())},
+                            {Var("y", Type())},
+                            Func::Intrinsic);
+}
+
+// The intrinsics are lazily initialized together, once, so that concurrent
+// compilations can look them up.
+static std::map<std::string,Func> byNameMap;
+static void init();
 
 const Func& mod() {
-  if (!modVar.defined()) {
-    modInit();
-  }
+  init();
   return modVar;
 }
 
 const Func& sin() {
-  if (!sinVar.defined()) {
-    sinInit();
-  }
+  init();
   return sinVar;
 }
 
 const Func& cos() {
-  if (!cosVar.defined()) {
-    cosInit();
-  }
+  init();
   return cosVar;
 }
 
 const Func& tan() {
-  if (!tanVar.defined()) {
-    tanInit();
-  }
+  init();
   return tanVar;
 }
 
 const Func& asin() {
-  if (!asinVar.defined()) {
-    asinInit();
-  }
+  init();
   return asinVar;
 }
 
 const Func& acos() {
-  if (!acosVar.defined()) {
-    acosInit();
-  }
+  init();
   return acosVar;
 }
 
 const Func& atan2() {
-  if (!atan2Var.defined()) {
-    atan2Init();
-  }
+  init();
   return atan2Var;
 }
 const Func& sqrt() {
-  if (!sqrtVar.defined()) {
-    sqrtInit();
-  }
+  init();
   return sqrtVar;
 }
 
 const Func& log() {
-  if (!logVar.defined()) {
-    logInit();
-  }
+  init();
   return logVar;
 }
 
 const Func& exp() {
-  if (!expVar.defined()) {
-    expInit();
-  }
+  init();
   return expVar;
 }
 
 
 const Func& pow() {
-  if (!powVar.defined()) {
-    powInit();
-  }
+  init();
   return powVar;
 }
 
 const Func& norm() {
-  if (!normVar.defined()) {
-    normInit();
-  }
+  init();
   return normVar;
 }
 
 const Func& dot() {
-  if (!dotVar.defined()) {
-    dotInit();
-  }
+  init();
   return dotVar;
 }
 
 const Func& det() {
-  if (!detVar.defined()) {
-    detInit();
-  }
+  init();
   return detVar;
 }
 
 const Func& inv() {
-  if (!invVar.defined()) {
-    invInit();
-  }
+  init();
   return invVar;
 }
 
 const Func& solve() {
-  if (!solveVar.defined()) {
-    solveInit();
-  }
+  init();
   return solveVar;
 }
 
+const Func& gemm() {
+  init();
+  return gemmVar;
+}
+
+const Func& symmetricMatVec() {
+  init();
+  return symmetricMatVecVar;
+}
+
 const Func& loc() {
-  if (!locVar.defined()) {
-    locInit();
-  }
+  init();
   return locVar;
 }
 
 const Func& free() {
-  if (!freeVar.defined()) {
-    freeInit();
-  }
+  init();
   return freeVar;
 }
 
 const Func& malloc() {
-  if (!mallocVar.defined()) {
-    mallocInit();
-  }
+  init();
   return mallocVar;
 }
 
 const Func& strcmp() {
-  if (!strcmpVar.defined()) {
-    strcmpInit();
-  }
+  init();
   return strcmpVar;
 }
 
 const Func& strlen() {
-  if (!strlenVar.defined()) {
-    strlenInit();
-  }
+  init();
   return strlenVar;
 }
 
 const Func& strcpy() {
-  if (!strcpyVar.defined()) {
-    strcpyInit();
-  }
+  init();
   return strcpyVar;
 }
 
 const Func& strcat() {
-  if (!strcatVar.defined()) {
-    strcatInit();
-  }
+  init();
   return strcatVar;
 }
 
 const Func& createComplex() {
-  if (!createComplexVar.defined()) {
-    createComplexInit();
-  }
+  init();
   return createComplexVar;
 }
 
 const Func& complexNorm() {
-  if (!complexNormVar.defined()) {
-    complexNormInit();
-  }
+  init();
   return complexNormVar;
 }
 
 const Func& complexGetReal() {
-  if (!complexGetRealVar.defined()) {
-    complexGetRealInit();
-  }
+  init();
   return complexGetRealVar;
 }
 
 const Func& complexGetImag() {
-  if (!complexGetImagVar.defined()) {
-    complexGetImagInit();
-  }
+  init();
   return complexGetImagVar;
 }
 
 const Func& complexConj() {
-  if (!complexConjVar.defined()) {
-    complexConjInit();
-  }
+  init();
   return complexConjVar;
 }
 
 const Func& clock() {
-  if (!clockVar.defined()) {
-    clockInit();
-  }
+  init();
   return clockVar;
 }
 
 const Func& storeTime() {
-  if (!storeTimeVar.defined()) {
-    storeTimeInit();
-  }
+  init();
   return storeTimeVar;
 }
 
+static void initIntrinsics() {
+  modInit();
+  sinInit();
+  cosInit();
+  tanInit();
+  asinInit();
+  acosInit();
+  atan2Init();
+  sqrtInit();
+  logInit();
+  expInit();
+  powInit();
+  normInit();
+  dotInit();
+  detInit();
+  invInit();
+  solveInit();
+  gemmInit();
+  symmetricMatVecInit();
+  locInit();
+  freeInit();
+  mallocInit();
+  strcmpInit();
+  strlenInit();
+  strcpyInit();
+  strcatInit();
+  createComplexInit();
+  complexNormInit();
+  complexGetRealInit();
+  complexGetImagInit();
+  complexConjInit();
+  clockInit();
+  storeTimeInit();
+  byNameMap.insert({{"mod",modVar},
+                    {"sin",sinVar},
+                    {"cos",cosVar},
+                    {"tan",tanVar},
+                    {"asin",asinVar},
+                    {"acos",acosVar},
+                    {"atan2",atan2Var},
+                    {"sqrt",sqrtVar},
+                    {"log",logVar},
+                    {"exp",expVar},
+                    {"pow",powVar},
+                    {"norm",normVar},
+                    {"dot",dotVar},
+                    {"det",detVar},
+                    {"inv",invVar},
+                    {"free", freeVar},
+                    {"malloc", mallocVar},
+                    {"strcmp", strcmpVar},
+                    {"strlen", strlenVar},
+                    {"strcpy", strcpyVar},
+                    {"strcat", strcatVar},
+                    {"createComplex",createComplexVar},
+                    {"complexNorm",complexNormVar},
+                    {"complexGetReal",complexGetRealVar},
+                    {"complexGetImag",complexGetImagVar},
+                    {"complexConj",complexConjVar},
+                    {"clock",clockVar},
+                    {"storeTime",storeTimeVar},
+                    {"__loc", locVar},
+                    {"__solve",solveVar},
+                    {"__gemm",gemmVar},
+                    {"__symmetricMatVec",symmetricMatVecVar}});
+}
+
+static void init() {
+  static std::once_flag initialized;
+  std::call_once(initialized, initIntrinsics);
+}
+
 const std::map<std::string,Func> &byNames() {
-  static std::map<std::string,Func> byNameMap;
-  if (byNameMap.size() == 0) {
-    modInit();
-    sinInit();
-    cosInit();
-    tanInit();
-    asinInit();
-    acosInit();
-    atan2Init();
-    sqrtInit();
-    logInit();
-    expInit();
-    powInit();
-    normInit();
-    dotInit();
-    detInit();
-    invInit();
-    solveInit();
-    locInit();
-    freeInit();
-    mallocInit();
-    strcmpInit();
-    strlenInit();
-    strcpyInit();
-    strcatInit();
-    createComplexInit();
-    complexNormInit();
-    complexGetRealInit();
-    complexGetImagInit();
-    complexConjInit();
-    clockInit();
-    storeTimeInit();
-    byNameMap.insert({{"mod",modVar},
-                      {"sin",sinVar},
-                      {"cos",cosVar},
-                      {"tan",tanVar},
-                      {"asin",asinVar},
-                      {"acos",acosVar},
-                      {"atan2",atan2Var},
-                      {"sqrt",sqrtVar},
-                      {"log",logVar},
-                      {"exp",expVar},
-                      {"pow",powVar},
-                      {"norm",normVar},
-                      {"dot",dotVar},
-                      {"det",detVar},
-                      {"inv",invVar},
-                      {"free", freeVar},
-                      {"malloc", mallocVar},
-                      {"strcmp", strcmpVar},
-                      {"strlen", strlenVar},
-                      {"strcpy", strcpyVar},
-                      {"strcat", strcatVar},
-                      {"createComplex",createComplexVar},
-                      {"complexNorm",complexNormVar},
-                      {"complexGetReal",complexGetRealVar},
-                      {"complexGetImag",complexGetImagVar},
-                      {"complexConj",complexConjVar},
-                      {"clock",clockVar},
-                      {"storeTime",storeTimeVar},
-                      {"__loc", locVar},
-                      {"__solve",solveVar}});
-  }
+  init();
   return byNameMap;
 }
 
@@ -43,6 +43,8 @@ const Func& clock();
 const Func& storeTime();
 const Func& loc();
 const Func& solve();
+const Func& gemm();
+const Func& symmetricMatVec();
 
 const Func& byName(const std::string& name);
 const std::map<std::string,Func> &byNames();
@@ -741,11 +741,12 @@ Stmt ForRange::make(Var var, Expr start, Expr end, Stmt body) {
 }
 
 // struct For
-Stmt For::make(Var var, ForDomain domain, Stmt body) {
+Stmt For::make(Var var, ForDomain domain, Stmt body, Kind kind) {
   For *node = new For;
   node->var = var;
   node->domain = domain;
   node->body = Scope::make(body);
+  node->kind = kind;
   return Scope::make(node);  // Put loop variable in a scope
 }
 
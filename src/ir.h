@@ -24,7 +24,7 @@ public:
   virtual void accept(IRVisitorStrict *visitor) const = 0;
 
 private:
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend void aquire(const IRNode *node) {++node->ref;}
   friend void release(const IRNode *node) {if (--node->ref == 0) delete node;}
 };
@@ -202,7 +202,8 @@ struct Length : public ExprNode {
 /// is the endpoints of the edges in the set.
 /// TODO DEPRECATED: This node has been deprecated with the old lowering pass
 struct IndexRead : public ExprNode {
-  enum Kind { Endpoints=0, NeighborsStart=1, Neighbors=2 };
+  enum Kind { Endpoints=0, NeighborsStart=1, Neighbors=2, ColorsStart=3,
+              ColorEdges=4, Locations=5 };
   Expr edgeSet;
   Kind kind;
   static Expr make(Expr edgeSet, Kind kind);
@@ -387,10 +388,23 @@ std::ostream &operator<<(std::ostream &os, const ForDomain &);
 
 // TODO DEPRECATED: Remove when new index system is in place.
 struct For : public StmtNode {
+  /// Serial loops execute their iterations in order. The iterations of
+  /// parallel loops are partitioned across threads, so a parallel loop body
+  /// must only write to loop-private variables, to locations owned by the loop
+  /// variable, or through compound (reduction) operators. Colored loops
+  /// iterate over an edge set one edge color at a time (see
+  /// Set::getEdgeColoring), and execute the edges of each color in parallel.
+  /// Since edges of the same color share no endpoints, writes to locations
+  /// owned by the endpoints need no synchronization. Scalar reductions in
+  /// colored loops are combined in a fixed order, so colored loops give the
+  /// same result for any number of threads.
+  enum Kind { Serial, Parallel, Colored };
+
   Var var;
   ForDomain domain;
   Stmt body;
-  static Stmt make(Var var, ForDomain domain, Stmt body);
+  Kind kind;
+  static Stmt make(Var var, ForDomain domain, Stmt body, Kind kind=Serial);
   void accept(IRVisitorStrict *v) const {v->visit((const For*)this);}
 };
 
@@ -198,6 +198,15 @@ void IRPrinter::visit(const IndexRead *op) {
     case IndexRead::Neighbors:
       os << "neighbors";
       break;
+    case IndexRead::ColorsStart:
+      os << "colors.start";
+      break;
+    case IndexRead::ColorEdges:
+      os << "colors";
+      break;
+    case IndexRead::Locations:
+      os << "locations";
+      break;
   }
 }
 
@@ -405,6 +414,16 @@ void IRPrinter::visit(const ForRange *op) {
 
 void IRPrinter::visit(const For *op) {
   indent();
+  switch (op->kind) {
+    case For::Serial:
+      break;
+    case For::Parallel:
+      os << "parallel ";
+      break;
+    case For::Colored:
+      os << "colored parallel ";
+      break;
+  }
   os << "for " << op->var << " in " << op->domain << endl;
   ++indentation;
   print(op->body);
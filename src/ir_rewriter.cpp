@@ -296,7 +296,7 @@ void IRRewriter::visit(const For *op) {
     stmt = op;
   }
   else {
-    stmt = For::make(op->var, op->domain, body);
+    stmt = For::make(op->var, op->domain, body, op->kind);
   }
 }
 
@@ -83,6 +83,16 @@ std::pair<Stmt,std::vector<Stmt>> removeVarDecls(Stmt stmt) {
       varDecls.push_back(op);
       stmt = Stmt();
     }
+
+    /// Variables declared in a parallel loop are private to each iteration,
+    /// so their declarations must stay inside the loop.
+    void visit(const For *op) {
+      if (op->kind == For::Parallel) {
+        stmt = op;
+        return;
+      }
+      IRRewriter::visit(op);
+    }
   };
   RemoveVarDeclsRewriter rewriter;
 
@@ -0,0 +1,549 @@
+#include "batch_loops.h"
+
+#include <set>
+#include <map>
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "macros.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+
+static int mapBatchWidth = 1;
+
+void setMapBatchWidth(int width) {
+  uassert(width > 0) << "the map batch width must be positive";
+  mapBatchWidth = width;
+}
+
+namespace ir {
+
+int getMapBatchWidth() {
+  return mapBatchWidth;
+}
+
+/// A location outside a loop body: a variable, or a field of a set variable.
+typedef pair<Var,string> Location;
+
+/// Returns true iff the buffer is a variable or a field of a set variable, in
+/// which case its location is returned.
+static bool getLocation(const Expr& buffer, Location* location) {
+  if (isa<VarExpr>(buffer)) {
+    *location = Location(to<VarExpr>(buffer)->var, "");
+    return true;
+  }
+  if (isa<FieldRead>(buffer) &&
+      isa<VarExpr>(to<FieldRead>(buffer)->elementOrSet)) {
+    const FieldRead* fieldRead = to<FieldRead>(buffer);
+    *location = Location(to<VarExpr>(fieldRead->elementOrSet)->var,
+                         fieldRead->fieldName);
+    return true;
+  }
+  return false;
+}
+
+/// True iff the loop iterates over a range, such as the loops over the
+/// dimensions of dense tensors.
+static bool isRangeLoop(const For *loop) {
+  return loop->domain.kind == ForDomain::IndexSet &&
+         loop->domain.indexSet.getKind() == IndexSet::Range;
+}
+
+/// Checks whether a loop's iterations can execute in batches, where each
+/// statement executes for all iterations in a batch before the next.
+class BatchSafety : public IRVisitor {
+public:
+  bool isBatchable(const For *loop) {
+    if (loop->kind != For::Serial ||
+        loop->domain.kind != ForDomain::IndexSet ||
+        loop->domain.indexSet.getKind() != IndexSet::Set) {
+      return false;
+    }
+    loopVar = loop->var;
+    safe = true;
+    locals.clear();
+    localSet.clear();
+    reads.clear();
+    compoundWrites.clear();
+    storeCounts.clear();
+
+    loop->body.accept(this);
+
+    // Batching reorders the statements of different iterations, so the body
+    // may not read what it writes to non-local locations, and each location
+    // may only be overwritten by one statement, which keeps the last write.
+    for (auto& location : compoundWrites) {
+      if (util::contains(reads, location) ||
+          util::contains(storeCounts, location)) {
+        safe = false;
+      }
+    }
+    for (auto& location : storeCounts) {
+      if (util::contains(reads, location.first) || location.second > 1) {
+        safe = false;
+      }
+    }
+    return safe;
+  }
+
+  /// The variables the loop body declares, in order of declaration.
+  const vector<Var>& getLocals() const {return locals;}
+
+private:
+  Var loopVar;
+  bool safe;
+  vector<Var> locals;
+  set<Var> localSet;
+  set<Location> reads;
+  set<Location> compoundWrites;
+  map<Location,int> storeCounts;
+
+  bool isLocal(const Var& var) const {
+    return util::contains(localSet, var);
+  }
+
+  bool isLocalTensor(const Expr& expr) const {
+    return isa<VarExpr>(expr) && isLocal(to<VarExpr>(expr)->var) &&
+           !isScalar(expr.type());
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const VarDecl *op) {
+    const Type& type = op->var.getType();
+    // Lane arrays have one copy of the variable per lane, which requires a
+    // static size
+    if (!type.isTensor() || isString(type) ||
+        (!isScalar(type) && type.toTensor()->hasSystemDimensions())) {
+      safe = false;
+    }
+    locals.push_back(op->var);
+    localSet.insert(op->var);
+  }
+
+  void visit(const VarExpr *op) {
+    // Local tensors are only accessed through loads, stores, assignments and
+    // call arguments, which are rewritten to access the lane arrays.
+    if (isLocalTensor(op)) {
+      safe = false;
+    }
+    else if (!isLocal(op->var)) {
+      reads.insert(Location(op->var, ""));
+    }
+  }
+
+  void visit(const FieldRead *op) {
+    Location location;
+    if (getLocation(op, &location)) {
+      reads.insert(location);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Load *op) {
+    if (!isLocalTensor(op->buffer)) {
+      op->buffer.accept(this);
+    }
+    op->index.accept(this);
+  }
+
+  void visit(const AssignStmt *op) {
+    if (isLocal(op->var)) {
+      if (!isScalar(op->var.getType())) {
+        // Whole local tensors are only assigned literals and local tensors
+        if (op->cop != CompoundOperator::None ||
+            !(isa<Literal>(op->value) || isLocalTensor(op->value))) {
+          safe = false;
+        }
+        return;
+      }
+    }
+    else if (op->var != loopVar && op->cop == CompoundOperator::Add &&
+             isScalar(op->var.getType())) {
+      compoundWrites.insert(Location(op->var, ""));
+    }
+    else {
+      safe = false;
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const Store *op) {
+    if (!isLocalTensor(op->buffer)) {
+      Location location;
+      if (!getLocation(op->buffer, &location) || isLocal(location.first)) {
+        safe = false;
+      }
+      else if (op->cop == CompoundOperator::Add) {
+        compoundWrites.insert(location);
+      }
+      else {
+        storeCounts[location]++;
+      }
+    }
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const CallStmt *op) {
+    // Calls without results are called for their side effects
+    if (op->results.size() == 0) {
+      safe = false;
+    }
+    for (const Var& result : op->results) {
+      if (!isLocal(result)) {
+        safe = false;
+      }
+    }
+    for (const Expr& actual : op->actuals) {
+      if (actual.type().isElement() || actual.type().isSet()) {
+        safe = false;
+      }
+      if (!isLocalTensor(actual)) {
+        actual.accept(this);
+      }
+    }
+  }
+
+  void visit(const For *op) {
+    if (isRangeLoop(op)) {
+      IRVisitor::visit(op);
+    }
+    else {
+      safe = false;
+    }
+  }
+
+  void visit(const FieldWrite *op) {safe = false;}
+  void visit(const While *op) {safe = false;}
+  void visit(const Kernel *op) {safe = false;}
+  void visit(const Print *op) {safe = false;}
+  void visit(const TensorRead *op) {safe = false;}
+  void visit(const TensorWrite *op) {safe = false;}
+  void visit(const Map *op) {safe = false;}
+};
+
+/// Returns true iff the expression has the same value in every lane, because
+/// it references neither the loop variable nor variables declared in the loop.
+static bool isUniform(const Expr& expr, const Var& loopVar,
+                      const map<Var,Var>& laneVars) {
+  class UniformVisitor : public IRVisitor {
+  public:
+    UniformVisitor(const Var& loopVar, const map<Var,Var>& laneVars)
+        : loopVar(loopVar), laneVars(laneVars) {}
+    const Var& loopVar;
+    const map<Var,Var>& laneVars;
+    bool uniform = true;
+
+    using IRVisitor::visit;
+    void visit(const VarExpr *op) {
+      if (op->var == loopVar || util::contains(laneVars, op->var)) {
+        uniform = false;
+      }
+    }
+  };
+  UniformVisitor visitor(loopVar, laneVars);
+  expr.accept(&visitor);
+  return visitor.uniform;
+}
+
+/// Rewrites a statement of a batched loop body to execute for one lane, by
+/// replacing the loop variable with the lane's element and local variables
+/// with their lane arrays.
+class LaneRewriter : public IRRewriter {
+public:
+  LaneRewriter(const Var& loopVar, const Var& batchVar, const Var& lane,
+               int width, const map<Var,Var>& laneVars)
+      : loopVar(loopVar), lane(lane), width(width), laneVars(laneVars) {
+    element = Add::make(Mul::make(batchVar, Literal::make(width)), lane);
+  }
+
+  /// The local variables that calls use as per-lane buffers.
+  const vector<Var>& getLaneBuffers() const {return laneBuffers;}
+
+private:
+  Var loopVar;
+  Var lane;
+  int width;
+  const map<Var,Var>& laneVars;
+  Expr element;
+  vector<Var> laneBuffers;
+
+  bool isLocal(const Expr& expr) const {
+    return isa<VarExpr>(expr) &&
+           util::contains(laneVars, to<VarExpr>(expr)->var);
+  }
+
+  /// The location of a component of a local variable in its lane array.
+  Expr laneIndex(const Expr& index) const {
+    return Add::make(Mul::make(index, Literal::make(width)), lane);
+  }
+
+  /// Returns a loop over the components of a tensor, whose body copies the
+  /// component at the loop index.
+  Stmt copy(const Var& var, std::function<Stmt(Expr)> copyComponent) const {
+    Var k(INTERNAL_PREFIX("k"), Int);
+    int size = (int)var.getType().toTensor()->size();
+    return ForRange::make(k, 0, size, copyComponent(k));
+  }
+
+  void addLaneBuffer(const Var& var) {
+    if (!util::contains(laneBuffers, var)) {
+      laneBuffers.push_back(var);
+    }
+  }
+
+  /// Copies the lane's components of a local tensor to the tensor, which calls
+  /// use as a per-lane buffer.
+  Stmt copyToLaneBuffer(const Var& var) {
+    addLaneBuffer(var);
+    const Var& laneVar = laneVars.at(var);
+    return copy(var, [&](Expr k) {
+      return Store::make(var, k, Load::make(laneVar, laneIndex(k)));
+    });
+  }
+
+  /// Copies a per-lane buffer back to the lane's components of its variable.
+  Stmt copyFromLaneBuffer(const Var& var) {
+    addLaneBuffer(var);
+    const Var& laneVar = laneVars.at(var);
+    if (isScalar(var.getType())) {
+      return Store::make(laneVar, lane, var);
+    }
+    return copy(var, [&](Expr k) {
+      return Store::make(laneVar, laneIndex(k), Load::make(var, k));
+    });
+  }
+
+  using IRRewriter::visit;
+
+  void visit(const VarExpr *op) {
+    if (op->var == loopVar) {
+      expr = element;
+    }
+    else if (util::contains(laneVars, op->var)) {
+      iassert(isScalar(op->type)) << "local tensors are accessed through loads";
+      expr = Load::make(laneVars.at(op->var), lane);
+    }
+    else {
+      expr = op;
+    }
+  }
+
+  void visit(const Load *op) {
+    if (isLocal(op->buffer)) {
+      const Var& laneVar = laneVars.at(to<VarExpr>(op->buffer)->var);
+      expr = Load::make(laneVar, laneIndex(rewrite(op->index)));
+    }
+    else {
+      IRRewriter::visit(op);
+    }
+  }
+
+  void visit(const VarDecl *op) {
+    // Lane arrays are declared before the batched loop
+    stmt = util::contains(laneVars, op->var) ? Stmt() : op;
+  }
+
+  void visit(const AssignStmt *op) {
+    if (!util::contains(laneVars, op->var)) {
+      IRRewriter::visit(op);
+      return;
+    }
+    const Var& laneVar = laneVars.at(op->var);
+    if (isScalar(op->var.getType())) {
+      stmt = Store::make(laneVar, lane, rewrite(op->value), op->cop);
+    }
+    else if (isLocal(op->value)) {
+      const Var& valueVar = laneVars.at(to<VarExpr>(op->value)->var);
+      stmt = copy(op->var, [&](Expr k) {
+        return Store::make(laneVar, laneIndex(k),
+                           Load::make(valueVar, laneIndex(k)));
+      });
+    }
+    else {
+      iassert(isa<Literal>(op->value));
+      const Expr& value = op->value;
+      stmt = copy(op->var, [&](Expr k) {
+        return Store::make(laneVar, laneIndex(k),
+                           isScalar(value.type()) ? value
+                                                  : Load::make(value, k));
+      });
+    }
+  }
+
+  void visit(const Store *op) {
+    if (isLocal(op->buffer)) {
+      const Var& laneVar = laneVars.at(to<VarExpr>(op->buffer)->var);
+      stmt = Store::make(laneVar, laneIndex(rewrite(op->index)),
+                         rewrite(op->value), op->cop);
+    }
+    else {
+      IRRewriter::visit(op);
+    }
+  }
+
+  void visit(const CallStmt *op) {
+    vector<Stmt> stmts;
+    vector<Expr> actuals;
+    for (const Expr& actual : op->actuals) {
+      if (isLocal(actual) && !isScalar(actual.type())) {
+        stmts.push_back(copyToLaneBuffer(to<VarExpr>(actual)->var));
+        actuals.push_back(actual);
+      }
+      else {
+        actuals.push_back(rewrite(actual));
+      }
+    }
+    stmts.push_back(CallStmt::make(op->results, op->callee, actuals));
+    for (const Var& result : op->results) {
+      stmts.push_back(copyFromLaneBuffer(result));
+    }
+    stmt = Block::make(stmts);
+  }
+};
+
+/// Rewrites a loop over a set to process batches of elements.
+class BatchRewriter {
+public:
+  BatchRewriter(const For* loop, const vector<Var>& locals, int width,
+                Storage* storage)
+      : loopVar(loop->var), width(width),
+        batchVar(INTERNAL_PREFIX(loop->var.getName() + "batch"), Int),
+        lane(INTERNAL_PREFIX(loop->var.getName() + "lane"), Int),
+        storage(storage) {
+    for (const Var& local : locals) {
+      const TensorType* type = local.getType().toTensor();
+      int size = isScalar(local.getType()) ? 1 : (int)type->size();
+      Type laneType = TensorType::make(type->getComponentType(),
+                                       {IndexDomain(IndexSet(size*width))});
+      Var laneVar(local.getName() + "_lanes", laneType);
+      laneVars.insert({local, laneVar});
+      laneVarList.push_back(laneVar);
+      storage->add(laneVar, TensorStorage(TensorStorage::Dense));
+    }
+  }
+
+  Stmt rewrite(const For* loop) {
+    LaneRewriter laneRewriter(loopVar, batchVar, lane, width, laneVars);
+    Stmt body = batch(loop->body, &laneRewriter);
+
+    vector<Stmt> stmts;
+    for (const Var& laneVar : laneVarList) {
+      stmts.push_back(VarDecl::make(laneVar));
+    }
+    for (const Var& laneBuffer : laneRewriter.getLaneBuffers()) {
+      stmts.push_back(VarDecl::make(laneBuffer));
+    }
+
+    // Full batches, followed by the remaining elements one at a time
+    Expr length = Length::make(loop->domain.indexSet);
+    Expr batches = Div::make(length, Literal::make(width));
+    stmts.push_back(ForRange::make(batchVar, 0, batches, body));
+    stmts.push_back(ForRange::make(loopVar,
+                                   Mul::make(batches, Literal::make(width)),
+                                   length, loop->body));
+    return Block::make(stmts);
+  }
+
+private:
+  Var loopVar;
+  int width;
+  Var batchVar;
+  Var lane;
+  Storage* storage;
+  map<Var,Var> laneVars;
+  vector<Var> laneVarList;
+
+  Stmt batch(const Stmt& stmt, LaneRewriter* laneRewriter) {
+    if (isa<Block>(stmt)) {
+      const Block* block = to<Block>(stmt);
+      Stmt first = batch(block->first, laneRewriter);
+      Stmt rest = block->rest.defined() ? batch(block->rest, laneRewriter)
+                                        : Stmt();
+      if (!first.defined() || !rest.defined()) {
+        return first.defined() ? first : rest;
+      }
+      return Block::make(first, rest);
+    }
+    else if (isa<Scope>(stmt)) {
+      return Scope::make(batch(to<Scope>(stmt)->scopedStmt, laneRewriter));
+    }
+    else if (isa<Comment>(stmt)) {
+      const Comment* comment = to<Comment>(stmt);
+      Stmt commented = comment->commentedStmt.defined()
+                       ? batch(comment->commentedStmt, laneRewriter) : Stmt();
+      return Comment::make(comment->comment, commented,
+                           comment->footerSpace, comment->headerSpace);
+    }
+    else if (isa<Pass>(stmt)) {
+      return stmt;
+    }
+    else if (isa<VarDecl>(stmt)) {
+      // Lane arrays are declared before the batched loop
+      return Stmt();
+    }
+    else if (isa<ForRange>(stmt) &&
+             isUniform(to<ForRange>(stmt)->start, loopVar, laneVars) &&
+             isUniform(to<ForRange>(stmt)->end, loopVar, laneVars)) {
+      const ForRange* forRange = to<ForRange>(stmt);
+      return ForRange::make(forRange->var, forRange->start, forRange->end,
+                            batch(forRange->body, laneRewriter));
+    }
+    else if (isa<For>(stmt) && isRangeLoop(to<For>(stmt))) {
+      const For* loop = to<For>(stmt);
+      return For::make(loop->var, loop->domain,
+                       batch(loop->body, laneRewriter), loop->kind);
+    }
+    else if (isa<IfThenElse>(stmt) &&
+             isUniform(to<IfThenElse>(stmt)->condition, loopVar, laneVars)) {
+      const IfThenElse* ifThenElse = to<IfThenElse>(stmt);
+      Stmt elseBody = ifThenElse->elseBody.defined()
+                      ? batch(ifThenElse->elseBody, laneRewriter) : Stmt();
+      return IfThenElse::make(ifThenElse->condition,
+                              batch(ifThenElse->thenBody, laneRewriter),
+                              elseBody);
+    }
+    return ForRange::make(lane, 0, width, laneRewriter->rewrite(stmt));
+  }
+};
+
+Func batchLoops(Func func) {
+  class BatchLoopsRewriter : public IRRewriter {
+  public:
+    BatchLoopsRewriter(int width, Storage* storage)
+        : width(width), storage(storage) {}
+
+  private:
+    int width;
+    Storage* storage;
+    BatchSafety safety;
+
+    using IRRewriter::visit;
+
+    void visit(const For *op) {
+      if (safety.isBatchable(op)) {
+        stmt = BatchRewriter(op, safety.getLocals(), width, storage)
+            .rewrite(op);
+      }
+      else {
+        IRRewriter::visit(op);
+      }
+    }
+  };
+  int width = getMapBatchWidth();
+  if (width == 1) {
+    return func;
+  }
+  Stmt body = BatchLoopsRewriter(width, &func.getStorage())
+      .rewrite(func.getBody());
+  return Func(func, body);
+}
+
+}}
@@ -0,0 +1,29 @@
+#ifndef SIMIT_BATCH_LOOPS_H
+#define SIMIT_BATCH_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Returns the number of set elements batched loops process per iteration
+/// (see setMapBatchWidth). One means loops are not batched.
+int getMapBatchWidth();
+
+/// Rewrites serial loops over sets, such as inlined maps, to process batches
+/// of getMapBatchWidth() elements per iteration, one element per vector lane.
+/// The variables the loop body declares get one copy per lane, stored as
+/// structures of arrays (`x[i*W + lane]`), and each statement of the body
+/// executes for every lane before the next, so the backend can vectorize the
+/// statements across elements. Loops over uniform ranges and branches on
+/// uniform conditions are kept around the lane loops; other statements
+/// execute for one lane at a time, and calls copy local tensor arguments and
+/// results between the lane arrays and per-lane buffers. The remaining
+/// elements are processed by the original loop body. A loop is only batched if
+/// its body only writes to variables it declares, writes to other locations
+/// through compound adds or single stores, and does not read what it writes
+/// to other locations. Must run after lowerTensorAccesses.
+Func batchLoops(Func func);
+
+}}
+#endif
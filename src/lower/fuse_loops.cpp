@@ -0,0 +1,348 @@
+#include "fuse_loops.h"
+
+#include <set>
+#include <map>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "var_replace_rewriter.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+
+static bool loopFusion = true;
+
+void setLoopFusion(bool enabled) {
+  loopFusion = enabled;
+}
+
+namespace ir {
+
+bool useLoopFusion() {
+  return loopFusion;
+}
+
+/// How a statement accesses a variable declared outside of it.
+struct VarAccess {
+  bool read = false;
+  bool written = false;
+  /// True iff every access is an element access at the loop variable
+  bool elementwise = true;
+};
+
+/// Summarizes how a statement accesses the variables declared outside of it.
+/// Statements with effects other than writes to variables, such as prints,
+/// calls and field writes, are opaque and are never reordered.
+class AccessAnalysis : public IRVisitor {
+public:
+  AccessAnalysis(const Stmt& stmt, const Var& loopVar=Var())
+      : loopVar(loopVar), opaque(false) {
+    // A declaration must stay above the uses of the declared variable
+    if (isa<VarDecl>(stmt)) {
+      access(to<VarDecl>(stmt)->var, true, false);
+    }
+    stmt.accept(this);
+  }
+
+  /// True iff the statements can execute in either order.
+  bool isIndependentOf(const AccessAnalysis& other) const {
+    if (opaque || other.opaque) {
+      return false;
+    }
+    for (auto& access : accesses) {
+      if (!util::contains(other.accesses, access.first)) continue;
+      const VarAccess& otherAccess = other.accesses.at(access.first);
+      if (access.second.written || otherAccess.written) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// True iff this loop and a later loop over the same set can execute as one
+  /// loop, where each iteration executes this loop's body and then the later
+  /// loop's body. Variables that either loop writes must only be accessed at
+  /// the loop variable by both, so each location is accessed by the same
+  /// iteration of both loops.
+  bool isFusableWith(const AccessAnalysis& later) const {
+    if (opaque || later.opaque) {
+      return false;
+    }
+    for (auto& access : accesses) {
+      if (!util::contains(later.accesses, access.first)) continue;
+      const VarAccess& laterAccess = later.accesses.at(access.first);
+      if ((access.second.written || laterAccess.written) &&
+          !(access.second.elementwise && laterAccess.elementwise)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  Var loopVar;
+  bool opaque;
+  map<Var,VarAccess> accesses;
+  set<Var> declared;
+
+  void access(const Var& var, bool write, bool elementwise) {
+    if (util::contains(declared, var) ||
+        (loopVar.defined() && var == loopVar)) {
+      return;
+    }
+    VarAccess& varAccess = accesses[var];
+    if (write) {
+      varAccess.written = true;
+    }
+    else {
+      varAccess.read = true;
+    }
+    if (!elementwise) {
+      varAccess.elementwise = false;
+    }
+  }
+
+  bool isLoopVarIndex(const vector<Expr>& indices) const {
+    return loopVar.defined() && indices.size() == 1 &&
+           isa<VarExpr>(indices[0]) && to<VarExpr>(indices[0])->var == loopVar;
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr *op) {
+    access(op->var, false, false);
+  }
+
+  void visit(const VarDecl *op) {
+    declared.insert(op->var);
+  }
+
+  void visit(const ForRange *op) {
+    declared.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For *op) {
+    declared.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const AssignStmt *op) {
+    op->value.accept(this);
+    if (op->cop != CompoundOperator::None) {
+      access(op->var, false, false);
+    }
+    access(op->var, true, false);
+  }
+
+  void visit(const TensorRead *op) {
+    if (isa<VarExpr>(op->tensor)) {
+      access(to<VarExpr>(op->tensor)->var, false, isLoopVarIndex(op->indices));
+    }
+    else {
+      op->tensor.accept(this);
+    }
+    for (const Expr& index : op->indices) {
+      index.accept(this);
+    }
+  }
+
+  void visit(const TensorWrite *op) {
+    if (!isa<VarExpr>(op->tensor)) {
+      opaque = true;
+      return;
+    }
+    const Var& tensor = to<VarExpr>(op->tensor)->var;
+    bool elementwise = isLoopVarIndex(op->indices);
+    if (op->cop != CompoundOperator::None) {
+      access(tensor, false, elementwise);
+    }
+    access(tensor, true, elementwise);
+    for (const Expr& index : op->indices) {
+      index.accept(this);
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const Store *op) {
+    if (!isa<VarExpr>(op->buffer)) {
+      opaque = true;
+      return;
+    }
+    access(to<VarExpr>(op->buffer)->var, true, false);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    if (op->callee.getKind() != Func::Intrinsic) {
+      opaque = true;
+      return;
+    }
+    for (const Expr& actual : op->actuals) {
+      actual.accept(this);
+    }
+    for (const Var& result : op->results) {
+      access(result, true, false);
+    }
+  }
+
+  void visit(const FieldWrite *op) {opaque = true;}
+  void visit(const Print *op) {opaque = true;}
+  void visit(const Kernel *op) {opaque = true;}
+  void visit(const Map *op) {opaque = true;}
+};
+
+/// Returns the loop of a statement, looking through the scope that For::make
+/// puts around loops, or nullptr if the statement is not a loop.
+static const For* getLoop(const Stmt& stmt) {
+  if (isa<Scope>(stmt)) {
+    return getLoop(to<Scope>(stmt)->scopedStmt);
+  }
+  return isa<For>(stmt) ? to<For>(stmt) : nullptr;
+}
+
+static bool isFusable(const Stmt& stmt) {
+  const For* loop = getLoop(stmt);
+  if (loop == nullptr) {
+    return false;
+  }
+  return loop->kind == For::Serial &&
+         loop->domain.kind == ForDomain::IndexSet &&
+         loop->domain.indexSet.getKind() == IndexSet::Set;
+}
+
+static bool isSameSet(const Stmt& a, const Stmt& b) {
+  const Expr& setA = getLoop(a)->domain.indexSet.getSet();
+  const Expr& setB = getLoop(b)->domain.indexSet.getSet();
+  if (isa<VarExpr>(setA) && isa<VarExpr>(setB)) {
+    return to<VarExpr>(setA)->var == to<VarExpr>(setB)->var;
+  }
+  return setA == setB;
+}
+
+static void flattenBlocks(const Stmt& stmt, vector<Stmt>* stmts) {
+  if (isa<Block>(stmt)) {
+    const Block* block = to<Block>(stmt);
+    flattenBlocks(block->first, stmts);
+    if (block->rest.defined()) {
+      flattenBlocks(block->rest, stmts);
+    }
+  }
+  else {
+    stmts->push_back(stmt);
+  }
+}
+
+/// Fuse the loops of a statement list. Starting from a loop, each later loop
+/// over the same set is fused into it as long as the statements in between
+/// can be moved: those the later loop does not depend on are sunk below the
+/// fused loop, and the rest are hoisted above it.
+static vector<Stmt> fuseLoops(const vector<Stmt>& stmts) {
+  vector<Stmt> fused;
+  size_t i = 0;
+  while (i < stmts.size()) {
+    if (!isFusable(stmts[i])) {
+      fused.push_back(stmts[i]);
+      ++i;
+      continue;
+    }
+
+    Stmt loop = stmts[i];
+    vector<Stmt> hoisted;
+    vector<Stmt> sunk;
+    size_t next = i+1;
+    while (true) {
+      size_t candidate = next;
+      while (candidate < stmts.size() &&
+             !(isFusable(stmts[candidate]) &&
+               isSameSet(loop, stmts[candidate]))) {
+        ++candidate;
+      }
+      if (candidate == stmts.size()) {
+        break;
+      }
+
+      const For* fusedLoop = getLoop(loop);
+      const For* candidateLoop = getLoop(stmts[candidate]);
+      AccessAnalysis loopAccesses(fusedLoop->body, fusedLoop->var);
+      AccessAnalysis candidateAccesses(candidateLoop->body,
+                                       candidateLoop->var);
+      if (!loopAccesses.isFusableWith(candidateAccesses)) {
+        break;
+      }
+
+      // The candidate moves above the statements sunk so far, and statements
+      // that are hoisted move above the loop and the sunk statements
+      vector<AccessAnalysis> sunkAccesses;
+      for (const Stmt& stmt : sunk) {
+        sunkAccesses.push_back(AccessAnalysis(stmt));
+      }
+      bool movable = true;
+      for (const AccessAnalysis& stmtAccesses : sunkAccesses) {
+        if (!stmtAccesses.isIndependentOf(candidateAccesses)) {
+          movable = false;
+        }
+      }
+      vector<Stmt> newHoisted;
+      vector<Stmt> newSunk;
+      for (size_t j=next; movable && j < candidate; ++j) {
+        AccessAnalysis stmtAccesses(stmts[j]);
+        if (stmtAccesses.isIndependentOf(candidateAccesses)) {
+          newSunk.push_back(stmts[j]);
+          sunkAccesses.push_back(stmtAccesses);
+          continue;
+        }
+        bool hoistable = stmtAccesses.isIndependentOf(loopAccesses);
+        for (const AccessAnalysis& sunkStmtAccesses : sunkAccesses) {
+          if (!stmtAccesses.isIndependentOf(sunkStmtAccesses)) {
+            hoistable = false;
+          }
+        }
+        if (!hoistable) {
+          movable = false;
+        }
+        newHoisted.push_back(stmts[j]);
+      }
+      if (!movable) {
+        break;
+      }
+
+      hoisted.insert(hoisted.end(), newHoisted.begin(), newHoisted.end());
+      sunk.insert(sunk.end(), newSunk.begin(), newSunk.end());
+      Stmt candidateBody = replaceVar(candidateLoop->body, candidateLoop->var,
+                                      fusedLoop->var);
+      loop = For::make(fusedLoop->var, fusedLoop->domain,
+                       Block::make(fusedLoop->body, candidateBody),
+                       fusedLoop->kind);
+      next = candidate+1;
+    }
+
+    fused.insert(fused.end(), hoisted.begin(), hoisted.end());
+    fused.push_back(loop);
+    fused.insert(fused.end(), sunk.begin(), sunk.end());
+    i = next;
+  }
+  return fused;
+}
+
+Func fuseLoops(Func func) {
+  class FuseLoopsRewriter : public IRRewriter {
+    using IRRewriter::visit;
+
+    void visit(const Block *op) {
+      vector<Stmt> stmts;
+      flattenBlocks(op, &stmts);
+      for (Stmt& s : stmts) {
+        s = rewrite(s);
+      }
+      stmt = Block::make(fuseLoops(stmts));
+    }
+  };
+  Stmt body = FuseLoopsRewriter().rewrite(func.getBody());
+  return Func(func, body);
+}
+
+}}
@@ -0,0 +1,23 @@
+#ifndef SIMIT_FUSE_LOOPS_H
+#define SIMIT_FUSE_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Returns true iff loops over the same set should be fused (see
+/// setLoopFusion).
+bool useLoopFusion();
+
+/// Fuses loops over the same set in a block into one loop, so that sequences
+/// of lowered vector operations and reductions (e.g. the updates of a CG
+/// iteration) traverse memory once. Two loops are fused if every variable
+/// that one of them writes and the other accesses is only accessed at the
+/// loop variable, and the statements between them can be moved above the
+/// first loop or below the second. Must run before lowerTensorAccesses, while
+/// element accesses are still tensor reads and writes.
+Func fuseLoops(Func func);
+
+}}
+#endif
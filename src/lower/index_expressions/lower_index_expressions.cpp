@@ -9,8 +9,13 @@
 #include "lower_matrix_multiply.h"
 
 #include "path_expressions.h"
+#include "intrinsics.h"
+#include "block_kernels.h"
+#include "util/collections.h"
 
 namespace simit {
+extern std::string kBackend;
+
 namespace ir {
 
 inline unsigned getExperssionArity(const IndexExpr* iexpr) {
@@ -158,6 +163,94 @@ inline bool isGemm(const IndexExpr* iexpr) {
   return result;
 }
 
+/// Returns the size of a dense, statically sized, unblocked dimension that
+/// block kernels support, or zero.
+inline int getBlockKernelSize(const IndexDomain& dimension) {
+  if (dimension.getIndexSets().size() != 1 ||
+      dimension.getIndexSets()[0].getKind() != IndexSet::Range) {
+    return 0;
+  }
+  int size = dimension.getSize();
+  return (size <= internal::MAX_BLOCK_KERNEL_SIZE) ? size : 0;
+}
+
+inline bool isBlockKernelMatrix(const Var& var, const Storage& storage) {
+  if (!var.getType().isTensor() || !storage.hasStorage(var) ||
+      storage.getStorage(var).getKind() != TensorStorage::Dense) {
+    return false;
+  }
+  const TensorType* type = var.getType().toTensor();
+  if (type->order() != 2 || !type->getComponentType().isFloat()) {
+    return false;
+  }
+  for (auto& dimension : type->getDimensions()) {
+    if (getBlockKernelSize(dimension) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Lowers an assignment of a product of small dense matrices with static
+/// dimensions, (i,j A(i,+k) * B(+k,j)) where either operand may be transposed,
+/// to a call to a block kernel. Returns an undefined statement for compound
+/// assignments, products too small to benefit from a call, and other
+/// expressions.
+inline Stmt lowerBlockKernelGemm(const AssignStmt* op, const Storage& storage) {
+  if (kBackend == "gpu" || op->cop != CompoundOperator::None ||
+      !isa<IndexExpr>(op->value)) {
+    return Stmt();
+  }
+  const Var& target = op->var;
+  const IndexExpr* iexpr = to<IndexExpr>(op->value);
+  if (iexpr->resultVars.size() != 2 ||
+      !isa<Mul>(iexpr->value) || !isBlockKernelMatrix(target, storage)) {
+    return Stmt();
+  }
+  const Mul* mul = to<Mul>(iexpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return Stmt();
+  }
+  const IndexedTensor* a = to<IndexedTensor>(mul->a);
+  const IndexedTensor* b = to<IndexedTensor>(mul->b);
+  if (!isa<VarExpr>(a->tensor) || !isa<VarExpr>(b->tensor) ||
+      a->indexVars.size() != 2 || b->indexVars.size() != 2) {
+    return Stmt();
+  }
+
+  const IndexVar& i = iexpr->resultVars[0];
+  const IndexVar& j = iexpr->resultVars[1];
+  if (!util::contains(a->indexVars, i)) {
+    std::swap(a, b);
+  }
+  Var A = to<VarExpr>(a->tensor)->var;
+  Var B = to<VarExpr>(b->tensor)->var;
+  if (A == target || B == target ||
+      !isBlockKernelMatrix(A, storage) || !isBlockKernelMatrix(B, storage)) {
+    return Stmt();
+  }
+
+  bool transposeA = (a->indexVars[1] == i);
+  bool transposeB = (b->indexVars[1] != j);
+  const IndexVar& k = a->indexVars[transposeA ? 0 : 1];
+  if (a->indexVars[transposeA ? 1 : 0] != i ||
+      b->indexVars[transposeB ? 0 : 1] != j ||
+      b->indexVars[transposeB ? 1 : 0] != k ||
+      !k.isReductionVar() || k.getOperator() != ReductionOperator::Sum) {
+    return Stmt();
+  }
+
+  int m = getBlockKernelSize(i.getDomain());
+  int n = getBlockKernelSize(j.getDomain());
+  int kSize = getBlockKernelSize(k.getDomain());
+  if (m == 0 || n == 0 || kSize == 0 ||
+      m*kSize*n < internal::MIN_BLOCK_KERNEL_MULTIPLIES) {
+    return Stmt();
+  }
+  return CallStmt::make({target}, intrinsics::gemm(),
+                        {A, B, m, kSize, n, (int)transposeA, (int)transposeB});
+}
+
 Func lowerIndexExpressions(Func func) {
   class LowerIndexExpressionsRewriter : private IRRewriter {
   public:
@@ -207,6 +300,12 @@ Func lowerIndexExpressions(Func func) {
       const Var& var = op->var;
       const TensorType* type = iexpr->type.toTensor();
 
+      // Products of small dense matrices call block kernels
+      stmt = lowerBlockKernelGemm(op, *storage);
+      if (stmt.defined()) {
+        return;
+      }
+
       if (type->order()==0 || type->order()==1 ||
           storage->getStorage(var).getKind() == TensorStorage::Dense) {
         kind = DenseResult;
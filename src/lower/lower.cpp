@@ -9,6 +9,11 @@
 #include "lower_accesses.h"
 #include "lower_prints.h"
 #include "lower_string_ops.h"
+#include "parallelize_loops.h"
+#include "fuse_loops.h"
+#include "matrix_free.h"
+#include "symmetric_matrices.h"
+#include "batch_loops.h"
 
 #include "storage.h"
 #include "timers.h"
@@ -44,7 +49,13 @@ Func rewriteCallGraph(const Func& func, const function<Func(Func)>& rewriter) {
         func = *op;
         return;
       }
+      // Passes update the storage of funcs in place, so rewritten funcs get
+      // their own, as earlier funcs may be shared with the program and with
+      // concurrent compilations
       func = simit::ir::Func(*op, rewrite(op->getBody()));
+      Storage storage;
+      storage.add(op->getStorage());
+      func.setStorage(storage);
       func = rewriter(func);
     }
   };
@@ -100,6 +111,19 @@ Func lower(Func func, bool print, bool time) {
   func = rewriteCallGraph(func, insertTemporaries);
   printCallGraph("Insert Temporaries and Flatten Index Expressions", func, print);
 
+  // Replace assembled matrices that are only multiplied with vectors by maps
+  // that multiply each element's blocks with the vector
+  if (useMatrixFreeOperators()) {
+    func = rewriteCallGraph(func, makeMatrixFree);
+    printCallGraph("Make Matrix-Free Operators", func, print);
+  }
+
+  // Store symmetric assembled matrices as their upper triangles
+  if (useSymmetricMatrices() && kBackend != "gpu") {
+    func = rewriteCallGraph(func, makeSymmetricMatrices);
+    printCallGraph("Make Symmetric Matrices", func, print);
+  }
+
   // Determine Storage
   func = rewriteCallGraph(func, [](Func func) -> Func {
     updateStorage(func, &func.getStorage(), &func.getEnvironment());
@@ -135,10 +159,30 @@ Func lower(Func func, bool print, bool time) {
   func = rewriteCallGraph(func, lowerIndexExpressions);
   printCallGraph("Lower Index Expressions", func, print);
 
+  // Fuse loops over the same set, so that vector operations and reductions
+  // share traversals. The GPU backend fuses its kernels instead.
+  if (kBackend != "gpu" && useLoopFusion()) {
+    func = rewriteCallGraph(func, fuseLoops);
+    printCallGraph("Fuse Loops", func, print);
+  }
+
   // Lower Tensor Reads and Writes
   func = rewriteCallGraph(func, lowerTensorAccesses);
   printCallGraph("Lower Tensor Reads and Writes", func, print);
 
+  // Process the elements of set loops in batches of vector lanes. Batched
+  // loops are not partitioned across threads.
+  if (kBackend == "cpu" && getMapBatchWidth() > 1) {
+    func = rewriteCallGraph(func, batchLoops);
+    printCallGraph("Batch Loops", func, print);
+  }
+
+  // Partition loops over sets across threads
+  if (kBackend == "cpu-parallel") {
+    func = rewriteCallGraph(func, parallelizeLoops);
+    printCallGraph("Parallelize Loops", func, print);
+  }
+
   if (time) {
     printTimedCallGraph("Insert Timers", func, print);
     func = rewriteCallGraph(func, insertTimers);
@@ -32,8 +32,25 @@ inline bool hasSameStorage(std::vector<Var> vars, const Storage &storage) {
 }
 
 class LowerMapFunctionRewriter : public MapFunctionRewriter {
+public:
+  LowerMapFunctionRewriter(const Storage& storage) : storage(storage) {}
+
+private:
+  const Storage& storage;
+
   using MapFunctionRewriter::visit;
 
+  /// Returns the location of block (i,j) of a symmetric result, whose index
+  /// holds the neighbors of row i from i onwards, so the block's location in
+  /// the row is its offset from the diagonal block in the full row.
+  Expr symmetricLocation(const TensorIndex& index, const TensorWrite* op,
+                         Expr i, Expr j) {
+    Expr row = rewrite(op->indices[0]);
+    Expr rowStart = Load::make(index.getRowptrArray(), row);
+    return Add::make(rowStart, Sub::make(TensorRead::make(locs, {i,j}),
+                                         TensorRead::make(locs, {i,i})));
+  }
+
   void visit(const TensorWrite *op) {
     // Rewrites the tensor write and assigns the result to stmt
     IRRewriter::visit(op);
@@ -55,7 +72,6 @@ class LowerMapFunctionRewriter : public MapFunctionRewriter {
 
     if (isResult(targetVar)) {
       if (locs.defined() && op->indices.size() == 2) {
-        iassert(endpoints.defined());
         iassert(op->indices.size() == 2);
         vector<Expr> indices;
         for (auto& index : op->indices) {
@@ -64,6 +80,17 @@ class LowerMapFunctionRewriter : public MapFunctionRewriter {
         }
         Expr index = TensorRead::make(locs, indices);
 
+        // Symmetric results only store the blocks on and above the diagonal
+        const TensorStorage& resultStorage =
+            storage.getStorage(resultToMapVar.at(targetVar));
+        Expr isStored;
+        if (resultStorage.isSymmetric()) {
+          isStored = Ge::make(index, TensorRead::make(locs, {indices[0],
+                                                             indices[0]}));
+          index = symmetricLocation(resultStorage.getTensorIndex(), op,
+                                    indices[0], indices[1]);
+        }
+
         // Change assignments to result to compound  assignments, using the map
         // reduction operator.
         switch (reduction.getKind()) {
@@ -78,6 +105,9 @@ class LowerMapFunctionRewriter : public MapFunctionRewriter {
             break;
           }
         }
+        if (isStored.defined()) {
+          stmt = IfThenElse::make(isStored, stmt);
+        }
       }
       else {
         // Change assignments to result to compound  assignments, using the map
@@ -115,7 +145,7 @@ private:
     iassert(hasStorage(op->vars, *storage))
         << "Every assembled tensor should have a storage descriptor";
 
-    LowerMapFunctionRewriter mapFunctionRewriter;
+    LowerMapFunctionRewriter mapFunctionRewriter(*storage);
     stmt = inlineMap(op, mapFunctionRewriter);
 
     // Add comment
@@ -129,7 +159,7 @@ private:
       auto tensorStorage = storage->getStorage(result);
       if (tensorStorage.getKind() == TensorStorage::Indexed) {
         auto& pexpr = tensorStorage.getTensorIndex().getPathExpression();
-        env->addTensorIndex(pexpr, result);
+        env->addTensorIndex(pexpr, result, tensorStorage.isSymmetric());
       }
     }
 
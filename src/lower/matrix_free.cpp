@@ -0,0 +1,443 @@
+#include "matrix_free.h"
+
+#include <set>
+#include <map>
+#include <vector>
+
+#include "flatten.h"
+#include "temps.h"
+#include "ir_builder.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+
+static bool matrixFreeOperators = false;
+
+void setMatrixFreeOperators(bool enabled) {
+  matrixFreeOperators = enabled;
+}
+
+namespace ir {
+
+bool useMatrixFreeOperators() {
+  return matrixFreeOperators;
+}
+
+static void flattenBlocks(const Stmt& stmt, vector<Stmt>* stmts) {
+  if (isa<Block>(stmt)) {
+    const Block* block = to<Block>(stmt);
+    flattenBlocks(block->first, stmts);
+    if (block->rest.defined()) {
+      flattenBlocks(block->rest, stmts);
+    }
+  }
+  else {
+    stmts->push_back(stmt);
+  }
+}
+
+/// Returns the variable a tensor, field or element access expression accesses
+/// (e.g. `A` for `A(i)(j)` and `s` for `s.a(i)`), or an undefined variable if
+/// the expression is not rooted in a variable.
+static Var getRootVar(Expr expr) {
+  while (true) {
+    if (isa<TensorRead>(expr)) {
+      expr = to<TensorRead>(expr)->tensor;
+    }
+    else if (isa<FieldRead>(expr)) {
+      expr = to<FieldRead>(expr)->elementOrSet;
+    }
+    else {
+      return isa<VarExpr>(expr) ? to<VarExpr>(expr)->var : Var();
+    }
+  }
+}
+
+bool isMatrixVectorProduct(const Stmt& stmt, Var* y, Var* A, Var* x) {
+  if (!isa<AssignStmt>(stmt) ||
+      to<AssignStmt>(stmt)->cop != CompoundOperator::None ||
+      !isa<IndexExpr>(to<AssignStmt>(stmt)->value)) {
+    return false;
+  }
+  const IndexExpr* indexExpr = to<IndexExpr>(to<AssignStmt>(stmt)->value);
+  if (indexExpr->resultVars.size() != 1 || !isa<Mul>(indexExpr->value)) {
+    return false;
+  }
+  const Mul* mul = to<Mul>(indexExpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return false;
+  }
+  const IndexedTensor* matrix = to<IndexedTensor>(mul->a);
+  const IndexedTensor* vector = to<IndexedTensor>(mul->b);
+  if (!isa<VarExpr>(matrix->tensor) || !isa<VarExpr>(vector->tensor) ||
+      matrix->indexVars.size() != 2 || vector->indexVars.size() != 1) {
+    return false;
+  }
+  const IndexVar& i = indexExpr->resultVars[0];
+  const IndexVar& j = vector->indexVars[0];
+  if (matrix->indexVars[0] != i || matrix->indexVars[1] != j ||
+      !j.isReductionVar() ||
+      j.getOperator().getKind() != ReductionOperator::Sum) {
+    return false;
+  }
+  *y = to<AssignStmt>(stmt)->var;
+  *A = to<VarExpr>(matrix->tensor)->var;
+  *x = to<VarExpr>(vector->tensor)->var;
+  return true;
+}
+
+/// Finds the uses of an assembled matrix, which are either matrix-vector
+/// products or other uses that require the matrix to be stored.
+class MatrixUses : public IRVisitor {
+public:
+  MatrixUses(const Var& matrix) : matrix(matrix) {}
+
+  /// The (y,x) pairs of the products y = A*x.
+  vector<pair<Var,Var>> products;
+  bool hasOtherUses = false;
+
+private:
+  Var matrix;
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr *op) {
+    if (op->var == matrix) {
+      hasOtherUses = true;
+    }
+  }
+
+  void visit(const AssignStmt *op) {
+    Var y, A, x;
+    if (isMatrixVectorProduct(op, &y, &A, &x) && A == matrix) {
+      products.push_back({y, x});
+      return;
+    }
+    if (op->var == matrix) {
+      hasOtherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    if (util::contains(op->results, matrix)) {
+      hasOtherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map *op) {
+    if (util::contains(op->vars, matrix)) {
+      hasOtherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+/// Collects the variables an expression reads.
+class ReadVars : public IRVisitor {
+public:
+  set<Var> vars;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarExpr *op) {
+    vars.insert(op->var);
+  }
+};
+
+/// Determines whether statements may write one of the given variables, or a
+/// field of them if they are sets.
+class WritesVars : public IRVisitor {
+public:
+  WritesVars(const set<Var>& vars) : vars(vars) {}
+
+  bool writes = false;
+
+private:
+  const set<Var>& vars;
+
+  bool reads(const Expr& expr) {
+    ReadVars readVars;
+    expr.accept(&readVars);
+    for (const Var& var : readVars.vars) {
+      if (util::contains(vars, var)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const AssignStmt *op) {
+    writes |= util::contains(vars, op->var);
+  }
+
+  void visit(const TensorWrite *op) {
+    writes |= util::contains(vars, getRootVar(op->tensor));
+  }
+
+  void visit(const FieldWrite *op) {
+    writes |= util::contains(vars, getRootVar(op->elementOrSet));
+  }
+
+  void visit(const Store *op) {
+    writes |= util::contains(vars, getRootVar(op->buffer));
+  }
+
+  // Calls and maps may write the fields of the sets they are passed
+  void visit(const CallStmt *op) {
+    for (const Var& result : op->results) {
+      writes |= util::contains(vars, result);
+    }
+    if (op->callee.getKind() != Func::Intrinsic) {
+      for (const Expr& actual : op->actuals) {
+        writes |= reads(actual);
+      }
+    }
+  }
+
+  void visit(const Map *op) {
+    for (const Var& var : op->vars) {
+      writes |= util::contains(vars, var);
+    }
+    writes |= reads(op->target);
+    if (op->neighbors.defined()) {
+      writes |= reads(op->neighbors);
+    }
+    for (const Expr& actual : op->partial_actuals) {
+      writes |= reads(actual);
+    }
+  }
+};
+
+/// Rewrites an assembly function to multiply the blocks it assembles with a
+/// vector, instead of storing them in a matrix.
+class MatrixFreeOperatorRewriter : public IRRewriter {
+public:
+  MatrixFreeOperatorRewriter(const Var& matrix, const Var& result,
+                             const Var& vector)
+      : matrix(matrix), result(result), vector(vector) {}
+
+  /// False if the function reads the matrix, or writes parts of its blocks.
+  bool valid = true;
+
+private:
+  Var matrix;
+  Var result;
+  Var vector;
+  IRBuilder builder;
+
+  using IRRewriter::visit;
+
+  void visit(const VarExpr *op) {
+    if (op->var == matrix) {
+      valid = false;
+    }
+    IRRewriter::visit(op);
+  }
+
+  void visit(const TensorWrite *op) {
+    if (!isa<VarExpr>(op->tensor) ||
+        to<VarExpr>(op->tensor)->var != matrix) {
+      IRRewriter::visit(op);
+      return;
+    }
+    if (op->indices.size() != 2) {
+      valid = false;
+      stmt = op;
+      return;
+    }
+
+    Expr row = rewrite(op->indices[0]);
+    Expr col = rewrite(op->indices[1]);
+    Expr block = rewrite(op->value);
+    Expr vectorBlock = TensorRead::make(vector, {col});
+    Expr product = (block.type().toTensor()->order() == 0)
+        ? Mul::make(block, vectorBlock)
+        : builder.gemv(block, vectorBlock);
+    stmt = TensorWrite::make(result, {row}, product, op->cop);
+  }
+};
+
+/// Returns the function that multiplies the matrix the map assembles by the
+/// vector, or an undefined function if the map's function cannot be
+/// rewritten.
+static Func createMatrixFreeOperator(const Map* map, const Var& y,
+                                     const Var& x) {
+  Func func = map->function;
+  iassert(func.getResults().size() == 1);
+  Var matrix = func.getResults()[0];
+  Var result(y.getName(), y.getType());
+
+  MatrixFreeOperatorRewriter rewriter(matrix, result, x);
+  Stmt body = rewriter.rewrite(func.getBody());
+  if (!rewriter.valid) {
+    return Func();
+  }
+
+  Func op(func.getName() + "_" + x.getName(), func.getArguments(), {result},
+          body, func.getEnvironment());
+  op = flattenIndexExpressions(op);
+  op = insertTemporaries(op);
+  return op;
+}
+
+/// Returns true iff the map assembles a single matrix with a sum reduction,
+/// without writing the fields of the sets it is mapped over.
+static bool isMatrixAssembly(const Map* map, const Func& caller) {
+  if (map->vars.size() != 1 || map->function.getResults().size() != 1 ||
+      map->reduction.getKind() != ReductionOperator::Sum) {
+    return false;
+  }
+  const Var& matrix = map->vars[0];
+  if (!matrix.getType().isTensor() ||
+      matrix.getType().toTensor()->order() != 2 ||
+      !matrix.getType().toTensor()->hasSystemDimensions() ||
+      util::contains(caller.getArguments(), matrix) ||
+      util::contains(caller.getResults(), matrix)) {
+    return false;
+  }
+
+  class FieldWrites : public IRVisitor {
+  public:
+    bool found = false;
+    using IRVisitor::visit;
+    void visit(const FieldWrite *op) {found = true;}
+  };
+  FieldWrites fieldWrites;
+  map->function.getBody().accept(&fieldWrites);
+  return !fieldWrites.found;
+}
+
+/// Replaces the matrix assembled by the map at the given top-level statement
+/// by matrix-free operators. Returns the rewritten body, or an undefined
+/// statement if the matrix cannot be replaced.
+static Stmt replaceMatrix(const vector<Stmt>& stmts, size_t mapIndex) {
+  const Map* map = to<Map>(stmts[mapIndex]);
+  const Var& matrix = map->vars[0];
+
+  // Every use must be a product after the map, and the map's arguments must
+  // not be written before the last product
+  vector<pair<Var,Var>> products;
+  size_t lastUse = mapIndex;
+  for (size_t i=0; i < stmts.size(); ++i) {
+    if (i == mapIndex) continue;
+    MatrixUses uses(matrix);
+    stmts[i].accept(&uses);
+    if (uses.hasOtherUses || (i < mapIndex && uses.products.size() > 0)) {
+      return Stmt();
+    }
+    if (uses.products.size() > 0) {
+      products.insert(products.end(),
+                      uses.products.begin(), uses.products.end());
+      lastUse = i;
+    }
+  }
+  if (products.size() == 0) {
+    return Stmt();
+  }
+
+  ReadVars inputs;
+  map->target.accept(&inputs);
+  if (map->neighbors.defined()) {
+    map->neighbors.accept(&inputs);
+  }
+  for (const Expr& actual : map->partial_actuals) {
+    actual.accept(&inputs);
+  }
+  WritesVars writesInputs(inputs.vars);
+  for (size_t i=mapIndex+1; i <= lastUse; ++i) {
+    stmts[i].accept(&writesInputs);
+  }
+  if (writesInputs.writes) {
+    return Stmt();
+  }
+
+  std::map<Var,Func> operators;
+  for (auto& product : products) {
+    const Var& y = product.first;
+    const Var& x = product.second;
+    if (y == x || util::contains(inputs.vars, y)) {
+      return Stmt();
+    }
+    if (!util::contains(operators, x)) {
+      Func op = createMatrixFreeOperator(map, y, x);
+      if (!op.defined()) {
+        return Stmt();
+      }
+      operators.insert({x, op});
+    }
+  }
+
+  class MatrixFreeRewriter : public IRRewriter {
+  public:
+    MatrixFreeRewriter(const Map* map, const std::map<Var,Func>& operators)
+        : map(map), operators(operators) {}
+
+  private:
+    const Map* map;
+    const std::map<Var,Func>& operators;
+
+    using IRRewriter::visit;
+
+    void visit(const VarDecl *op) {
+      stmt = (op->var == map->vars[0]) ? Stmt() : op;
+    }
+
+    void visit(const Map *op) {
+      stmt = (op == map) ? Stmt() : op;
+    }
+
+    void visit(const AssignStmt *op) {
+      Var y, A, x;
+      if (isMatrixVectorProduct(op, &y, &A, &x) && A == map->vars[0]) {
+        stmt = Map::make({y}, operators.at(x), map->partial_actuals,
+                         map->target, map->neighbors, map->reduction);
+      }
+      else {
+        stmt = op;
+      }
+    }
+  };
+  return MatrixFreeRewriter(map, operators).rewrite(Block::make(stmts));
+}
+
+Func makeMatrixFree(Func func) {
+  Stmt body = func.getBody();
+  bool scoped = isa<Scope>(body);
+  if (scoped) {
+    body = to<Scope>(body)->scopedStmt;
+  }
+
+  vector<Stmt> stmts;
+  flattenBlocks(body, &stmts);
+  bool changed = false;
+  for (size_t i=0; i < stmts.size(); ++i) {
+    if (!isa<Map>(stmts[i]) || !isMatrixAssembly(to<Map>(stmts[i]), func)) {
+      continue;
+    }
+    Stmt matrixFree = replaceMatrix(stmts, i);
+    if (matrixFree.defined()) {
+      // The map was removed, so the next statement is now at index i
+      stmts.clear();
+      flattenBlocks(matrixFree, &stmts);
+      changed = true;
+      --i;
+    }
+  }
+  if (!changed) {
+    return func;
+  }
+
+  body = Block::make(stmts);
+  return Func(func, scoped ? Scope::make(body) : body);
+}
+
+}}
@@ -0,0 +1,28 @@
+#ifndef SIMIT_MATRIX_FREE_H
+#define SIMIT_MATRIX_FREE_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Returns true iff assembled matrices that are only multiplied with vectors
+/// should be replaced by matrix-free operators (see setMatrixFreeOperators).
+bool useMatrixFreeOperators();
+
+/// Returns true iff the statement is a flattened matrix-vector product
+/// `y = (i A(i,+j) * x(+j))`, in which case the variables are returned.
+bool isMatrixVectorProduct(const Stmt& stmt, Var* y, Var* A, Var* x);
+
+/// Replaces matrices that are assembled by a map and only used in
+/// matrix-vector products by matrix-free operators. Each product `y = A*x`
+/// becomes a map of a copy of the assembly function where the writes of local
+/// blocks `A(i,j) = Aij` are replaced by `y(i) = Aij*x(j)`, so the matrix and
+/// its index are never stored. A matrix is replaced if its map's arguments,
+/// including the fields of the mapped sets, are not written between the map
+/// and the last product. Must run on flattened index expressions, before
+/// storage is determined.
+Func makeMatrixFree(Func func);
+
+}}
+#endif
@@ -0,0 +1,526 @@
+#include "parallelize_loops.h"
+
+#include <set>
+#include <map>
+#include <vector>
+
+#include "intrinsics.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "substitute.h"
+#include "util/collections.h"
+#include "util/util.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+static bool isShardable(const For *loop) {
+  return (loop->domain.kind == ForDomain::IndexSet &&
+          loop->domain.indexSet.getKind() == IndexSet::Set);
+}
+
+/// Edge colorings are passed with edge set arguments, so loops over edge set
+/// arguments can be colored.
+static bool isColorable(const For *loop, const set<Var>& arguments) {
+  const Expr& set = loop->domain.indexSet.getSet();
+  return set.type().toSet()->getCardinality() > 0 && isa<VarExpr>(set) &&
+         util::contains(arguments, to<VarExpr>(set)->var);
+}
+
+/// Intrinsics without side effects, that may be called from a parallel loop.
+static bool isPureIntrinsic(const Func& func) {
+  static const set<Func> pure = {
+    intrinsics::mod(), intrinsics::sin(), intrinsics::cos(), intrinsics::tan(),
+    intrinsics::asin(), intrinsics::acos(), intrinsics::atan2(),
+    intrinsics::sqrt(), intrinsics::log(), intrinsics::exp(),
+    intrinsics::pow(), intrinsics::norm(), intrinsics::dot(),
+    intrinsics::det(), intrinsics::inv(), intrinsics::gemm(),
+    intrinsics::loc(), intrinsics::createComplex(), intrinsics::complexNorm(),
+    intrinsics::complexConj(), intrinsics::complexGetReal(),
+    intrinsics::complexGetImag()
+  };
+  return util::contains(pure, func);
+}
+
+/// Compound adds to shared memory are emitted as atomics, which are only
+/// available for integers and floats.
+static bool hasAtomicAdd(const Type& type) {
+  iassert(type.isTensor());
+  ScalarType ctype = type.toTensor()->getComponentType();
+  return ctype.isInt() || ctype.isFloat();
+}
+
+/// The bounds [first,second] of the inner range loop variables whose start and
+/// end are integer literals.
+typedef map<Var,pair<long long,long long>> RangeBounds;
+
+/// An index expression of the form `stride*loopVar + offset`, where the offset
+/// is known to lie in [minOffset,maxOffset].
+struct AffineIndex {
+  bool affine;
+  long long stride;
+  long long minOffset;
+  long long maxOffset;
+};
+
+static AffineIndex getAffineIndex(const Expr& index, const Var& loopVar,
+                                  const RangeBounds& rangeBounds) {
+  const AffineIndex notAffine = {false, 0, 0, 0};
+  if (isa<VarExpr>(index)) {
+    const Var& var = to<VarExpr>(index)->var;
+    if (var == loopVar) {
+      return {true, 1, 0, 0};
+    }
+    if (util::contains(rangeBounds, var)) {
+      const pair<long long,long long>& bounds = rangeBounds.at(var);
+      return {true, 0, bounds.first, bounds.second};
+    }
+    return notAffine;
+  }
+  if (isa<Literal>(index)) {
+    const Literal *literal = to<Literal>(index);
+    if (!isScalar(literal->type) ||
+        !literal->type.toTensor()->getComponentType().isInt()) {
+      return notAffine;
+    }
+    long long val = ((int*)literal->data)[0];
+    return {true, 0, val, val};
+  }
+  if (isa<Length>(index) &&
+      to<Length>(index)->indexSet.getKind() == IndexSet::Range) {
+    long long size = to<Length>(index)->indexSet.getSize();
+    return {true, 0, size, size};
+  }
+  if (isa<Add>(index) || isa<Sub>(index) || isa<Mul>(index)) {
+    const BinaryExpr *op = to<BinaryExpr>(index);
+    AffineIndex a = getAffineIndex(op->a, loopVar, rangeBounds);
+    AffineIndex b = getAffineIndex(op->b, loopVar, rangeBounds);
+    if (!a.affine || !b.affine) {
+      return notAffine;
+    }
+    if (isa<Add>(index)) {
+      return {true, a.stride+b.stride, a.minOffset+b.minOffset,
+              a.maxOffset+b.maxOffset};
+    }
+    if (isa<Sub>(index)) {
+      if (b.stride != 0) {
+        return notAffine;
+      }
+      return {true, a.stride, a.minOffset-b.maxOffset,
+              a.maxOffset-b.minOffset};
+    }
+    // Products scale by a non-negative constant
+    if (a.stride == 0 && a.minOffset == a.maxOffset) {
+      swap(a, b);
+    }
+    if (b.stride != 0 || b.minOffset != b.maxOffset || b.minOffset < 0) {
+      return notAffine;
+    }
+    long long scale = b.minOffset;
+    return {true, a.stride*scale, a.minOffset*scale, a.maxOffset*scale};
+  }
+  return notAffine;
+}
+
+/// True iff the index expression is `stride*loopVar + offset` with a positive
+/// stride and an offset in [0,stride) computed from integer literals, range
+/// lengths and inner range loop variables (e.g. `i*3+j` in a loop over j from 0
+/// to 3), meaning different iterations access different locations.
+static bool isOwnedIndex(const Expr& index, const Var& loopVar,
+                         const RangeBounds& rangeBounds) {
+  AffineIndex affine = getAffineIndex(index, loopVar, rangeBounds);
+  return affine.affine && affine.stride > 0 && affine.minOffset >= 0 &&
+         affine.maxOffset < affine.stride;
+}
+
+/// Checks whether the locations computed by index expressions of an edge loop
+/// are owned by the loop edge's endpoints, meaning edges that share no
+/// endpoints compute different locations. Such locations are computed from the
+/// loop edge's endpoints or the locations of its endpoint pairs in matrix rows,
+/// or from loop variables holding those (e.g. `locs`), scaled by block sizes
+/// and offset by block indices.
+class EndpointLocations {
+public:
+  EndpointLocations(const Var& loopVar, const Var& edgeSet,
+                    const set<Var>& rangeVars, const RangeBounds& rangeBounds,
+                    const map<Var,vector<Expr>>& writes,
+                    const map<Var,const CallStmt*>& callResults)
+      : loopVar(loopVar), edgeSet(edgeSet), rangeVars(rangeVars),
+        rangeBounds(rangeBounds) {
+    // Start from every variable written in the loop and remove those that are
+    // assigned anything else than endpoint locations, until a fixpoint.
+    for (auto& write : writes) {
+      ownedVars.insert(write.first);
+    }
+    for (auto& callResult : callResults) {
+      ownedVars.insert(callResult.first);
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto& write : writes) {
+        if (!util::contains(ownedVars, write.first)) continue;
+        for (const Expr& value : write.second) {
+          if (!isOwned(value)) {
+            ownedVars.erase(write.first);
+            changed = true;
+            break;
+          }
+        }
+      }
+      for (auto& callResult : callResults) {
+        if (!util::contains(ownedVars, callResult.first)) continue;
+        if (util::contains(writes, callResult.first) ||
+            !isOwnedLocCall(callResult.second)) {
+          ownedVars.erase(callResult.first);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  bool isOwned(const Expr& index) const {
+    OwnedLocationVisitor visitor(this);
+    index.accept(&visitor);
+    return visitor.owned && visitor.hasEndpoint;
+  }
+
+private:
+  Var loopVar;
+  Var edgeSet;
+  set<Var> rangeVars;
+  RangeBounds rangeBounds;
+  set<Var> ownedVars;
+
+  /// loc(v0, v1, ...) is the location of (v0,v1) in row v0 of a matrix.
+  bool isOwnedLocCall(const CallStmt *call) const {
+    return call->callee == intrinsics::loc() && call->actuals.size() >= 2 &&
+           isOwned(call->actuals[0]) && isOwned(call->actuals[1]);
+  }
+
+  class OwnedLocationVisitor : public IRVisitor {
+  public:
+    OwnedLocationVisitor(const EndpointLocations *locations)
+        : locations(locations) {}
+    const EndpointLocations *locations;
+    bool owned = true;
+    bool hasEndpoint = false;
+
+    using IRVisitor::visit;
+
+    void visit(const VarExpr *op) {
+      if (util::contains(locations->ownedVars, op->var)) {
+        hasEndpoint = true;
+      }
+      else if (op->var != locations->loopVar &&
+               !util::contains(locations->rangeVars, op->var)) {
+        owned = false;
+      }
+    }
+
+    void visit(const Load *op) {
+      if (isa<IndexRead>(op->buffer)) {
+        const IndexRead *indexRead = to<IndexRead>(op->buffer);
+        if ((indexRead->kind != IndexRead::Endpoints &&
+             indexRead->kind != IndexRead::Locations) ||
+            !isa<VarExpr>(indexRead->edgeSet) ||
+            to<VarExpr>(indexRead->edgeSet)->var != locations->edgeSet ||
+            !isOwnedIndex(op->index, locations->loopVar,
+                          locations->rangeBounds)) {
+          owned = false;
+        }
+        hasEndpoint = true;
+      }
+      else if (isa<VarExpr>(op->buffer) &&
+               util::contains(locations->ownedVars,
+                              to<VarExpr>(op->buffer)->var)) {
+        hasEndpoint = true;
+      }
+      else {
+        owned = false;
+      }
+      op->index.accept(this);
+    }
+
+    // Locations are scaled and offset, which keeps them distinct
+    void visit(const Add *op) {
+      op->a.accept(this);
+      op->b.accept(this);
+    }
+    void visit(const Sub *op) {
+      op->a.accept(this);
+      op->b.accept(this);
+    }
+    void visit(const Mul *op) {
+      op->a.accept(this);
+      op->b.accept(this);
+    }
+
+    void visit(const UnaryExpr *op) {owned = false;}
+    void visit(const BinaryExpr *op) {owned = false;}
+    void visit(const FieldRead *op) {owned = false;}
+    void visit(const IndexRead *op) {owned = false;}
+    void visit(const TupleRead *op) {owned = false;}
+    void visit(const TensorRead *op) {owned = false;}
+    void visit(const IndexedTensor *op) {owned = false;}
+    void visit(const IndexExpr *op) {owned = false;}
+  };
+};
+
+/// Checks whether a loop's iterations can execute concurrently.
+class ParallelSafety : public IRVisitor {
+public:
+  bool isParallelizable(const For *loop) {
+    loopVar = loop->var;
+    safe = true;
+    declared = {loopVar};
+    rangeVars.clear();
+    rangeBounds.clear();
+    reductionVars.clear();
+    readVars.clear();
+    privateWrites.clear();
+    privateCallResults.clear();
+    sharedAddIndices.clear();
+    sharedStores.clear();
+    sharedLoads.clear();
+
+    loop->body.accept(this);
+
+    // Privatized reductions are only combined at the end of the loop, so the
+    // loop may not read intermediate values.
+    for (const Var& reductionVar : reductionVars) {
+      if (util::contains(readVars, reductionVar)) {
+        safe = false;
+      }
+    }
+
+    // Shared buffers that the loop stores to may only be loaded at locations
+    // the iteration stores to itself, such as x[i] when storing x[i], and not
+    // at those of other iterations, such as x[i+1].
+    for (auto& load : sharedLoads) {
+      if (!util::contains(sharedStores, load.first)) continue;
+      const vector<Expr>& storeIndices = sharedStores.at(load.first);
+      bool ownLocation = isOwnedIndex(load.second, loopVar, rangeBounds);
+      for (const Expr& storeIndex : storeIndices) {
+        if (!storeIndex.defined()) {
+          ownLocation = false;
+        }
+      }
+      if (ownLocation) {
+        string index = normalize(load.second);
+        ownLocation = false;
+        for (const Expr& storeIndex : storeIndices) {
+          if (normalize(storeIndex) == index) {
+            ownLocation = true;
+          }
+        }
+      }
+      if (!ownLocation) {
+        safe = false;
+      }
+    }
+    return safe;
+  }
+
+  /// True iff the last parallelizable loop, which must be a loop over an edge
+  /// set variable, makes compound adds to shared locations that are all owned
+  /// by the loop edge's endpoints, so coloring the loop makes them race-free.
+  bool needsColoring(const For *loop) {
+    if (sharedAddIndices.size() == 0) {
+      return false;
+    }
+    Var edgeSet = to<VarExpr>(loop->domain.indexSet.getSet())->var;
+    EndpointLocations locations(loopVar, edgeSet, rangeVars, rangeBounds,
+                                privateWrites, privateCallResults);
+    for (const Expr& index : sharedAddIndices) {
+      if (!locations.isOwned(index)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  Var loopVar;
+  bool safe;
+  set<Var> declared;
+  set<Var> rangeVars;
+  RangeBounds rangeBounds;
+  set<Var> reductionVars;
+  set<Var> readVars;
+
+  map<Var,vector<Expr>> privateWrites;
+  map<Var,const CallStmt*> privateCallResults;
+  vector<Expr> sharedAddIndices;
+
+  /// The indices the loop stores to and loads from each shared buffer, keyed
+  /// by the buffer expression. Stores to locations that are not owned by the
+  /// loop variable are recorded as undefined indices.
+  map<string,vector<Expr>> sharedStores;
+  vector<pair<string,Expr>> sharedLoads;
+
+  /// Print the index with the variables of inner range loops replaced by one
+  /// variable, so that indices into the same block of the loop variable, such
+  /// as x[i*3+j] and x[i*3+k], compare equal.
+  string normalize(const Expr& index) const {
+    Var blockVar(INTERNAL_PREFIX("block"), Int);
+    map<Expr,Expr> substitutions;
+    for (const Var& rangeVar : rangeVars) {
+      substitutions[VarExpr::make(rangeVar)] = VarExpr::make(blockVar);
+    }
+    return util::toString(substitute(substitutions, index));
+  }
+
+  using IRVisitor::visit;
+
+  void visit(const VarDecl *op) {
+    const Type& type = op->var.getType();
+    // Private tensors are allocated per thread, which requires a static size
+    if (!type.isTensor() ||
+        (!isScalar(type) && type.toTensor()->hasSystemDimensions())) {
+      safe = false;
+    }
+    declared.insert(op->var);
+  }
+
+  void visit(const ForRange *op) {
+    declared.insert(op->var);
+    rangeVars.insert(op->var);
+    AffineIndex start = getAffineIndex(op->start, loopVar, {});
+    AffineIndex end = getAffineIndex(op->end, loopVar, {});
+    if (start.affine && end.affine && start.stride == 0 && end.stride == 0 &&
+        start.minOffset == start.maxOffset && end.minOffset == end.maxOffset &&
+        start.minOffset < end.minOffset) {
+      rangeBounds[op->var] = {start.minOffset, end.minOffset-1};
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For *op) {
+    declared.insert(op->var);
+    if (op->domain.kind == ForDomain::IndexSet &&
+        op->domain.indexSet.getKind() == IndexSet::Range &&
+        op->domain.indexSet.getSize() > 0) {
+      rangeVars.insert(op->var);
+      rangeBounds[op->var] = {0, op->domain.indexSet.getSize()-1};
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const VarExpr *op) {
+    readVars.insert(op->var);
+  }
+
+  void visit(const AssignStmt *op) {
+    if (util::contains(declared, op->var)) {
+      privateWrites[op->var].push_back(op->value);
+    }
+    else {
+      if (op->cop == CompoundOperator::Add && isScalar(op->var.getType()) &&
+          hasAtomicAdd(op->var.getType())) {
+        reductionVars.insert(op->var);
+      }
+      else {
+        safe = false;
+      }
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const Store *op) {
+    bool isPrivate = isa<VarExpr>(op->buffer) &&
+                     util::contains(declared, to<VarExpr>(op->buffer)->var);
+    if (isPrivate) {
+      privateWrites[to<VarExpr>(op->buffer)->var].push_back(op->value);
+    }
+    else {
+      bool owned = isOwnedIndex(op->index, loopVar, rangeBounds);
+      switch (op->cop) {
+        case CompoundOperator::None:
+          if (!owned) {
+            safe = false;
+          }
+          break;
+        case CompoundOperator::Add:
+          if (!hasAtomicAdd(op->buffer.type())) {
+            safe = false;
+          }
+          if (!owned) {
+            sharedAddIndices.push_back(op->index);
+          }
+          break;
+      }
+      sharedStores[util::toString(op->buffer)].push_back(owned ? op->index
+                                                               : Expr());
+    }
+    op->buffer.accept(this);
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const Load *op) {
+    bool isPrivate = isa<VarExpr>(op->buffer) &&
+                     util::contains(declared, to<VarExpr>(op->buffer)->var);
+    if (!isPrivate) {
+      sharedLoads.push_back({util::toString(op->buffer), op->index});
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const FieldWrite *op) {
+    safe = false;
+  }
+
+  void visit(const CallStmt *op) {
+    if (op->callee.getKind() != Func::Intrinsic ||
+        !isPureIntrinsic(op->callee)) {
+      safe = false;
+    }
+    for (const Var& result : op->results) {
+      if (!util::contains(declared, result)) {
+        safe = false;
+      }
+      privateCallResults[result] = op;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Print *op) {
+    safe = false;
+  }
+};
+
+Func parallelizeLoops(Func func) {
+  class ParallelizeLoopsRewriter : public IRRewriter {
+  public:
+    ParallelizeLoopsRewriter(const set<Var>& arguments)
+        : arguments(arguments) {}
+
+  private:
+    set<Var> arguments;
+    ParallelSafety safety;
+
+    using IRRewriter::visit;
+
+    void visit(const For *op) {
+      if (isShardable(op) && safety.isParallelizable(op)) {
+        // Assembly loops that scatter to their endpoints are colored instead
+        // of adding atomically, which also makes the result deterministic
+        For::Kind kind = (isColorable(op, arguments) &&
+                          safety.needsColoring(op))
+                         ? For::Colored : For::Parallel;
+        stmt = For::make(op->var, op->domain, op->body, kind);
+      }
+      else {
+        IRRewriter::visit(op);
+      }
+    }
+  };
+  set<Var> arguments(func.getArguments().begin(), func.getArguments().end());
+  Stmt body = ParallelizeLoopsRewriter(arguments).rewrite(func.getBody());
+  return Func(func, body);
+}
+
+}}
@@ -0,0 +1,18 @@
+#ifndef SIMIT_PARALLELIZE_LOOPS_H
+#define SIMIT_PARALLELIZE_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Marks the outermost loops over sets whose iterations can safely execute
+/// concurrently as parallel. A loop is parallel if its body only writes to
+/// variables declared in the body, to locations indexed directly by the loop
+/// variable, or through integer/float compound adds (which the backend makes
+/// atomic or privatizes). Loops with calls to internal or external functions,
+/// prints or other side effects stay serial.
+Func parallelizeLoops(Func func);
+
+}}
+#endif
@@ -0,0 +1,654 @@
+#include "symmetric_matrices.h"
+
+#include <set>
+#include <map>
+#include <vector>
+
+#include "matrix_free.h"
+#include "intrinsics.h"
+#include "storage.h"
+#include "tensor_index.h"
+#include "path_expressions.h"
+#include "path_expression_analysis.h"
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+
+static bool symmetricMatrices = false;
+
+void setSymmetricMatrices(bool enabled) {
+  symmetricMatrices = enabled;
+}
+
+namespace ir {
+
+bool useSymmetricMatrices() {
+  return symmetricMatrices;
+}
+
+template <typename T>
+static bool isBoth(const Expr& a, const Expr& b) {
+  return isa<T>(a) && isa<T>(b);
+}
+
+/// Returns true iff the expressions are structurally equal, where the index
+/// variables of `a` are replaced by those they map to in `indexVars`. Reduction
+/// variables that are not mapped are mapped to the reduction variable at the
+/// same place in `b`.
+static bool equal(const Expr& a, const Expr& b,
+                  map<IndexVar,IndexVar>* indexVars) {
+  if (a.ptr == b.ptr) {
+    return true;
+  }
+  if (!a.defined() || !b.defined()) {
+    return false;
+  }
+
+  if (isBoth<VarExpr>(a, b)) {
+    return to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+  }
+  else if (isBoth<Literal>(a, b)) {
+    return *to<Literal>(a) == *to<Literal>(b);
+  }
+  else if (isBoth<TupleRead>(a, b)) {
+    return equal(to<TupleRead>(a)->tuple, to<TupleRead>(b)->tuple, indexVars) &&
+           equal(to<TupleRead>(a)->index, to<TupleRead>(b)->index, indexVars);
+  }
+  else if (isBoth<FieldRead>(a, b)) {
+    return to<FieldRead>(a)->fieldName == to<FieldRead>(b)->fieldName &&
+           equal(to<FieldRead>(a)->elementOrSet, to<FieldRead>(b)->elementOrSet,
+                 indexVars);
+  }
+  else if (isBoth<TensorRead>(a, b)) {
+    const TensorRead* ra = to<TensorRead>(a);
+    const TensorRead* rb = to<TensorRead>(b);
+    if (ra->indices.size() != rb->indices.size() ||
+        !equal(ra->tensor, rb->tensor, indexVars)) {
+      return false;
+    }
+    for (size_t i=0; i < ra->indices.size(); ++i) {
+      if (!equal(ra->indices[i], rb->indices[i], indexVars)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  else if (isBoth<IndexedTensor>(a, b)) {
+    const IndexedTensor* ta = to<IndexedTensor>(a);
+    const IndexedTensor* tb = to<IndexedTensor>(b);
+    if (ta->indexVars.size() != tb->indexVars.size() ||
+        !equal(ta->tensor, tb->tensor, indexVars)) {
+      return false;
+    }
+    for (size_t i=0; i < ta->indexVars.size(); ++i) {
+      const IndexVar& ia = ta->indexVars[i];
+      const IndexVar& ib = tb->indexVars[i];
+      if (!util::contains(*indexVars, ia) && ia != ib && ia.isReductionVar() &&
+          ib.isReductionVar() &&
+          ia.getOperator().getKind() == ib.getOperator().getKind()) {
+        indexVars->insert({ia, ib});
+      }
+      IndexVar mapped = util::contains(*indexVars, ia) ? indexVars->at(ia) : ia;
+      if (mapped != ib) {
+        return false;
+      }
+    }
+    return true;
+  }
+  else if (isBoth<IndexExpr>(a, b)) {
+    const IndexExpr* ea = to<IndexExpr>(a);
+    const IndexExpr* eb = to<IndexExpr>(b);
+    if (ea->resultVars.size() != eb->resultVars.size()) {
+      return false;
+    }
+    for (size_t i=0; i < ea->resultVars.size(); ++i) {
+      (*indexVars)[ea->resultVars[i]] = eb->resultVars[i];
+    }
+    return equal(ea->value, eb->value, indexVars);
+  }
+  else if (isBoth<Neg>(a, b)) {
+    return equal(to<Neg>(a)->a, to<Neg>(b)->a, indexVars);
+  }
+  else if (isBoth<Add>(a, b) || isBoth<Sub>(a, b) || isBoth<Mul>(a, b) ||
+           isBoth<Div>(a, b)) {
+    return equal(to<BinaryExpr>(a)->a, to<BinaryExpr>(b)->a, indexVars) &&
+           equal(to<BinaryExpr>(a)->b, to<BinaryExpr>(b)->b, indexVars);
+  }
+  return false;
+}
+
+static bool equal(const Expr& a, const Expr& b) {
+  map<IndexVar,IndexVar> indexVars;
+  return equal(a, b, &indexVars);
+}
+
+/// Returns true iff the index expressions compute matrices that are each
+/// other's transposes, i.e. `b(i,j) = a(j,i)`.
+static bool isTranspose(const Expr& a, const Expr& b) {
+  if (!isBoth<IndexExpr>(a, b) ||
+      to<IndexExpr>(a)->resultVars.size() != 2 ||
+      to<IndexExpr>(b)->resultVars.size() != 2) {
+    return false;
+  }
+  const IndexExpr* ea = to<IndexExpr>(a);
+  const IndexExpr* eb = to<IndexExpr>(b);
+  map<IndexVar,IndexVar> indexVars = {{ea->resultVars[0], eb->resultVars[1]},
+                                      {ea->resultVars[1], eb->resultVars[0]}};
+  return equal(ea->value, eb->value, &indexVars);
+}
+
+/// Returns true iff the expression uses one of the index variables.
+static bool usesIndexVars(const Expr& expr, const IndexVar& i,
+                          const IndexVar& j) {
+  class UsesIndexVars : public IRVisitor {
+  public:
+    UsesIndexVars(const IndexVar& i, const IndexVar& j) : i(i), j(j) {}
+    const IndexVar& i;
+    const IndexVar& j;
+    bool uses = false;
+
+    using IRVisitor::visit;
+    void visit(const IndexedTensor *op) {
+      for (const IndexVar& indexVar : op->indexVars) {
+        uses |= (indexVar == i || indexVar == j);
+      }
+      IRVisitor::visit(op);
+    }
+  };
+  UsesIndexVars visitor(i, j);
+  expr.accept(&visitor);
+  return visitor.uses;
+}
+
+/// Determines whether the element matrices of a function are symmetric, from
+/// the definitions of the variables that hold them.
+class SymmetryAnalysis {
+public:
+  SymmetryAnalysis(const Func& func) {
+    for (auto& constant : func.getEnvironment().getConstants()) {
+      constants.insert(constant);
+    }
+
+    class Definitions : public IRVisitor {
+    public:
+      Definitions(SymmetryAnalysis* analysis) : analysis(analysis) {}
+      SymmetryAnalysis* analysis;
+
+      using IRVisitor::visit;
+      void visit(const AssignStmt *op) {
+        if (op->cop == CompoundOperator::None ||
+            op->cop == CompoundOperator::Add) {
+          analysis->definitions[op->var].push_back(op->value);
+        }
+        else {
+          analysis->opaque.insert(op->var);
+        }
+        IRVisitor::visit(op);
+      }
+      void visit(const TensorWrite *op) {
+        Expr tensor = op->tensor;
+        while (isa<TensorRead>(tensor)) {
+          tensor = to<TensorRead>(tensor)->tensor;
+        }
+        if (isa<VarExpr>(tensor)) {
+          analysis->opaque.insert(to<VarExpr>(tensor)->var);
+        }
+        IRVisitor::visit(op);
+      }
+      void visit(const CallStmt *op) {
+        for (const Var& result : op->results) {
+          analysis->opaque.insert(result);
+        }
+        IRVisitor::visit(op);
+      }
+    };
+    Definitions definitions(this);
+    func.getBody().accept(&definitions);
+  }
+
+  /// True iff the expression is a scalar or a symmetric matrix.
+  bool isSymmetric(const Expr& expr) {
+    Type type = expr.type();
+    if (isScalar(type)) {
+      return true;
+    }
+    if (!type.isTensor() || type.toTensor()->order() != 2 ||
+        type.toTensor()->getDimensions()[0] !=
+        type.toTensor()->getDimensions()[1]) {
+      return false;
+    }
+
+    if (isa<VarExpr>(expr)) {
+      const Var& var = to<VarExpr>(expr)->var;
+      if (util::contains(constants, var)) {
+        return isSymmetric(constants.at(var));
+      }
+      if (util::contains(opaque, var) || !util::contains(definitions, var)) {
+        return false;
+      }
+      // A variable whose definitions are symmetric whenever the variable is
+      // symmetric, starting from zero, is always symmetric
+      if (util::contains(visiting, var)) {
+        return true;
+      }
+      visiting.insert(var);
+      bool symmetric = true;
+      for (const Expr& definition : definitions.at(var)) {
+        symmetric = symmetric && isSymmetric(definition);
+      }
+      visiting.erase(var);
+      return symmetric;
+    }
+    else if (isa<Literal>(expr)) {
+      const Literal* literal = to<Literal>(expr);
+      const TensorType* ttype = type.toTensor();
+      if (!ttype->getComponentType().isFloat() ||
+          ttype->getDimensions()[0].getIndexSets().size() != 1) {
+        return false;
+      }
+      int n = ttype->getDimensions()[0].getSize();
+      for (int i=0; i < n; ++i) {
+        for (int j=i+1; j < n; ++j) {
+          if (literal->getFloatVal(i*n+j) != literal->getFloatVal(j*n+i)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+    else if (isa<IndexExpr>(expr)) {
+      const IndexExpr* indexExpr = to<IndexExpr>(expr);
+      return indexExpr->resultVars.size() == 2 &&
+             isSwapInvariant(indexExpr->value, indexExpr->resultVars[0],
+                             indexExpr->resultVars[1]);
+    }
+    else if (isa<Neg>(expr)) {
+      return isSymmetric(to<Neg>(expr)->a);
+    }
+    else if (isa<Add>(expr) || isa<Sub>(expr)) {
+      return isSymmetric(to<BinaryExpr>(expr)->a) &&
+             isSymmetric(to<BinaryExpr>(expr)->b);
+    }
+    else if (isa<Mul>(expr) || isa<Div>(expr)) {
+      const BinaryExpr* binary = to<BinaryExpr>(expr);
+      return (isScalar(binary->a.type()) && isSymmetric(binary->b)) ||
+             (isScalar(binary->b.type()) && isSymmetric(binary->a));
+    }
+    return false;
+  }
+
+private:
+  map<Var,Expr> constants;
+  map<Var,vector<Expr>> definitions;
+  /// Variables that are written in ways that are not analyzed
+  set<Var> opaque;
+  set<Var> visiting;
+
+  /// True iff the index expression value is the same when i and j are swapped.
+  bool isSwapInvariant(const Expr& expr, const IndexVar& i, const IndexVar& j) {
+    if (isa<IndexedTensor>(expr)) {
+      const IndexedTensor* tensor = to<IndexedTensor>(expr);
+      const vector<IndexVar>& ivs = tensor->indexVars;
+      if (ivs.size() == 2 && ((ivs[0] == i && ivs[1] == j) ||
+                              (ivs[0] == j && ivs[1] == i))) {
+        return isSymmetric(tensor->tensor);
+      }
+      return !usesIndexVars(expr, i, j);
+    }
+    else if (isa<Neg>(expr)) {
+      return isSwapInvariant(to<Neg>(expr)->a, i, j);
+    }
+    else if (isa<Add>(expr) || isa<Sub>(expr) || isa<Div>(expr)) {
+      return isSwapInvariant(to<BinaryExpr>(expr)->a, i, j) &&
+             isSwapInvariant(to<BinaryExpr>(expr)->b, i, j);
+    }
+    else if (isa<Mul>(expr)) {
+      // Either both factors are invariant, or swapping them swaps i and j, as
+      // in the outer product U(i)*U(j)
+      const Mul* mul = to<Mul>(expr);
+      if (isSwapInvariant(mul->a, i, j) && isSwapInvariant(mul->b, i, j)) {
+        return true;
+      }
+      map<IndexVar,IndexVar> swap = {{i,j}, {j,i}};
+      return equal(mul->a, mul->b, &swap);
+    }
+    return !usesIndexVars(expr, i, j);
+  }
+};
+
+/// A write of a block of an assembled matrix, and the conditions it is made
+/// under, as the if statements it is nested in and their taken branches.
+struct BlockWrite {
+  Expr row;
+  Expr col;
+  Expr value;
+  CompoundOperator cop;
+  vector<pair<const IfThenElse*,bool>> conditions;
+};
+
+/// Collects the block writes of a matrix in an assembly function. The writes
+/// cannot be analyzed if the function reads the matrix, or writes it in a
+/// loop or other than block by block.
+class BlockWrites : public IRVisitor {
+public:
+  BlockWrites(const Var& matrix) : matrix(matrix) {}
+
+  vector<BlockWrite> writes;
+  bool valid = true;
+
+private:
+  Var matrix;
+  vector<pair<const IfThenElse*,bool>> conditions;
+  int loopDepth = 0;
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr *op) {
+    if (op->var == matrix) {
+      valid = false;
+    }
+  }
+
+  void visit(const AssignStmt *op) {
+    if (op->var == matrix) {
+      valid = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    if (util::contains(op->results, matrix)) {
+      valid = false;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const TensorWrite *op) {
+    if (!isa<VarExpr>(op->tensor) || to<VarExpr>(op->tensor)->var != matrix) {
+      IRVisitor::visit(op);
+      return;
+    }
+    if (op->indices.size() != 2 || loopDepth > 0) {
+      valid = false;
+      return;
+    }
+    writes.push_back({op->indices[0], op->indices[1], op->value, op->cop,
+                      conditions});
+    for (const Expr& index : op->indices) {
+      index.accept(this);
+    }
+    op->value.accept(this);
+  }
+
+  void visit(const IfThenElse *op) {
+    op->condition.accept(this);
+    conditions.push_back({op, true});
+    op->thenBody.accept(this);
+    conditions.back().second = false;
+    if (op->elseBody.defined()) {
+      op->elseBody.accept(this);
+    }
+    conditions.pop_back();
+  }
+
+  void visit(const ForRange *op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const For *op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+
+  void visit(const While *op) {
+    ++loopDepth;
+    IRVisitor::visit(op);
+    --loopDepth;
+  }
+};
+
+/// Returns true iff the matrix the function assembles into `matrix` is
+/// symmetric, because each block it writes off the diagonal has a partner
+/// block written to the transposed location under the same conditions, whose
+/// value is its transpose, and the blocks it writes to the diagonal are
+/// symmetric.
+static bool assemblesSymmetricMatrix(const Func& func, const Var& matrix) {
+  BlockWrites blockWrites(matrix);
+  func.getBody().accept(&blockWrites);
+  if (!blockWrites.valid || blockWrites.writes.size() == 0) {
+    return false;
+  }
+
+  SymmetryAnalysis symmetry(func);
+  const vector<BlockWrite>& writes = blockWrites.writes;
+  vector<bool> paired(writes.size(), false);
+  for (size_t i=0; i < writes.size(); ++i) {
+    const BlockWrite& write = writes[i];
+    if (equal(write.row, write.col)) {
+      if (!symmetry.isSymmetric(write.value)) {
+        return false;
+      }
+      continue;
+    }
+    if (paired[i]) {
+      continue;
+    }
+    bool foundPartner = false;
+    for (size_t j=i+1; j < writes.size() && !foundPartner; ++j) {
+      const BlockWrite& partner = writes[j];
+      if (paired[j] || partner.cop != write.cop ||
+          partner.conditions != write.conditions ||
+          !equal(partner.row, write.col) || !equal(partner.col, write.row)) {
+        continue;
+      }
+      if (isTranspose(write.value, partner.value) ||
+          (equal(write.value, partner.value) &&
+           symmetry.isSymmetric(write.value))) {
+        paired[i] = paired[j] = foundPartner = true;
+      }
+    }
+    if (!foundPartner) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Returns true iff the variable is a square system matrix with square or
+/// scalar blocks, that the caller does not receive or return.
+static bool isSquareSystemMatrix(const Var& var, const Func& caller) {
+  if (!var.getType().isTensor()) {
+    return false;
+  }
+  const TensorType* type = var.getType().toTensor();
+  if (type->order() != 2 || !type->hasSystemDimensions() ||
+      type->getDimensions()[0] != type->getDimensions()[1] ||
+      util::contains(caller.getArguments(), var) ||
+      util::contains(caller.getResults(), var)) {
+    return false;
+  }
+  Type block = type->getBlockType();
+  const TensorType* blockType = block.toTensor();
+  return blockType->order() == 0 ||
+         (blockType->order() == 2 &&
+          blockType->getDimensions()[0] == blockType->getDimensions()[1]);
+}
+
+/// Determines whether the uses of a matrix are all matrix-vector products and
+/// solves, which can use the matrix's upper triangle.
+class SymmetricMatrixUses : public IRVisitor {
+public:
+  SymmetricMatrixUses(const Var& matrix, const Map* assembly)
+      : matrix(matrix), assembly(assembly) {}
+
+  bool hasOtherUses = false;
+
+private:
+  Var matrix;
+  const Map* assembly;
+
+  using IRVisitor::visit;
+
+  void visit(const VarExpr *op) {
+    if (op->var == matrix) {
+      hasOtherUses = true;
+    }
+  }
+
+  void visit(const AssignStmt *op) {
+    Var y, A, x;
+    if (isMatrixVectorProduct(op, &y, &A, &x) && A == matrix) {
+      if (y == matrix || x == matrix || y == x) {
+        hasOtherUses = true;
+      }
+      return;
+    }
+    if (op->var == matrix) {
+      hasOtherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    if (util::contains(op->results, matrix)) {
+      hasOtherUses = true;
+    }
+    size_t first = 0;
+    if (op->callee == intrinsics::solve() && op->actuals.size() > 0 &&
+        isa<VarExpr>(op->actuals[0]) &&
+        to<VarExpr>(op->actuals[0])->var == matrix) {
+      first = 1;
+    }
+    for (size_t i=first; i < op->actuals.size(); ++i) {
+      op->actuals[i].accept(this);
+    }
+  }
+
+  void visit(const Map *op) {
+    if (op == assembly) {
+      return;
+    }
+    if (util::contains(op->vars, matrix)) {
+      hasOtherUses = true;
+    }
+    IRVisitor::visit(op);
+  }
+};
+
+/// Rewrites the products of symmetric matrices to symmetric products, and
+/// declares the product results that have not been declared, as their
+/// assignments did.
+class SymmetricProductRewriter : public IRRewriter {
+public:
+  SymmetricProductRewriter(const Func& func, const set<Var>& matrices)
+      : matrices(matrices) {
+    declared.insert(func.getArguments().begin(), func.getArguments().end());
+    declared.insert(func.getResults().begin(), func.getResults().end());
+    for (auto& constant : func.getEnvironment().getConstants()) {
+      declared.insert(constant.first);
+    }
+    for (auto& temporary : func.getEnvironment().getTemporaries()) {
+      declared.insert(temporary);
+    }
+  }
+
+private:
+  const set<Var>& matrices;
+  set<Var> declared;
+
+  using IRRewriter::visit;
+
+  void visit(const VarDecl *op) {
+    declared.insert(op->var);
+    stmt = op;
+  }
+
+  void visit(const AssignStmt *op) {
+    Var y, A, x;
+    if (isMatrixVectorProduct(op, &y, &A, &x) && util::contains(matrices, A)) {
+      stmt = CallStmt::make({y}, intrinsics::symmetricMatVec(), {A, x});
+      if (!util::contains(declared, y)) {
+        stmt = Block::make(VarDecl::make(y), stmt);
+      }
+    }
+    else {
+      stmt = op;
+    }
+    declared.insert(op->var);
+  }
+
+  void visit(const CallStmt *op) {
+    declared.insert(op->results.begin(), op->results.end());
+    stmt = op;
+  }
+
+  void visit(const Map *op) {
+    declared.insert(op->vars.begin(), op->vars.end());
+    stmt = op;
+  }
+};
+
+Func makeSymmetricMatrices(Func func) {
+  class Assemblies : public IRVisitor {
+  public:
+    vector<const Map*> maps;
+    using IRVisitor::visit;
+    void visit(const Map *op) {
+      maps.push_back(op);
+    }
+  };
+  Assemblies assemblies;
+  func.getBody().accept(&assemblies);
+
+  set<Var> matrices;
+  for (const Map* map : assemblies.maps) {
+    const SetType* targetType = map->target.type().toSet();
+    if (map->reduction.getKind() != ReductionOperator::Sum ||
+        targetType->getCardinality() == 0 || !map->neighbors.defined()) {
+      continue;
+    }
+
+    PathExpressionBuilder peBuilder;
+    for (size_t i=0; i < map->vars.size(); ++i) {
+      const Var& matrix = map->vars[i];
+      if (util::contains(matrices, matrix) ||
+          !isSquareSystemMatrix(matrix, func)) {
+        continue;
+      }
+
+      SymmetricMatrixUses uses(matrix, map);
+      func.getBody().accept(&uses);
+      if (uses.hasOtherUses ||
+          !assemblesSymmetricMatrix(map->function,
+                                    map->function.getResults()[i])) {
+        continue;
+      }
+
+      // Store the matrix in an upper triangular index, which storage
+      // determination keeps
+      peBuilder.computePathExpression(map);
+      pe::PathExpression pexpr = peBuilder.getPathExpression(matrix);
+      Environment& env = func.getEnvironment();
+      env.addTensorIndex(pexpr, matrix, true);
+      func.getStorage().add(matrix,
+          TensorStorage(TensorStorage::Indexed,
+                        env.getTensorIndex(pexpr, true)));
+      matrices.insert(matrix);
+    }
+  }
+  if (matrices.size() == 0) {
+    return func;
+  }
+
+  Stmt body = SymmetricProductRewriter(func, matrices).rewrite(func.getBody());
+  return Func(func, body);
+}
+
+}}
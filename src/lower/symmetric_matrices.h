@@ -0,0 +1,24 @@
+#ifndef SIMIT_SYMMETRIC_MATRICES_H
+#define SIMIT_SYMMETRIC_MATRICES_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Returns true iff assembled matrices that are provably symmetric should be
+/// stored as their upper triangles (see setSymmetricMatrices).
+bool useSymmetricMatrices();
+
+/// Stores matrices that are assembled by a map and provably symmetric as their
+/// upper triangles. A matrix is symmetric if every block its assembly function
+/// writes off the diagonal has a partner block written to the transposed
+/// location under the same conditions, whose value is its transpose, and if
+/// the blocks written to the diagonal are symmetric. The matrix must only be
+/// used in matrix-vector products, which become symmetric products, and in
+/// solves. Must run on flattened index expressions, before storage is
+/// determined.
+Func makeSymmetricMatrices(Func func);
+
+}}
+#endif
@@ -0,0 +1,210 @@
+#include "multigrid.h"
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+#include "graph.h"
+#include "tensor_data.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+
+/// The most grid cells along each dimension, so that cell coordinates can be
+/// packed into one key.
+static const int64_t maxCells = 1 << 20;
+
+/// Returns the spatial field of the set as three doubles per element.
+static vector<double> getPositions(Set& set) {
+  uassert(set.hasSpatialField())
+      << "Multigrid hierarchies require a set with a spatial field";
+  Set::FieldData* field =
+      set.getFields()[set.getFieldIndex(set.getSpatialFieldName())];
+  const int n = set.getSize();
+  vector<double> positions(n*3);
+  switch (field->type->getComponentType()) {
+    case ComponentType::Double: {
+      const double* data = static_cast<const double*>(field->data);
+      copy(data, data + n*3, positions.begin());
+      break;
+    }
+    case ComponentType::Float: {
+      const float* data = static_cast<const float*>(field->data);
+      copy(data, data + n*3, positions.begin());
+      break;
+    }
+    default:
+      uerror << "The spatial field must hold floats or doubles";
+  }
+  return positions;
+}
+
+// class MultigridHierarchy
+MultigridHierarchy::MultigridHierarchy(Set& fine, int coarsestSize) {
+  uassert(coarsestSize >= 1)
+      << "The coarsest multigrid level must have at least one element";
+  vector<double> positions = getPositions(fine);
+  spatialField = fine.getSpatialFieldName();
+  sizes.push_back(fine.getSize());
+  ones.resize(fine.getSize(), 1.0);
+
+  while (sizes.back() > coarsestSize) {
+    positions = coarsen(positions);
+  }
+}
+
+MultigridHierarchy::~MultigridHierarchy() {
+}
+
+vector<double> MultigridHierarchy::coarsen(const vector<double>& positions) {
+  const int n = positions.size() / 3;
+  iassert(n > 1);
+
+  double lo[3], hi[3];
+  for (int d=0; d < 3; ++d) {
+    lo[d] = hi[d] = positions[d];
+  }
+  for (int i=0; i < n; ++i) {
+    for (int d=0; d < 3; ++d) {
+      lo[d] = min(lo[d], positions[i*3+d]);
+      hi[d] = max(hi[d], positions[i*3+d]);
+    }
+  }
+
+  // Cells are twice the mean spacing s of the elements along the dimensions
+  // they extend in, so that each holds about two elements along each
+  // dimension. Each element covers a cell of size s, so s is the fixed point
+  // of s^dims = prod(extent+s) / n. Cells start half an element before the
+  // first elements, so regularly spaced elements do not straddle cell faces.
+  int dims = 0;
+  double maxExtent = 0.0;
+  for (int d=0; d < 3; ++d) {
+    if (hi[d] > lo[d]) {
+      ++dims;
+      maxExtent = max(maxExtent, hi[d] - lo[d]);
+    }
+  }
+  double spacing = maxExtent / n;
+  for (int iteration=0; dims > 0 && iteration < 32; ++iteration) {
+    double volume = 1.0;
+    for (int d=0; d < 3; ++d) {
+      if (hi[d] > lo[d]) {
+        volume *= hi[d] - lo[d] + spacing;
+      }
+    }
+    spacing = pow(volume / n, 1.0 / dims);
+  }
+  double cellSize = (dims > 0) ? 2.0 * spacing : 1.0;
+  cellSize = max(cellSize, maxExtent / (maxCells - 2));
+  for (int d=0; d < 3; ++d) {
+    lo[d] -= cellSize / 4;
+  }
+
+  // Number the aggregates in the order of their first elements, which keeps
+  // the locality of reordered sets. Irregularly spaced elements may not share
+  // cells, in which case the cells grow until some do.
+  vector<int> aggregate(n);
+  unordered_map<int64_t,int> cells;
+  while (true) {
+    cells.clear();
+    for (int i=0; i < n; ++i) {
+      int64_t key = 0;
+      for (int d=0; d < 3; ++d) {
+        int64_t cell = (int64_t)((positions[i*3+d] - lo[d]) / cellSize);
+        key = key * maxCells + min(cell, maxCells - 1);
+      }
+      auto it = cells.insert({key, (int)cells.size()}).first;
+      aggregate[i] = it->second;
+    }
+    if ((int)cells.size() < n) {
+      break;
+    }
+    cellSize *= 2.0;
+  }
+  const int numAggregates = cells.size();
+
+  // The restriction holds the elements of each aggregate, in order
+  vector<int> prolongationRowPtr(n+1);
+  for (int i=0; i <= n; ++i) {
+    prolongationRowPtr[i] = i;
+  }
+  vector<int> restrictionRowPtr(numAggregates+1, 0);
+  for (int i=0; i < n; ++i) {
+    ++restrictionRowPtr[aggregate[i]+1];
+  }
+  for (int a=0; a < numAggregates; ++a) {
+    restrictionRowPtr[a+1] += restrictionRowPtr[a];
+  }
+  vector<int> restrictionColIdx(n);
+  vector<int> next(restrictionRowPtr.begin(), restrictionRowPtr.end()-1);
+  for (int i=0; i < n; ++i) {
+    restrictionColIdx[next[aggregate[i]]++] = i;
+  }
+
+  // Aggregates lie at the centroids of their elements
+  vector<double> centroids(numAggregates*3, 0.0);
+  for (int i=0; i < n; ++i) {
+    for (int d=0; d < 3; ++d) {
+      centroids[aggregate[i]*3+d] += positions[i*3+d];
+    }
+  }
+  for (int a=0; a < numAggregates; ++a) {
+    int count = restrictionRowPtr[a+1] - restrictionRowPtr[a];
+    for (int d=0; d < 3; ++d) {
+      centroids[a*3+d] /= count;
+    }
+  }
+
+  unique_ptr<Set> coarse(new Set());
+  coarse->addField<double,3>(spatialField);
+  coarse->addN(numAggregates);
+  double* coarsePositions =
+      static_cast<double*>(coarse->getFieldData(spatialField));
+  copy(centroids.begin(), centroids.end(), coarsePositions);
+  coarse->setSpatialField(spatialField);
+
+  aggregates.push_back(move(aggregate));
+  prolongationRowPtrs.push_back(move(prolongationRowPtr));
+  restrictionRowPtrs.push_back(move(restrictionRowPtr));
+  restrictionColIdxs.push_back(move(restrictionColIdx));
+  sets.push_back(move(coarse));
+  sizes.push_back(numAggregates);
+  return centroids;
+}
+
+Set& MultigridHierarchy::getSet(int level) {
+  uassert(level >= 1 && level < getNumLevels())
+      << "The hierarchy has no coarse level " << level;
+  return *sets[level-1];
+}
+
+SparseMatrixView MultigridHierarchy::getProlongation(int level) const {
+  uassert(level >= 0 && level+1 < getNumLevels())
+      << "The hierarchy has no transfer from level " << level+1;
+  SparseMatrixView view;
+  view.numBlockRows = sizes[level];
+  view.numBlockCols = sizes[level+1];
+  view.rowPtr = prolongationRowPtrs[level].data();
+  view.colIdx = aggregates[level].data();
+  view.vals = const_cast<double*>(ones.data());
+  view.componentType = ComponentType::Double;
+  return view;
+}
+
+SparseMatrixView MultigridHierarchy::getRestriction(int level) const {
+  uassert(level >= 0 && level+1 < getNumLevels())
+      << "The hierarchy has no transfer to level " << level+1;
+  SparseMatrixView view;
+  view.numBlockRows = sizes[level+1];
+  view.numBlockCols = sizes[level];
+  view.rowPtr = restrictionRowPtrs[level].data();
+  view.colIdx = restrictionColIdxs[level].data();
+  view.vals = const_cast<double*>(ones.data());
+  view.componentType = ComponentType::Double;
+  return view;
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef SIMIT_MULTIGRID_H
+#define SIMIT_MULTIGRID_H
+
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+class Set;
+struct SparseMatrixView;
+
+/// A hierarchy of coarsened vertex sets for multigrid solves, built by
+/// aggregating the elements of a set that are close in its spatial field (see
+/// Set::setSpatialField). Each element of a coarse set aggregates the elements
+/// of the next finer set that lie in a cell of a uniform grid, whose cells hold
+/// about two elements along each dimension, and lies at their centroid.
+///
+/// The transfer operators between levels are piecewise constant: prolongation
+/// copies the value of each aggregate to its elements, and restriction sums the
+/// values of the elements of each aggregate. Set the hierarchy as the
+/// multigridHierarchy of SolverParams to coarsen the solves of matrices indexed
+/// by the finest set with it.
+class MultigridHierarchy : private interfaces::Uncopyable {
+public:
+  /// Coarsen the set until the coarsest set has at most coarsestSize elements.
+  /// The set must have a spatial field of floats or doubles.
+  explicit MultigridHierarchy(Set& fine, int coarsestSize=64);
+  ~MultigridHierarchy();
+
+  /// The number of levels, including the finest set.
+  int getNumLevels() const {return sizes.size();}
+
+  /// The number of elements of the set of the level, where level 0 is the
+  /// finest set.
+  int getSize(int level) const {return sizes[level];}
+
+  /// The coarse set of a level other than the finest, whose elements have the
+  /// spatial field of the finest set.
+  Set& getSet(int level);
+
+  /// The aggregate on level+1 of each element of the level.
+  const std::vector<int>& getAggregates(int level) const {
+    return aggregates[level];
+  }
+
+  /// The prolongation from level+1 to the level, as a matrix with a row per
+  /// element of the level whose only entry is a one in the column of its
+  /// aggregate. The view refers to memory owned by the hierarchy.
+  SparseMatrixView getProlongation(int level) const;
+
+  /// The restriction from the level to level+1, which is the transpose of the
+  /// prolongation: row i holds the elements of aggregate i, in order.
+  SparseMatrixView getRestriction(int level) const;
+
+private:
+  std::string spatialField;
+  std::vector<int> sizes;
+  std::vector<std::vector<int>> aggregates;
+  std::vector<std::unique_ptr<Set>> sets;
+
+  /// The row pointers of the prolongations, and the row pointers and columns
+  /// of the restrictions, of each level but the coarsest
+  std::vector<std::vector<int>> prolongationRowPtrs;
+  std::vector<std::vector<int>> restrictionRowPtrs;
+  std::vector<std::vector<int>> restrictionColIdxs;
+
+  /// The values of the transfer operators, which are all one
+  std::vector<double> ones;
+
+  /// Add a level that aggregates the elements at the given positions, and
+  /// return the positions of the aggregates.
+  std::vector<double> coarsen(const std::vector<double>& positions);
+};
+
+}
+#endif
@@ -47,7 +47,7 @@ struct SetContent {
   std::string name;
 
   SetContent(std::string name) : name(name) {}
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(const SetContent *v) {++v->ref;}
   friend inline void release(const SetContent *v) {if (--v->ref==0) delete v;}
 };
@@ -65,7 +65,7 @@ public:
 struct VarContent {
   std::string name;
   Set set;
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(const VarContent *v) {++v->ref;}
   friend inline void release(const VarContent *v) {if (--v->ref==0) delete v;}
 };
@@ -124,7 +124,7 @@ public:
   friend bool operator==(const PathExpressionImpl&, const PathExpressionImpl&);
   friend bool operator<(const PathExpressionImpl&, const PathExpressionImpl&);
 
-  mutable long ref = 0;
+  mutable std::atomic<long> ref{0};
   friend inline void aquire(const PathExpressionImpl *p) {++p->ref;}
   friend inline void release(const PathExpressionImpl *p) {
     if (--p->ref==0) delete p;
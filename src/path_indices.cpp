@@ -4,9 +4,15 @@
 #include <stack>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <cstring>
+#include <memory>
 
 #include "path_expressions.h"
 #include "graph.h"
+#include "graph_indices.h"
 #include "util/collections.h"
 
 using namespace std;
@@ -131,6 +137,49 @@ SegmentedPathIndex::neighbors(unsigned elemID) const {
                               &sinksData[coordsData[elemID]]);
 }
 
+template <typename T>
+void SegmentedPathIndex::patch(unsigned numRows,
+    const std::function<std::pair<const T*,const T*>(unsigned)>& getRow) {
+  iassert(numRows >= numElems);
+  if (numRows > numElems) {
+    coordsData = (uint32_t*)internal::alignedRealloc(
+        coordsData, (numRows+1)*sizeof(uint32_t));
+    fill(coordsData+numElems+1, coordsData+numRows+1, coordsData[numElems]);
+    numElems = numRows;
+  }
+
+  // Find the rows that changed
+  vector<internal::RowResize> resized;
+  long long size = coordsData[numElems];
+  for (unsigned elem=0; elem < numElems; ++elem) {
+    pair<const T*,const T*> row = getRow(elem);
+    int oldRowSize = coordsData[elem+1] - coordsData[elem];
+    int rowSize = row.second - row.first;
+    if (rowSize != oldRowSize ||
+        !equal(row.first, row.second, sinksData + coordsData[elem])) {
+      resized.push_back({(int)elem, oldRowSize, rowSize});
+      size += rowSize - oldRowSize;
+    }
+  }
+  if (resized.size() == 0) {
+    return;
+  }
+
+  if ((size_t)size > sinksCapacity) {
+    sinksCapacity = size + size/4;
+    sinksData = (uint32_t*)internal::alignedRealloc(
+        sinksData, sinksCapacity*sizeof(uint32_t));
+  }
+  internal::resizeRows(coordsData, numElems, resized,
+      [&](long long from, long long to, long long count) {
+        memmove(sinksData + to, sinksData + from, count*sizeof(uint32_t));
+      });
+  for (const internal::RowResize &r : resized) {
+    pair<const T*,const T*> row = getRow(r.row);
+    copy(row.first, row.second, sinksData + coordsData[r.row]);
+  }
+}
+
 void SegmentedPathIndex::print(std::ostream &os) const {
   os << "SegmentedPathIndex:";
   os << "\n  ";
@@ -144,6 +193,67 @@ void SegmentedPathIndex::print(std::ostream &os) const {
 }
 
 
+/// Sort the entries of `row` from `rowBegin` and remove duplicates.
+static void sortUnique(vector<uint32_t> *row, size_t rowBegin) {
+  sort(row->begin()+rowBegin, row->end());
+  row->erase(unique(row->begin()+rowBegin, row->end()), row->end());
+}
+
+/// A view of the neighbors of a path index in compressed sparse row form, where
+/// the neighbors of each element are sorted and unique. Segmented path indices
+/// are viewed in place, while other path indices are packed into the view.
+class NeighborRows {
+public:
+  NeighborRows(const PathIndex &pi) {
+    if (isa<SegmentedPathIndex>(pi)) {
+      const SegmentedPathIndex *spi = to<SegmentedPathIndex>(pi);
+      numElems = spi->numElements();
+      coords = spi->getCoordData();
+      sinks = spi->getSinkData();
+      return;
+    }
+
+    numElems = pi.numElements();
+    internal::buildRowsInParallel<uint32_t>(numElems,
+        [&](int elem, vector<uint32_t> *row) {
+          size_t rowBegin = row->size();
+          for (unsigned nbr : pi.neighbors(elem)) {
+            row->push_back(nbr);
+          }
+          sortUnique(row, rowBegin);
+        },
+        &coordsStorage, &sinksStorage);
+    coords = coordsStorage.data();
+    sinks = sinksStorage.data();
+  }
+
+  unsigned numElements() const {return numElems;}
+  unsigned numNeighbors() const {return coords[numElems];}
+  unsigned numNeighbors(unsigned elem) const {
+    return coords[elem+1] - coords[elem];
+  }
+
+  const uint32_t *begin(unsigned elem) const {return sinks + coords[elem];}
+  const uint32_t *end(unsigned elem) const {return sinks + coords[elem+1];}
+
+  /// One more than the largest neighbor of any element.
+  unsigned getSinkBound() const {
+    unsigned bound = 0;
+    for (unsigned i=0; i < numNeighbors(); ++i) {
+      bound = max(bound, sinks[i]+1);
+    }
+    return bound;
+  }
+
+private:
+  unsigned numElems;
+  const uint32_t *coords;
+  const uint32_t *sinks;
+
+  vector<uint32_t> coordsStorage;
+  vector<uint32_t> sinksStorage;
+};
+
 // class PathIndexBuilder
 PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
                                            unsigned sourceEndpoint){
@@ -168,35 +278,29 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     }
 
   private:
-    /// Pack neighbor vectors into a segmented vector (contiguous array).
-    PathIndex pack(const map<unsigned, set<unsigned>> &pathNeighbors) {
-      unsigned numNeighbors = 0;
-      for (auto &p : pathNeighbors) {
-        numNeighbors += p.second.size();
-      }
-
-      size_t numElements = pathNeighbors.size();
-      uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
-      uint32_t* sinksData = (uint32_t*)malloc(numNeighbors*sizeof(uint32_t));
-
-      int currNbrsStart = 0;
-      for (auto& p : pathNeighbors) {
-        unsigned elem = p.first;
-        coordsData[elem] = currNbrsStart;
-
-        unsigned pNeighborSize = p.second.size();
-        if (pNeighborSize > 0) {
-          vector<unsigned> pNeighbors(p.second.begin(), p.second.end());
-          sort(pNeighbors.begin(), pNeighbors.end());
-
-          memcpy(&sinksData[currNbrsStart], pNeighbors.data(),
-                 pNeighbors.size() * sizeof(uint32_t));
-
-          currNbrsStart += pNeighborSize;
-        }
-      }
-      coordsData[numElements] = currNbrsStart;
-      return new SegmentedPathIndex(numElements, coordsData, sinksData);;
+    /// Pack neighbor rows into a segmented vector (contiguous array).
+    PathIndex pack(const vector<uint32_t> &coords,
+                   const vector<uint32_t> &sinks) {
+      iassert(coords.size() > 0 && coords.back() == sinks.size());
+      size_t numElements = coords.size()-1;
+      uint32_t* coordsData =
+          (uint32_t*)internal::alignedMalloc(coords.size()*sizeof(uint32_t));
+      uint32_t* sinksData =
+          (uint32_t*)internal::alignedMalloc(sinks.size()*sizeof(uint32_t));
+      memcpy(coordsData, coords.data(), coords.size()*sizeof(uint32_t));
+      memcpy(sinksData, sinks.data(), sinks.size()*sizeof(uint32_t));
+      return new SegmentedPathIndex(numElements, coordsData, sinksData);
+    }
+    PathIndex pack(const vector<int> &coords, const vector<int> &sinks) {
+      iassert(coords.size() > 0 && coords.back() == (int)sinks.size());
+      size_t numElements = coords.size()-1;
+      uint32_t* coordsData =
+          (uint32_t*)internal::alignedMalloc(coords.size()*sizeof(uint32_t));
+      uint32_t* sinksData =
+          (uint32_t*)internal::alignedMalloc(sinks.size()*sizeof(uint32_t));
+      copy(coords.begin(), coords.end(), coordsData);
+      copy(sinks.begin(), sinks.end(), sinksData);
+      return new SegmentedPathIndex(numElements, coordsData, sinksData);
     }
 
     void visit(const Link *link) {
@@ -211,25 +315,18 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           break;
         }
         case Link::ve: {
-          // add each edge to the neighbor vectors of its endpoints
-          map<unsigned, set<unsigned>> pathNeighbors;
-
-          // create neighbor lists
+          // Counting sort the edges by their endpoints, which lists the edges
+          // of each vertex in order
           const simit::Set& vertexSet =
               *builder->getBinding(link->getVertexSet());
-          for (auto &v : vertexSet) {
-            pathNeighbors.insert({v.getIdent(), set<unsigned>()});
-          }
-
-          // populate neighbor lists
-          for (auto &e : edgeSet) {
-            iassert(e.getIdent() >= 0);
-            for (auto &ep : edgeSet.getEndpoints(e)) {
-              iassert(ep.getIdent() >= 0);
-              pathNeighbors.at(ep.getIdent()).insert(e.getIdent());
-            }
-          }
-          pi = pack(pathNeighbors);
+          vector<int> slots(edgeSet.getCardinality());
+          iota(slots.begin(), slots.end(), 0);
+
+          vector<int> coords;
+          vector<int> sinks;
+          internal::buildVertexToEdges(edgeSet, slots, vertexSet.getSize(),
+                                       &coords, &sinks);
+          pi = pack(coords, sinks);
           break;
         }
       }
@@ -292,31 +389,25 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
+      vector<uint32_t> coords;
+      vector<uint32_t> sinks;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
 
-        // Build a path index that is the intersection of lhsIndex and rhsIndex.
-        // OPT: If path indices supported efficient lookups we could instead:
-        //      for each (elem,nbr) pair in lhs, if it exist in rhs then emit.
-        map<unsigned, set<unsigned>> lhsPathNeighbors;
-        for (unsigned elem : lhsIndex) {
-          lhsPathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            lhsPathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            auto &elemNbrs = lhsPathNeighbors.at(elem);
-            if (elemNbrs.find(nbr) != elemNbrs.end()) {
-              pathNeighbors.at(elem).insert(nbr);
-            }
-          }
-        }
+        // Build a path index that is the intersection of lhsIndex and rhsIndex,
+        // by intersecting the sorted neighbor rows of each element.
+        NeighborRows lhsRows(lhsIndex);
+        NeighborRows rhsRows(rhsIndex);
+        iassert(rhsRows.numElements() <= lhsRows.numElements());
+        internal::buildRowsInParallel<uint32_t>(rhsRows.numElements(),
+            [&](int elem, vector<uint32_t> *row) {
+              set_intersection(lhsRows.begin(elem), lhsRows.end(elem),
+                               rhsRows.begin(elem), rhsRows.end(elem),
+                               back_inserter(*row));
+            },
+            &coords, &sinks);
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -337,17 +428,36 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
             buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
 
         // Build a path index from the first free variable to the second free
-        // variable, through the quantified variable.
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          for (unsigned q : sourceToQuantified.neighbors(source)) {
-            for (unsigned sink : quantifiedToSink.neighbors(q)) {
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
-        }
+        // variable, through the quantified variable. This is the sparsity
+        // pattern of the product of the two indices, which we expand row by
+        // row, marking the sinks already reached from the current source.
+        // Each thread keeps its own marks.
+        NeighborRows sourceRows(sourceToQuantified);
+        NeighborRows quantifiedRows(quantifiedToSink);
+        const unsigned sinkBound = quantifiedRows.getSinkBound();
+        typedef function<void(int,vector<uint32_t>*)> RowBuilder;
+        internal::buildRowsInParallelWith<uint32_t>(sourceRows.numElements(),
+            [&]() -> RowBuilder {
+              auto lastSource = make_shared<vector<int>>(sinkBound, -1);
+              return [&,lastSource](int source, vector<uint32_t> *row) {
+                size_t rowBegin = row->size();
+                for (const uint32_t *q = sourceRows.begin(source);
+                     q != sourceRows.end(source); ++q) {
+                  iassert(*q < quantifiedRows.numElements());
+                  for (const uint32_t *sink = quantifiedRows.begin(*q);
+                       sink != quantifiedRows.end(*q); ++sink) {
+                    if ((*lastSource)[*sink] != source) {
+                      (*lastSource)[*sink] = source;
+                      row->push_back(*sink);
+                    }
+                  }
+                }
+                sort(row->begin()+rowBegin, row->end());
+              };
+            },
+            &coords, &sinks);
       }
-      pi = pack(pathNeighbors);
+      pi = pack(coords, sinks);
     }
 
     void visit(const Or *f) {
@@ -358,25 +468,30 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
+      vector<uint32_t> coords;
+      vector<uint32_t> sinks;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
 
-        // Build a path index that is the union of lhsIndex and rhsIndex
-        for (unsigned elem : lhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          iassert(pathNeighbors.find(elem) != pathNeighbors.end());
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
-        }
+        // Build a path index that is the union of lhsIndex and rhsIndex, by
+        // merging the sorted neighbor rows of each element.
+        NeighborRows lhsRows(lhsIndex);
+        NeighborRows rhsRows(rhsIndex);
+        iassert(rhsRows.numElements() <= lhsRows.numElements());
+        internal::buildRowsInParallel<uint32_t>(lhsRows.numElements(),
+            [&](int elem, vector<uint32_t> *row) {
+              if ((unsigned)elem < rhsRows.numElements()) {
+                set_union(lhsRows.begin(elem), lhsRows.end(elem),
+                          rhsRows.begin(elem), rhsRows.end(elem),
+                          back_inserter(*row));
+              }
+              else {
+                row->insert(row->end(), lhsRows.begin(elem), lhsRows.end(elem));
+              }
+            },
+            &coords, &sinks);
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -404,28 +519,49 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         // quantified variable. Every free variable that can reach any
         // quantified variable gets links to every element of the second
         // variable. Vice versa for the second variable, but jump from the
-        // quantified var.
-        auto sinkSet = builder->getBinding(f->getSet(freeVars[1]));
-
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          if (sourceToQuantified.numNeighbors(source) > 0) {
-            for (auto &sinkElem : *sinkSet) {
-              unsigned sink = sinkElem.getIdent();
-              pathNeighbors.at(source).insert(sink);
-            }
+        // quantified var. Every source thus gets one of two neighbor rows.
+        NeighborRows sourceRows(sourceToQuantified);
+        NeighborRows quantifiedRows(quantifiedToSink);
+
+        // The sinks reachable from any quantified variable, in order
+        vector<bool> reachable(quantifiedRows.getSinkBound(), false);
+        for (unsigned q=0; q < quantifiedRows.numElements(); ++q) {
+          for (const uint32_t *sink = quantifiedRows.begin(q);
+               sink != quantifiedRows.end(q); ++sink) {
+            reachable[*sink] = true;
+          }
+        }
+        vector<uint32_t> reachableSinks;
+        for (unsigned sink=0; sink < reachable.size(); ++sink) {
+          if (reachable[sink]) {
+            reachableSinks.push_back(sink);
           }
         }
 
-        for (unsigned quantified : quantifiedToSink) {
-          for (unsigned sink: quantifiedToSink.neighbors(quantified)) {
-            for (unsigned source : sourceToQuantified) {
-              pathNeighbors.at(source).insert(sink);
-            }
+        // Every sink set element, plus the reachable sinks
+        unsigned numSinkElems = builder->getBinding(f->getSet(freeVars[1]))
+                                       ->getSize();
+        vector<uint32_t> allSinks;
+        allSinks.reserve(max<size_t>(numSinkElems, reachableSinks.size()));
+        for (unsigned sink=0; sink < numSinkElems; ++sink) {
+          allSinks.push_back(sink);
+        }
+        for (uint32_t sink : reachableSinks) {
+          if (sink >= numSinkElems) {
+            allSinks.push_back(sink);
           }
         }
+
+        internal::buildRowsInParallel<uint32_t>(sourceRows.numElements(),
+            [&](int source, vector<uint32_t> *row) {
+              const vector<uint32_t> &sourceSinks =
+                  (sourceRows.numNeighbors(source) > 0) ? allSinks
+                                                        : reachableSinks;
+              row->insert(row->end(), sourceSinks.begin(), sourceSinks.end());
+            },
+            &coords, &sinks);
       }
-      pi = pack(pathNeighbors);
+      pi = pack(coords, sinks);
     }
 
     PathIndex pi;  // Path index returned from cases
@@ -446,6 +582,113 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
   return pi;
 }
 
+PathIndex PathIndexBuilder::buildUpperTriangular(const PathIndex &pi) {
+  NeighborRows rows(pi);
+  vector<uint32_t> coords;
+  vector<uint32_t> sinks;
+  internal::buildRowsInParallel<uint32_t>(rows.numElements(),
+      [&](int elem, vector<uint32_t> *row) {
+        row->insert(row->end(),
+                    lower_bound(rows.begin(elem), rows.end(elem), elem),
+                    rows.end(elem));
+      },
+      &coords, &sinks);
+
+  uint32_t* coordsData =
+      (uint32_t*)internal::alignedMalloc(coords.size()*sizeof(uint32_t));
+  uint32_t* sinksData =
+      (uint32_t*)internal::alignedMalloc(sinks.size()*sizeof(uint32_t));
+  copy(coords.begin(), coords.end(), coordsData);
+  copy(sinks.begin(), sinks.end(), sinksData);
+  return new SegmentedPathIndex(coords.size()-1, coordsData, sinksData);
+}
+
+bool PathIndexBuilder::updateSegmented(const PathExpression &pe,
+                                       const PathIndex &pi) {
+  const simit::Set* edgeSet = getNeighborEdgeSet(pe);
+  if (edgeSet == nullptr || !isa<SegmentedPathIndex>(pi)) {
+    return false;
+  }
+  const internal::NeighborIndex *nbrs = edgeSet->getNeighborIndex();
+  if ((unsigned)nbrs->getNumVertices() < pi.numElements()) {
+    return false;
+  }
+
+  // The index is only shared by its owner and this builder's memoized indices
+  SegmentedPathIndex *index =
+      const_cast<SegmentedPathIndex*>(to<SegmentedPathIndex>(pi));
+  const int *start = nbrs->getStartIndex();
+  const int *neighbors = nbrs->getNeighborIndex();
+  index->patch<int>(nbrs->getNumVertices(), [&](unsigned v) {
+    return make_pair(neighbors + start[v], neighbors + start[v+1]);
+  });
+  pathIndices[{pe,0}] = pi;
+  return true;
+}
+
+void PathIndexBuilder::updateUpperTriangular(const PathIndex &pi,
+                                             const PathIndex &upper) {
+  NeighborRows rows(pi);
+  SegmentedPathIndex *index =
+      const_cast<SegmentedPathIndex*>(to<SegmentedPathIndex>(upper));
+  index->patch<uint32_t>(rows.numElements(), [&](unsigned elem) {
+    return make_pair((const uint32_t*)lower_bound(rows.begin(elem),
+                                                  rows.end(elem), elem),
+                     rows.end(elem));
+  });
+}
+
+const simit::Set*
+PathIndexBuilder::getNeighborEdgeSet(const PathExpression &pe) const {
+  if (!isa<And>(pe)) {
+    return nullptr;
+  }
+  const And *path = to<And>(pe);
+  if (path->getFreeVars().size() != 2 ||
+      path->getQuantifiedVars().size() != 1) {
+    return nullptr;
+  }
+
+  // The path must go from the first free variable to an edge, and from the
+  // edge to the second free variable
+  PathExpression lhs = path->getLhs();
+  PathExpression rhs = path->getRhs();
+  Var u = path->getFreeVars()[0];
+  Var v = path->getFreeVars()[1];
+  Var e = path->getQuantifiedVars()[0].getVar();
+  if (!(lhs.getPathEndpoint(0) == u) || !(lhs.getPathEndpoint(1) == e) ||
+      !(rhs.getPathEndpoint(0) == e) || !(rhs.getPathEndpoint(1) == v)) {
+    return nullptr;
+  }
+  auto getLink = [](PathExpression pe) -> const Link* {
+    if (isa<RenamedPathExpression>(pe)) {
+      pe = to<RenamedPathExpression>(pe)->getPathExpression();
+    }
+    return isa<Link>(pe) ? to<Link>(pe) : nullptr;
+  };
+  const Link *ve = getLink(lhs);
+  const Link *ev = getLink(rhs);
+  if (ve == nullptr || ev == nullptr ||
+      ve->getType() != Link::ve || ev->getType() != Link::ev ||
+      !ve->getEdgeSet().defined() || !ev->getEdgeSet().defined() ||
+      !ve->getVertexSet().defined() || !ev->getVertexSet().defined()) {
+    return nullptr;
+  }
+
+  // The edges must connect the elements of the free variables' set
+  const simit::Set *edgeSet = getBinding(ve->getEdgeSet());
+  if (edgeSet != getBinding(ev->getEdgeSet()) ||
+      edgeSet->getCardinality() < 2 || !edgeSet->isHomogeneous()) {
+    return nullptr;
+  }
+  const simit::Set *vertexSet = edgeSet->getEndpointSet(0);
+  if (getBinding(ve->getVertexSet()) != vertexSet ||
+      getBinding(ev->getVertexSet()) != vertexSet) {
+    return nullptr;
+  }
+  return edgeSet;
+}
+
 void PathIndexBuilder::bind(std::string name, const simit::Set* set) {
   bindings.insert({name,set});
 }
@@ -5,8 +5,11 @@
 #include <map>
 #include <memory>
 #include <typeinfo>
+#include <functional>
+#include <utility>
 
 #include "graph.h"
+#include "allocator.h"
 #include "path_expressions.h"
 #include "interfaces/printable.h"
 
@@ -175,8 +178,8 @@ private:
 class SegmentedPathIndex : public PathIndexImpl {
 public:
   ~SegmentedPathIndex() {
-    free(coordsData);
-    free(sinksData);
+    internal::alignedFree(coordsData);
+    internal::alignedFree(sinksData);
   }
 
   unsigned numElements() const {return numElems;}
@@ -199,14 +202,27 @@ private:
   uint32_t* coordsData;
   uint32_t* sinksData;
 
+  /// The number of neighbors sinksData has room for
+  size_t sinksCapacity;
+
   void print(std::ostream &os) const;
 
+  /// Rewrite the rows that differ from the rows `getRow` returns in place, and
+  /// move the rows between them. Rows are added for new elements. The buffers
+  /// are only reallocated when they grow past their capacity.
+  template <typename T>
+  void patch(unsigned numRows,
+             const std::function<std::pair<const T*,const T*>(unsigned)>&
+                 getRow);
+
   friend PathIndexBuilder;
 
   SegmentedPathIndex(size_t numElements, uint32_t *nbrsStart, uint32_t *nbrs)
-      : numElems(numElements), coordsData(nbrsStart), sinksData(nbrs) {}
+      : numElems(numElements), coordsData(nbrsStart), sinksData(nbrs),
+        sinksCapacity(nbrsStart[numElements]) {}
 
-  SegmentedPathIndex() : numElems(0), coordsData(nullptr), sinksData(nullptr) {
+  SegmentedPathIndex() : numElems(0), coordsData(nullptr), sinksData(nullptr),
+                         sinksCapacity(0) {
     coordsData = new uint32_t[1];
     coordsData[0] = 0;
   }
@@ -237,12 +253,33 @@ public:
   // Build a Segmented path index by evaluating the `pe` over the given graph.
   PathIndex buildSegmented(const PathExpression &pe, unsigned sourceEndpoint);
 
+  // Build a Segmented path index with the neighbors of each element in `pi`
+  // that are not smaller than the element, which is the upper triangle of the
+  // matrices `pi` indexes.
+  PathIndex buildUpperTriangular(const PathIndex &pi);
+
+  // Update the Segmented path index `pi` of `pe`, built when the bound sets
+  // had other elements, in place to the sets' current elements. Only the rows
+  // that changed are rewritten. Neighbor path expressions (u-e-v) of
+  // homogeneous edge sets are updated from the edge set's neighbor index, which
+  // the set patches as edges are added and removed. Returns false for other
+  // path expressions, whose indices must be built again.
+  bool updateSegmented(const PathExpression &pe, const PathIndex &pi);
+
+  // Update the upper triangle `upper` (see buildUpperTriangular) of a path
+  // index in place after the path index was updated.
+  void updateUpperTriangular(const PathIndex &pi, const PathIndex &upper);
+
   void bind(std::string name, const simit::Set* set);
 
   const simit::Set* getBinding(pe::Set pset) const;
 
 private:
   std::map<std::pair<PathExpression,unsigned>, PathIndex> pathIndices;
+
+  // Returns the edge set of a neighbor path expression (see updateSegmented),
+  // or nullptr if `pe` is not one.
+  const simit::Set* getNeighborEdgeSet(const PathExpression &pe) const;
   std::map<std::string, const simit::Set*> bindings;
 };
 
@@ -2,6 +2,10 @@
 
 #include <set>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <algorithm>
 
 #include "ir.h"
 #include "frontend/frontend.h"
@@ -20,6 +24,7 @@ namespace simit {
 
 const std::vector<std::string> VALID_BACKENDS = {
   "cpu",
+  "cpu-parallel",
 #ifdef GPU
   "gpu",
 #endif
@@ -109,6 +114,48 @@ Function Program::compileWithTimers(const std::string &function) {
   return simit::compile(simitFunc, content->backend, true);
 }
 
+std::vector<Function>
+Program::compileAll(const std::vector<std::string> &functions) {
+  vector<Function> compiled(functions.size());
+  vector<exception_ptr> errors(functions.size());
+
+  // Threads take the next function to compile until none are left
+  atomic<size_t> next(0);
+  auto compileNext = [&]() {
+    for (size_t i=next++; i < functions.size(); i=next++) {
+      try {
+        compiled[i] = compile(functions[i]);
+      }
+      catch (...) {
+        errors[i] = current_exception();
+      }
+    }
+  };
+  size_t numThreads = min<size_t>(functions.size(),
+                                  max(1u, thread::hardware_concurrency()));
+  vector<thread> threads;
+  for (size_t t=1; t < numThreads; ++t) {
+    threads.push_back(thread(compileNext));
+  }
+  compileNext();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto &error : errors) {
+    if (error) {
+      rethrow_exception(error);
+    }
+  }
+  return compiled;
+}
+
+std::future<Function> Program::compileAsync(const std::string &function) {
+  return async(launch::async, [this, function]() {
+    return compile(function);
+  });
+}
+
 int Program::verify() {
   // For each test look up the called function. Grab the actual arguments and
   // run the function with them as input.  Then compare the result to the
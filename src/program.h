@@ -5,6 +5,7 @@
 #include <ostream>
 #include <vector>
 #include <memory>
+#include <future>
 
 #include "function.h"
 #include "init.h"
@@ -48,6 +49,16 @@ public:
   Function compile(const std::string &function);
   Function compileWithTimers(const std::string &function);
 
+  /// Compile the functions concurrently and return them in the same order.
+  /// Each function is lowered and compiled on a thread of its own, with up to
+  /// one thread per hardware thread. If some functions fail to compile, the
+  /// error of the first of them is rethrown once all compilations finish.
+  std::vector<Function> compileAll(const std::vector<std::string> &functions);
+
+  /// Compile the function on another thread. The program must not be cleared
+  /// or destroyed until the compilation finishes.
+  std::future<Function> compileAsync(const std::string &function);
+
   /// Verify the program by executing in-code comment tests.
   int verify();
 
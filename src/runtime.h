@@ -4,16 +4,52 @@
 #include <time.h>
 #include <vector>
 
+#include "thread_pool.h"
+#include "solver.h"
+#include "block_kernels.h"
+#include "allocator.h"
+
+namespace simit {
+namespace internal {
+/// The number of chunks the edges of each color of a colored loop are split
+/// into. The chunks do not depend on the number of threads, so reductions that
+/// combine per-chunk results in chunk order give the same result for any
+/// number of threads.
+const int kColoredLoopChunks = 256;
+}
+}
+
 extern "C" {
 
 // appease GCC
-void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
+void cMatSolve_f64(void* solver, int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, double* A,
-                   double* x, double* b);
-void cMatSolve_f32(int n,  int m,  int* rowPtr, int* colIdx,
+                   double* b, double* x);
+void cMatSolve_f32(void* solver, int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, float* A,
-                   float* x, float* b);
+                   float* b, float* x);
+void cMatSolveSymmetric_f64(void* solver, int n,  int m,  int* rowPtr,
+                            int* colIdx, int nn, int mm, double* A,
+                            double* b, double* x);
+void cMatSolveSymmetric_f32(void* solver, int n,  int m,  int* rowPtr,
+                            int* colIdx, int nn, int mm, float* A,
+                            float* b, float* x);
+void cMatVecSymmetric_f64(void* solver, int n,  int m,  int* rowPtr,
+                          int* colIdx, int nn, int mm, double* A, double* x,
+                          double* y);
+void cMatVecSymmetric_f32(void* solver, int n,  int m,  int* rowPtr,
+                          int* colIdx, int nn, int mm, float* A, float* x,
+                          float* y);
 int loc(int v0, int v1, int *neighbors_start, int *neighbors);
+void* simitMalloc(size_t size);
+void simitFree(void* ptr);
+void simitParallelFor(int begin, int end,
+                      void (*body)(int begin, int end, void* closure),
+                      void* closure);
+void simitParallelForColored(const int* colorsStart, int numEdges,
+                             void (*body)(int begin, int end, int chunk,
+                                          void* closure),
+                             void* closure);
 
 double atan2_f64(double y, double x);
 float atan2_f32(float y, float x);
@@ -27,6 +63,10 @@ double det3_f64(double* a);
 float det3_f32(float* a);
 void inv3_f64(double* a, double* inv);
 void inv3_f32(float* a, float* inv);
+void simitBlockGemm_f64(double* A, double* B, int m, int k, int n,
+                        int transposeA, int transposeB, double* C);
+void simitBlockGemm_f32(float* A, float* B, int m, int k, int n,
+                        int transposeA, int transposeB, float* C);
 double complexNorm_f64(double r, double i);
 float complexNorm_f32(float r, float i);  
 
@@ -34,102 +74,74 @@ float complexNorm_f32(float r, float i);
 void simitStoreTime(int i, double value);
 double simitClock();
 
-// If Eigen is not detected, make solves just do a noop.
-// This is not a #else because we will in the future support more
-// solver backends.
-#ifndef EIGEN
-void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
+static simit::internal::SolverContext* getSolverContext(void* solver) {
+  return (solver != nullptr) ? (simit::internal::SolverContext*)solver
+                             : &simit::internal::getDefaultSolverContext();
+}
+
+// Solves A*x = b, where A is an n x m block sparse matrix with nn x mm blocks
+// in Simit's BCSR layout, with the calling function's solver context.
+void cMatSolve_f64(void* solver, int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, double* A,
-                   double* x, double* b) {
-  return;
+                   double* b, double* x) {
+#ifndef SIMIT_EXTERN_SOLVE_NOOP
+  simit::internal::BlockSparseMatrix<double> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                    nn, mm, A, false};
+  getSolverContext(solver)->solve(mat, b, x);
+#endif
 }
 
-void cMatSolve_f32(int n, int m, int* rowPtr, int* colIdx,
+void cMatSolve_f32(void* solver, int n,  int m,  int* rowPtr, int* colIdx,
                    int nn, int mm, float* A,
-                   float* x, float* b) {
-  return;
-}
+                   float* b, float* x) {
+#ifndef SIMIT_EXTERN_SOLVE_NOOP
+  simit::internal::BlockSparseMatrix<float> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                   nn, mm, A, false};
+  getSolverContext(solver)->solve(mat, b, x);
 #endif
-} // extern "C"
-
-
-#ifdef EIGEN
-#include <Eigen/Core>
-#include <Eigen/Dense>
-#include <Eigen/Sparse>
-#include <Eigen/IterativeLinearSolvers>
-
-extern "C" {
-// NOTE: Implementation MUST stay synchronized with cMatSolve_f32
-void cMatSolve_f64(int n,  int m,  int* rowPtr, int* colIdx,
-                   int nn, int mm, double* A,
-                   double* x, double* b) {
-  using namespace Eigen;
-  int nnz = rowPtr[n/nn];
-
-  auto xvec = new Eigen::Map<Eigen::Matrix<double,Dynamic,1>>(x, m);
-  auto cvec = new Eigen::Map<Eigen::Matrix<double,Dynamic,1>>(b, n);
-  
-  // Construct the matrix
-  std::vector<Triplet<double>> tripletList;
-  tripletList.reserve(nnz*nn*mm);
-  for (int i=0; i<n/(nn); i++) {
-    for (int j=rowPtr[i]; j<rowPtr[i+1]; j++) {
-      for (int bi=0; bi<nn; bi++) {
-        for (int bj=0; bj<mm; bj++) {
-          tripletList.push_back(Triplet<double>(i*nn+bi, colIdx[j]*mm+bj,
-                                                A[j*nn*mm+bi*nn+bj]));
-        }
-      }
-    }
-  }
-  SparseMatrix<double> mat(n, m);
-  mat.setFromTriplets(tripletList.begin(), tripletList.end());
+}
 
+// Solves A*x = b like cMatSolve, where A is a symmetric matrix that only
+// stores the blocks on and above its diagonal.
+void cMatSolveSymmetric_f64(void* solver, int n,  int m,  int* rowPtr,
+                            int* colIdx, int nn, int mm, double* A,
+                            double* b, double* x) {
 #ifndef SIMIT_EXTERN_SOLVE_NOOP
-  ConjugateGradient<SparseMatrix<double>,Lower,IdentityPreconditioner> solver;
-  solver.setMaxIterations(50);
-  solver.compute(mat);
-  *cvec = solver.solve(*xvec);
+  simit::internal::BlockSparseMatrix<double> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                    nn, mm, A, true};
+  getSolverContext(solver)->solve(mat, b, x);
 #endif
 }
 
-// NOTE: Implementation MUST stay synchronized with cMatSolve_f64
-void cMatSolve_f32(int n,  int m,  int* rowPtr, int* colIdx,
-                   int nn, int mm, float* A,
-                   float* x, float* b) {
-  using namespace Eigen;
-  int nnz = rowPtr[n/nn];
-
-  auto xvec = new Eigen::Map<Eigen::Matrix<float,Dynamic,1>>(x, m);
-  auto cvec = new Eigen::Map<Eigen::Matrix<float,Dynamic,1>>(b, n);
-
-  // Construct the matrix
-  std::vector<Triplet<float>> tripletList;
-  tripletList.reserve(nnz*nn*mm);
-  for (int i=0; i<n/(nn); i++) {
-    for (int j=rowPtr[i]; j<rowPtr[i+1]; j++) {
-      for (int bi=0; bi<nn; bi++) {
-        for (int bj=0; bj<mm; bj++) {
-          tripletList.push_back(Triplet<float>(i*nn+bi, colIdx[j]*mm+bj,
-                                               A[j*nn*mm+bi*nn+bj]));
-        }
-      }
-    }
-  }
-  SparseMatrix<float> mat(n, m);
-  mat.setFromTriplets(tripletList.begin(), tripletList.end());
-  
+void cMatSolveSymmetric_f32(void* solver, int n,  int m,  int* rowPtr,
+                            int* colIdx, int nn, int mm, float* A,
+                            float* b, float* x) {
 #ifndef SIMIT_EXTERN_SOLVE_NOOP
-  ConjugateGradient<SparseMatrix<float>,Lower,IdentityPreconditioner> solver;
-  solver.setMaxIterations(50);
-  solver.compute(mat);
-  *cvec = solver.solve(*xvec);
+  simit::internal::BlockSparseMatrix<float> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                   nn, mm, A, true};
+  getSolverContext(solver)->solve(mat, b, x);
 #endif
-  
+}
+
+// Computes y = A*x, where A is a symmetric matrix that only stores the blocks
+// on and above its diagonal. The solver context keeps the index of the blocks
+// below the diagonal.
+void cMatVecSymmetric_f64(void* solver, int n,  int m,  int* rowPtr,
+                          int* colIdx, int nn, int mm, double* A, double* x,
+                          double* y) {
+  simit::internal::BlockSparseMatrix<double> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                    nn, mm, A, true};
+  getSolverContext(solver)->multiplySymmetric(mat, x, y);
+}
+
+void cMatVecSymmetric_f32(void* solver, int n,  int m,  int* rowPtr,
+                          int* colIdx, int nn, int mm, float* A, float* x,
+                          float* y) {
+  simit::internal::BlockSparseMatrix<float> mat = {n/nn, m/mm, rowPtr, colIdx,
+                                                   nn, mm, A, true};
+  getSolverContext(solver)->multiplySymmetric(mat, x, y);
 }
 } // extern "C"
-#endif // ifdef EIGEN
 
 
 extern "C" {
@@ -140,6 +152,53 @@ int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
   return l;
 }
 
+// Allocates the buffers of compiled functions with the installed allocator,
+// aligned so that their accesses may be vectorized without peeling.
+void* simitMalloc(size_t size) {
+  return simit::internal::alignedMalloc(size);
+}
+
+void simitFree(void* ptr) {
+  simit::internal::alignedFree(ptr);
+}
+
+// Runs body over chunks of [begin,end) on the thread pool. The closure holds
+// the values the outlined loop body captured from the enclosing function.
+void simitParallelFor(int begin, int end,
+                      void (*body)(int begin, int end, void* closure),
+                      void* closure) {
+  simit::internal::getThreadPool().parallelFor(begin, end,
+      [body,closure](int chunkBegin, int chunkEnd) {
+        body(chunkBegin, chunkEnd, closure);
+      });
+}
+
+// Runs body over each color of an edge coloring in turn, where the edges of a
+// color are the range [colorsStart[c],colorsStart[c+1]) of the edges sorted by
+// color. Colors are non-empty, so the last color ends at numEdges. The edges of
+// each color are split into kColoredLoopChunks chunks, and body gets the number
+// of the chunk it executes.
+void simitParallelForColored(const int* colorsStart, int numEdges,
+                             void (*body)(int begin, int end, int chunk,
+                                          void* closure),
+                             void* closure) {
+  const int numChunks = simit::internal::kColoredLoopChunks;
+  simit::internal::ThreadPool& pool = simit::internal::getThreadPool();
+  for (int color=0; colorsStart[color] < numEdges; ++color) {
+    int begin = colorsStart[color];
+    long long numColorEdges = colorsStart[color+1] - begin;
+    pool.parallelFor(0, numChunks, [=](int chunkBegin, int chunkEnd) {
+      for (int chunk=chunkBegin; chunk < chunkEnd; ++chunk) {
+        int edgesBegin = begin + (int)(numColorEdges * chunk / numChunks);
+        int edgesEnd = begin + (int)(numColorEdges * (chunk+1) / numChunks);
+        if (edgesBegin < edgesEnd) {
+          body(edgesBegin, edgesEnd, chunk, closure);
+        }
+      }
+    });
+  }
+}
+
 // atan2 wrapper
 double atan2_f64(double y, double x) {
   return atan2(y, x);
@@ -250,6 +309,18 @@ void inv3_f32(float * a, float * inv){
   inv[8] = cof22 * determ;
 }
 
+// Computes C = op(A)*op(B) for small dense matrices, where op(A) is m x k and
+// op(B) is k x n, with the block kernels for this CPU.
+void simitBlockGemm_f64(double* A, double* B, int m, int k, int n,
+                        int transposeA, int transposeB, double* C) {
+  simit::internal::blockGemm(m, k, n, A, transposeA, B, transposeB, C);
+}
+
+void simitBlockGemm_f32(float* A, float* B, int m, int k, int n,
+                        int transposeA, int transposeB, float* C) {
+  simit::internal::blockGemm(m, k, n, A, transposeA, B, transposeB, C);
+}
+
 double complexNorm_f64(double r, double i) {
   return sqrt(r*r+i*i);
 }
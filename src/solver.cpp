@@ -0,0 +1,1442 @@
+#include "solver.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <tuple>
+#include <algorithm>
+#include <limits>
+
+#ifdef EIGEN
+#include <Eigen/Core>
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+#endif
+
+#include "multigrid.h"
+#include "thread_pool.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+
+static void checkParams(const SolverParams& params) {
+  uassert(params.tolerance >= 0.0) << "The solver tolerance cannot be negative";
+  uassert(params.maxIterations >= 0)
+      << "The solver iteration limit cannot be negative";
+#ifndef EIGEN
+  uassert(params.method != SolverParams::LDLT &&
+          params.method != SolverParams::Cholesky)
+      << "Sparse factorizations require Simit to be built with Eigen";
+#endif
+}
+
+static SolverParams solverParams;
+
+void setSolverParams(const SolverParams& params) {
+  checkParams(params);
+  solverParams = params;
+}
+
+const SolverParams& getSolverParams() {
+  return solverParams;
+}
+
+namespace internal {
+
+/// Multiply block rows [begin,end) with x. Non-zero NN and MM fix the block
+/// sizes at compile time, so that the block loops are unrolled.
+template <typename T, int NN, int MM>
+static void spmvRows(const BlockSparseMatrix<T>& A, const T* x, T* y,
+                     int begin, int end) {
+  const int nn = (NN != 0) ? NN : A.rowBlockSize;
+  const int mm = (MM != 0) ? MM : A.colBlockSize;
+  const int blockSize = nn*mm;
+  for (int i=begin; i < end; ++i) {
+    T* yi = &y[i*nn];
+    for (int bi=0; bi < nn; ++bi) {
+      yi[bi] = 0;
+    }
+    for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+      const T* block = &A.vals[j*blockSize];
+      const T* xj = &x[A.colIdx[j]*mm];
+      for (int bi=0; bi < nn; ++bi) {
+        T sum = 0;
+        for (int bj=0; bj < mm; ++bj) {
+          sum += block[bi*mm+bj] * xj[bj];
+        }
+        yi[bi] += sum;
+      }
+    }
+  }
+}
+
+/// The blocks below the diagonal of a matrix that stores its upper triangle,
+/// indexed by block row: lower block row i holds the stored blocks of block
+/// column i above the diagonal, [rowPtr[i],rowPtr[i+1]), where block k is the
+/// transpose of the stored block at blocks[k] in block row rows[k].
+struct LowerBlockIndex {
+  vector<int> rowPtr;
+  vector<int> rows;
+  vector<int> blocks;
+
+  /// Index the blocks of A with a counting sort by column, which keeps the
+  /// blocks of each lower row sorted by column.
+  template <typename T>
+  void build(const BlockSparseMatrix<T>& A) {
+    build(A.numBlockRows, A.rowPtr, A.colIdx);
+  }
+
+  void build(int numBlockRows, const int* rowPtrA, const int* colIdxA) {
+    rowPtr.assign(numBlockRows+1, 0);
+    for (int i=0; i < numBlockRows; ++i) {
+      for (int j=rowPtrA[i]; j < rowPtrA[i+1]; ++j) {
+        if (colIdxA[j] > i) {
+          ++rowPtr[colIdxA[j]+1];
+        }
+      }
+    }
+    for (int i=0; i < numBlockRows; ++i) {
+      rowPtr[i+1] += rowPtr[i];
+    }
+    rows.resize(rowPtr[numBlockRows]);
+    blocks.resize(rowPtr[numBlockRows]);
+    vector<int> next(rowPtr.begin(), rowPtr.end()-1);
+    for (int i=0; i < numBlockRows; ++i) {
+      for (int j=rowPtrA[i]; j < rowPtrA[i+1]; ++j) {
+        int col = colIdxA[j];
+        if (col > i) {
+          rows[next[col]] = i;
+          blocks[next[col]] = j;
+          ++next[col];
+        }
+      }
+    }
+  }
+};
+
+/// Multiply block rows [begin,end) of a matrix that stores its upper triangle
+/// with x, adding the transposed blocks of the lower triangle, so that each
+/// row is only written by the thread that computes it.
+template <typename T, int N>
+static void spmvSymmetricRows(const BlockSparseMatrix<T>& A,
+                              const LowerBlockIndex& lower, const T* x, T* y,
+                              int begin, int end) {
+  const int n = (N != 0) ? N : A.rowBlockSize;
+  const int blockSize = n*n;
+  for (int i=begin; i < end; ++i) {
+    T* yi = &y[i*n];
+    for (int bi=0; bi < n; ++bi) {
+      yi[bi] = 0;
+    }
+    for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+      const T* block = &A.vals[j*blockSize];
+      const T* xj = &x[A.colIdx[j]*n];
+      for (int bi=0; bi < n; ++bi) {
+        T sum = 0;
+        for (int bj=0; bj < n; ++bj) {
+          sum += block[bi*n+bj] * xj[bj];
+        }
+        yi[bi] += sum;
+      }
+    }
+    for (int k=lower.rowPtr[i]; k < lower.rowPtr[i+1]; ++k) {
+      const T* block = &A.vals[lower.blocks[k]*blockSize];
+      const T* xj = &x[lower.rows[k]*n];
+      for (int bi=0; bi < n; ++bi) {
+        T sum = 0;
+        for (int bj=0; bj < n; ++bj) {
+          sum += block[bj*n+bi] * xj[bj];
+        }
+        yi[bi] += sum;
+      }
+    }
+  }
+}
+
+template <typename T>
+static void spmvSymmetric(const BlockSparseMatrix<T>& A,
+                          const LowerBlockIndex& lower, const T* x, T* y) {
+  iassert(A.rowBlockSize == A.colBlockSize)
+      << "Symmetric matrices must have square blocks";
+  void (*rows)(const BlockSparseMatrix<T>&, const LowerBlockIndex&, const T*,
+               T*, int, int);
+  if (A.rowBlockSize == 3) {
+    rows = spmvSymmetricRows<T,3>;
+  }
+  else if (A.rowBlockSize == 1) {
+    rows = spmvSymmetricRows<T,1>;
+  }
+  else {
+    rows = spmvSymmetricRows<T,0>;
+  }
+  getThreadPool().parallelFor(0, A.numBlockRows, [&](int begin, int end) {
+    rows(A, lower, x, y, begin, end);
+  });
+}
+
+template <typename T>
+static void spmv(const BlockSparseMatrix<T>& A, const T* x, T* y) {
+  if (A.upperTriangular) {
+    LowerBlockIndex lower;
+    lower.build(A);
+    spmvSymmetric(A, lower, x, y);
+    return;
+  }
+
+  void (*rows)(const BlockSparseMatrix<T>&, const T*, T*, int, int);
+  if (A.rowBlockSize == 3 && A.colBlockSize == 3) {
+    rows = spmvRows<T,3,3>;
+  }
+  else if (A.rowBlockSize == 1 && A.colBlockSize == 1) {
+    rows = spmvRows<T,1,1>;
+  }
+  else {
+    rows = spmvRows<T,0,0>;
+  }
+  getThreadPool().parallelFor(0, A.numBlockRows, [&](int begin, int end) {
+    rows(A, x, y, begin, end);
+  });
+}
+
+void blockSpMV(const BlockSparseMatrix<double>& A, const double* x,
+               double* y) {
+  spmv(A, x, y);
+}
+
+void blockSpMV(const BlockSparseMatrix<float>& A, const float* x, float* y) {
+  spmv(A, x, y);
+}
+
+/// Multiply block rows [begin,end) with x like spmvRows, but decode the column
+/// of each block from its difference to the previous column of the row.
+/// Escaped columns are read in order from escaped, which must point to the
+/// first escaped column of row begin.
+template <typename T, typename D, int NN, int MM>
+static void spmvCompressedRows(const BlockSparseMatrix<T>& A, const D* deltas,
+                               const int* escaped, const T* x, T* y,
+                               int begin, int end) {
+  const D escape = numeric_limits<D>::min();
+  const int nn = (NN != 0) ? NN : A.rowBlockSize;
+  const int mm = (MM != 0) ? MM : A.colBlockSize;
+  const int blockSize = nn*mm;
+  for (int i=begin; i < end; ++i) {
+    T* yi = &y[i*nn];
+    for (int bi=0; bi < nn; ++bi) {
+      yi[bi] = 0;
+    }
+    int col = i;
+    for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+      const D delta = deltas[j];
+      col = (delta != escape) ? col + delta : *escaped++;
+      const T* block = &A.vals[j*blockSize];
+      const T* xj = &x[col*mm];
+      for (int bi=0; bi < nn; ++bi) {
+        T sum = 0;
+        for (int bj=0; bj < mm; ++bj) {
+          sum += block[bi*mm+bj] * xj[bj];
+        }
+        yi[bi] += sum;
+      }
+    }
+  }
+}
+
+template <typename T, typename D>
+static void spmvCompressed(const BlockSparseMatrix<T>& A, const D* deltas,
+                           const vector<int>& escaped,
+                           const vector<int>& escapedPtr, const T* x, T* y) {
+  void (*rows)(const BlockSparseMatrix<T>&, const D*, const int*, const T*, T*,
+               int, int);
+  if (A.rowBlockSize == 3 && A.colBlockSize == 3) {
+    rows = spmvCompressedRows<T,D,3,3>;
+  }
+  else if (A.rowBlockSize == 1 && A.colBlockSize == 1) {
+    rows = spmvCompressedRows<T,D,1,1>;
+  }
+  else {
+    rows = spmvCompressedRows<T,D,0,0>;
+  }
+  getThreadPool().parallelFor(0, A.numBlockRows, [&](int begin, int end) {
+    const int* rowEscaped = nullptr;
+    if (!escapedPtr.empty()) {
+      // Count the escaped columns from the last row with a pointer
+      const D escape = numeric_limits<D>::min();
+      int first = begin - begin % CompressedBlockIndex::ESCAPED_PTR_STRIDE;
+      rowEscaped = escaped.data() +
+                   escapedPtr[first / CompressedBlockIndex::ESCAPED_PTR_STRIDE];
+      for (int j=A.rowPtr[first]; j < A.rowPtr[begin]; ++j) {
+        rowEscaped += (deltas[j] == escape) ? 1 : 0;
+      }
+    }
+    rows(A, deltas, rowEscaped, x, y, begin, end);
+  });
+}
+
+/// True iff the column difference fits in D without being the escape value.
+template <typename D>
+static bool fits(int delta) {
+  return delta > numeric_limits<D>::min() && delta <= numeric_limits<D>::max();
+}
+
+// class CompressedBlockIndex
+CompressedBlockIndex::CompressedBlockIndex() : deltaBytes(4), numBlocks(0) {
+}
+
+void CompressedBlockIndex::compress(int numBlockRows, const int* rowPtr,
+                                    const int* colIdx) {
+  // Count the columns each width has to escape, and keep the smallest index
+  numBlocks = rowPtr[numBlockRows];
+  size_t escaped8 = 0;
+  size_t escaped16 = 0;
+  for (int i=0; i < numBlockRows; ++i) {
+    int col = i;
+    for (int j=rowPtr[i]; j < rowPtr[i+1]; ++j) {
+      int delta = colIdx[j] - col;
+      escaped8 += fits<int8_t>(delta) ? 0 : 1;
+      escaped16 += fits<int16_t>(delta) ? 0 : 1;
+      col = colIdx[j];
+    }
+  }
+  size_t numEscapedPtrs = numBlockRows / ESCAPED_PTR_STRIDE + 1;
+  auto bytes = [&](size_t width, size_t numEscaped) {
+    size_t escapedBytes = (numEscaped > 0)
+        ? (numEscaped + numEscapedPtrs) * sizeof(int) : 0;
+    return (size_t)numBlocks*width + escapedBytes;
+  };
+  size_t bytes8 = bytes(1, escaped8);
+  size_t bytes16 = bytes(2, escaped16);
+  size_t bytes32 = (size_t)numBlocks * sizeof(int);
+
+  deltas8.clear();
+  deltas16.clear();
+  escaped.clear();
+  escapedPtr.clear();
+  if (bytes8 <= bytes16 && bytes8 < bytes32) {
+    deltaBytes = 1;
+    encode(numBlockRows, rowPtr, colIdx, &deltas8);
+  }
+  else if (bytes16 < bytes32) {
+    deltaBytes = 2;
+    encode(numBlockRows, rowPtr, colIdx, &deltas16);
+  }
+  else {
+    deltaBytes = 4;
+  }
+}
+
+template <typename D>
+void CompressedBlockIndex::encode(int numBlockRows, const int* rowPtr,
+                                  const int* colIdx, vector<D>* deltas) {
+  deltas->resize(rowPtr[numBlockRows]);
+  for (int i=0; i < numBlockRows; ++i) {
+    if (i % ESCAPED_PTR_STRIDE == 0) {
+      escapedPtr.push_back(escaped.size());
+    }
+    int col = i;
+    for (int j=rowPtr[i]; j < rowPtr[i+1]; ++j) {
+      int delta = colIdx[j] - col;
+      if (fits<D>(delta)) {
+        (*deltas)[j] = (D)delta;
+      }
+      else {
+        (*deltas)[j] = numeric_limits<D>::min();
+        escaped.push_back(colIdx[j]);
+      }
+      col = colIdx[j];
+    }
+  }
+  // Rows without escaped columns need no pointers
+  if (escaped.size() == 0) {
+    escapedPtr.clear();
+  }
+}
+
+size_t CompressedBlockIndex::getBytes() const {
+  if (deltaBytes == 4) {
+    return numBlocks * sizeof(int);
+  }
+  return deltas8.size() + deltas16.size()*sizeof(int16_t) +
+         (escaped.size() + escapedPtr.size())*sizeof(int);
+}
+
+template <typename T>
+void CompressedBlockIndex::multiplyT(const BlockSparseMatrix<T>& A, const T* x,
+                                     T* y) const {
+  switch (deltaBytes) {
+    case 1:
+      spmvCompressed(A, deltas8.data(), escaped, escapedPtr, x, y);
+      break;
+    case 2:
+      spmvCompressed(A, deltas16.data(), escaped, escapedPtr, x, y);
+      break;
+    default:
+      spmv(A, x, y);
+      break;
+  }
+}
+
+void CompressedBlockIndex::multiply(const BlockSparseMatrix<double>& A,
+                                    const double* x, double* y) const {
+  multiplyT(A, x, y);
+}
+
+void CompressedBlockIndex::multiply(const BlockSparseMatrix<float>& A,
+                                    const float* x, float* y) const {
+  multiplyT(A, x, y);
+}
+
+/// Each thread sums the products of its chunk in double precision, and the
+/// partial sums are added in thread order, so the result does not depend on
+/// scheduling.
+template <typename T>
+static double dot(const T* a, const T* b, int n) {
+  ThreadPool& pool = getThreadPool();
+  int numChunks = pool.getNumThreads();
+  vector<double> partialSums(numChunks, 0.0);
+  pool.parallelFor(0, numChunks, [&](int begin, int end) {
+    for (int chunk=begin; chunk < end; ++chunk) {
+      int chunkEnd = pool.getChunkBegin(0, n, chunk+1);
+      double sum = 0.0;
+      for (int i=pool.getChunkBegin(0, n, chunk); i < chunkEnd; ++i) {
+        sum += (double)a[i] * (double)b[i];
+      }
+      partialSums[chunk] = sum;
+    }
+  });
+  double sum = 0.0;
+  for (double partialSum : partialSums) {
+    sum += partialSum;
+  }
+  return sum;
+}
+
+/// Invert the n x n row-major matrix a into inv by Gauss-Jordan elimination
+/// with partial pivoting. Returns false if the matrix is singular.
+static bool invertBlock(vector<double> a, int n, double* inv) {
+  for (int i=0; i < n*n; ++i) {
+    inv[i] = (i / n == i % n) ? 1.0 : 0.0;
+  }
+  for (int col=0; col < n; ++col) {
+    int pivot = col;
+    for (int row=col+1; row < n; ++row) {
+      if (fabs(a[row*n+col]) > fabs(a[pivot*n+col])) {
+        pivot = row;
+      }
+    }
+    if (a[pivot*n+col] == 0.0) {
+      return false;
+    }
+    if (pivot != col) {
+      for (int k=0; k < n; ++k) {
+        swap(a[col*n+k], a[pivot*n+k]);
+        swap(inv[col*n+k], inv[pivot*n+k]);
+      }
+    }
+    double scale = 1.0 / a[col*n+col];
+    for (int k=0; k < n; ++k) {
+      a[col*n+k] *= scale;
+      inv[col*n+k] *= scale;
+    }
+    for (int row=0; row < n; ++row) {
+      double factor = a[row*n+col];
+      if (row == col || factor == 0.0) continue;
+      for (int k=0; k < n; ++k) {
+        a[row*n+k] -= factor * a[col*n+k];
+        inv[row*n+k] -= factor * inv[col*n+k];
+      }
+    }
+  }
+  return true;
+}
+
+/// A (block) Jacobi preconditioner, which stores the inverse of each diagonal
+/// block, or the inverse of each diagonal entry. Recomputing it for a matrix
+/// with the same structure reuses its storage.
+template <typename T>
+class JacobiPreconditioner {
+public:
+  JacobiPreconditioner() : numRows(0), blockSize(0) {}
+
+  void compute(const BlockSparseMatrix<T>& A,
+               SolverParams::Preconditioner kind) {
+    numRows = A.getNumRows();
+    blockSize = 0;
+    if (kind == SolverParams::None) {
+      return;
+    }
+    bool blocked = (kind == SolverParams::BlockJacobi &&
+                    A.rowBlockSize == A.colBlockSize);
+    blockSize = blocked ? A.rowBlockSize : 1;
+    inverses.resize(numRows * blockSize);
+    getThreadPool().parallelFor(0, A.numBlockRows, [&](int begin, int end) {
+      for (int i=begin; i < end; ++i) {
+        if (blocked) {
+          invertDiagonalBlock(A, i);
+        }
+        else {
+          for (int bi=0; bi < A.rowBlockSize; ++bi) {
+            int row = i*A.rowBlockSize + bi;
+            inverses[row] = inverse(getEntry(A, row, row));
+          }
+        }
+      }
+    });
+  }
+
+  /// Compute z = M^-1 * r.
+  void apply(const T* r, T* z) const {
+    getThreadPool().parallelFor(0, numRows / max(blockSize,1),
+                                [&](int begin, int end) {
+      if (blockSize == 0) {
+        copy(r+begin, r+end, z+begin);
+        return;
+      }
+      for (int i=begin; i < end; ++i) {
+        const T* inv = &inverses[i*blockSize*blockSize];
+        for (int bi=0; bi < blockSize; ++bi) {
+          T sum = 0;
+          for (int bj=0; bj < blockSize; ++bj) {
+            sum += inv[bi*blockSize+bj] * r[i*blockSize+bj];
+          }
+          z[i*blockSize+bi] = sum;
+        }
+      }
+    });
+  }
+
+private:
+  int numRows;
+  int blockSize;
+  vector<T> inverses;
+
+  static T inverse(T value) {
+    return (value != 0) ? 1 / value : 1;
+  }
+
+  static T getEntry(const BlockSparseMatrix<T>& A, int row, int col) {
+    int nn = A.rowBlockSize;
+    int mm = A.colBlockSize;
+    int blockRow = row / nn;
+    for (int j=A.rowPtr[blockRow]; j < A.rowPtr[blockRow+1]; ++j) {
+      if (A.colIdx[j] == col / mm) {
+        return A.vals[j*nn*mm + (row%nn)*mm + col%mm];
+      }
+    }
+    return 0;
+  }
+
+  /// Diagonal blocks that are missing or singular are preconditioned by the
+  /// inverse of their diagonal instead.
+  void invertDiagonalBlock(const BlockSparseMatrix<T>& A, int i) {
+    int n = blockSize;
+    T* inv = &inverses[i*n*n];
+    for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+      if (A.colIdx[j] == i) {
+        vector<double> block(&A.vals[j*n*n], &A.vals[(j+1)*n*n]);
+        vector<double> blockInverse(n*n);
+        if (invertBlock(block, n, blockInverse.data())) {
+          copy(blockInverse.begin(), blockInverse.end(), inv);
+          return;
+        }
+        break;
+      }
+    }
+    for (int bi=0; bi < n; ++bi) {
+      for (int bj=0; bj < n; ++bj) {
+        inv[bi*n+bj] = (bi == bj) ? inverse(getEntry(A, i*n+bi, i*n+bi)) : 0;
+      }
+    }
+  }
+};
+
+
+/// Call body(i) for each i in [0,n), partitioned across the thread pool.
+template <typename F>
+static void parallelForEach(int n, const F& body) {
+  getThreadPool().parallelFor(0, n, [&](int begin, int end) {
+    for (int i=begin; i < end; ++i) {
+      body(i);
+    }
+  });
+}
+
+/// The weight of the damped block Jacobi sweeps that smooth multigrid levels.
+static const double multigridDamping = 2.0 / 3.0;
+
+/// Multigrid levels are coarsened until they have at most this many block
+/// rows, or until there are maxMultigridLevels levels.
+static const int multigridCoarsestSize = 64;
+static const int maxMultigridLevels = 16;
+
+/// The coarsest multigrid level is solved with a dense inverse if it has at
+/// most this many rows, and smoothed otherwise.
+static const int maxDenseInverseRows = 512;
+
+/// Aggregate each row whose neighbors are not aggregated with its neighbors,
+/// then add each remaining row to the aggregate of a neighbor, or to its own if
+/// it has none. forEachNeighbor(i, f) calls f(j) for each neighbor j of row i
+/// in the symmetric matrix graph. Returns the number of aggregates.
+template <typename F>
+static int aggregateRows(int n, const F& forEachNeighbor,
+                         vector<int>* aggregates) {
+  vector<int>& aggregate = *aggregates;
+  aggregate.assign(n, -1);
+  int numAggregates = 0;
+  for (int i=0; i < n; ++i) {
+    bool isolated = (aggregate[i] == -1);
+    forEachNeighbor(i, [&](int j) {
+      isolated = isolated && aggregate[j] == -1;
+    });
+    if (isolated) {
+      aggregate[i] = numAggregates;
+      forEachNeighbor(i, [&](int j) {aggregate[j] = numAggregates;});
+      ++numAggregates;
+    }
+  }
+  for (int i=0; i < n; ++i) {
+    if (aggregate[i] == -1) {
+      forEachNeighbor(i, [&](int j) {
+        if (aggregate[i] == -1 && aggregate[j] != -1) {
+          aggregate[i] = aggregate[j];
+        }
+      });
+      if (aggregate[i] == -1) {
+        aggregate[i] = numAggregates++;
+      }
+    }
+  }
+  return numAggregates;
+}
+
+/// A level of a multigrid V-cycle.
+template <typename T>
+struct MultigridLevel {
+  /// The matrix of the level. The finest level's is the solved matrix, while
+  /// coarser levels' are stored in rowPtr, colIdx and vals.
+  BlockSparseMatrix<T> A;
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<T> vals;
+
+  JacobiPreconditioner<T> smoother;
+
+  /// The aggregate on the next level of each block row, and the block rows of
+  /// each aggregate, [memberPtr[a],memberPtr[a+1]).
+  vector<int> aggregates;
+  vector<int> memberPtr;
+  vector<int> members;
+
+  /// The blocks of the next level's matrix are sums of blocks of this level's:
+  /// block b sums the contributions [contribPtr[b],contribPtr[b+1]), where
+  /// contribution c is block c/2 of this level, transposed if c is odd.
+  vector<int> contribPtr;
+  vector<int> contribs;
+
+  /// The dense inverse of the coarsest level's matrix, if it has one
+  vector<double> inverse;
+
+  // Scratch vectors: the restricted residual and correction of coarse levels,
+  // and residuals
+  vector<T> r, z, residual, smoothed;
+};
+
+/// An aggregation multigrid V-cycle with damped block Jacobi smoothing (see
+/// SolverParams::Multigrid). The levels are rebuilt on every compute, since
+/// the index arrays of the solved matrix may have been updated in place, and
+/// reuse the storage of earlier levels.
+template <typename T>
+class MultigridPreconditioner {
+public:
+  MultigridPreconditioner() : numLevels(0), lower(nullptr) {}
+
+  /// Build the levels of A, whose blocks below the diagonal must be indexed by
+  /// lower if it is upper triangular, coarsening with the hierarchy's
+  /// aggregates before the matrix graph's.
+  void compute(const BlockSparseMatrix<T>& A, const LowerBlockIndex* lower,
+               const MultigridHierarchy* hierarchy) {
+    iassert(A.rowBlockSize == A.colBlockSize);
+    this->lower = lower;
+    numLevels = 1;
+    if (levels.size() == 0) {
+      levels.emplace_back(new MultigridLevel<T>);
+    }
+    levels[0]->A = A;
+
+    for (int l=0; ; ++l) {
+      MultigridLevel<T>& level = *levels[l];
+      const int n = level.A.numBlockRows;
+      level.smoother.compute(level.A, SolverParams::BlockJacobi);
+      level.residual.resize(level.A.getNumRows());
+      level.smoothed.resize(level.A.getNumRows());
+      if (n <= multigridCoarsestSize || numLevels == maxMultigridLevels) {
+        break;
+      }
+
+      int numAggregates;
+      if (hierarchy != nullptr && l+1 < hierarchy->getNumLevels()) {
+        uassert(hierarchy->getSize(l) == n)
+            << "Level " << l << " of the multigrid hierarchy has "
+            << hierarchy->getSize(l) << " elements, but the matrix has " << n
+            << " block rows";
+        level.aggregates = hierarchy->getAggregates(l);
+        numAggregates = hierarchy->getSize(l+1);
+      }
+      else {
+        numAggregates = aggregateRows(n, [&](int i, const function<void(int)>& f) {
+          forEachNeighbor(level.A, i, f);
+        }, &level.aggregates);
+      }
+      if (numAggregates >= n) {
+        break;
+      }
+
+      if ((int)levels.size() == numLevels) {
+        levels.emplace_back(new MultigridLevel<T>);
+      }
+      coarsen(&level, numAggregates, levels[numLevels].get());
+      ++numLevels;
+    }
+
+    // Invert the coarsest matrix, or smooth it if it is too large or singular
+    MultigridLevel<T>& coarsest = *levels[numLevels-1];
+    coarsest.inverse.clear();
+    const int n = coarsest.A.getNumRows();
+    if (n <= maxDenseInverseRows) {
+      const BlockSparseMatrix<T>& C = coarsest.A;
+      const int bs = C.rowBlockSize;
+      vector<double> dense(n*n, 0.0);
+      for (int i=0; i < C.numBlockRows; ++i) {
+        for (int j=C.rowPtr[i]; j < C.rowPtr[i+1]; ++j) {
+          for (int bi=0; bi < bs; ++bi) {
+            for (int bj=0; bj < bs; ++bj) {
+              T value = C.vals[j*bs*bs + bi*bs + bj];
+              int row = i*bs + bi;
+              int col = C.colIdx[j]*bs + bj;
+              dense[row*n + col] += value;
+              if (C.upperTriangular && C.colIdx[j] != i) {
+                dense[col*n + row] += value;
+              }
+            }
+          }
+        }
+      }
+      coarsest.inverse.resize(n*n);
+      if (!invertBlock(dense, n, coarsest.inverse.data())) {
+        coarsest.inverse.clear();
+      }
+    }
+  }
+
+  /// Compute z = M^-1 * r with one V-cycle.
+  void apply(const T* r, T* z) {
+    cycle(0, r, z);
+  }
+
+private:
+  vector<unique_ptr<MultigridLevel<T>>> levels;
+  int numLevels;
+  const LowerBlockIndex* lower;
+
+  /// Call f(j) for each neighbor j of block row i other than itself, including
+  /// the rows of the blocks below the diagonal of upper triangular matrices.
+  void forEachNeighbor(const BlockSparseMatrix<T>& A, int i,
+                       const function<void(int)>& f) const {
+    for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+      if (A.colIdx[j] != i) {
+        f(A.colIdx[j]);
+      }
+    }
+    if (A.upperTriangular) {
+      for (int k=lower->rowPtr[i]; k < lower->rowPtr[i+1]; ++k) {
+        f(lower->rows[k]);
+      }
+    }
+  }
+
+  /// Build the next level's matrix, P^T*A*P for the piecewise constant
+  /// prolongation P of the level's aggregates, which sums the blocks of A
+  /// whose rows and columns are in the same aggregates.
+  void coarsen(MultigridLevel<T>* level, int numAggregates,
+               MultigridLevel<T>* next) {
+    const BlockSparseMatrix<T>& A = level->A;
+    const int n = A.numBlockRows;
+    const int bs = A.rowBlockSize;
+    const vector<int>& aggregate = level->aggregates;
+
+    level->memberPtr.assign(numAggregates+1, 0);
+    for (int i=0; i < n; ++i) {
+      ++level->memberPtr[aggregate[i]+1];
+    }
+    for (int a=0; a < numAggregates; ++a) {
+      level->memberPtr[a+1] += level->memberPtr[a];
+    }
+    level->members.resize(n);
+    vector<int> nextMember(level->memberPtr.begin(), level->memberPtr.end()-1);
+    for (int i=0; i < n; ++i) {
+      level->members[nextMember[aggregate[i]]++] = i;
+    }
+
+    // Bucket the contributions by coarse row, then sort each row's by column.
+    // Blocks above the diagonal of upper triangular matrices also contribute
+    // their transposes, so coarse matrices store both triangles.
+    auto forEachContribution = [&](const function<void(int,int,int)>& f) {
+      for (int i=0; i < n; ++i) {
+        for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+          int row = aggregate[i];
+          int col = aggregate[A.colIdx[j]];
+          f(row, col, 2*j);
+          if (A.upperTriangular && A.colIdx[j] != i) {
+            f(col, row, 2*j+1);
+          }
+        }
+      }
+    };
+    vector<int> bucketPtr(numAggregates+1, 0);
+    forEachContribution([&](int row, int, int) {++bucketPtr[row+1];});
+    for (int a=0; a < numAggregates; ++a) {
+      bucketPtr[a+1] += bucketPtr[a];
+    }
+    vector<pair<int,int>> entries(bucketPtr[numAggregates]);
+    vector<int> nextEntry(bucketPtr.begin(), bucketPtr.end()-1);
+    forEachContribution([&](int row, int col, int contrib) {
+      entries[nextEntry[row]++] = {col, contrib};
+    });
+
+    next->rowPtr.assign(numAggregates+1, 0);
+    next->colIdx.clear();
+    level->contribPtr.clear();
+    level->contribs.resize(entries.size());
+    for (int a=0; a < numAggregates; ++a) {
+      sort(entries.begin()+bucketPtr[a], entries.begin()+bucketPtr[a+1]);
+      for (int e=bucketPtr[a]; e < bucketPtr[a+1]; ++e) {
+        if (e == bucketPtr[a] || entries[e].first != entries[e-1].first) {
+          next->colIdx.push_back(entries[e].first);
+          level->contribPtr.push_back(e);
+        }
+        level->contribs[e] = entries[e].second;
+      }
+      next->rowPtr[a+1] = next->colIdx.size();
+    }
+    level->contribPtr.push_back(entries.size());
+
+    const int numBlocks = next->colIdx.size();
+    next->vals.resize(numBlocks*bs*bs);
+    getThreadPool().parallelFor(0, numBlocks, [&](int begin, int end) {
+      for (int b=begin; b < end; ++b) {
+        T* block = &next->vals[b*bs*bs];
+        fill(block, block + bs*bs, T(0));
+        for (int k=level->contribPtr[b]; k < level->contribPtr[b+1]; ++k) {
+          int contrib = level->contribs[k];
+          const T* fineBlock = &A.vals[(contrib/2)*bs*bs];
+          bool transposed = contrib % 2;
+          for (int bi=0; bi < bs; ++bi) {
+            for (int bj=0; bj < bs; ++bj) {
+              block[bi*bs+bj] += transposed ? fineBlock[bj*bs+bi]
+                                            : fineBlock[bi*bs+bj];
+            }
+          }
+        }
+      }
+    });
+
+    next->A = {numAggregates, numAggregates, next->rowPtr.data(),
+               next->colIdx.data(), bs, bs, next->vals.data(), false};
+    next->r.resize(next->A.getNumRows());
+    next->z.resize(next->A.getNumRows());
+  }
+
+  /// Compute y = A*x for the matrix of a level.
+  void multiply(const MultigridLevel<T>& level, const T* x, T* y) const {
+    if (level.A.upperTriangular) {
+      spmvSymmetric(level.A, *lower, x, y);
+    }
+    else {
+      spmv(level.A, x, y);
+    }
+  }
+
+  /// Add a damped block Jacobi sweep of A*z = r to z, from z = 0 if initial.
+  void smooth(MultigridLevel<T>& level, const T* r, T* z, bool initial) {
+    const int n = level.A.getNumRows();
+    const T damping = (T)multigridDamping;
+    if (initial) {
+      level.smoother.apply(r, z);
+      parallelForEach(n, [&](int i) {z[i] *= damping;});
+      return;
+    }
+    T* residual = level.residual.data();
+    multiply(level, z, residual);
+    parallelForEach(n, [&](int i) {residual[i] = r[i] - residual[i];});
+    level.smoother.apply(residual, level.smoothed.data());
+    const T* smoothed = level.smoothed.data();
+    parallelForEach(n, [&](int i) {z[i] += damping * smoothed[i];});
+  }
+
+  void cycle(int l, const T* r, T* z) {
+    MultigridLevel<T>& level = *levels[l];
+    const int n = level.A.getNumRows();
+    if (l == numLevels-1) {
+      if (level.inverse.empty()) {
+        smooth(level, r, z, true);
+        smooth(level, r, z, false);
+        return;
+      }
+      const double* inverse = level.inverse.data();
+      parallelForEach(n, [&](int i) {
+        double sum = 0.0;
+        for (int j=0; j < n; ++j) {
+          sum += inverse[i*n+j] * r[j];
+        }
+        z[i] = (T)sum;
+      });
+      return;
+    }
+
+    smooth(level, r, z, true);
+
+    // Restrict the residual to the next level, solve for its correction there,
+    // and prolong the correction
+    MultigridLevel<T>& next = *levels[l+1];
+    const int bs = level.A.rowBlockSize;
+    T* residual = level.residual.data();
+    multiply(level, z, residual);
+    parallelForEach(n, [&](int i) {residual[i] = r[i] - residual[i];});
+    parallelForEach(next.A.numBlockRows, [&](int a) {
+      for (int bi=0; bi < bs; ++bi) {
+        T sum = 0;
+        for (int m=level.memberPtr[a]; m < level.memberPtr[a+1]; ++m) {
+          sum += residual[level.members[m]*bs + bi];
+        }
+        next.r[a*bs + bi] = sum;
+      }
+    });
+    cycle(l+1, next.r.data(), next.z.data());
+    parallelForEach(level.A.numBlockRows, [&](int i) {
+      for (int bi=0; bi < bs; ++bi) {
+        z[i*bs + bi] += next.z[level.aggregates[i]*bs + bi];
+      }
+    });
+
+    smooth(level, r, z, false);
+  }
+};
+
+
+#ifdef EIGEN
+/// A sparse LDLT or Cholesky factorization computed with Eigen. The scalar
+/// structure of the matrix and the symbolic analysis are computed once, so
+/// refactorizing a matrix with new values only gathers its block values.
+template <typename T>
+class SparseFactorization {
+public:
+  /// Builds the scalar compressed columns of A^T, which equals A as the
+  /// factorized matrices are symmetric, from the block rows of A. Only the
+  /// lower triangle of A^T is factorized, so upper triangular matrices are
+  /// built the same way.
+  explicit SparseFactorization(const BlockSparseMatrix<T>& A)
+      : ldltAnalyzed(false), lltAnalyzed(false) {
+    const int n = A.getNumRows();
+    const int nn = A.rowBlockSize;
+    const int mm = A.colBlockSize;
+    const int nnz = A.rowPtr[A.numBlockRows] * nn * mm;
+
+    matrix.resize(n, n);
+    matrix.resizeNonZeros(nnz);
+    int* outer = matrix.outerIndexPtr();
+    int* inner = matrix.innerIndexPtr();
+    valueIndices.resize(nnz);
+
+    int k = 0;
+    vector<pair<int,int>> entries;
+    for (int i=0; i < A.numBlockRows; ++i) {
+      for (int bi=0; bi < nn; ++bi) {
+        outer[i*nn+bi] = k;
+        entries.clear();
+        for (int j=A.rowPtr[i]; j < A.rowPtr[i+1]; ++j) {
+          for (int bj=0; bj < mm; ++bj) {
+            entries.push_back({A.colIdx[j]*mm+bj, j*nn*mm+bi*mm+bj});
+          }
+        }
+        sort(entries.begin(), entries.end());
+        for (auto& entry : entries) {
+          inner[k] = entry.first;
+          valueIndices[k] = entry.second;
+          ++k;
+        }
+      }
+    }
+    outer[n] = k;
+  }
+
+  void solve(const BlockSparseMatrix<T>& A, const T* b, T* x,
+             SolverParams::Method method) {
+    T* values = matrix.valuePtr();
+    getThreadPool().parallelFor(0, valueIndices.size(),
+                                [&](int begin, int end) {
+      for (int k=begin; k < end; ++k) {
+        values[k] = A.vals[valueIndices[k]];
+      }
+    });
+
+    typedef Eigen::Matrix<T,Eigen::Dynamic,1> Vector;
+    Eigen::Map<const Vector> bvec(b, matrix.rows());
+    Eigen::Map<Vector> xvec(x, matrix.rows());
+    if (method == SolverParams::LDLT) {
+      if (!ldltAnalyzed) {
+        ldlt.analyzePattern(matrix);
+        ldltAnalyzed = true;
+      }
+      ldlt.factorize(matrix);
+      uassert(ldlt.info() == Eigen::Success)
+          << "The LDLT factorization of the matrix failed";
+      xvec = ldlt.solve(bvec);
+    }
+    else {
+      if (!lltAnalyzed) {
+        llt.analyzePattern(matrix);
+        lltAnalyzed = true;
+      }
+      llt.factorize(matrix);
+      uassert(llt.info() == Eigen::Success)
+          << "The Cholesky factorization of the matrix failed, so it is not "
+          << "positive definite";
+      xvec = llt.solve(bvec);
+    }
+  }
+
+private:
+  typedef Eigen::SparseMatrix<T> Matrix;
+  Matrix matrix;
+  /// The location in the block values of each entry of the scalar matrix
+  vector<int> valueIndices;
+
+  Eigen::SimplicialLDLT<Matrix> ldlt;
+  Eigen::SimplicialLLT<Matrix> llt;
+  bool ldltAnalyzed;
+  bool lltAnalyzed;
+};
+#endif
+
+/// Hash the block sparsity pattern of a matrix.
+template <typename T>
+static uint64_t hashPattern(const BlockSparseMatrix<T>& A) {
+  // FNV-1a over the row pointers and column indices
+  uint64_t hash = 14695981039346656037ULL;
+  auto combine = [&hash](const int* values, int size) {
+    for (int i=0; i < size; ++i) {
+      hash = (hash ^ (uint32_t)values[i]) * 1099511628211ULL;
+    }
+  };
+  combine(A.rowPtr, A.numBlockRows+1);
+  combine(A.colIdx, A.rowPtr[A.numBlockRows]);
+  return hash;
+}
+
+/// The state of the solves of one matrix. The states are kept by the addresses
+/// of the matrix arrays, which may be reused for a matrix with another
+/// pattern, so a state also records the pattern it was computed for.
+template <typename T>
+struct MatrixState {
+  int numBlockRows;
+  int numBlockCols;
+  int rowBlockSize;
+  int colBlockSize;
+  bool upperTriangular;
+  uint64_t pattern;
+
+  JacobiPreconditioner<T> preconditioner;
+
+  /// The V-cycle of Multigrid solves, if usesMultigrid is set
+  MultigridPreconditioner<T> multigrid;
+  bool usesMultigrid = false;
+
+  // Scratch vectors
+  vector<T> r, z, p, v, rHat, y, s, t;
+
+  /// The previous solution, or empty
+  vector<T> solution;
+
+  /// The compressed column indices that matrix products use, if
+  /// compressedIndices is set
+  CompressedBlockIndex index;
+  bool compressedIndices = false;
+
+  /// The blocks below the diagonal of upper triangular matrices
+  LowerBlockIndex lower;
+
+#ifdef EIGEN
+  unique_ptr<SparseFactorization<T>> factorization;
+#endif
+
+  explicit MatrixState(const BlockSparseMatrix<T>& A)
+      : numBlockRows(A.numBlockRows), numBlockCols(A.numBlockCols),
+        rowBlockSize(A.rowBlockSize), colBlockSize(A.colBlockSize),
+        upperTriangular(A.upperTriangular), pattern(hashPattern(A)) {
+  }
+
+  /// True iff the state was computed for a matrix with the dimensions and
+  /// sparsity pattern of A. Hashing the pattern takes time linear in the
+  /// number of blocks, like building the indices at the start of a solve.
+  bool matches(const BlockSparseMatrix<T>& A) const {
+    return numBlockRows == A.numBlockRows && numBlockCols == A.numBlockCols &&
+           rowBlockSize == A.rowBlockSize && colBlockSize == A.colBlockSize &&
+           upperTriangular == A.upperTriangular && pattern == hashPattern(A);
+  }
+
+  /// Multigrid preconditions matrices with square blocks, and BlockJacobi the
+  /// others.
+  void computePreconditioner(const BlockSparseMatrix<T>& A,
+                             const SolverParams& params) {
+    SolverParams::Preconditioner kind = params.preconditioner;
+    usesMultigrid = (kind == SolverParams::Multigrid &&
+                     A.rowBlockSize == A.colBlockSize);
+    if (usesMultigrid) {
+      multigrid.compute(A, A.upperTriangular ? &lower : nullptr,
+                        params.multigridHierarchy.get());
+      return;
+    }
+    if (kind == SolverParams::Multigrid) {
+      kind = SolverParams::BlockJacobi;
+    }
+    preconditioner.compute(A, kind);
+  }
+
+  /// Compute z = M^-1 * r.
+  void precondition(const T* r, T* z) {
+    if (usesMultigrid) {
+      multigrid.apply(r, z);
+    }
+    else {
+      preconditioner.apply(r, z);
+    }
+  }
+};
+
+/// Compute y = A*x, through the compressed index if the solve uses one.
+template <typename T>
+static void multiply(const BlockSparseMatrix<T>& A, const MatrixState<T>& state,
+                     const T* x, T* y) {
+  if (A.upperTriangular) {
+    spmvSymmetric(A, state.lower, x, y);
+  }
+  else if (state.compressedIndices) {
+    state.index.multiply(A, x, y);
+  }
+  else {
+    spmv(A, x, y);
+  }
+}
+
+static void checkSquare(int numRows, int numCols) {
+  uassert(numRows == numCols) << "solve requires a square matrix, but the "
+                              << "matrix is " << numRows << "x" << numCols;
+}
+
+/// Set x to the initial guess, which is the previous solution on warm starts
+/// and zero otherwise, and r to the residual b - A*x. Compresses the column
+/// indices if the solve uses them, and indexes the lower triangle of upper
+/// triangular matrices.
+template <typename T>
+static void startSolve(const BlockSparseMatrix<T>& A, const T* b, T* x,
+                       const SolverParams& params, MatrixState<T>* state) {
+  // The indices are rebuilt on every solve, since the index arrays may have
+  // been updated in place. Products with upper triangular matrices do not use
+  // compressed columns.
+  state->compressedIndices = params.compressIndices && !A.upperTriangular;
+  if (state->compressedIndices) {
+    state->index.compress(A);
+  }
+  if (A.upperTriangular) {
+    state->lower.build(A);
+  }
+
+  const int n = A.getNumRows();
+  vector<T>& r = state->r;
+  r.resize(n);
+  if (params.warmStart && (int)state->solution.size() == n) {
+    copy(state->solution.begin(), state->solution.end(), x);
+    multiply(A, *state, x, r.data());
+    parallelForEach(n, [&](int i) {r[i] = b[i] - r[i];});
+  }
+  else {
+    fill(x, x+n, T(0));
+    copy(b, b+n, r.begin());
+  }
+}
+
+template <typename T>
+static int pcg(const BlockSparseMatrix<T>& A, const T* b, T* x,
+               const SolverParams& params, MatrixState<T>* state) {
+  const int n = A.getNumRows();
+  const double threshold = params.tolerance * sqrt(dot(b, b, n));
+  startSolve(A, b, x, params, state);
+
+  vector<T>& r = state->r;
+  vector<T>& z = state->z;
+  vector<T>& p = state->p;
+  vector<T>& Ap = state->v;
+  z.resize(n);
+  Ap.resize(n);
+
+  int iterations = 0;
+  if (sqrt(dot(r.data(), r.data(), n)) > threshold) {
+    state->computePreconditioner(A, params);
+    state->precondition(r.data(), z.data());
+    p = z;
+    double rz = dot(r.data(), z.data(), n);
+
+    while (iterations < params.maxIterations && rz != 0.0) {
+      multiply(A, *state, p.data(), Ap.data());
+      double pAp = dot(p.data(), Ap.data(), n);
+      if (pAp <= 0.0) {
+        break;
+      }
+
+      T alpha = (T)(rz / pAp);
+      parallelForEach(n, [&](int i) {
+        x[i] += alpha * p[i];
+        r[i] -= alpha * Ap[i];
+      });
+      ++iterations;
+
+      if (sqrt(dot(r.data(), r.data(), n)) <= threshold) {
+        break;
+      }
+
+      state->precondition(r.data(), z.data());
+      double rzNext = dot(r.data(), z.data(), n);
+      T beta = (T)(rzNext / rz);
+      rz = rzNext;
+      parallelForEach(n, [&](int i) {p[i] = z[i] + beta * p[i];});
+    }
+  }
+  state->solution.assign(x, x+n);
+  return iterations;
+}
+
+/// Right-preconditioned BiCGSTAB.
+template <typename T>
+static int bicgstab(const BlockSparseMatrix<T>& A, const T* b, T* x,
+                    const SolverParams& params, MatrixState<T>* state) {
+  const int n = A.getNumRows();
+  const double threshold = params.tolerance * sqrt(dot(b, b, n));
+  startSolve(A, b, x, params, state);
+
+  vector<T>& r = state->r;
+  vector<T>& rHat = state->rHat;
+  vector<T>& p = state->p;
+  vector<T>& v = state->v;
+  vector<T>& y = state->y;
+  vector<T>& s = state->s;
+  vector<T>& z = state->z;
+  vector<T>& t = state->t;
+  rHat = r;
+  p.assign(n, T(0));
+  v.assign(n, T(0));
+  y.resize(n);
+  s.resize(n);
+  z.resize(n);
+  t.resize(n);
+
+  int iterations = 0;
+  if (sqrt(dot(r.data(), r.data(), n)) > threshold) {
+    state->computePreconditioner(A, params);
+    double rho = 1.0;
+    double alpha = 1.0;
+    double omega = 1.0;
+
+    while (iterations < params.maxIterations) {
+      double rhoNext = dot(rHat.data(), r.data(), n);
+      if (rhoNext == 0.0 || omega == 0.0) {
+        break;
+      }
+      T beta = (T)((rhoNext / rho) * (alpha / omega));
+      rho = rhoNext;
+      T omegaT = (T)omega;
+      parallelForEach(n, [&](int i) {
+        p[i] = r[i] + beta * (p[i] - omegaT * v[i]);
+      });
+
+      state->precondition(p.data(), y.data());
+      multiply(A, *state, y.data(), v.data());
+      double rHatV = dot(rHat.data(), v.data(), n);
+      if (rHatV == 0.0) {
+        break;
+      }
+      alpha = rho / rHatV;
+      T alphaT = (T)alpha;
+      parallelForEach(n, [&](int i) {s[i] = r[i] - alphaT * v[i];});
+      ++iterations;
+
+      if (sqrt(dot(s.data(), s.data(), n)) <= threshold) {
+        parallelForEach(n, [&](int i) {x[i] += alphaT * y[i];});
+        break;
+      }
+
+      state->precondition(s.data(), z.data());
+      multiply(A, *state, z.data(), t.data());
+      double tt = dot(t.data(), t.data(), n);
+      omega = (tt != 0.0) ? dot(t.data(), s.data(), n) / tt : 0.0;
+      omegaT = (T)omega;
+      parallelForEach(n, [&](int i) {
+        x[i] += alphaT * y[i] + omegaT * z[i];
+        r[i] = s[i] - omegaT * t[i];
+      });
+
+      if (sqrt(dot(r.data(), r.data(), n)) <= threshold) {
+        break;
+      }
+    }
+  }
+  state->solution.assign(x, x+n);
+  return iterations;
+}
+
+template <typename T>
+static int pcgFromZero(const BlockSparseMatrix<T>& A, const T* b, T* x,
+                       const SolverParams& params) {
+  checkSquare(A.getNumRows(), A.getNumCols());
+  MatrixState<T> state(A);
+  SolverParams coldParams = params;
+  coldParams.warmStart = false;
+  return pcg(A, b, x, coldParams, &state);
+}
+
+int conjugateGradient(const BlockSparseMatrix<double>& A, const double* b,
+                      double* x, const SolverParams& params) {
+  return pcgFromZero(A, b, x, params);
+}
+
+int conjugateGradient(const BlockSparseMatrix<float>& A, const float* b,
+                      float* x, const SolverParams& params) {
+  return pcgFromZero(A, b, x, params);
+}
+
+// class SolverContext
+template <typename T>
+using MatrixStates = map<tuple<const int*,const int*,const T*>,
+                         unique_ptr<MatrixState<T>>>;
+
+/// The most matrices a context keeps state for. Temporaries that are
+/// reallocated leave states behind, which are discarded once there are more.
+static const size_t maxMatrixStates = 16;
+
+struct SolverContext::Content {
+  bool hasParams = false;
+  SolverParams params;
+  MatrixStates<double> doubleStates;
+  MatrixStates<float> floatStates;
+
+  /// The lower triangle indices of symmetric matrices, by their index arrays
+  map<pair<const int*,const int*>, LowerBlockIndex> lowerIndices;
+
+  /// Returns the lower triangle index of A, which is built if A's index arrays
+  /// were not indexed before.
+  template <typename T>
+  const LowerBlockIndex& getLowerIndex(const BlockSparseMatrix<T>& A) {
+    LowerBlockIndex& lower = lowerIndices[make_pair(A.rowPtr, A.colIdx)];
+    if ((int)lower.rowPtr.size() != A.numBlockRows+1) {
+      lower.build(A);
+    }
+    return lower;
+  }
+};
+
+template <typename T>
+static int solve(const BlockSparseMatrix<T>& A, const T* b, T* x,
+                 const SolverParams& params, MatrixStates<T>* states) {
+  checkSquare(A.getNumRows(), A.getNumCols());
+
+  auto key = make_tuple(A.rowPtr, A.colIdx, A.vals);
+  auto it = states->find(key);
+  if (it == states->end() || !it->second->matches(A)) {
+    if (it == states->end() && states->size() >= maxMatrixStates) {
+      states->clear();
+    }
+    (*states)[key].reset(new MatrixState<T>(A));
+    it = states->find(key);
+  }
+  MatrixState<T>* state = it->second.get();
+
+  switch (params.method) {
+    case SolverParams::ConjugateGradient:
+      return pcg(A, b, x, params, state);
+    case SolverParams::BiCGSTAB:
+      return bicgstab(A, b, x, params, state);
+    case SolverParams::LDLT:
+    case SolverParams::Cholesky:
+#ifdef EIGEN
+      if (state->factorization == nullptr) {
+        state->factorization.reset(new SparseFactorization<T>(A));
+      }
+      state->factorization->solve(A, b, x, params.method);
+#else
+      uerror << "Sparse factorizations require Simit to be built with Eigen";
+#endif
+      return 0;
+  }
+  unreachable;
+  return 0;
+}
+
+SolverContext::SolverContext() : content(new Content) {
+}
+
+SolverContext::~SolverContext() {
+}
+
+void SolverContext::setParams(const SolverParams& params) {
+  checkParams(params);
+  content->params = params;
+  content->hasParams = true;
+}
+
+const SolverParams& SolverContext::getParams() const {
+  return content->hasParams ? content->params : getSolverParams();
+}
+
+int SolverContext::solve(const BlockSparseMatrix<double>& A, const double* b,
+                         double* x) {
+  return internal::solve(A, b, x, getParams(), &content->doubleStates);
+}
+
+int SolverContext::solve(const BlockSparseMatrix<float>& A, const float* b,
+                         float* x) {
+  return internal::solve(A, b, x, getParams(), &content->floatStates);
+}
+
+void SolverContext::multiplySymmetric(const BlockSparseMatrix<double>& A,
+                                      const double* x, double* y) {
+  iassert(A.upperTriangular);
+  spmvSymmetric(A, content->getLowerIndex(A), x, y);
+}
+
+void SolverContext::multiplySymmetric(const BlockSparseMatrix<float>& A,
+                                      const float* x, float* y) {
+  iassert(A.upperTriangular);
+  spmvSymmetric(A, content->getLowerIndex(A), x, y);
+}
+
+void SolverContext::indexLowerTriangle(int numBlockRows, const int* rowPtr,
+                                       const int* colIdx) {
+  content->lowerIndices[make_pair(rowPtr, colIdx)].build(numBlockRows, rowPtr,
+                                                         colIdx);
+}
+
+void SolverContext::clear() {
+  content->doubleStates.clear();
+  content->floatStates.clear();
+  content->lowerIndices.clear();
+}
+
+SolverContext& getDefaultSolverContext() {
+  static SolverContext defaultContext;
+  return defaultContext;
+}
+
+}}
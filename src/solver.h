@@ -0,0 +1,224 @@
+#ifndef SIMIT_SOLVER_H
+#define SIMIT_SOLVER_H
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+class MultigridHierarchy;
+
+/// Parameters of the solver behind `solve` (the `\` operator) in Simit
+/// programs.
+struct SolverParams {
+  enum Method {
+    /// Preconditioned conjugate gradient, for symmetric positive definite
+    /// matrices.
+    ConjugateGradient,
+    /// Preconditioned BiCGSTAB, for general matrices.
+    BiCGSTAB,
+    /// Sparse LDLT factorization, for symmetric matrices. Requires Eigen.
+    LDLT,
+    /// Sparse Cholesky factorization, for symmetric positive definite
+    /// matrices. Requires Eigen.
+    Cholesky
+  };
+
+  enum Preconditioner {
+    /// No preconditioning.
+    None,
+    /// Scale by the inverse of the matrix diagonal.
+    Jacobi,
+    /// Multiply by the inverses of the diagonal blocks. Equal to Jacobi for
+    /// scalar blocks, and used as Jacobi for non-square blocks.
+    BlockJacobi,
+    /// An aggregation multigrid V-cycle with block Jacobi smoothing, for
+    /// symmetric positive definite matrices. Coarse levels aggregate the block
+    /// rows of the next finer level, as given by multigridHierarchy or by the
+    /// matrix graph, and their matrices are the Galerkin products of the finer
+    /// matrices with the piecewise constant transfer operators. Used as
+    /// BlockJacobi for non-square blocks.
+    Multigrid
+  };
+
+  Method method = ConjugateGradient;
+
+  /// Iterative solves stop when the residual norm is at most tolerance times
+  /// the norm of the right-hand side.
+  double tolerance = 1e-10;
+
+  /// Iterative solves stop after this many iterations, even if they have not
+  /// reached the tolerance.
+  int maxIterations = 50;
+
+  Preconditioner preconditioner = BlockJacobi;
+
+  /// The aggregates of the levels of the Multigrid preconditioner, whose finest
+  /// set must be the set the block rows of the solved matrices are indexed by.
+  /// If null, or once its levels are exhausted, block rows are aggregated with
+  /// their neighbors in the matrix graph.
+  std::shared_ptr<const MultigridHierarchy> multigridHierarchy;
+
+  /// Start iterative solves from the previous solution of the same matrix,
+  /// rather than from zero. Off by default, since it makes results depend on
+  /// earlier solves.
+  bool warmStart = false;
+
+  /// Multiply with the matrix through column indices compressed to 8 or 16-bit
+  /// deltas (see CompressedBlockIndex), which reduces the memory traffic of
+  /// iterative solves of matrices whose columns are close to their rows, such
+  /// as matrices of reordered meshes.
+  bool compressIndices = false;
+};
+
+/// Set the parameters that solves in Simit programs use, unless overridden
+/// with Function::setSolverParams.
+void setSolverParams(const SolverParams& params);
+
+/// Returns the parameters that solves in Simit programs use by default.
+const SolverParams& getSolverParams();
+
+namespace internal {
+
+/// A view of a matrix in Simit's block compressed sparse row layout: block row
+/// i holds the blocks [rowPtr[i],rowPtr[i+1]), where block j has block column
+/// colIdx[j] and its rowBlockSize x colBlockSize row-major values start at
+/// vals[j*rowBlockSize*colBlockSize]. Symmetric matrices may store only their
+/// upper triangle, in which case block rows only hold the blocks in columns
+/// from their own onwards, and the blocks below the diagonal are the
+/// transposes of those above it.
+template <typename T>
+struct BlockSparseMatrix {
+  int numBlockRows;
+  int numBlockCols;
+  const int* rowPtr;
+  const int* colIdx;
+  int rowBlockSize;
+  int colBlockSize;
+  const T* vals;
+  bool upperTriangular;
+
+  int getNumRows() const {return numBlockRows * rowBlockSize;}
+  int getNumCols() const {return numBlockCols * colBlockSize;}
+};
+
+/// Compute y = A*x, partitioning the block rows across the thread pool.
+/// Products with upper triangular matrices first index the blocks below the
+/// diagonal by block row, which takes time linear in the number of blocks.
+void blockSpMV(const BlockSparseMatrix<double>& A, const double* x, double* y);
+void blockSpMV(const BlockSparseMatrix<float>& A, const float* x, float* y);
+
+/// The block column indices of a block sparse matrix, compressed to the
+/// differences between consecutive columns of each row, where the first column
+/// of a row is relative to the row. Differences are stored in 8 or 16 bits,
+/// whichever takes the fewest bytes, and those that do not fit are escaped and
+/// stored in full in a separate array. Indices are kept uncompressed if that
+/// takes fewer bytes.
+class CompressedBlockIndex {
+public:
+  /// The number of block rows between pointers to their first escaped column.
+  static const int ESCAPED_PTR_STRIDE = 64;
+
+  CompressedBlockIndex();
+
+  /// Compress the column indices of A, reusing the storage of earlier indices.
+  template <typename T>
+  void compress(const BlockSparseMatrix<T>& A) {
+    compress(A.numBlockRows, A.rowPtr, A.colIdx);
+  }
+  void compress(int numBlockRows, const int* rowPtr, const int* colIdx);
+
+  /// The bytes each column difference takes: 1, 2, or 4 if the indices are
+  /// not compressed.
+  int getDeltaBytes() const {return deltaBytes;}
+
+  /// The bytes of the column indices, including escaped columns.
+  size_t getBytes() const;
+
+  /// Returns the number of columns that are stored in full.
+  int getNumEscaped() const {return escaped.size();}
+
+  /// Compute y = A*x using the index instead of A's column indices, which
+  /// the index must have been compressed from.
+  void multiply(const BlockSparseMatrix<double>& A, const double* x,
+                double* y) const;
+  void multiply(const BlockSparseMatrix<float>& A, const float* x,
+                float* y) const;
+
+private:
+  int deltaBytes;
+  int numBlocks;
+  std::vector<int8_t> deltas8;
+  std::vector<int16_t> deltas16;
+  /// The escaped columns, where those of block row i*ESCAPED_PTR_STRIDE start
+  /// at escapedPtr[i]
+  std::vector<int> escaped;
+  std::vector<int> escapedPtr;
+
+  template <typename D>
+  void encode(int numBlockRows, const int* rowPtr, const int* colIdx,
+              std::vector<D>* deltas);
+
+  template <typename T>
+  void multiplyT(const BlockSparseMatrix<T>& A, const T* x, T* y) const;
+};
+
+/// Solve A*x = b, where A must be symmetric positive definite, with the
+/// preconditioned conjugate gradient method starting from x = 0. Returns the
+/// number of iterations.
+int conjugateGradient(const BlockSparseMatrix<double>& A, const double* b,
+                      double* x, const SolverParams& params);
+int conjugateGradient(const BlockSparseMatrix<float>& A, const float* b,
+                      float* x, const SolverParams& params);
+
+/// The state of the solves of a Simit function, which is reused by later
+/// solves of matrices with the same structure: preconditioner storage, scratch
+/// vectors, the symbolic analysis of sparse factorizations and the previous
+/// solution for warm starts. Matrices are identified by their index and value
+/// arrays, and their state is rebuilt if their dimensions or sparsity pattern
+/// change.
+class SolverContext : private interfaces::Uncopyable {
+public:
+  SolverContext();
+  ~SolverContext();
+
+  /// Use the given parameters instead of the process-wide parameters.
+  void setParams(const SolverParams& params);
+  const SolverParams& getParams() const;
+
+  /// Solve A*x = b with the context's parameters. Returns the number of
+  /// iterations of iterative methods, and zero for factorizations.
+  int solve(const BlockSparseMatrix<double>& A, const double* b, double* x);
+  int solve(const BlockSparseMatrix<float>& A, const float* b, float* x);
+
+  /// Compute y = A*x, where A stores the upper triangle of a symmetric matrix.
+  /// The product indexes the blocks below the diagonal by block row, and the
+  /// index is kept for later products with the same index arrays.
+  void multiplySymmetric(const BlockSparseMatrix<double>& A, const double* x,
+                         double* y);
+  void multiplySymmetric(const BlockSparseMatrix<float>& A, const float* x,
+                         float* y);
+
+  /// Index the blocks below the diagonal of the upper triangular matrices with
+  /// the given block rows and columns, replacing the index of earlier arrays
+  /// at the same addresses. Functions call this whenever they build the index
+  /// of a symmetric matrix, so its products do not index it again.
+  void indexLowerTriangle(int numBlockRows, const int* rowPtr,
+                          const int* colIdx);
+
+  /// Discard the state of all matrices.
+  void clear();
+
+private:
+  struct Content;
+  std::unique_ptr<Content> content;
+};
+
+/// Returns the context of solves that are not made by a function with its own
+/// context.
+SolverContext& getDefaultSolverContext();
+
+}}
+#endif
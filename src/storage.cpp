@@ -48,6 +48,11 @@ const TensorIndex& TensorStorage::getTensorIndex() const {
   return content->index;
 }
 
+bool TensorStorage::isSymmetric() const {
+  return getKind() == TensorStorage::Indexed && hasTensorIndex() &&
+         content->index.isUpperTriangular();
+}
+
 void TensorStorage::setTensorIndex(Var tensor) {
   content->index = TensorIndex(tensor.getName()+"_index", pe::PathExpression());
 }
@@ -65,6 +70,9 @@ std::ostream &operator<<(std::ostream &os, const TensorStorage &ts) {
       break;
     case TensorStorage::Indexed:
       os << "Indexed";
+      if (ts.isSymmetric()) {
+        os << " symmetric";
+      }
       if (ts.hasTensorIndex()) {
         os << " (" << ts.getTensorIndex().getPathExpression() << ")";
       }
@@ -295,6 +303,11 @@ private:
 
       for (const Var& var : op->vars) {
         Type type = var.getType();
+        // Symmetric matrices are given their storage before it is determined
+        if (storage->hasStorage(var) &&
+            storage->getStorage(var).isSymmetric()) {
+          continue;
+        }
         if (type.isTensor() && !isScalar(type)) {
           // For now we'll store all assembled vectors as dense and other tensors
           // as system reduced
@@ -328,6 +341,11 @@ private:
     // Scalars don't need storage
     if (isScalar(var.getType())) return;
 
+    // Symmetric matrices are given their storage before it is determined
+    if (storage->hasStorage(var) && storage->getStorage(var).isSymmetric()) {
+      return;
+    }
+
     // If all dimensions are ranges then we choose dense row major. Otherwise,
     // we choose system reduced storage order (for now).
     Type type = var.getType();
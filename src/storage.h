@@ -56,6 +56,10 @@ public:
   /// indexed tensor.
   const TensorIndex& getTensorIndex() const;
 
+  /// True if the tensor is a symmetric matrix whose tensor index only holds
+  /// the upper triangle, false otherwise.
+  bool isSymmetric() const;
+
   /// Set the storage descriptor's tensor index.
   void setTensorIndex(Var tensor);
 
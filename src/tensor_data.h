@@ -1,8 +1,41 @@
 #ifndef SIMIT_TENSOR_DATA_H
 #define SIMIT_TENSOR_DATA_H
 
+#include "tensor_type.h"
+
 namespace simit {
 
+/// A view of a sparse matrix in the block compressed sparse row (BCSR) layout
+/// that Simit assembles matrices in: block row i holds the blocks
+/// [rowPtr[i],rowPtr[i+1]), sorted by column, where block j has block column
+/// colIdx[j] and its rowBlockSize x colBlockSize row-major values start at
+/// vals[j*rowBlockSize*colBlockSize]. Symmetric matrices may only store their
+/// upper triangle (see setSymmetricMatrices), in which case block rows only
+/// hold the blocks from their diagonal onwards.
+///
+/// Views do not own their memory, which belongs to the function the matrix was
+/// obtained from (see Function::getMatrix).
+struct SparseMatrixView {
+  int numBlockRows = 0;
+  int numBlockCols = 0;
+  int rowBlockSize = 1;
+  int colBlockSize = 1;
+  const int* rowPtr = nullptr;
+  const int* colIdx = nullptr;
+  void* vals = nullptr;
+  ComponentType componentType = ComponentType::Double;
+  bool upperTriangular = false;
+
+  int numRows() const {return numBlockRows * rowBlockSize;}
+  int numCols() const {return numBlockCols * colBlockSize;}
+
+  /// The number of stored blocks.
+  int numBlocks() const {return rowPtr[numBlockRows];}
+
+  /// The number of stored scalar values.
+  int numValues() const {return numBlocks() * rowBlockSize * colBlockSize;}
+};
+
 // TODO: For now only a way of wrapping sparse tensor data
 class TensorData {
 public:
@@ -15,6 +48,15 @@ public:
       kind(Sparse), rowPtr(rowPtr), colInd(colInd), data(data),
       rowLen(rowLen), dataLen(dataLen) {}
 
+  /// Wraps the view's arrays, so a matrix obtained from one function can be
+  /// bound to another without copying it.
+  explicit TensorData(const SparseMatrixView& view) :
+      kind(Sparse), rowPtr(view.rowPtr), colInd(view.colIdx), data(view.vals),
+      rowLen(view.numBlockRows+1), dataLen(view.numBlocks()) {
+    uassert(!view.upperTriangular)
+        << "cannot bind the upper triangle of a symmetric matrix";
+  }
+
   TensorData(TensorData& td) :
       kind(td.kind), rowPtr(td.rowPtr), colInd(td.colInd), data(td.data),
       rowLen(td.rowLen), dataLen(td.dataLen) {}
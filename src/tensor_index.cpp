@@ -14,14 +14,17 @@ namespace ir {
 struct TensorIndex::Content {
   std::string name;
   pe::PathExpression pexpr;
+  bool upperTriangular;
   Var coordArray;
   Var sinkArray;
 };
 
-TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr)
+TensorIndex::TensorIndex(std::string name, pe::PathExpression pexpr,
+                         bool upperTriangular)
     : content(new Content) {
   content->name = name;
   content->pexpr = pexpr;
+  content->upperTriangular = upperTriangular;
 
   string prefix = (name == "") ? name : name + ".";
   content->coordArray = Var(prefix + "coords", ArrayType::make(ScalarType::Int));
@@ -36,6 +39,10 @@ const pe::PathExpression& TensorIndex::getPathExpression() const {
   return content->pexpr;
 }
 
+bool TensorIndex::isUpperTriangular() const {
+  return content->upperTriangular;
+}
+
 const Var& TensorIndex::getRowptrArray() const {
   return content->coordArray;
 }
@@ -47,8 +54,11 @@ const Var& TensorIndex::getColidxArray() const {
 ostream &operator<<(ostream& os, const TensorIndex& ti) {
   auto rowptr = ti.getRowptrArray();
   auto colidx = ti.getColidxArray();
-  os << "tensor-index " << ti.getName() << ": " << ti.getPathExpression()
-     << endl;
+  os << "tensor-index " << ti.getName() << ": " << ti.getPathExpression();
+  if (ti.isUpperTriangular()) {
+    os << " (upper triangle)";
+  }
+  os << endl;
   os << "  " << rowptr << " : " << rowptr.getType() << endl;
   os << "  " << colidx << " : " << colidx.getType();
   return os;
@@ -25,7 +25,8 @@ class Var;
 class TensorIndex {
 public:
   TensorIndex() {}
-  TensorIndex(std::string name, pe::PathExpression pexpr);
+  TensorIndex(std::string name, pe::PathExpression pexpr,
+              bool upperTriangular=false);
 
   /// Get tensor index name
   const std::string getName() const;
@@ -37,6 +38,10 @@ public:
   /// function, or by Simit as they are computed.
   const pe::PathExpression& getPathExpression() const;
 
+  /// True if the index only holds the upper triangle (i <= j) of its path
+  /// expression's sparsity, which is used to store symmetric matrices.
+  bool isUpperTriangular() const;
+
   /// Return the tensor index's rowptr array.  A rowptr array contains the
   /// beginning and end of the column indices in the colidx array for each row
   /// of the tensor index.
@@ -0,0 +1,291 @@
+#include "thread_pool.h"
+
+#include <memory>
+#include <atomic>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace internal {
+
+// Set on threads that are executing a chunk of a parallel loop, so that nested
+// parallel loops (e.g. in called functions) run serially instead of deadlocking
+static thread_local bool inParallelRegion = false;
+
+/// Marks the calling thread as being inside a parallel loop while it is in
+/// scope, also if the loop body throws.
+class ParallelRegion {
+public:
+  ParallelRegion() : outer(inParallelRegion) {inParallelRegion = true;}
+  ~ParallelRegion() {inParallelRegion = outer;}
+
+private:
+  bool outer;
+};
+
+/// Returns the CPUs the process may run on, or none if threads cannot be
+/// pinned on this platform.
+static vector<int> getAllowedCPUs() {
+  vector<int> cpus;
+#if defined(__linux__)
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu=0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+#if defined(__linux__)
+/// Restrict the thread to run on the given CPUs.
+static bool setAffinity(pthread_t thread, const vector<int>& cpus) {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &cpuSet);
+  }
+  return pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet) == 0;
+}
+#endif
+
+/// Pins the calling thread to a CPU while it is in scope, and then lets it run
+/// on the CPUs it could run on before.
+class ScopedPin {
+public:
+  ScopedPin(int cpu) : pinned(false) {
+#if defined(__linux__)
+    pinned = pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved)==0&&
+             setAffinity(pthread_self(), {cpu});
+#endif
+  }
+
+  ~ScopedPin() {
+#if defined(__linux__)
+    if (pinned) {
+      pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+#endif
+  }
+
+private:
+  bool pinned;
+#if defined(__linux__)
+  cpu_set_t saved;
+#endif
+};
+
+// class ThreadPool
+ThreadPool::ThreadPool(int numThreads, bool pinThreads)
+    : numThreads(numThreads), pinnedThreads(false), stopped(false),
+      job(nullptr), jobBegin(0), jobEnd(0), generation(0), pending(0),
+      shutdown(false) {
+  if (this->numThreads <= 0) {
+    this->numThreads = max(1u, thread::hardware_concurrency());
+  }
+  for (int tid=1; tid < this->numThreads; ++tid) {
+    workers.push_back(thread(&ThreadPool::workerLoop, this, tid));
+  }
+  if (pinThreads) {
+    pinWorkers();
+  }
+}
+
+void ThreadPool::pinWorkers() {
+  cpus = getAllowedCPUs();
+  if (cpus.empty()) {
+    return;
+  }
+#if defined(__linux__)
+  // Workers are either all pinned or all left free, so that a failure does
+  // not leave the partition half pinned
+  bool pinned = true;
+  for (int tid=1; tid < numThreads && pinned; ++tid) {
+    pinned = setAffinity(workers[tid-1].native_handle(), {getCPU(tid)});
+  }
+  if (!pinned) {
+    for (thread& worker : workers) {
+      setAffinity(worker.native_handle(), cpus);
+    }
+    cpus.clear();
+    return;
+  }
+  pinnedThreads = true;
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void ThreadPool::stop() {
+  lock_guard<std::mutex> jobLock(jobMutex);
+  if (stopped) {
+    return;
+  }
+  {
+    lock_guard<std::mutex> lock(mutex);
+    shutdown = true;
+  }
+  workAvailable.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  stopped = true;
+}
+
+void ThreadPool::parallelFor(int begin, int end,
+                             const function<void(int,int)>& body) {
+  if (end <= begin) {
+    return;
+  }
+  if (numThreads == 1 || inParallelRegion || end-begin < numThreads) {
+    body(begin, end);
+    return;
+  }
+
+  lock_guard<std::mutex> jobLock(jobMutex);
+  if (stopped) {
+    body(begin, end);
+    return;
+  }
+
+  // The calling thread executes the first chunk, on the first CPU if the
+  // workers are pinned
+  unique_ptr<ScopedPin> callerPin;
+  if (pinnedThreads) {
+    callerPin.reset(new ScopedPin(getCPU(0)));
+  }
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    job = &body;
+    jobBegin = begin;
+    jobEnd = end;
+    pending = numThreads-1;
+    ++generation;
+  }
+  workAvailable.notify_all();
+
+  runChunk(0);
+
+  exception_ptr chunkError;
+  {
+    unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this]{return pending == 0;});
+    job = nullptr;
+    swap(chunkError, error);
+  }
+  if (chunkError) {
+    rethrow_exception(chunkError);
+  }
+}
+
+void ThreadPool::workerLoop(int tid) {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      unique_lock<std::mutex> lock(mutex);
+      workAvailable.wait(lock, [&]{return shutdown || generation != seen;});
+      if (shutdown) {
+        return;
+      }
+      seen = generation;
+    }
+
+    runChunk(tid);
+
+    bool last;
+    {
+      lock_guard<std::mutex> lock(mutex);
+      last = (--pending == 0);
+    }
+    if (last) {
+      workDone.notify_one();
+    }
+  }
+}
+
+void ThreadPool::runChunk(int tid) {
+  int chunkBegin = getChunkBegin(jobBegin, jobEnd, tid);
+  int chunkEnd   = getChunkBegin(jobBegin, jobEnd, tid+1);
+  if (chunkBegin < chunkEnd) {
+    ParallelRegion region;
+    try {
+      (*job)(chunkBegin, chunkEnd);
+    }
+    catch (...) {
+      lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = current_exception();
+      }
+    }
+  }
+}
+
+// The current pool, and the pools that were replaced by setNumThreads. These
+// are stopped but kept, since other threads may still refer to them.
+static mutex poolMutex;
+static atomic<ThreadPool*> threadPool(nullptr);
+static vector<unique_ptr<ThreadPool>> pools;
+static int numPoolThreads = 0;
+static bool pinPoolThreads = false;
+
+ThreadPool& getThreadPool() {
+  ThreadPool* pool = threadPool.load(memory_order_acquire);
+  if (pool == nullptr) {
+    lock_guard<std::mutex> lock(poolMutex);
+    pool = threadPool.load(memory_order_relaxed);
+    if (pool == nullptr) {
+      pool = new ThreadPool(numPoolThreads, pinPoolThreads);
+      pools.push_back(unique_ptr<ThreadPool>(pool));
+      threadPool.store(pool, memory_order_release);
+    }
+  }
+  return *pool;
+}
+
+/// Replace the current pool, so that the next call to getThreadPool creates a
+/// pool with the current settings, and stop it once its running loop is done.
+/// The running loop may itself call getThreadPool, so the pool is stopped
+/// after poolMutex is released.
+static void resetThreadPool(unique_lock<std::mutex>& lock) {
+  ThreadPool* pool = threadPool.exchange(nullptr);
+  lock.unlock();
+  if (pool != nullptr) {
+    pool->stop();
+  }
+}
+
+}  // namespace simit::internal
+
+void setNumThreads(int numThreads) {
+  uassert(numThreads >= 0) << "The number of threads cannot be negative";
+  uassert(!internal::inParallelRegion)
+      << "The number of threads cannot be set inside a parallel loop";
+  unique_lock<mutex> lock(internal::poolMutex);
+  internal::numPoolThreads = numThreads;
+  internal::resetThreadPool(lock);
+}
+
+void setThreadPinning(bool enabled) {
+  uassert(!internal::inParallelRegion)
+      << "Thread pinning cannot be set inside a parallel loop";
+  unique_lock<mutex> lock(internal::poolMutex);
+  internal::pinPoolThreads = enabled;
+  internal::resetThreadPool(lock);
+}
+
+}
@@ -0,0 +1,114 @@
+#ifndef SIMIT_THREAD_POOL_H
+#define SIMIT_THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include "interfaces/uncopyable.h"
+
+namespace simit {
+namespace internal {
+
+/// A fixed-size pool of worker threads that execute parallel loops. A loop
+/// range is statically partitioned into one contiguous chunk per thread, so a
+/// given range and thread count always produce the same partition. The calling
+/// thread executes the first chunk.
+///
+/// Threads can be pinned to the CPUs the process may run on, so that each
+/// thread keeps executing the same chunks of a range on the same CPU.
+/// Together with memory that is first touched in the same partition (see
+/// internal::parallelCalloc), the data of each chunk then stays on the NUMA
+/// node of the thread that processes it across calls.
+class ThreadPool : private interfaces::Uncopyable {
+public:
+  /// Create a pool with the given number of threads, including the calling
+  /// thread. Zero selects the number of hardware threads. If pinThreads is set,
+  /// worker thread `tid` is pinned to the tid'th CPU of the process's affinity
+  /// mask, and the thread that calls parallelFor runs its chunk on the first
+  /// CPU. If any worker cannot be pinned, none are.
+  explicit ThreadPool(int numThreads=0, bool pinThreads=false);
+  ~ThreadPool();
+
+  int getNumThreads() const {return numThreads;}
+
+  /// True if the threads are pinned to CPUs.
+  bool hasPinnedThreads() const {return pinnedThreads;}
+
+  /// Partition [begin,end) across the threads and call body(chunkBegin,
+  /// chunkEnd) once for each non-empty chunk. Returns when all chunks are done.
+  /// Loops started from inside a parallel loop run serially on the calling
+  /// thread. Loops started concurrently from several threads take turns, and
+  /// loops started after the pool is stopped run serially. If body throws, the
+  /// other chunks still run to completion, and the first exception is then
+  /// rethrown on the calling thread.
+  void parallelFor(int begin, int end,
+                   const std::function<void(int,int)>& body);
+
+  /// Wait for the running loop, if any, and join the worker threads.
+  void stop();
+
+  /// Return the first element of the chunk that thread `tid` executes when
+  /// [begin,end) is partitioned across the pool.
+  int getChunkBegin(int begin, int end, int tid) const {
+    return begin + (int)(((long long)(end-begin) * tid) / numThreads);
+  }
+
+private:
+  int numThreads;
+  bool pinnedThreads;
+
+  /// The CPUs the process may run on, if the threads are pinned
+  std::vector<int> cpus;
+  int getCPU(int tid) const {return cpus[tid % cpus.size()];}
+  void pinWorkers();
+
+  std::vector<std::thread> workers;
+
+  /// Held by the thread that runs a loop on the pool, so that loops from
+  /// several threads do not share the job state below
+  std::mutex jobMutex;
+  bool stopped;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+
+  // The current job, guarded by mutex
+  const std::function<void(int,int)>* job;
+  int jobBegin;
+  int jobEnd;
+  unsigned long generation;
+  int pending;
+  bool shutdown;
+
+  /// The first exception thrown by a chunk of the current job, guarded by mutex
+  std::exception_ptr error;
+
+  void workerLoop(int tid);
+  void runChunk(int tid);
+};
+
+/// Returns the process-wide thread pool used by parallel Simit loops. The pool
+/// is created on first use, and may be used from any thread.
+ThreadPool& getThreadPool();
+
+}
+
+/// Set the number of threads that parallel loops are partitioned across (see
+/// the "cpu-parallel" backend). Zero selects the number of hardware threads.
+/// The current pool is stopped once its running loop is done, and loops that
+/// were started on it before then run serially. Must not be called from inside
+/// a parallel loop.
+void setNumThreads(int numThreads);
+
+/// Pin the threads of parallel loops to CPUs (see ThreadPool). Processes that
+/// share CPUs should leave it disabled, which is the default. Must not be
+/// called from inside a parallel loop.
+void setThreadPinning(bool enabled);
+
+}
+#endif
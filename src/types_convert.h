@@ -16,5 +16,8 @@ class Type;
 ir::Type convert(const simit::TensorType &tensorType);
 simit::TensorType convert(const ir::Type &tensorType);
 
+ScalarType convert(ComponentType componentType);
+ComponentType convert(ScalarType scalarType);
+
 }}
 #endif
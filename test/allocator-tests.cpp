@@ -0,0 +1,123 @@
+#include "simit-test.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "allocator.h"
+#include "graph.h"
+
+using namespace std;
+using namespace simit;
+
+// Counts the allocations it serves from the heap
+class CountingAllocator : public Allocator {
+public:
+  int numAllocations = 0;
+  int numDeallocations = 0;
+
+  void* allocate(size_t size) {
+    ++numAllocations;
+    void* ptr = nullptr;
+    return (posix_memalign(&ptr, BUFFER_ALIGNMENT, size) == 0) ? ptr : nullptr;
+  }
+
+  void deallocate(void* ptr, size_t size) {
+    ++numDeallocations;
+    free(ptr);
+  }
+};
+
+TEST(Allocator, setAllocator) {
+  shared_ptr<CountingAllocator> allocator = make_shared<CountingAllocator>();
+  AllocationStats before = getAllocationStats();
+  setAllocator(allocator);
+  {
+    Set points;
+    points.addField<double,3>("x");
+    points.addField<int>("i");
+    ASSERT_EQ(2, allocator->numAllocations);
+    points.addN(5000);
+    ASSERT_EQ(4, allocator->numAllocations);
+    ASSERT_EQ(2, allocator->numDeallocations);
+
+    AllocationStats stats = getAllocationStats();
+    ASSERT_EQ(before.numAllocations + 4, stats.numAllocations);
+    ASSERT_LE(before.bytesAllocated + points.getSize()*(3*sizeof(double) +
+                                                        sizeof(int)),
+              stats.bytesAllocated);
+    ASSERT_LE(stats.bytesAllocated, stats.peakBytesAllocated);
+  }
+  ASSERT_EQ(4, allocator->numDeallocations);
+
+  // Memory is released by the allocator that allocated it
+  Set points;
+  FieldRef<int> i = points.addField<int>("i");
+  setAllocator(nullptr);
+  ElementRef p = points.addN(5000);
+  i.set(p, 42);
+  ASSERT_EQ(5, allocator->numAllocations);
+  ASSERT_EQ(5, allocator->numDeallocations);
+  ASSERT_EQ(42, i.get(p));
+}
+
+TEST(Allocator, hugePages) {
+  // Huge page options fall back to regular pages where they are unavailable
+  DefaultAllocator::Options options;
+  options.transparentHugePages = true;
+  options.hugeTLB = true;
+  options.hugePageThreshold = 4096;
+  options.numaNode = 0;
+  shared_ptr<DefaultAllocator> allocator =
+      make_shared<DefaultAllocator>(options);
+
+  // Mappings from the huge page pool are rounded to whole huge pages, which
+  // deallocation must unmap
+  size_t size = (3 << 20) + BUFFER_ALIGNMENT;
+  char* buffer = (char*)allocator->allocate(size);
+  ASSERT_NE(nullptr, buffer);
+  buffer[0] = buffer[size-1] = 1;
+  allocator->deallocate(buffer, size);
+
+  setAllocator(allocator);
+
+  Set points;
+  FieldRef<double,3> x = points.addField<double,3>("x");
+  points.addN(100000);
+  ASSERT_EQ(0u, (uintptr_t)points.getFieldData("x") % BUFFER_ALIGNMENT);
+  int n = 0;
+  for (ElementRef p : points) {
+    x.set(p, {(double)n, 0.0, 0.0});
+    ++n;
+  }
+  n = 0;
+  for (ElementRef p : points) {
+    SIMIT_ASSERT_FLOAT_EQ((double)n, x.get(p)(0));
+    ++n;
+  }
+  setAllocator(nullptr);
+}
+
+TEST(Allocator, parallelCalloc) {
+  // Large enough to be first touched by the thread pool
+  const size_t n = 1 << 18;
+  int* data = (int*)internal::parallelCalloc(n, sizeof(int));
+  for (size_t i=0; i < n; ++i) {
+    ASSERT_EQ(0, data[i]);
+    data[i] = i;
+  }
+
+  data = (int*)internal::parallelRealloc(data, n, 3*n, sizeof(int));
+  ASSERT_EQ(0u, (uintptr_t)data % BUFFER_ALIGNMENT);
+  for (size_t i=0; i < 3*n; ++i) {
+    ASSERT_EQ((i < n) ? (int)i : 0, data[i]) << "element " << i;
+  }
+
+  vector<unsigned> rowOffsets = {0, n, n, 3*n};
+  internal::parallelZeroRows(data, rowOffsets.data(), 3, sizeof(int));
+  for (size_t i=0; i < 3*n; ++i) {
+    ASSERT_EQ(0, data[i]);
+  }
+  internal::alignedFree(data);
+}
@@ -0,0 +1,72 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "block_kernels.h"
+
+using namespace std;
+using namespace simit::internal;
+
+// Computes C = op(A)*op(B) with a reference triple loop.
+template <typename T>
+static vector<T> referenceGemm(int m, int k, int n, const vector<T>& A,
+                               bool transposeA, const vector<T>& B,
+                               bool transposeB) {
+  vector<T> C(m*n, 0);
+  for (int i=0; i < m; ++i) {
+    for (int j=0; j < n; ++j) {
+      for (int l=0; l < k; ++l) {
+        T a = transposeA ? A[l*m + i] : A[i*k + l];
+        T b = transposeB ? B[j*k + l] : B[l*n + j];
+        C[i*n + j] += a * b;
+      }
+    }
+  }
+  return C;
+}
+
+template <typename T>
+static void testGemm(int m, int k, int n) {
+  vector<T> A(m*k);
+  vector<T> B(k*n);
+  for (size_t i=0; i < A.size(); ++i) {
+    A[i] = (T)((i*7) % 11) - 5;
+  }
+  for (size_t i=0; i < B.size(); ++i) {
+    B[i] = (T)((i*5) % 13) - 6;
+  }
+
+  for (bool transposeA : {false, true}) {
+    for (bool transposeB : {false, true}) {
+      vector<T> expected = referenceGemm(m, k, n, A, transposeA,
+                                         B, transposeB);
+      // Guard elements detect writes past the end of C
+      vector<T> C(m*n + 1, 42);
+      blockGemm(m, k, n, A.data(), transposeA, B.data(), transposeB,
+                C.data());
+      for (int i=0; i < m*n; ++i) {
+        ASSERT_EQ(expected[i], C[i]) << m << "x" << k << "x" << n
+                                     << " element " << i;
+      }
+      ASSERT_EQ(42, C[m*n]);
+    }
+  }
+}
+
+TEST(BlockKernels, gemm) {
+  // The unrolled sizes, and sizes that use partial vectors
+  for (int size : {1, 2, 3, 4, 5, 9, 12, 16}) {
+    testGemm<double>(size, size, size);
+    testGemm<float>(size, size, size);
+  }
+  testGemm<double>(3, 12, 4);
+  testGemm<double>(12, 6, 12);
+  testGemm<float>(7, 3, 13);
+  testGemm<float>(2, 16, 3);
+}
+
+TEST(BlockKernels, isa) {
+  string isa = getBlockKernelISA();
+  ASSERT_TRUE(isa == "avx512" || isa == "avx2" || isa == "generic");
+}
@@ -10,6 +10,7 @@
 #include "types.h"
 
 #include "ffi.h"
+#include "tensor_data.h"
 
 using namespace std;
 using namespace testing;
@@ -287,6 +288,76 @@ TEST(ffi, gemv_blocked) {
 }
 
 
+TEST(ffi, expandToCSR) {
+  // A 2x2 block matrix of 2x3 blocks, missing block (0,0)
+  int rowPtr[] = {0, 1, 3};
+  int colIdx[] = {1, 0, 1};
+  double vals[] = {1,  2,  3,  4,  5,  6,
+                   7,  8,  9,  10, 11, 12,
+                   13, 14, 15, 16, 17, 18};
+  vector<int> csrRowStart(5);
+  vector<int> csrColIdx(18);
+  vector<double> csrVals(18);
+  expandToCSR(vals, rowPtr, colIdx, 4, 6, 2, 3,
+              csrRowStart.data(), csrColIdx.data(), csrVals.data());
+
+  ASSERT_EQ(vector<int>({0, 3, 6, 12, 18}), csrRowStart);
+  ASSERT_EQ(vector<int>({3, 4, 5,
+                         3, 4, 5,
+                         0, 1, 2, 3, 4, 5,
+                         0, 1, 2, 3, 4, 5}), csrColIdx);
+  ASSERT_EQ(vector<double>({1, 2, 3,
+                            4, 5, 6,
+                            7, 8, 9, 13, 14, 15,
+                            10, 11, 12, 16, 17, 18}), csrVals);
+}
+
+TEST(ffi, export_matrix) {
+  Set V;
+  FieldRef<simit_float> a = V.addField<simit_float>("a");
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  ElementRef v0 = V.add();
+  ElementRef v1 = V.add();
+  ElementRef v2 = V.add();
+  b(v0) = 1.0;
+  b(v1) = 2.0;
+  b(v2) = 3.0;
+
+  Set E(V,V);
+  FieldRef<simit_float> e = E.addField<simit_float>("e");
+  ElementRef e0 = E.add(v0,v1);
+  ElementRef e1 = E.add(v1,v2);
+  e(e0) = 1.0;
+  e(e1) = 2.0;
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  // The view refers to the matrix the function assembled
+  SparseMatrixView A = func.getMatrix("A");
+  ASSERT_EQ(3, A.numBlockRows);
+  ASSERT_EQ(3, A.numBlockCols);
+  ASSERT_EQ(1, A.rowBlockSize);
+  ASSERT_EQ(1, A.colBlockSize);
+  ASSERT_TRUE(A.componentType == simit::typeOf<simit_float>());
+  ASSERT_EQ(7, A.numValues());
+
+  vector<int> csrRowStart(A.numRows()+1);
+  vector<int> csrColIdx(A.numValues());
+  vector<simit_float> csrVals(A.numValues());
+  expandToCSR(A, csrRowStart.data(), csrColIdx.data(), csrVals.data());
+  ASSERT_EQ(vector<int>({0, 2, 5, 7}), csrRowStart);
+  ASSERT_EQ(vector<int>({0, 1, 0, 1, 2, 1, 2}), csrColIdx);
+  ASSERT_EQ(vector<simit_float>({1, 1, 1, 3, 2, 2, 2}), csrVals);
+
+  SIMIT_EXPECT_FLOAT_EQ(3.0, a(v0));
+  SIMIT_EXPECT_FLOAT_EQ(13.0, a(v1));
+  SIMIT_EXPECT_FLOAT_EQ(10.0, a(v2));
+}
+
 // Tests that use Eigen
 #ifdef EIGEN
 #include <Eigen/Core>
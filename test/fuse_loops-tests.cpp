@@ -0,0 +1,90 @@
+#include "simit-test.h"
+
+#include "init.h"
+#include "ir.h"
+#include "ir_visitor.h"
+#include "lower/fuse_loops.h"
+
+using namespace std;
+using namespace simit::ir;
+
+static const Type VertexType = ElementType::make("Vertex", {});
+static const Var V("V", SetType::make(VertexType, {}));
+static const Type VectorType =
+    TensorType::make(ScalarType::Float, {IndexDomain(IndexSet(V))});
+
+/// Returns the number of loops over a set in a statement.
+static int countSetLoops(const Stmt& stmt) {
+  int loops = 0;
+  match(stmt,
+    function<void(const For*)>([&](const For* op) {
+      if (op->domain.kind == ForDomain::IndexSet &&
+          op->domain.indexSet.getKind() == IndexSet::Set) {
+        ++loops;
+      }
+    })
+  );
+  return loops;
+}
+
+/// Returns the number of loops over a set in the while loop of a function.
+static int countSetLoopsInWhile(const Func& func) {
+  int loops = 0;
+  match(func.getBody(),
+    function<void(const While*)>([&](const While* op) {
+      loops += countSetLoops(op->body);
+    })
+  );
+  return loops;
+}
+
+/// Returns the number of loops over V after fusing the loops of a function
+/// that executes the statements in order.
+static int fuse(const vector<Stmt>& stmts) {
+  Func func("f", {V}, {}, Block::make(stmts));
+  return countSetLoops(fuseLoops(func).getBody());
+}
+
+TEST(FuseLoops, elementwise) {
+  // for i in V: x[i] = y[i];  for j in V: y[j] = x[j] * x[j]
+  Var x("x", VectorType);
+  Var y("y", VectorType);
+  Var i("i", VertexType);
+  Var j("j", VertexType);
+  Stmt first = For::make(i, ForDomain(IndexSet(V)),
+                         TensorWrite::make(x, {i}, TensorRead::make(y, {i})));
+  Stmt second = For::make(j, ForDomain(IndexSet(V)),
+                          TensorWrite::make(y, {j},
+                                            Mul::make(TensorRead::make(x, {j}),
+                                                      TensorRead::make(x, {j}))));
+  ASSERT_EQ(1, fuse({VarDecl::make(x), VarDecl::make(y), first, second}));
+}
+
+TEST(FuseLoops, readOfOtherIteration) {
+  // for i in V: x[i] = y[i];  for j in V: y[j] = x[k]
+  // The second loop reads an element of x that another iteration of the first
+  // loop writes, so the loops must not be fused.
+  Var x("x", VectorType);
+  Var y("y", VectorType);
+  Var k("k", VertexType);
+  Var i("i", VertexType);
+  Var j("j", VertexType);
+  Stmt first = For::make(i, ForDomain(IndexSet(V)),
+                         TensorWrite::make(x, {i}, TensorRead::make(y, {i})));
+  Stmt second = For::make(j, ForDomain(IndexSet(V)),
+                          TensorWrite::make(y, {j}, TensorRead::make(x, {k})));
+  ASSERT_EQ(2, fuse({VarDecl::make(x), VarDecl::make(y), VarDecl::make(k),
+                     first, second}));
+}
+
+TEST(FuseLoops, cg) {
+  // The iteration of the inlined CG solver fuses into three loops: the matrix
+  // vector product with the dot products that follow it, the updates of x and
+  // r with their dot products, and the update of p with the norm of r.
+  string fileName = string(TEST_INPUT_DIR) + "/program/cg.sim";
+  ASSERT_EQ(3, countSetLoopsInWhile(lowerFunction(fileName)));
+
+  simit::setLoopFusion(false);
+  ScopeGuard resetLoopFusion([]() {simit::setLoopFusion(true);});
+  ASSERT_LT(3, countSetLoopsInWhile(lowerFunction(fileName)));
+}
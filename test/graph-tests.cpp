@@ -61,6 +61,71 @@ TEST(Set, IncreaseCapacity) {
   ASSERT_EQ(count, 1029);
 }
 
+TEST(Set, Reserve) {
+  Set myset;
+  auto fld = myset.addField<int>("foo");
+  ElementRef first = myset.add();
+  fld.set(first, 42);
+
+  myset.reserve(5000);
+  ASSERT_EQ(1, myset.getSize());
+  ASSERT_EQ(42, fld.get(first));
+
+  for (int i=1; i<5000; i++) {
+    ElementRef item = myset.add();
+    fld.set(item, i);
+  }
+  ASSERT_EQ(5000, myset.getSize());
+  ASSERT_EQ(42, fld.get(first));
+}
+
+TEST(Set, AddN) {
+  Set myset;
+  auto fld = myset.addField<double>("foo");
+  myset.add();
+
+  ElementRef first = myset.addN(3000);
+  ASSERT_EQ(1, first.getIdent());
+  ASSERT_EQ(3001, myset.getSize());
+  for (auto element : myset) {
+    SIMIT_ASSERT_FLOAT_EQ(0.0, fld.get(element));
+  }
+}
+
+TEST(Set, FieldAlignment) {
+  Set myset;
+  myset.addField<int>("foo");
+  myset.addField<double,3>("bar");
+  for (int i=0; i<3000; i++) {
+    myset.add();
+    if (i == 0 || i == 2999) {
+      // Fields stay aligned when the set grows
+      for (const char* name : {"foo", "bar"}) {
+        ASSERT_EQ(0u, (uintptr_t)myset.getFieldData(name) %
+                      BUFFER_ALIGNMENT);
+      }
+    }
+  }
+}
+
+TEST(EdgeSet, AddEdges) {
+  Set points;
+  ElementRef p0 = points.addN(4);
+  Set springs(points,points);
+  springs.add(p0, p0);
+
+  const int endpoints[] = {1,2, 2,3, 3,0};
+  ElementRef first = springs.addEdges(endpoints, 3);
+  ASSERT_EQ(1, first.getIdent());
+  ASSERT_EQ(4, springs.getSize());
+
+  int expected[] = {0,0, 1,2, 2,3, 3,0};
+  int *eps = springs.getEndpointsPtr();
+  for (int i=0; i<8; i++) {
+    ASSERT_EQ(expected[i], eps[i]);
+  }
+}
+
 TEST(Set, FieldAccessByName) {
   Set myset;
   
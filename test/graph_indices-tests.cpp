@@ -1,5 +1,8 @@
-#include "gtest/gtest.h"
+#include "simit-test.h"
 
+#include <algorithm>
+
+#include "init.h"
 #include "graph.h"
 #include "graph_indices.h"
 
@@ -22,8 +25,8 @@ TEST(VertexToEdgeEndpointIndex, chain) {
   ASSERT_EQ(edgeindex.getTotalEdges(), 2);
   ASSERT_EQ(2u, edgeindex.getWhichEdgesForElement(p0, 0).size());
   ASSERT_EQ(0u, edgeindex.getWhichEdgesForElement(p0, 1).size());
-  ASSERT_TRUE(edgeindex.getWhichEdgesForElement(p1, 1).find(0) !=
-              edgeindex.getWhichEdgesForElement(p1, 1).end());
+  auto p1Edges = edgeindex.getWhichEdgesForElement(p1, 1);
+  ASSERT_TRUE(find(p1Edges.begin(), p1Edges.end(), 0) != p1Edges.end());
 }
 
 TEST(VertexToEdgeIndex, chain) {
@@ -41,8 +44,8 @@ TEST(VertexToEdgeIndex, chain) {
   ASSERT_EQ(edgeindex.getTotalEdges(), 2);
   ASSERT_EQ(2u, edgeindex.getWhichEdgesForElement(p0, points).size());
   ASSERT_EQ(1u, edgeindex.getWhichEdgesForElement(p1, points).size());
-  ASSERT_TRUE(edgeindex.getWhichEdgesForElement(p1, points).find(0)
-              != edgeindex.getWhichEdgesForElement(p1, points).end());
+  auto p1Edges = edgeindex.getWhichEdgesForElement(p1, points);
+  ASSERT_TRUE(find(p1Edges.begin(), p1Edges.end(), 0) != p1Edges.end());
 }
 
 TEST(NeighborIndex, chain) {
@@ -77,3 +80,318 @@ TEST(NeighborIndex, triangles) {
   ASSERT_EQ(nIndex.getNumNeighbors(p1), 4);
   ASSERT_EQ(nIndex.getNeighbors(p1)[0], 0);
 }
+
+TEST(NeighborIndex, threads) {
+  Set points;
+  Set edges(points, points);
+  createBox(&points, &edges, 7, 5, 3);
+
+  // The index does not depend on the backend or the number of threads
+  string backend = kBackend;
+  ScopeGuard restore([&]() {
+    kBackend = backend;
+    setNumThreads(0);
+  });
+  kBackend = "cpu";
+  internal::NeighborIndex serial(edges);
+  kBackend = "cpu-parallel";
+  setNumThreads(3);
+  internal::NeighborIndex parallel(edges);
+
+  ASSERT_EQ(serial.getSize(), parallel.getSize());
+  for (int i=0; i < points.getSize()+1; ++i) {
+    ASSERT_EQ(serial.getStartIndex()[i], parallel.getStartIndex()[i]);
+  }
+  for (int i=0; i < serial.getSize(); ++i) {
+    ASSERT_EQ(serial.getNeighborIndex()[i], parallel.getNeighborIndex()[i]);
+  }
+
+  // Points are their own neighbors, and edges make their endpoints neighbors
+  ASSERT_EQ(7*5*3 + 2*edges.getSize(), serial.getSize());
+}
+
+static void verifySameNeighbors(const NeighborIndex &actual,
+                                const NeighborIndex &expected) {
+  ASSERT_EQ(expected.getNumVertices(), actual.getNumVertices());
+  ASSERT_EQ(expected.getSize(), actual.getSize());
+  for (int i=0; i < expected.getNumVertices()+1; ++i) {
+    ASSERT_EQ(expected.getStartIndex()[i], actual.getStartIndex()[i]);
+  }
+  for (int i=0; i < expected.getSize(); ++i) {
+    ASSERT_EQ(expected.getNeighborIndex()[i], actual.getNeighborIndex()[i]);
+  }
+}
+
+TEST(NeighborIndex, update) {
+  Set points;
+  Set edges(points, points);
+  Box box = createBox(&points, &edges, 4, 4, 1);
+  unsigned long version = edges.getTopologyVersion();
+  edges.getNeighborIndex();
+
+  // Add a diagonal and a duplicate edge, then patch the index
+  edges.add(box(0,0,0), box(1,1,0));
+  edges.add(box(1,0,0), box(0,0,0));
+  ASSERT_NE(version, edges.getTopologyVersion());
+  verifySameNeighbors(*edges.getNeighborIndex(), NeighborIndex(edges));
+
+  // Remove the diagonal and an edge that connects points that are still
+  // connected by the duplicate edge
+  edges.remove(box.getEdge(box(0,0,0), box(1,0,0)));
+  ElementRef diagonal;
+  for (auto e : edges) {
+    if (edges.getEndpoint(e,0) == box(0,0,0) &&
+        edges.getEndpoint(e,1) == box(1,1,0)) {
+      diagonal = e;
+    }
+  }
+  edges.remove(diagonal);
+  verifySameNeighbors(*edges.getNeighborIndex(), NeighborIndex(edges));
+
+  // Add points and connect one of them
+  ElementRef p = points.add();
+  points.add();
+  edges.add(p, box(3,3,0));
+  verifySameNeighbors(*edges.getNeighborIndex(), NeighborIndex(edges));
+}
+
+TEST(NeighborIndex, updateInPlace) {
+  Set points;
+  Set edges(points, points);
+  Box box = createBox(&points, &edges, 4, 4, 1);
+  const NeighborIndex *nbrs = edges.getNeighborIndex();
+  const EdgeLocationIndex *locations = edges.getEdgeLocationIndex();
+  const EdgeColoring *coloring = edges.getEdgeColoring();
+  const int *startIndex = nbrs->getStartIndex();
+  const int *neighbors = nbrs->getNeighborIndex();
+  const int *locs = locations->getLocations();
+  const int *colorEdges = coloring->getColorEdges();
+
+  // Move an edge: the rows of its endpoints are patched, and the index
+  // buffers are not reallocated since the indices do not grow
+  edges.remove(box.getEdge(box(1,1,0), box(2,1,0)));
+  edges.add(box(1,1,0), box(2,1,0));
+  ASSERT_EQ(nbrs, edges.getNeighborIndex());
+  ASSERT_EQ(locations, edges.getEdgeLocationIndex());
+  ASSERT_EQ(coloring, edges.getEdgeColoring());
+  ASSERT_EQ(startIndex, nbrs->getStartIndex());
+  ASSERT_EQ(neighbors, nbrs->getNeighborIndex());
+  ASSERT_EQ(locs, locations->getLocations());
+  ASSERT_EQ(colorEdges, coloring->getColorEdges());
+  verifySameNeighbors(*nbrs, NeighborIndex(edges));
+
+  EdgeLocationIndex expected(edges, *nbrs);
+  for (int i=0; i < edges.getSize()*2*2; ++i) {
+    ASSERT_EQ(expected.getLocations()[i], locations->getLocations()[i]);
+  }
+}
+
+TEST(EdgeLocationIndex, triangles) {
+  Set points;
+  auto p0 = points.add();
+  auto p1 = points.add();
+  auto p2 = points.add();
+  auto p3 = points.add();
+
+  Set edges(points, points, points);
+  edges.add(p0, p1, p2);
+  auto e1 = edges.add(p1, p3, p2);
+
+  const NeighborIndex *nIndex = edges.getNeighborIndex();
+  const EdgeLocationIndex *locIndex = edges.getEdgeLocationIndex();
+  ASSERT_EQ(locIndex, edges.getEdgeLocationIndex());
+
+  // Every location holds the column of the endpoint pair's row
+  const int *nbrs = nIndex->getNeighborIndex();
+  const int *locations = locIndex->getLocations();
+  for (auto e : edges) {
+    for (int i=0; i < 3; ++i) {
+      for (int j=0; j < 3; ++j) {
+        int loc = locations[(e.getIdent()*3 + i)*3 + j];
+        ElementRef vi = edges.getEndpoint(e, i);
+        ASSERT_GE(loc, nIndex->getStartIndex()[vi.getIdent()]);
+        ASSERT_LT(loc, nIndex->getStartIndex()[vi.getIdent()+1]);
+        ASSERT_EQ(edges.getEndpoint(e, j).getIdent(), nbrs[loc]);
+      }
+    }
+  }
+  ASSERT_EQ(nIndex->getStartIndex()[p1.getIdent()] + 3,
+            locations[(e1.getIdent()*3 + 0)*3 + 1]);
+
+  // Adding edges invalidates the index
+  auto e2 = edges.add(p0, p1, p3);
+  nbrs = edges.getNeighborIndex()->getNeighborIndex();
+  locations = edges.getEdgeLocationIndex()->getLocations();
+  ASSERT_EQ(p3.getIdent(), nbrs[locations[(e2.getIdent()*3 + 0)*3 + 2]]);
+}
+
+static ElementRef getElement(const Set &set, int ident) {
+  for (auto element : set) {
+    if (element.getIdent() == ident) {
+      return element;
+    }
+  }
+  return ElementRef();
+}
+
+static void verifyLocations(const Set &edges) {
+  const NeighborIndex *nbrs = edges.getNeighborIndex();
+  const int *locations = edges.getEdgeLocationIndex()->getLocations();
+  EdgeLocationIndex expected(edges, *nbrs);
+  int cardinality = edges.getCardinality();
+  for (int i=0; i < edges.getSize()*cardinality*cardinality; ++i) {
+    ASSERT_EQ(expected.getLocations()[i], locations[i]);
+  }
+}
+
+TEST(EdgeLocationIndex, unary) {
+  // Edge sets with one endpoint have no neighbors and no locations
+  Set points;
+  auto p0 = points.add();
+  Set edges("edges", points);
+  edges.add(p0);
+  ASSERT_EQ(nullptr, edges.getNeighborIndex());
+  ASSERT_EQ(nullptr, edges.getEdgeLocationIndex());
+}
+
+TEST(EdgeLocationIndex, update) {
+  Set points;
+  vector<ElementRef> p;
+  for (int i=0; i < 8; ++i) {
+    p.push_back(points.add());
+  }
+  Set triangles(points, points, points);
+  for (int i=0; i < 6; ++i) {
+    triangles.add(p[i], p[i+1], p[i+2]);
+  }
+  verifyLocations(triangles);
+
+  // Add triangles that make new neighbors of points before, between and after
+  // the rows that do not change, remove one, and add points
+  triangles.add(p[0], p[3], p[7]);
+  triangles.add(p[2], p[5], p[6]);
+  triangles.remove(getElement(triangles, 1));
+  ElementRef q = points.add();
+  triangles.add(p[4], q, p[4]);
+  verifyLocations(triangles);
+  verifySameNeighbors(*triangles.getNeighborIndex(), NeighborIndex(triangles));
+
+  // Remove triangles until the rows shrink
+  triangles.remove(getElement(triangles, 0));
+  triangles.remove(getElement(triangles, 3));
+  verifyLocations(triangles);
+  verifySameNeighbors(*triangles.getNeighborIndex(), NeighborIndex(triangles));
+}
+
+TEST(EdgeColoring, chain) {
+  Set points;
+  auto p0 = points.add();
+  auto p1 = points.add();
+  auto p2 = points.add();
+  auto p3 = points.add();
+
+  Set edges(points, points);
+  edges.add(p0, p1);
+  edges.add(p1, p2);
+  edges.add(p2, p3);
+
+  const EdgeColoring *coloring = edges.getEdgeColoring();
+  ASSERT_EQ(coloring, edges.getEdgeColoring());
+  ASSERT_EQ(2, coloring->getNumColors());
+
+  // Edges 0 and 2 share no endpoints and get the first color
+  const int *colorStart = coloring->getColorStart();
+  const int *colorEdges = coloring->getColorEdges();
+  ASSERT_EQ(0, colorStart[0]);
+  ASSERT_EQ(2, colorStart[1]);
+  ASSERT_EQ(3, colorStart[2]);
+  ASSERT_EQ(0, colorEdges[0]);
+  ASSERT_EQ(2, colorEdges[1]);
+  ASSERT_EQ(1, colorEdges[2]);
+}
+
+TEST(EdgeColoring, triangles) {
+  Set points;
+  vector<ElementRef> p;
+  for (int i=0; i < 6; ++i) {
+    p.push_back(points.add());
+  }
+
+  Set triangles(points, points, points);
+  triangles.add(p[0], p[1], p[2]);
+  triangles.add(p[1], p[2], p[3]);
+  triangles.add(p[3], p[4], p[5]);
+  triangles.add(p[0], p[4], p[5]);
+  triangles.add(p[2], p[3], p[4]);
+
+  vector<ElementRef> t;
+  for (auto triangle : triangles) {
+    t.push_back(triangle);
+  }
+
+  const EdgeColoring *coloring = triangles.getEdgeColoring();
+  const int *colorStart = coloring->getColorStart();
+  const int *colorEdges = coloring->getColorEdges();
+  ASSERT_EQ(triangles.getSize(), colorStart[coloring->getNumColors()]);
+
+  // No two triangles of a color share a point
+  for (int color=0; color < coloring->getNumColors(); ++color) {
+    ASSERT_LT(colorStart[color], colorStart[color+1]);
+    set<int> colorPoints;
+    for (int loc=colorStart[color]; loc < colorStart[color+1]; ++loc) {
+      for (auto ep : triangles.getEndpoints(t[colorEdges[loc]])) {
+        ASSERT_TRUE(colorPoints.insert(ep.getIdent()).second);
+      }
+    }
+  }
+}
+
+static void verifyColoring(const Set &edges) {
+  const EdgeColoring *coloring = edges.getEdgeColoring();
+  const int *colorStart = coloring->getColorStart();
+  const int *colorEdges = coloring->getColorEdges();
+  ASSERT_EQ(edges.getSize(), colorStart[coloring->getNumColors()]);
+
+  // Every edge has one color, no two edges of a color share a point, and the
+  // edges of each color are in increasing order
+  set<int> coloredEdges;
+  for (int color=0; color < coloring->getNumColors(); ++color) {
+    set<int> colorPoints;
+    for (int loc=colorStart[color]; loc < colorStart[color+1]; ++loc) {
+      ASSERT_TRUE(coloredEdges.insert(colorEdges[loc]).second);
+      if (loc > colorStart[color]) {
+        ASSERT_LT(colorEdges[loc-1], colorEdges[loc]);
+      }
+      set<int> edgePoints;
+      for (auto ep : edges.getEndpoints(getElement(edges, colorEdges[loc]))) {
+        edgePoints.insert(ep.getIdent());
+      }
+      for (int point : edgePoints) {
+        ASSERT_TRUE(colorPoints.insert(point).second);
+      }
+    }
+  }
+  ASSERT_EQ((size_t)edges.getSize(), coloredEdges.size());
+}
+
+TEST(EdgeColoring, update) {
+  Set points;
+  Set edges(points, points);
+  Box box = createBox(&points, &edges, 4, 4, 1);
+  const EdgeColoring *coloring = edges.getEdgeColoring();
+  verifyColoring(edges);
+
+  // Edges are colored and uncolored as they are added and removed
+  edges.add(box(0,0,0), box(1,1,0));
+  edges.add(box(1,1,0), box(2,2,0));
+  edges.remove(box.getEdge(box(1,1,0), box(2,1,0)));
+  ElementRef p = points.add();
+  edges.add(p, box(3,3,0));
+  edges.add(p, p);
+  ASSERT_EQ(coloring, edges.getEdgeColoring());
+  verifyColoring(edges);
+
+  edges.remove(getElement(edges, 0));
+  edges.remove(getElement(edges, edges.getSize()-1));
+  verifyColoring(edges);
+}
@@ -0,0 +1,122 @@
+#include "simit-test.h"
+
+#include <vector>
+
+#include "graph.h"
+#include "multigrid.h"
+#include "solver.h"
+#include "tensor_data.h"
+
+using namespace std;
+using namespace simit;
+using namespace simit::internal;
+
+// A set of n x n points on a unit grid in the z = 0 plane
+static void addGrid(Set* points, int n) {
+  FieldRef<simit_float,3> x = points->addField<simit_float,3>("x");
+  for (int i=0; i < n; ++i) {
+    for (int j=0; j < n; ++j) {
+      ElementRef p = points->add();
+      x.set(p, {(simit_float)i, (simit_float)j, 0.0});
+    }
+  }
+  points->setSpatialField("x");
+}
+
+TEST(Multigrid, hierarchy) {
+  const int n = 32;
+  Set points;
+  addGrid(&points, n);
+  MultigridHierarchy hierarchy(points, 16);
+
+  // Each level aggregates 2x2 blocks of points
+  ASSERT_EQ(4, hierarchy.getNumLevels());
+  ASSERT_EQ(n*n, hierarchy.getSize(0));
+  for (int l=1; l < hierarchy.getNumLevels(); ++l) {
+    ASSERT_EQ(hierarchy.getSize(l-1) / 4, hierarchy.getSize(l));
+  }
+
+  for (int l=0; l+1 < hierarchy.getNumLevels(); ++l) {
+    const vector<int>& aggregates = hierarchy.getAggregates(l);
+    SparseMatrixView P = hierarchy.getProlongation(l);
+    SparseMatrixView R = hierarchy.getRestriction(l);
+    ASSERT_EQ(hierarchy.getSize(l), P.numBlockRows);
+    ASSERT_EQ(hierarchy.getSize(l+1), P.numBlockCols);
+    ASSERT_EQ(P.numBlockCols, R.numBlockRows);
+    ASSERT_EQ(P.numBlockRows, R.numBlockCols);
+
+    // The restriction is the transpose of the prolongation
+    for (int i=0; i < P.numBlockRows; ++i) {
+      ASSERT_EQ(1, P.rowPtr[i+1] - P.rowPtr[i]);
+      ASSERT_EQ(aggregates[i], P.colIdx[P.rowPtr[i]]);
+    }
+    for (int a=0; a < R.numBlockRows; ++a) {
+      ASSERT_EQ(4, R.rowPtr[a+1] - R.rowPtr[a]);
+      for (int k=R.rowPtr[a]; k < R.rowPtr[a+1]; ++k) {
+        ASSERT_EQ(a, aggregates[R.colIdx[k]]);
+      }
+    }
+    ASSERT_EQ(1.0, static_cast<const double*>(R.vals)[0]);
+
+    // Coarse elements lie at the centroids of their aggregates
+    Set& coarse = hierarchy.getSet(l+1);
+    ASSERT_EQ(hierarchy.getSize(l+1), coarse.getSize());
+    ASSERT_EQ("x", coarse.getSpatialFieldName());
+    const double* centroids =
+        static_cast<const double*>(coarse.getFieldData("x"));
+    for (int a=0; a < R.numBlockRows; ++a) {
+      double sum = 0.0;
+      for (int k=R.rowPtr[a]; k < R.rowPtr[a+1]; ++k) {
+        sum += (l == 0)
+            ? (double)static_cast<const simit_float*>(
+                  points.getFieldData("x"))[R.colIdx[k]*3]
+            : static_cast<const double*>(
+                  hierarchy.getSet(l).getFieldData("x"))[R.colIdx[k]*3];
+      }
+      SIMIT_ASSERT_FLOAT_NEAR_EQ(sum / 4, centroids[a*3]);
+    }
+  }
+}
+
+TEST(Multigrid, solve) {
+  // The 2D Laplacian of the grid, preconditioned with the hierarchy's levels
+  const int n = 32;
+  Set points;
+  addGrid(&points, n);
+  SolverParams params;
+  params.maxIterations = n*n;
+  params.preconditioner = SolverParams::Multigrid;
+  params.multigridHierarchy = make_shared<MultigridHierarchy>(points, 16);
+
+  vector<int> rowPtr = {0};
+  vector<int> colIdx;
+  vector<double> vals;
+  for (int i=0; i < n; ++i) {
+    for (int j=0; j < n; ++j) {
+      for (int di=-1; di <= 1; ++di) {
+        for (int dj=-1; dj <= 1; ++dj) {
+          if ((di != 0 && dj != 0) || i+di < 0 || i+di >= n || j+dj < 0 ||
+              j+dj >= n) continue;
+          colIdx.push_back((i+di)*n + j+dj);
+          vals.push_back((di == 0 && dj == 0) ? 4.0 : -1.0);
+        }
+      }
+      rowPtr.push_back(colIdx.size());
+    }
+  }
+  BlockSparseMatrix<double> A = {n*n, n*n, rowPtr.data(), colIdx.data(), 1, 1,
+                                 vals.data(), false};
+  vector<double> expected(n*n);
+  for (int i=0; i < n*n; ++i) {
+    expected[i] = i % 5;
+  }
+  vector<double> b(n*n);
+  blockSpMV(A, expected.data(), b.data());
+
+  vector<double> x(n*n);
+  int iterations = conjugateGradient(A, b.data(), x.data(), params);
+  ASSERT_LT(iterations, 40);
+  for (int i=0; i < n*n; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-6);
+  }
+}
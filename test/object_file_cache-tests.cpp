@@ -0,0 +1,219 @@
+#include "simit-test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "program.h"
+#include "init.h"
+#include "backend/object_file_cache.h"
+
+using namespace std;
+using namespace simit;
+using simit::backend::ObjectFileCache;
+
+/// Create an empty temporary directory.
+static std::string createTempDirectory() {
+  char directory[] = "/tmp/simit-cache-XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    return "";
+  }
+  return directory;
+}
+
+/// Remove the files of a temporary directory. Returns the number of files.
+static int removeFiles(const std::string& directory) {
+  int numFiles = 0;
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return 0;
+  }
+  while (dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      std::remove((directory + "/" + name).c_str());
+      ++numFiles;
+    }
+  }
+  closedir(dir);
+  return numFiles;
+}
+
+static void removeDirectory(const std::string& directory) {
+  removeFiles(directory);
+  rmdir(directory.c_str());
+}
+
+TEST(ObjectFileCache, miss) {
+  std::string directory = createTempDirectory();
+  ASSERT_NE("", directory);
+  ScopeGuard cleanup([&]() {removeDirectory(directory);});
+
+  ObjectFileCache cache(directory);
+  std::string object;
+  ASSERT_FALSE(cache.lookup("key"));
+  ASSERT_FALSE(cache.takeObject("key", &object));
+  ASSERT_EQ(0u, cache.getNumHits());
+  ASSERT_EQ(1u, cache.getNumMisses());
+}
+
+TEST(ObjectFileCache, hit) {
+  std::string directory = createTempDirectory();
+  ASSERT_NE("", directory);
+  ScopeGuard cleanup([&]() {removeDirectory(directory);});
+
+  ObjectFileCache cache(directory);
+  std::string stored("object\0code", 11);
+  cache.storeObject("key", stored.data(), stored.size());
+
+  std::string object;
+  ASSERT_TRUE(cache.lookup("key"));
+  ASSERT_TRUE(cache.takeObject("key", &object));
+  ASSERT_EQ(stored, object);
+
+  // An object is taken once per lookup
+  ASSERT_FALSE(cache.takeObject("key", &object));
+  ASSERT_EQ(1u, cache.getNumHits());
+  ASSERT_EQ(0u, cache.getNumMisses());
+
+  // Other keys, such as those of other optimization levels, miss
+  ASSERT_FALSE(cache.lookup("other"));
+  ASSERT_EQ(1u, cache.getNumMisses());
+
+  // Caches in the same directory share objects
+  ObjectFileCache other(directory);
+  ASSERT_TRUE(other.lookup("key"));
+}
+
+TEST(ObjectFileCache, invalidate) {
+  std::string directory = createTempDirectory();
+  ASSERT_NE("", directory);
+  ScopeGuard cleanup([&]() {removeDirectory(directory);});
+
+  ObjectFileCache cache(directory);
+  std::string stored = "object";
+  cache.storeObject("key", stored.data(), stored.size());
+
+  // Removing the file after a lookup does not turn the hit into a miss
+  ASSERT_TRUE(cache.lookup("key"));
+  ASSERT_EQ(1, removeFiles(directory));
+  std::string object;
+  ASSERT_TRUE(cache.takeObject("key", &object));
+  ASSERT_EQ(stored, object);
+
+  // Removing the file before a lookup does
+  ASSERT_FALSE(cache.lookup("key"));
+  ASSERT_FALSE(cache.takeObject("key", &object));
+
+  // Replacing the file after a lookup does not change the object found
+  cache.storeObject("key", stored.data(), stored.size());
+  ASSERT_TRUE(cache.lookup("key"));
+  std::string replaced = "replaced";
+  cache.storeObject("key", replaced.data(), replaced.size());
+  ASSERT_TRUE(cache.takeObject("key", &object));
+  ASSERT_EQ(stored, object);
+}
+
+static void runGemv(Function func) {
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+  b.set(p0, 1.0);
+  b.set(p1, 2.0);
+  b.set(p2, 3.0);
+
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+  a.set(s0, 1.0);
+  a.set(s1, 2.0);
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+  func.runSafe();
+
+  ASSERT_EQ(3.0, c.get(p0));
+  ASSERT_EQ(13.0, c.get(p1));
+  ASSERT_EQ(10.0, c.get(p2));
+}
+
+TEST(ObjectFileCache, compile) {
+  if (kBackend == "gpu") {
+    return;
+  }
+  std::string directory = createTempDirectory();
+  ASSERT_NE("", directory);
+  setCompileCacheDirectory(directory);
+  ScopeGuard cleanup([&]() {
+    setCompileCacheDirectory("");
+    removeDirectory(directory);
+  });
+  shared_ptr<ObjectFileCache> cache = backend::getObjectFileCache();
+  ASSERT_TRUE(cache != nullptr);
+
+  std::string fileName = std::string(TEST_INPUT_DIR) + "/system/gemv.sim";
+
+  // The first compilation generates and stores the object
+  Function func = loadFunction(fileName, "main");
+  if (!func.defined()) FAIL();
+  runGemv(func);
+  ASSERT_EQ(0u, cache->getNumHits());
+  ASSERT_EQ(1u, cache->getNumMisses());
+
+  // The second loads it
+  Function cached = loadFunction(fileName, "main");
+  if (!cached.defined()) FAIL();
+  runGemv(cached);
+  ASSERT_EQ(1u, cache->getNumHits());
+  ASSERT_EQ(1u, cache->getNumMisses());
+
+  // Removing the objects invalidates the cache, and the function is optimized
+  // and compiled again
+  ASSERT_EQ(1, removeFiles(directory));
+  Function recompiled = loadFunction(fileName, "main");
+  if (!recompiled.defined()) FAIL();
+  runGemv(recompiled);
+  ASSERT_EQ(1u, cache->getNumHits());
+  ASSERT_EQ(2u, cache->getNumMisses());
+}
+
+TEST(ObjectFileCache, literals) {
+  if (kBackend == "gpu") {
+    return;
+  }
+  std::string directory = createTempDirectory();
+  ASSERT_NE("", directory);
+  setCompileCacheDirectory(directory);
+  ScopeGuard cleanup([&]() {
+    setCompileCacheDirectory("");
+    removeDirectory(directory);
+  });
+  shared_ptr<ObjectFileCache> cache = backend::getObjectFileCache();
+  ASSERT_TRUE(cache != nullptr);
+
+  // Functions with matrix literals, whose data is allocated anew by every
+  // compilation, share their objects
+  std::string fileName =
+      std::string(TEST_INPUT_DIR) + "/system/gemv_blocked_symmetric.sim";
+  Function func = loadFunction(fileName, "main");
+  if (!func.defined()) FAIL();
+  Function cached = loadFunction(fileName, "main");
+  if (!cached.defined()) FAIL();
+  ASSERT_EQ(1u, cache->getNumHits());
+  ASSERT_EQ(1u, cache->getNumMisses());
+
+  // Functions compiled after the cache is disabled do not use it, and the
+  // cache stays alive while it is referenced
+  setCompileCacheDirectory("");
+  ASSERT_TRUE(backend::getObjectFileCache() == nullptr);
+  Function uncached = loadFunction(fileName, "main");
+  if (!uncached.defined()) FAIL();
+  ASSERT_EQ(1u, cache->getNumHits());
+  ASSERT_EQ(1u, cache->getNumMisses());
+}
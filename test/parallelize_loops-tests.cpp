@@ -0,0 +1,70 @@
+#include "simit-test.h"
+
+#include "ir.h"
+#include "ir_visitor.h"
+#include "lower/parallelize_loops.h"
+
+using namespace std;
+using namespace simit::ir;
+
+static const Type VertexType =
+    ElementType::make("Vertex", {Field("x", Float), Field("y", Float)});
+static const Var V("V", SetType::make(VertexType, {}));
+
+/// Returns the kind of the loop over V after parallelizing a function that
+/// loops over V with the given body.
+static For::Kind parallelize(const Var& i, const Stmt& body) {
+  Func func("f", {V}, {}, For::make(i, ForDomain(IndexSet(V)), body));
+  For::Kind kind = For::Serial;
+  match(parallelizeLoops(func).getBody(),
+    function<void(const For*)>([&](const For* op) {
+      kind = op->kind;
+    })
+  );
+  return kind;
+}
+
+TEST(ParallelizeLoops, ownedStore) {
+  // x[i] = x[i] + y[i]
+  Var i("i", Int);
+  Expr x = FieldRead::make(V, "x");
+  Expr y = FieldRead::make(V, "y");
+  Stmt body = Store::make(x, i, Add::make(Load::make(x, i), Load::make(y, i)));
+  ASSERT_EQ(For::Parallel, parallelize(i, body));
+}
+
+TEST(ParallelizeLoops, loadOfOtherIteration) {
+  // x[i] = x[i+1] reads what another iteration writes
+  Var i("i", Int);
+  Expr x = FieldRead::make(V, "x");
+  Stmt body = Store::make(x, i, Load::make(x, Add::make(i, 1)));
+  ASSERT_EQ(For::Serial, parallelize(i, body));
+
+  // y[i] = x[i+1] only reads x
+  Expr y = FieldRead::make(V, "y");
+  body = Store::make(y, i, Load::make(x, Add::make(i, 1)));
+  ASSERT_EQ(For::Parallel, parallelize(i, body));
+}
+
+TEST(ParallelizeLoops, storeOfOtherIteration) {
+  // Stores to locations that several iterations compute race
+  Var i("i", Int);
+  Expr x = FieldRead::make(V, "x");
+  Expr one = Literal::make(1.0);
+  ASSERT_EQ(For::Serial,
+            parallelize(i, Store::make(x, Div::make(i, 2), one)));
+  ASSERT_EQ(For::Serial,
+            parallelize(i, Store::make(x, Mul::make(0, i), one)));
+  ASSERT_EQ(For::Serial,
+            parallelize(i, Store::make(x, Add::make(i, 1), one)));
+
+  // Blocks of the loop variable are owned if their offsets are in the block
+  Var j("j", Int);
+  Stmt body = ForRange::make(j, 0, 3,
+                             Store::make(x, Add::make(Mul::make(i, 3), j),
+                                         one));
+  ASSERT_EQ(For::Parallel, parallelize(i, body));
+  body = ForRange::make(j, 0, 3,
+                        Store::make(x, Add::make(Mul::make(i, 2), j), one));
+  ASSERT_EQ(For::Serial, parallelize(i, body));
+}
@@ -5,8 +5,11 @@
 #include <map>
 #include <set>
 #include <iostream>
+#include <algorithm>
 
+#include "init.h"
 #include "graph.h"
+#include "thread_pool.h"
 #include "path_expressions.h"
 #include "path_indices.h"
 
@@ -72,6 +75,16 @@ TEST(PathIndex, Link) {
   builder.bind("G", &G);
   PathIndex vgIndex = builder.buildSegmented(vg, 0);
   VERIFY_INDEX(vgIndex, nbrs({{0}, {}, {}, {}, {0}}));
+
+  // Test ve where an edge connects a vertex to itself
+  Var l("l", simit::pe::Set("L"));
+  PathExpression vl = Link::make(v, l, Link::ve);
+  simit::Set L(V,V);
+  L.add(box(1,0,0), box(1,0,0));
+  L.add(box(1,0,0), box(2,0,0));
+  builder.bind("L", &L);
+  PathIndex vlIndex = builder.buildSegmented(vl, 0);
+  VERIFY_INDEX(vlIndex, nbrs({{}, {0,1}, {1}, {}, {}}));
 }
 
 
@@ -232,6 +245,52 @@ TEST(PathIndex, ExistAnd) {
   VERIFY_INDEX(vevgvIndex, nbrs({{0,2}, {0,2}, {0,2}}));
 }
 
+TEST(PathIndex, ExistAndThreads) {
+  simit::Set V;
+  simit::Set E(V,V);
+  createBox(&V, &E, 7, 5, 3);
+
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  Var vk("vk");
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+  PathExpression vevev = And::make({vi,vj}, {{QuantifiedVar::Exist,vk}},
+                                   vev(vi,vk), vev(vk, vj));
+
+  // The two-hop index does not depend on the backend or the number of threads
+  string backend = kBackend;
+  ScopeGuard restore([&]() {
+    kBackend = backend;
+    setNumThreads(0);
+  });
+  vector<vector<vector<unsigned>>> rows;
+  for (string parallelBackend : {"cpu", "cpu-parallel"}) {
+    kBackend = parallelBackend;
+    setNumThreads(3);
+    PathIndexBuilder builder;
+    builder.bind("V", &V);
+    builder.bind("E", &E);
+    PathIndex index = builder.buildSegmented(vevev, 0);
+    ASSERT_EQ((unsigned)V.getSize(), index.numElements());
+
+    rows.push_back({});
+    for (unsigned elem=0; elem < index.numElements(); ++elem) {
+      vector<unsigned> row;
+      for (unsigned nbr : index.neighbors(elem)) {
+        row.push_back(nbr);
+      }
+      ASSERT_TRUE(is_sorted(row.begin(), row.end()));
+      ASSERT_EQ(row.end(), adjacent_find(row.begin(), row.end()));
+      rows.back().push_back(row);
+    }
+  }
+  ASSERT_EQ(rows[0], rows[1]);
+}
+
 TEST(PathIndex, ExistOr) {
   PathIndexBuilder builder;
 
@@ -367,3 +426,80 @@ TEST(PathIndex, Hypergraph) {
   PathIndex pidx = builder.buildSegmented(vevORvfv, 0);
   VERIFY_INDEX(pidx, nbrs({{0,1,2}, {0,1,2,3}, {0,1,2,3}, {1,2,3}}));
 }
+
+static void verifySameIndex(const PathIndex &actual, const PathIndex &expected) {
+  const SegmentedPathIndex *a = to<SegmentedPathIndex>(actual);
+  const SegmentedPathIndex *e = to<SegmentedPathIndex>(expected);
+  ASSERT_EQ(e->numElements(), a->numElements());
+  for (unsigned i=0; i < e->numElements()+1; ++i) {
+    ASSERT_EQ(e->getCoordData()[i], a->getCoordData()[i]);
+  }
+  for (unsigned i=0; i < e->numNeighbors(); ++i) {
+    ASSERT_EQ(e->getSinkData()[i], a->getSinkData()[i]);
+  }
+}
+
+TEST(PathIndex, update) {
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression ve = makeVE();
+  PathExpression ev = makeEV();
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 ve(vi, e), ev(e, vj));
+
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 4, 4, 1);
+
+  PathIndexBuilder builder;
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex index = builder.buildSegmented(vev, 0);
+  PathIndex upper = builder.buildUpperTriangular(index);
+  const uint32_t *coords = to<SegmentedPathIndex>(index)->getCoordData();
+  const uint32_t *sinks = to<SegmentedPathIndex>(index)->getSinkData();
+  const uint32_t *upperCoords = to<SegmentedPathIndex>(upper)->getCoordData();
+  const uint32_t *upperSinks = to<SegmentedPathIndex>(upper)->getSinkData();
+
+  // Moving an edge patches the rows of its endpoints, in the same buffers
+  E.remove(box.getEdge(box(1,1,0), box(2,1,0)));
+  E.add(box(1,1,0), box(2,2,0));
+  PathIndexBuilder updater;
+  updater.bind("V", &V);
+  updater.bind("E", &E);
+  ASSERT_TRUE(updater.updateSegmented(vev, index));
+  updater.updateUpperTriangular(index, upper);
+  ASSERT_EQ(coords, to<SegmentedPathIndex>(index)->getCoordData());
+  ASSERT_EQ(sinks, to<SegmentedPathIndex>(index)->getSinkData());
+  ASSERT_EQ(upperCoords, to<SegmentedPathIndex>(upper)->getCoordData());
+  ASSERT_EQ(upperSinks, to<SegmentedPathIndex>(upper)->getSinkData());
+  {
+    PathIndexBuilder expected;
+    expected.bind("V", &V);
+    expected.bind("E", &E);
+    PathIndex expectedIndex = expected.buildSegmented(vev, 0);
+    verifySameIndex(index, expectedIndex);
+    verifySameIndex(upper, expected.buildUpperTriangular(expectedIndex));
+  }
+
+  // Indices grow with new points and edges
+  ElementRef p = V.add();
+  V.add();
+  E.add(p, box(0,0,0));
+  E.add(box(3,3,0), box(0,0,0));
+  ASSERT_TRUE(updater.updateSegmented(vev, index));
+  updater.updateUpperTriangular(index, upper);
+  {
+    PathIndexBuilder expected;
+    expected.bind("V", &V);
+    expected.bind("E", &E);
+    PathIndex expectedIndex = expected.buildSegmented(vev, 0);
+    verifySameIndex(index, expectedIndex);
+    verifySameIndex(upper, expected.buildUpperTriangular(expectedIndex));
+  }
+
+  // Other path expressions are not updated in place
+  PathIndex veIndex = updater.buildSegmented(ve, 0);
+  ASSERT_FALSE(updater.updateSegmented(ve, veIndex));
+}
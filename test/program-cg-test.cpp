@@ -3,42 +3,150 @@
 #include "graph.h"
 #include "program.h"
 #include "error.h"
+#include "init.h"
 
 using namespace std;
 using namespace simit;
 
-TEST(Program, cg) {
+/// Creates a chain of n points, where point i has b = i+1 and spring i has
+/// a = i+4, and returns the points.
+static vector<ElementRef> createChain(Set* points, Set* springs, int n) {
+  FieldRef<simit_float>  b = points->addField<simit_float>("b");
+  points->addField<simit_float>("c");
+  points->addField<int>("id");
+  FieldRef<simit_float> a = springs->addField<simit_float>("a");
+
+  vector<ElementRef> elements;
+  for (int i=0; i < n; ++i) {
+    elements.push_back(points->add());
+    b.set(elements.back(), i+1.0);
+  }
+  for (int i=0; i < n-1; ++i) {
+    a.set(springs->add(elements[i], elements[i+1]), i+4.0);
+  }
+  return elements;
+}
+
+static void runCG(const string& fileName) {
   Set points;
-  FieldRef<simit_float>  b = points.addField<simit_float>("b");
-  FieldRef<simit_float>  c = points.addField<simit_float>("c");
-  FieldRef<int>    id = points.addField<int>("id");
+  Set springs(points,points);
+  vector<ElementRef> p = createChain(&points, &springs, 3);
+  FieldRef<simit_float> c = points.getField<simit_float>("c");
 
-  ElementRef p0 = points.add();
-  ElementRef p1 = points.add();
-  ElementRef p2 = points.add();
+  Function func = loadFunction(fileName, "main");
+  if (!func.defined()) FAIL();
 
-  b.set(p0, 1.0);
-  b.set(p1, 2.0);
-  b.set(p2, 3.0);
+  func.bind("points", &points);
+  func.bind("springs", &springs);
 
-  Set springs(points,points);
-  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+  func.runSafe();
 
-  ElementRef s0 = springs.add(p0,p1);
-  ElementRef s1 = springs.add(p1,p2);
+  SIMIT_ASSERT_FLOAT_EQ(0.95883777239709455653, (simit_float)c.get(p[0]));
+  SIMIT_ASSERT_FLOAT_EQ(1.98789346246973352983, (simit_float)c.get(p[1]));
+  SIMIT_ASSERT_FLOAT_EQ(3.05326876513317202466, (simit_float)c.get(p[2]));
+}
 
-  a.set(s0, 4.0);
-  a.set(s1, 5.0);
+TEST(Program, cg) {
+  runCG(TEST_FILE_NAME);
+}
+
+TEST(Program, cg_unfused) {
+  setLoopFusion(false);
+  ScopeGuard resetLoopFusion([]() {setLoopFusion(true);});
+  runCG(string(TEST_INPUT_DIR) + "/program/cg.sim");
+}
 
-  Function func = loadFunction(TEST_FILE_NAME, "main");
+TEST(Program, cg_rebind) {
+  string fileName = string(TEST_INPUT_DIR) + "/program/cg.sim";
+  Function func = loadFunction(fileName, "main");
   if (!func.defined()) FAIL();
 
+  Set points;
+  Set springs(points,points);
+  vector<ElementRef> p = createChain(&points, &springs, 3);
+  FieldRef<simit_float> c = points.getField<simit_float>("c");
   func.bind("points", &points);
   func.bind("springs", &springs);
+  func.runSafe();
+  SIMIT_ASSERT_FLOAT_EQ(0.95883777239709455653, (simit_float)c.get(p[0]));
+  SIMIT_ASSERT_FLOAT_EQ(1.98789346246973352983, (simit_float)c.get(p[1]));
+  SIMIT_ASSERT_FLOAT_EQ(3.05326876513317202466, (simit_float)c.get(p[2]));
 
+  // Bind sets of a different size to the compiled function, and compare with a
+  // function that is compiled for them
+  Set morePoints;
+  Set moreSprings(morePoints,morePoints);
+  vector<ElementRef> q = createChain(&morePoints, &moreSprings, 5);
+  FieldRef<simit_float> qc = morePoints.getField<simit_float>("c");
+  func.bind("points", &morePoints);
+  func.bind("springs", &moreSprings);
   func.runSafe();
 
-  SIMIT_ASSERT_FLOAT_EQ(0.95883777239709455653, (simit_float)c.get(p0));
-  SIMIT_ASSERT_FLOAT_EQ(1.98789346246973352983, (simit_float)c.get(p1));
-  SIMIT_ASSERT_FLOAT_EQ(3.05326876513317202466, (simit_float)c.get(p2));
+  Function expectedFunc = loadFunction(fileName, "main");
+  Set expectedPoints;
+  Set expectedSprings(expectedPoints,expectedPoints);
+  vector<ElementRef> e = createChain(&expectedPoints, &expectedSprings, 5);
+  FieldRef<simit_float> ec = expectedPoints.getField<simit_float>("c");
+  expectedFunc.bind("points", &expectedPoints);
+  expectedFunc.bind("springs", &expectedSprings);
+  expectedFunc.runSafe();
+
+  for (int i=0; i < 5; ++i) {
+    ASSERT_EQ((simit_float)ec.get(e[i]), (simit_float)qc.get(q[i]));
+  }
+
+  // The first sets are unchanged, and can be bound again
+  c.set(p[0], 0.0);
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+  func.runSafe();
+  SIMIT_ASSERT_FLOAT_EQ(0.95883777239709455653, (simit_float)c.get(p[0]));
+}
+
+/// Solve the system of a chain of n points, and return the points' c.
+static void solveChain(const string& fileName, int n,
+                       vector<simit_float>* solution) {
+  Set points;
+  Set springs(points,points);
+  vector<ElementRef> p = createChain(&points, &springs, n);
+  FieldRef<simit_float> c = points.getField<simit_float>("c");
+
+  Function func = loadFunction(fileName, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+  func.runSafe();
+
+  for (const ElementRef& point : p) {
+    solution->push_back(c.get(point));
+  }
+}
+
+TEST(Program, cg_parallel) {
+  if (kBackend == "gpu") {
+    return;
+  }
+  string backend = kBackend;
+  ScopeGuard resetBackend([=]() {
+    kBackend = backend;
+    setNumThreads(0);
+  });
+  string fileName = string(TEST_INPUT_DIR) + "/program/cg.sim";
+
+  // The assembly, the products and the dot product reductions of the solver
+  // are partitioned across threads, which only changes the order floating
+  // point sums are computed in
+  kBackend = "cpu";
+  vector<simit_float> expected;
+  solveChain(fileName, 1000, &expected);
+  kBackend = "cpu-parallel";
+  setNumThreads(4);
+  vector<simit_float> actual;
+  solveChain(fileName, 1000, &actual);
+
+  ASSERT_EQ(1000u, expected.size());
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i=0; i < expected.size(); ++i) {
+    SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[i], actual[i]);
+  }
 }
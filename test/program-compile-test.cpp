@@ -0,0 +1,100 @@
+#include "simit-test.h"
+
+#include <map>
+#include <future>
+
+#include "graph.h"
+#include "program.h"
+#include "init.h"
+#include "error.h"
+
+using namespace std;
+using namespace simit;
+
+// Run the function on a path of three vertices and return the vertices' a
+static vector<simit_float> run(Function& func) {
+  Set V;
+  FieldRef<simit_float> a = V.addField<simit_float>("a");
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  ElementRef v0 = V.add();
+  ElementRef v1 = V.add();
+  ElementRef v2 = V.add();
+  b.set(v0, 1.0);
+  b.set(v1, 2.0);
+  b.set(v2, 3.0);
+
+  Set E(V,V);
+  FieldRef<simit_float> e = E.addField<simit_float>("e");
+  e.set(E.add(v0,v1), 1.0);
+  e.set(E.add(v1,v2), 2.0);
+
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+  return {a.get(v0), a.get(v1), a.get(v2)};
+}
+
+TEST(Program, compileAll) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(TEST_FILE_NAME));
+
+  // Functions that share callees, and functions compiled more than once, are
+  // compiled concurrently
+  vector<string> names = {"multiply", "scale", "multiplyAndScale",
+                          "multiply", "scale", "multiplyAndScale"};
+  vector<Function> funcs = program.compileAll(names);
+  ASSERT_EQ(names.size(), funcs.size());
+
+  map<string, vector<simit_float>> expected = {
+    {"multiply",         {-1.0, -1.0, 2.0}},
+    {"scale",            { 2.0,  4.0, 6.0}},
+    {"multiplyAndScale", { 1.0,  3.0, 8.0}}
+  };
+  for (size_t i=0; i < names.size(); ++i) {
+    ASSERT_TRUE(funcs[i].defined());
+    vector<simit_float> a = run(funcs[i]);
+    for (int j=0; j < 3; ++j) {
+      SIMIT_ASSERT_FLOAT_EQ(expected[names[i]][j], a[j]);
+    }
+  }
+
+  // Errors are rethrown on the calling thread
+  ASSERT_THROW(program.compileAll({"scale", "undefined"}), SimitException);
+}
+
+TEST(Program, compileAsync) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(TEST_INPUT_DIR "/program/compileAll.sim"));
+
+  future<Function> multiply = program.compileAsync("multiply");
+  future<Function> scale = program.compileAsync("scale");
+  Function func = multiply.get();
+  vector<simit_float> a = run(func);
+  SIMIT_ASSERT_FLOAT_EQ(-1.0, a[0]);
+  SIMIT_ASSERT_FLOAT_EQ(-1.0, a[1]);
+  SIMIT_ASSERT_FLOAT_EQ( 2.0, a[2]);
+  func = scale.get();
+  a = run(func);
+  SIMIT_ASSERT_FLOAT_EQ(2.0, a[0]);
+  SIMIT_ASSERT_FLOAT_EQ(4.0, a[1]);
+  SIMIT_ASSERT_FLOAT_EQ(6.0, a[2]);
+}
+
+TEST(Program, tieredCompilation) {
+  Program program;
+  ASSERT_EQ(0, program.loadFile(TEST_INPUT_DIR "/program/compileAll.sim"));
+
+  // The function runs before and after it switches to the optimized code
+  setTieredCompilation(true);
+  Function func = program.compile("multiplyAndScale");
+  setTieredCompilation(false);
+  vector<simit_float> a = run(func);
+  SIMIT_ASSERT_FLOAT_EQ(1.0, a[0]);
+  SIMIT_ASSERT_FLOAT_EQ(3.0, a[1]);
+  SIMIT_ASSERT_FLOAT_EQ(8.0, a[2]);
+  func.waitForOptimization();
+  a = run(func);
+  SIMIT_ASSERT_FLOAT_EQ(1.0, a[0]);
+  SIMIT_ASSERT_FLOAT_EQ(3.0, a[1]);
+  SIMIT_ASSERT_FLOAT_EQ(8.0, a[2]);
+}
@@ -3,11 +3,15 @@
 #include "graph.h"
 #include "program.h"
 #include "error.h"
+#include "init.h"
 
 using namespace std;
 using namespace simit;
 
-TEST(Program, esprings) {
+/// Simulate a cube of springs for ten time steps, and return the positions of
+/// its corners.
+static void simulateESprings(const string& fileName,
+                             vector<simit_float>* positions) {
   // Points
   Set points;
   FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
@@ -93,7 +97,7 @@ TEST(Program, esprings) {
   l0.set(s12, 0.9);
 
   // Compile program and bind arguments
-  Function func = loadFunction(TEST_FILE_NAME, "main");
+  Function func = loadFunction(fileName, "main");
   if (!func.defined()) FAIL();
 
   func.bind("points", &points);
@@ -103,44 +107,74 @@ TEST(Program, esprings) {
     func.runSafe();
   }
 
+  for (const ElementRef& point : {p1, p2, p3, p4, p5, p6, p7, p8}) {
+    for (int i=0; i < 3; ++i) {
+      positions->push_back(x.get(point)(i));
+    }
+  }
+}
+
+TEST(Program, esprings) {
+  vector<simit_float> x;
+  simulateESprings(TEST_FILE_NAME, &x);
+  ASSERT_EQ(8u*3, x.size());
+
   // Check outputs
-  TensorRef<simit_float,3> x1 = x.get(p1);
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x1(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x1(1));
-  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x1(2));
-
-  TensorRef<simit_float,3> x2 = x.get(p2);
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x2(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x2(1));
-  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x2(2));
-
-  TensorRef<simit_float,3> x3 = x.get(p3);
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x3(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x3(1));
-  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x3(2));
-
-  TensorRef<simit_float,3> x4 = x.get(p4);
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x4(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x4(1));
-  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x4(2));
-
-  TensorRef<simit_float,3> x5 = x.get(p5);
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x5(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x5(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x5(2));
-
-  TensorRef<simit_float,3> x6 = x.get(p6);
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x6(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x6(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x6(2));
-
-  TensorRef<simit_float,3> x7 = x.get(p7);
-  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x7(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x7(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x7(2));
-
-  TensorRef<simit_float,3> x8 = x.get(p8);
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x8(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x8(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x8(2));
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[0*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[0*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x[0*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[1*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[1*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x[1*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[2*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[2*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x[2*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[3*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[3*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(-0.0130301827915078, x[3*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[4*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[4*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x[4*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[5*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[5*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x[5*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.0409248172084922, x[6*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[6*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x[6*3+2]);
+
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[7*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x[7*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x[7*3+2]);
+}
+
+TEST(Program, esprings_parallel) {
+  if (kBackend == "gpu") {
+    return;
+  }
+  string backend = kBackend;
+  ScopeGuard resetBackend([=]() {
+    kBackend = backend;
+    setNumThreads(0);
+  });
+  string fileName = string(TEST_INPUT_DIR) + "/program/esprings.sim";
+
+  // The spring forces are assembled by colored loops, one color at a time
+  kBackend = "cpu";
+  vector<simit_float> expected;
+  simulateESprings(fileName, &expected);
+  kBackend = "cpu-parallel";
+  setNumThreads(4);
+  vector<simit_float> actual;
+  simulateESprings(fileName, &actual);
+
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i=0; i < expected.size(); ++i) {
+    SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[i], actual[i]);
+  }
 }
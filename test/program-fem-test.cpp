@@ -7,11 +7,15 @@
 #include "error.h"
 #include "mesh.h"
 #include "timers.h"
+#include "init.h"
 
 using namespace std;
 using namespace simit;
 
-TEST(Program, femTet) {
+/// Simulate the bar2k mesh for ten time steps, and return the positions of its
+/// vertices.
+static void simulateFemTet(const string& fileName,
+                           vector<simit_float>* positions) {
   string dir(TEST_INPUT_DIR);
   string prefix=dir+"/program/fem/bar2k";
   string nodeFile = prefix + ".node";
@@ -76,14 +80,14 @@ TEST(Program, femTet) {
     l.set(t,lval);    
   }
   
-  m_precomputation = loadFunction(TEST_FILE_NAME, "initializeTet");
+  m_precomputation = loadFunction(fileName, "initializeTet");
 
   m_precomputation.bind("verts", &m_verts);
   m_precomputation.bind("tets", &m_tets);
   m_precomputation.init();
   m_precomputation.runSafe();
   
-  m_timeStepper = loadFunction(TEST_FILE_NAME, "main");
+  m_timeStepper = loadFunction(fileName, "main");
   if(!m_timeStepper.defined()) FAIL();
   m_timeStepper.bind("verts", &m_verts);
   m_timeStepper.bind("tets", &m_tets);
@@ -92,16 +96,67 @@ TEST(Program, femTet) {
   for (size_t i=0; i < nSteps; ++i) {
     m_timeStepper.runSafe();
   }
-  
+
+  for (const ElementRef& vert : vertRefs) {
+    for (int i=0; i < 3; ++i) {
+      positions->push_back(x.get(vert)(i));
+    }
+  }
+}
+
+static void runFemTet(const string& fileName) {
+  vector<simit_float> x;
+  simulateFemTet(fileName, &x);
+  ASSERT_LT(300u*3+2, x.size());
+
   // Check outputs
-  SIMIT_ASSERT_FLOAT_EQ(0.010771915616785779,  x.get(vertRefs[100])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.058853573999788439,  x.get(vertRefs[100])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.030899457015375883,  x.get(vertRefs[100])(2));
-  SIMIT_ASSERT_FLOAT_EQ(0.0028221631202928516, x.get(vertRefs[200])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.017969982607667911,  x.get(vertRefs[200])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.012885386063393013,  x.get(vertRefs[200])(2));
-  SIMIT_ASSERT_FLOAT_EQ(0.02411959295647129,   x.get(vertRefs[300])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.052036155669135678,  x.get(vertRefs[300])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.030173075240629205,  x.get(vertRefs[300])(2));
+  SIMIT_ASSERT_FLOAT_EQ(0.010771915616785779,  x[100*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.058853573999788439,  x[100*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.030899457015375883,  x[100*3+2]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0028221631202928516, x[200*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.017969982607667911,  x[200*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.012885386063393013,  x[200*3+2]);
+  SIMIT_ASSERT_FLOAT_EQ(0.02411959295647129,   x[300*3+0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.052036155669135678,  x[300*3+1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.030173075240629205,  x[300*3+2]);
 }
 
+
+TEST(Program, femTet) {
+  runFemTet(TEST_FILE_NAME);
+}
+
+TEST(Program, femTet_batched) {
+  // Compile the maps to process four tets per iteration, with the remaining
+  // tets processed one at a time
+  setMapBatchWidth(4);
+  ScopeGuard resetBatchWidth([]() {setMapBatchWidth(1);});
+  runFemTet(string(TEST_INPUT_DIR) + "/program/femTet.sim");
+}
+
+TEST(Program, femTet_parallel) {
+  if (kBackend == "gpu") {
+    return;
+  }
+  string backend = kBackend;
+  ScopeGuard resetBackend([=]() {
+    kBackend = backend;
+    setNumThreads(0);
+  });
+  string fileName = string(TEST_INPUT_DIR) + "/program/femTet.sim";
+
+  // Partitioning the assembly and the solver across threads only changes the
+  // order floating point sums are computed in
+  kBackend = "cpu";
+  vector<simit_float> expected;
+  simulateFemTet(fileName, &expected);
+  kBackend = "cpu-parallel";
+  setNumThreads(4);
+  vector<simit_float> actual;
+  simulateFemTet(fileName, &actual);
+
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i=0; i < expected.size(); ++i) {
+    SIMIT_ASSERT_FLOAT_NEAR_EQ(expected[i], actual[i]);
+  }
+}
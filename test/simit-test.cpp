@@ -11,6 +11,9 @@
 #include "util/util.h"
 
 #include "program.h"
+#include "program_context.h"
+#include "frontend/frontend.h"
+#include "lower/lower.h"
 #include "backend/backend.h"
 #include "backend/llvm/llvm_backend.h"
 #ifdef GPU
@@ -172,3 +175,16 @@ simit::Function loadFunctionWithTimers(std::string fileName, std::string funcNam
   return f;
 }
 
+simit::ir::Func lowerFunction(std::string fileName, std::string funcName) {
+  simit::internal::ProgramContext ctx;
+  simit::internal::Frontend frontend;
+  std::vector<simit::ParseError> errors;
+  int errorCode = frontend.parseFile(fileName, &ctx, &errors);
+  if (errorCode || errors.size() > 0) {
+    for (auto& error : errors) {
+      std::cerr << error.toString() << std::endl;
+    }
+    return simit::ir::Func();
+  }
+  return simit::ir::lower(ctx.getFunction(funcName));
+}
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <functional>
 
 #include "function.h"
 #include "backend/backend.h"
@@ -53,6 +54,15 @@ simit::Function loadFunction(std::string fileName, std::string funcName="main");
 simit::Function loadFunctionWithTimers(std::string fileName, std::string 
     funcName="main");
 
+namespace simit {
+namespace ir {
+class Func;
+}}
+
+/// Parse the function from a file and lower it, without compiling it, so that
+/// tests can inspect the lowered IR and its environment.
+simit::ir::Func lowerFunction(std::string fileName, std::string funcName="main");
+
 #define Vec3f TensorType::make(ScalarType::Float, {IndexDomain(3)})
 
 #define Mat3f TensorType::make(ScalarType::Float, \
@@ -63,5 +73,16 @@ simit::Function loadFunctionWithTimers(std::string fileName, std::string
 #define Mat3i TensorType::make(ScalarType::Int, \
                                {IndexDomain(3),IndexDomain(3)})
 
+/// Calls a function when it goes out of scope, so that tests that change
+/// global settings restore them even when one of their assertions fails.
+class ScopeGuard {
+public:
+  explicit ScopeGuard(std::function<void()> onExit) : onExit(onExit) {}
+  ~ScopeGuard() {onExit();}
+  ScopeGuard(const ScopeGuard&) = delete;
+  ScopeGuard& operator=(const ScopeGuard&) = delete;
+private:
+  std::function<void()> onExit;
+};
 
 #endif
@@ -0,0 +1,499 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "solver.h"
+#include "thread_pool.h"
+
+using namespace std;
+using namespace simit;
+using namespace simit::internal;
+
+// The 1D Laplacian with Dirichlet boundaries, which is symmetric positive
+// definite, stored with scalar blocks, or only its upper triangle.
+struct Laplacian {
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<double> vals;
+  bool upper;
+
+  explicit Laplacian(int n, bool upper=false) : upper(upper) {
+    rowPtr.push_back(0);
+    for (int i=0; i < n; ++i) {
+      for (int j=(upper ? i : max(i-1,0)); j <= min(i+1,n-1); ++j) {
+        colIdx.push_back(j);
+        vals.push_back((i == j) ? 2.0 : -1.0);
+      }
+      rowPtr.push_back(colIdx.size());
+    }
+  }
+
+  BlockSparseMatrix<double> getMatrix() const {
+    int n = rowPtr.size()-1;
+    return {n, n, rowPtr.data(), colIdx.data(), 1, 1, vals.data(), upper};
+  }
+};
+
+TEST(Solver, spmv3x3) {
+  // [A00 A01]   with A00 = 2I, A01 = A10' = [1 2 3; 4 5 6; 7 8 9], A11 = I
+  // [A10 A11]
+  vector<int> rowPtr = {0, 2, 4};
+  vector<int> colIdx = {0, 1, 0, 1};
+  vector<double> vals = {2,0,0, 0,2,0, 0,0,2,
+                         1,2,3, 4,5,6, 7,8,9,
+                         1,4,7, 2,5,8, 3,6,9,
+                         1,0,0, 0,1,0, 0,0,1};
+  BlockSparseMatrix<double> A = {2, 2, rowPtr.data(), colIdx.data(), 3, 3,
+                                 vals.data(), false};
+  vector<double> x = {1, 2, 3, 1, 1, 1};
+  vector<double> y(6);
+  blockSpMV(A, x.data(), y.data());
+
+  vector<double> expected = {8, 19, 30, 31, 37, 43};
+  for (size_t i=0; i < y.size(); ++i) {
+    ASSERT_DOUBLE_EQ(expected[i], y[i]);
+  }
+}
+
+TEST(Solver, spmvCompressed) {
+  // A banded matrix with 3x3 blocks, whose first and last rows also have a
+  // block in the opposite corner
+  const int n = 1000;
+  for (int band : {1, 7, 331}) {
+    vector<int> rowPtr = {0};
+    vector<int> colIdx;
+    for (int i=0; i < n; ++i) {
+      if (i == n-1) colIdx.push_back(0);
+      for (int j=max(i-1,0); j <= min(i+1,n-1); ++j) {
+        colIdx.push_back(j * band % n);
+      }
+      if (i == 0) colIdx.push_back(n-1);
+      rowPtr.push_back(colIdx.size());
+    }
+    vector<double> vals(colIdx.size()*9);
+    for (size_t k=0; k < vals.size(); ++k) {
+      vals[k] = (double)(k % 17) - 8;
+    }
+    vector<double> x(n*3);
+    for (size_t k=0; k < x.size(); ++k) {
+      x[k] = (double)(k % 5) + 1;
+    }
+    BlockSparseMatrix<double> A = {n, n, rowPtr.data(), colIdx.data(), 3, 3,
+                                   vals.data(), false};
+    vector<double> expected(n*3);
+    blockSpMV(A, x.data(), expected.data());
+
+    CompressedBlockIndex index;
+    index.compress(A);
+    // Threads that start between escaped column pointers find their first
+    // escaped column by counting
+    for (int threads : {1, 3}) {
+      setNumThreads(threads);
+      vector<double> y(n*3);
+      index.multiply(A, x.data(), y.data());
+      for (int i=0; i < n*3; ++i) {
+        ASSERT_EQ(expected[i], y[i]) << "band " << band << " row " << i;
+      }
+    }
+    setNumThreads(0);
+
+    // Near-diagonal columns take one byte, with the columns after the jumps
+    // to and from the corners escaped
+    if (band == 1) {
+      ASSERT_EQ(1, index.getDeltaBytes());
+      ASSERT_EQ(3, index.getNumEscaped());
+    }
+    ASSERT_LE(index.getBytes(), colIdx.size()*sizeof(int));
+  }
+}
+
+TEST(Solver, spmvSymmetric) {
+  // A symmetric block tridiagonal matrix with 3x3 blocks, with a block that
+  // connects the first and last rows, stored in full and as its upper triangle
+  const int n = 100;
+  vector<int> rowPtr = {0};
+  vector<int> colIdx;
+  vector<double> vals;
+  vector<int> upperRowPtr = {0};
+  vector<int> upperColIdx;
+  vector<double> upperVals;
+  auto block = [](int i, int j, int bi, int bj) {
+    // Transposing the block of (i,j) gives the block of (j,i)
+    int lo = min(i,j), hi = max(i,j);
+    int r = (i <= j) ? bi : bj;
+    int c = (i <= j) ? bj : bi;
+    return (lo == hi) ? (double)((bi+1)*(bj+1) + lo % 5)
+                      : (double)(lo % 7 + hi % 3 + r*3 + c) - 6;
+  };
+  for (int i=0; i < n; ++i) {
+    vector<int> cols;
+    if (i == n-1) cols.push_back(0);
+    for (int j=max(i-1,0); j <= min(i+1,n-1); ++j) cols.push_back(j);
+    if (i == 0) cols.push_back(n-1);
+    for (int j : cols) {
+      colIdx.push_back(j);
+      if (j >= i) upperColIdx.push_back(j);
+      for (int bi=0; bi < 3; ++bi) {
+        for (int bj=0; bj < 3; ++bj) {
+          vals.push_back(block(i, j, bi, bj));
+          if (j >= i) upperVals.push_back(block(i, j, bi, bj));
+        }
+      }
+    }
+    rowPtr.push_back(colIdx.size());
+    upperRowPtr.push_back(upperColIdx.size());
+  }
+  BlockSparseMatrix<double> A = {n, n, rowPtr.data(), colIdx.data(), 3, 3,
+                                 vals.data(), false};
+  BlockSparseMatrix<double> U = {n, n, upperRowPtr.data(), upperColIdx.data(),
+                                 3, 3, upperVals.data(), true};
+  vector<double> x(n*3);
+  for (size_t k=0; k < x.size(); ++k) {
+    x[k] = (double)(k % 5) + 1;
+  }
+  vector<double> expected(n*3);
+  blockSpMV(A, x.data(), expected.data());
+
+  for (int threads : {1, 3}) {
+    setNumThreads(threads);
+    vector<double> y(n*3);
+    blockSpMV(U, x.data(), y.data());
+    for (int i=0; i < n*3; ++i) {
+      ASSERT_DOUBLE_EQ(expected[i], y[i]) << "row " << i;
+    }
+  }
+  setNumThreads(0);
+}
+
+TEST(Solver, cg) {
+  const int n = 100;
+  Laplacian laplacian(n);
+  BlockSparseMatrix<double> A = laplacian.getMatrix();
+  vector<double> expected(n);
+  for (int i=0; i < n; ++i) {
+    expected[i] = i % 7;
+  }
+  vector<double> b(n);
+  blockSpMV(A, expected.data(), b.data());
+
+  SolverParams params;
+  params.maxIterations = n;
+  for (auto preconditioner : {SolverParams::None, SolverParams::Jacobi,
+                              SolverParams::BlockJacobi}) {
+    params.preconditioner = preconditioner;
+    for (bool compressIndices : {false, true}) {
+      params.compressIndices = compressIndices;
+      vector<double> x(n, 1.0);
+      int iterations = conjugateGradient(A, b.data(), x.data(), params);
+      ASSERT_LE(iterations, n);
+      for (int i=0; i < n; ++i) {
+        ASSERT_NEAR(expected[i], x[i], 1e-6);
+      }
+    }
+  }
+}
+
+TEST(Solver, cgSymmetric) {
+  // Solves with the upper triangle take the same iterations as with the full
+  // matrix, and ignore compressed indices
+  const int n = 100;
+  Laplacian full(n);
+  Laplacian upper(n, true);
+  vector<double> b(n);
+  for (int i=0; i < n; ++i) {
+    b[i] = i % 7;
+  }
+
+  SolverParams params;
+  params.maxIterations = n;
+  params.compressIndices = true;
+  vector<double> expected(n);
+  int expectedIterations = conjugateGradient(full.getMatrix(), b.data(),
+                                             expected.data(), params);
+  vector<double> x(n);
+  int iterations = conjugateGradient(upper.getMatrix(), b.data(), x.data(),
+                                     params);
+  ASSERT_EQ(expectedIterations, iterations);
+  for (int i=0; i < n; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-10);
+  }
+}
+
+TEST(Solver, blockJacobi) {
+  // A block diagonal matrix is solved in one block Jacobi iteration
+  vector<int> rowPtr = {0, 1, 2};
+  vector<int> colIdx = {0, 1};
+  vector<float> vals = {4,1,0, 1,3,1, 0,1,2,
+                        2,1,1, 1,2,1, 1,1,2};
+  BlockSparseMatrix<float> A = {2, 2, rowPtr.data(), colIdx.data(), 3, 3,
+                                vals.data(), false};
+  vector<float> expected = {1, 2, 3, 4, 5, 6};
+  vector<float> b(6);
+  blockSpMV(A, expected.data(), b.data());
+
+  SolverParams params;
+  params.tolerance = 1e-6;
+  vector<float> x(6);
+  int iterations = conjugateGradient(A, b.data(), x.data(), params);
+  ASSERT_EQ(1, iterations);
+  for (int i=0; i < 6; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-4);
+  }
+}
+
+TEST(Solver, multigrid) {
+  // The V-cycle reduces the iterations of the Laplacian, whose condition
+  // number grows with n^2, to a small fraction of block Jacobi's, both with
+  // the full matrix and with its upper triangle
+  const int n = 2000;
+  vector<double> expected(n);
+  for (int i=0; i < n; ++i) {
+    expected[i] = i % 7;
+  }
+  vector<double> b(n);
+  blockSpMV(Laplacian(n).getMatrix(), expected.data(), b.data());
+
+  SolverParams params;
+  params.maxIterations = n;
+  params.preconditioner = SolverParams::BlockJacobi;
+  vector<double> x(n);
+  int jacobiIterations = conjugateGradient(Laplacian(n).getMatrix(), b.data(),
+                                           x.data(), params);
+
+  params.preconditioner = SolverParams::Multigrid;
+  for (bool upper : {false, true}) {
+    Laplacian laplacian(n, upper);
+    for (auto method : {SolverParams::ConjugateGradient,
+                        SolverParams::BiCGSTAB}) {
+      params.method = method;
+      SolverContext context;
+      context.setParams(params);
+      int iterations = context.solve(laplacian.getMatrix(), b.data(),
+                                     x.data());
+      ASSERT_LT(iterations, jacobiIterations / 10);
+      for (int i=0; i < n; ++i) {
+        ASSERT_NEAR(expected[i], x[i], 1e-4);
+      }
+    }
+  }
+}
+
+TEST(Solver, threads) {
+  const int n = 1000;
+  Laplacian laplacian(n);
+  BlockSparseMatrix<double> A = laplacian.getMatrix();
+  vector<double> b(n, 1.0);
+
+  SolverParams params;
+  params.maxIterations = 20;
+  setNumThreads(1);
+  vector<double> serial(n);
+  conjugateGradient(A, b.data(), serial.data(), params);
+
+  // Reductions are added in thread order, so results only depend on the
+  // number of threads
+  setNumThreads(4);
+  vector<double> parallel(n);
+  conjugateGradient(A, b.data(), parallel.data(), params);
+  vector<double> again(n);
+  conjugateGradient(A, b.data(), again.data(), params);
+  setNumThreads(0);
+
+  for (int i=0; i < n; ++i) {
+    ASSERT_NEAR(serial[i], parallel[i], 1e-9);
+    ASSERT_EQ(parallel[i], again[i]);
+  }
+}
+
+TEST(SolverContext, warmStart) {
+  const int n = 100;
+  Laplacian laplacian(n);
+  BlockSparseMatrix<double> A = laplacian.getMatrix();
+  vector<double> b(n, 1.0);
+
+  SolverContext context;
+  SolverParams params;
+  ASSERT_FALSE(params.warmStart);
+  params.maxIterations = 2*n;
+  params.tolerance = 1e-8;
+  params.warmStart = true;
+  context.setParams(params);
+
+  vector<double> x(n);
+  int coldIterations = context.solve(A, b.data(), x.data());
+  ASSERT_GT(coldIterations, 0);
+
+  // Solving the same system again starts from the solution
+  vector<double> again(n);
+  int warmIterations = context.solve(A, b.data(), again.data());
+  ASSERT_LT(warmIterations, coldIterations);
+  for (int i=0; i < n; ++i) {
+    ASSERT_NEAR(x[i], again[i], 1e-6);
+  }
+
+  params.warmStart = false;
+  context.setParams(params);
+  ASSERT_EQ(coldIterations, context.solve(A, b.data(), again.data()));
+}
+
+// A symmetric positive definite matrix where row i has 4 on the diagonal and
+// -1 at columns i-stride and i+stride, modulo n, or only its upper triangle.
+// The matrix has 3n blocks, and its upper triangle 2n, for every stride
+// smaller than n/2.
+static void createCyclic(int n, int stride, vector<int>* rowPtr,
+                         vector<int>* colIdx, vector<double>* vals,
+                         bool upper=false) {
+  rowPtr->assign(1, 0);
+  colIdx->clear();
+  vals->clear();
+  for (int i=0; i < n; ++i) {
+    vector<int> cols = {(i+n-stride) % n, i, (i+stride) % n};
+    sort(cols.begin(), cols.end());
+    for (int j : cols) {
+      if (upper && j < i) continue;
+      colIdx->push_back(j);
+      vals->push_back((i == j) ? 4.0 : -1.0);
+    }
+    rowPtr->push_back(colIdx->size());
+  }
+}
+
+TEST(SolverContext, patternChange) {
+  const int n = 20;
+  vector<int> rowPtr;
+  vector<int> colIdx;
+  vector<double> vals;
+  createCyclic(n, 1, &rowPtr, &colIdx, &vals);
+  BlockSparseMatrix<double> A = {n, n, rowPtr.data(), colIdx.data(), 1, 1,
+                                 vals.data(), false};
+  vector<double> b(n);
+  for (int i=0; i < n; ++i) {
+    b[i] = i % 4;
+  }
+
+  vector<SolverParams::Method> methods = {SolverParams::ConjugateGradient};
+#ifdef EIGEN
+  methods.push_back(SolverParams::LDLT);
+#endif
+  for (auto method : methods) {
+    SolverContext context;
+    SolverParams params;
+    params.method = method;
+    params.tolerance = 1e-10;
+    context.setParams(params);
+    createCyclic(n, 1, &rowPtr, &colIdx, &vals);
+    vector<double> x(n);
+    context.solve(A, b.data(), x.data());
+
+    // Rewrite the matrix arrays in place with another pattern with as many
+    // blocks. The solve must not reuse the state of the first matrix.
+    createCyclic(n, 3, &rowPtr, &colIdx, &vals);
+    ASSERT_EQ(A.colIdx, colIdx.data());
+    int iterations = context.solve(A, b.data(), x.data());
+
+    SolverContext freshContext;
+    freshContext.setParams(params);
+    vector<double> expected(n);
+    ASSERT_EQ(freshContext.solve(A, b.data(), expected.data()), iterations);
+    for (int i=0; i < n; ++i) {
+      ASSERT_EQ(expected[i], x[i]);
+    }
+  }
+}
+
+TEST(SolverContext, multiplySymmetric) {
+  const int n = 20;
+  vector<int> rowPtr, colIdx, upperRowPtr, upperColIdx;
+  vector<double> vals, upperVals;
+  createCyclic(n, 1, &rowPtr, &colIdx, &vals);
+  createCyclic(n, 1, &upperRowPtr, &upperColIdx, &upperVals, true);
+  BlockSparseMatrix<double> A = {n, n, rowPtr.data(), colIdx.data(), 1, 1,
+                                 vals.data(), false};
+  BlockSparseMatrix<double> U = {n, n, upperRowPtr.data(), upperColIdx.data(),
+                                 1, 1, upperVals.data(), true};
+  vector<double> x(n);
+  for (int i=0; i < n; ++i) {
+    x[i] = i % 3 + 1;
+  }
+
+  SolverContext context;
+  vector<double> expected(n);
+  vector<double> y(n);
+  blockSpMV(A, x.data(), expected.data());
+  context.multiplySymmetric(U, x.data(), y.data());
+  ASSERT_EQ(expected, y);
+
+  // Rewrite the matrices in place with another pattern, and index the lower
+  // triangle again, as functions do when they rebuild the index of a matrix
+  createCyclic(n, 3, &rowPtr, &colIdx, &vals);
+  createCyclic(n, 3, &upperRowPtr, &upperColIdx, &upperVals, true);
+  ASSERT_EQ(U.colIdx, upperColIdx.data());
+  context.indexLowerTriangle(n, U.rowPtr, U.colIdx);
+  blockSpMV(A, x.data(), expected.data());
+  context.multiplySymmetric(U, x.data(), y.data());
+  ASSERT_EQ(expected, y);
+}
+
+TEST(SolverContext, bicgstab) {
+  // A non-symmetric, diagonally dominant tridiagonal matrix
+  const int n = 50;
+  vector<int> rowPtr = {0};
+  vector<int> colIdx;
+  vector<double> vals;
+  for (int i=0; i < n; ++i) {
+    for (int j=max(i-1,0); j <= min(i+1,n-1); ++j) {
+      colIdx.push_back(j);
+      vals.push_back((i == j) ? 4.0 : (j < i) ? -1.0 : -2.0);
+    }
+    rowPtr.push_back(colIdx.size());
+  }
+  BlockSparseMatrix<double> A = {n, n, rowPtr.data(), colIdx.data(), 1, 1,
+                                 vals.data(), false};
+  vector<double> expected(n);
+  for (int i=0; i < n; ++i) {
+    expected[i] = i % 5;
+  }
+  vector<double> b(n);
+  blockSpMV(A, expected.data(), b.data());
+
+  SolverContext context;
+  SolverParams params;
+  params.method = SolverParams::BiCGSTAB;
+  params.maxIterations = n;
+  context.setParams(params);
+  vector<double> x(n);
+  context.solve(A, b.data(), x.data());
+  for (int i=0; i < n; ++i) {
+    ASSERT_NEAR(expected[i], x[i], 1e-6);
+  }
+}
+
+#ifdef EIGEN
+TEST(SolverContext, factorizations) {
+  const int n = 100;
+  Laplacian laplacian(n);
+  BlockSparseMatrix<double> A = laplacian.getMatrix();
+  vector<double> expected(n);
+  for (int i=0; i < n; ++i) {
+    expected[i] = i % 3;
+  }
+  vector<double> b(n);
+  blockSpMV(A, expected.data(), b.data());
+
+  SolverContext context;
+  SolverParams params;
+  for (auto method : {SolverParams::LDLT, SolverParams::Cholesky}) {
+    params.method = method;
+    context.setParams(params);
+    // The second solve reuses the symbolic analysis
+    for (int solve=0; solve < 2; ++solve) {
+      vector<double> x(n);
+      ASSERT_EQ(0, context.solve(A, b.data(), x.data()));
+      for (int i=0; i < n; ++i) {
+        ASSERT_NEAR(expected[i], x[i], 1e-8);
+      }
+    }
+  }
+}
+#endif
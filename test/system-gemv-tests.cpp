@@ -4,6 +4,9 @@
 #include "tensor.h"
 #include "program.h"
 #include "error.h"
+#include "init.h"
+#include "tensor_index.h"
+#include "ir_visitor.h"
 
 using namespace std;
 using namespace simit;
@@ -524,6 +527,178 @@ TEST(System, gemv_blocked) {
   ASSERT_EQ(136.0, c2(1));
 }
 
+/// True iff the lowered function declares a system matrix.
+static bool declaresMatrix(const ir::Func& func) {
+  bool declaresMatrix = false;
+  ir::match(func.getBody(),
+    std::function<void(const ir::VarDecl*)>([&](const ir::VarDecl* op) {
+      const ir::Type& type = op->var.getType();
+      if (type.isTensor() && type.toTensor()->order() == 2 &&
+          type.toTensor()->hasSystemDimensions()) {
+        declaresMatrix = true;
+      }
+    })
+  );
+  return declaresMatrix;
+}
+
+TEST(System, gemv_blocked_matrix_free) {
+  // Points
+  Set points;
+  FieldRef<simit_float,2> b = points.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0});
+  b.set(p1, {3.0, 4.0});
+  b.set(p2, {5.0, 6.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,2,2> a = springs.addField<simit_float,2,2>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0});
+  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+
+  // The assembled matrix is stored with a tensor index
+  ir::Func lowered = lowerFunction(TEST_FILE_NAME, "main");
+  ASSERT_TRUE(lowered.defined());
+  ASSERT_EQ(1u, lowered.getEnvironment().getTensorIndices().size());
+  ASSERT_TRUE(declaresMatrix(lowered));
+
+  // Compile program with the matrix applied by the map, and bind arguments
+  setMatrixFreeOperators(true);
+  ScopeGuard resetMatrixFree([]() {setMatrixFreeOperators(false);});
+
+  // The matrix and its index are never stored
+  lowered = lowerFunction(TEST_FILE_NAME, "main");
+  ASSERT_TRUE(lowered.defined());
+  ASSERT_EQ(0u, lowered.getEnvironment().getTensorIndices().size());
+  ASSERT_FALSE(declaresMatrix(lowered));
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are the same as with the assembled matrix
+  TensorRef<simit_float,2> c0 = c.get(p0);
+  ASSERT_EQ(16.0, c0(0));
+  ASSERT_EQ(36.0, c0(1));
+
+  TensorRef<simit_float,2> c1 = c.get(p1);
+  ASSERT_EQ(116.0, c1(0));
+  ASSERT_EQ(172.0, c1(1));
+
+  TensorRef<simit_float,2> c2 = c.get(p2);
+  ASSERT_EQ(100.0, c2(0));
+  ASSERT_EQ(136.0, c2(1));
+}
+
+/// True iff the lowered function stores a matrix as its upper triangle.
+static bool hasUpperTriangularIndex(const ir::Func& func) {
+  for (const ir::TensorIndex& tensorIndex :
+           func.getEnvironment().getTensorIndices()) {
+    if (tensorIndex.isUpperTriangular()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(System, gemv_blocked_symmetric) {
+  // Points
+  Set points;
+  FieldRef<simit_float,2> b = points.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0});
+  b.set(p1, {3.0, 4.0});
+  b.set(p2, {5.0, 6.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,2,2> a = springs.addField<simit_float,2,2>("a");
+  FieldRef<simit_float> k = springs.addField<simit_float>("k");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0});
+  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+  k.set(s0, 1.0);
+  k.set(s1, 2.0);
+
+  for (bool symmetric : {false, true}) {
+    setSymmetricMatrices(symmetric);
+    ScopeGuard resetSymmetric([]() {setSymmetricMatrices(false);});
+
+    // The assembled matrix is only stored as its upper triangle if enabled
+    ir::Func lowered = lowerFunction(TEST_FILE_NAME, "main");
+    ASSERT_TRUE(lowered.defined());
+    ASSERT_EQ(1u, lowered.getEnvironment().getTensorIndices().size());
+    ASSERT_EQ(symmetric, hasUpperTriangularIndex(lowered));
+
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    if (!func.defined()) FAIL();
+
+    func.bind("points", &points);
+    func.bind("springs", &springs);
+
+    c.set(p0, {0.0, 0.0});
+    c.set(p1, {0.0, 0.0});
+    c.set(p2, {0.0, 0.0});
+    func.runSafe();
+
+    // Check that outputs are the same with and without symmetric storage
+    TensorRef<simit_float,2> c0 = c.get(p0);
+    ASSERT_EQ(12.0, c0(0));
+    ASSERT_EQ(27.0, c0(1));
+
+    TensorRef<simit_float,2> c1 = c.get(p1);
+    ASSERT_EQ(77.0, c1(0));
+    ASSERT_EQ(105.0, c1(1));
+
+    TensorRef<simit_float,2> c2 = c.get(p2);
+    ASSERT_EQ(53.0, c2(0));
+    ASSERT_EQ(62.0, c2(1));
+  }
+}
+
+TEST(System, gemv_blocked_symmetric_unpaired) {
+  // A block off the diagonal without a block at the transposed location
+  setSymmetricMatrices(true);
+  ScopeGuard resetSymmetric([]() {setSymmetricMatrices(false);});
+  ir::Func lowered = lowerFunction(TEST_FILE_NAME, "main");
+  ASSERT_TRUE(lowered.defined());
+  ASSERT_EQ(1u, lowered.getEnvironment().getTensorIndices().size());
+  ASSERT_FALSE(hasUpperTriangularIndex(lowered));
+}
+
+TEST(System, gemv_blocked_symmetric_untransposed) {
+  // Blocks at transposed locations whose values are not each other's
+  // transposes
+  setSymmetricMatrices(true);
+  ScopeGuard resetSymmetric([]() {setSymmetricMatrices(false);});
+  ir::Func lowered = lowerFunction(TEST_FILE_NAME, "main");
+  ASSERT_TRUE(lowered.defined());
+  ASSERT_EQ(1u, lowered.getEnvironment().getTensorIndices().size());
+  ASSERT_FALSE(hasUpperTriangularIndex(lowered));
+}
+
 TEST(System, gemv_blocked_nw) {
   // Points
   Set points;
@@ -0,0 +1,142 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "thread_pool.h"
+#include "error.h"
+
+using namespace std;
+using namespace simit::internal;
+
+TEST(ThreadPool, partition) {
+  ThreadPool pool(4);
+  ASSERT_EQ(pool.getNumThreads(), 4);
+  ASSERT_EQ(pool.getChunkBegin(0, 10, 0), 0);
+  ASSERT_EQ(pool.getChunkBegin(0, 10, 1), 2);
+  ASSERT_EQ(pool.getChunkBegin(0, 10, 2), 5);
+  ASSERT_EQ(pool.getChunkBegin(0, 10, 3), 7);
+  ASSERT_EQ(pool.getChunkBegin(0, 10, 4), 10);
+}
+
+TEST(ThreadPool, parallelFor) {
+  ThreadPool pool(4);
+  vector<int> visits(1000, 0);
+  atomic<int> numChunks(0);
+  pool.parallelFor(0, (int)visits.size(), [&](int begin, int end) {
+    ++numChunks;
+    for (int i=begin; i < end; ++i) {
+      visits[i] += 1;
+    }
+  });
+  ASSERT_EQ(numChunks, 4);
+  for (int i=0; i < (int)visits.size(); ++i) {
+    ASSERT_EQ(visits[i], 1) << "element " << i;
+  }
+
+  // Loops smaller than the pool run on the calling thread
+  numChunks = 0;
+  pool.parallelFor(0, 2, [&](int begin, int end) {++numChunks;});
+  ASSERT_EQ(numChunks, 1);
+
+  // Nested loops run serially within the enclosing loop's chunks
+  numChunks = 0;
+  pool.parallelFor(0, 4, [&](int begin, int end) {
+    ++numChunks;
+    pool.parallelFor(0, 100, [&](int begin, int end) {++numChunks;});
+  });
+  ASSERT_EQ(numChunks, 8);
+}
+
+TEST(ThreadPool, exceptions) {
+  // Exceptions from chunks are rethrown on the calling thread once every
+  // chunk is done
+  ThreadPool pool(4);
+  vector<int> visits(1000, 0);
+  ASSERT_THROW(pool.parallelFor(0, 1000, [&](int begin, int end) {
+    for (int i=begin; i < end; ++i) {
+      visits[i] += 1;
+    }
+    if (begin == 0 || begin == pool.getChunkBegin(0, 1000, 2)) {
+      throw runtime_error("chunk failed");
+    }
+  }), runtime_error);
+  for (int i=0; i < (int)visits.size(); ++i) {
+    ASSERT_EQ(visits[i], 1) << "element " << i;
+  }
+
+  // The pool, and the calling thread, can run parallel loops afterwards
+  atomic<int> numChunks(0);
+  pool.parallelFor(0, 1000, [&](int begin, int end) {++numChunks;});
+  ASSERT_EQ(numChunks, 4);
+
+  // Changing the pool from inside a parallel loop is an error
+  simit::setNumThreads(4);
+  ASSERT_THROW(getThreadPool().parallelFor(0, 4, [](int begin, int end) {
+    simit::setNumThreads(2);
+  }), simit::SimitException);
+  simit::setNumThreads(0);
+}
+
+TEST(ThreadPool, pinning) {
+  ThreadPool pool(4, true);
+  if (!pool.hasPinnedThreads()) {
+    return;
+  }
+#if defined(__linux__)
+  // Each thread, including the caller, executes its chunks on the same CPU
+  // across loops
+  vector<int> cpus(4, -1);
+  for (int loop=0; loop < 10; ++loop) {
+    pool.parallelFor(0, 100, [&](int begin, int end) {
+      for (int tid=0; tid < 4; ++tid) {
+        if (begin == pool.getChunkBegin(0, 100, tid)) {
+          int cpu = sched_getcpu();
+          if (cpus[tid] == -1) {
+            cpus[tid] = cpu;
+          }
+          ASSERT_EQ(cpus[tid], cpu) << "thread " << tid;
+        }
+      }
+    });
+  }
+#endif
+}
+
+TEST(ThreadPool, concurrentLoops) {
+  // Loops started from several threads take turns on the pool
+  ThreadPool pool(4);
+  vector<vector<int>> visits(4, vector<int>(1000, 0));
+  vector<thread> callers;
+  for (int c=0; c < 4; ++c) {
+    callers.push_back(thread([&,c]() {
+      for (int loop=0; loop < 50; ++loop) {
+        pool.parallelFor(0, 1000, [&](int begin, int end) {
+          for (int i=begin; i < end; ++i) {
+            visits[c][i] += 1;
+          }
+        });
+      }
+    }));
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+  for (int c=0; c < 4; ++c) {
+    for (int i=0; i < 1000; ++i) {
+      ASSERT_EQ(visits[c][i], 50) << "caller " << c << ", element " << i;
+    }
+  }
+
+  // Loops on a stopped pool run serially
+  pool.stop();
+  atomic<int> numChunks(0);
+  pool.parallelFor(0, 1000, [&](int begin, int end) {++numChunks;});
+  ASSERT_EQ(numChunks, 1);
+}